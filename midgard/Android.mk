@@ -99,7 +99,8 @@ LOCAL_HEADER_LIBRARIES += \
 
 LOCAL_CPPFLAGS := -Wunused-variable
 LOCAL_SRC_FILES := \
-	gralloc_drm.cpp
+	gralloc_drm.cpp \
+	gralloc_drm_tracker.cpp
 
 LOCAL_SHARED_LIBRARIES := \
 	libdrm \
@@ -109,6 +110,11 @@ LOCAL_SHARED_LIBRARIES := \
 
 	# libhardware_legacy \
 
+# android::CallStack, used by gralloc_drm_tracker.cpp, was split out of libutils in Android P.
+ifeq ($(shell test $(PLATFORM_SDK_VERSION) -ge 28 && echo OK),OK)
+LOCAL_SHARED_LIBRARIES += libutilscallstack
+endif
+
 ifneq ($(filter $(intel_drivers), $(DRM_GPU_DRIVERS)),)
 LOCAL_SRC_FILES += gralloc_drm_intel.c
 LOCAL_C_INCLUDES += external/libdrm/intel
@@ -187,6 +193,11 @@ LOCAL_C_INCLUDES += \
 	hardware/rockchip/librkvpu \
 
 LOCAL_SRC_FILES += gralloc_drm_rockchip.cpp \
+	gralloc_drm_rockchip_convert.cpp \
+	gralloc_drm_rockchip_afbc.cpp \
+	gralloc_drm_rockchip_ledger.cpp \
+	gralloc_drm_rockchip_arena.cpp \
+	gralloc_drm_rockchip_commit.cpp \
 	mali_gralloc_formats.cpp \
 	$(AFBC_FILES)
 
@@ -195,14 +206,18 @@ LOCAL_SHARED_LIBRARIES += libdrm_rockchip
 #RK_DRM_GRALLOC for rockchip drm gralloc
 #RK_DRM_GRALLOC_DEBUG for rockchip drm gralloc debug.
 MAJOR_VERSION := "RK_GRAPHICS_VER=commit-id:$(shell cd $(LOCAL_PATH) && git log  -1 --oneline | awk '{print $$1}')"
-LOCAL_CFLAGS +=-DRK_DRM_GRALLOC=1 -DRK_DRM_GRALLOC_DEBUG=0 -DENABLE_ROCKCHIP -DPLATFORM_SDK_VERSION=$(PLATFORM_SDK_VERSION) -D$(GRALLOC_DEPTH) -DMALI_ARCHITECTURE_UTGARD=$(MALI_ARCHITECTURE_UTGARD) -DDISABLE_FRAMEBUFFER_HAL=$(DISABLE_FRAMEBUFFER_HAL) -DMALI_AFBC_GRALLOC=$(MALI_AFBC_GRALLOC) -DMALI_SUPPORT_AFBC_WIDEBLK=$(MALI_SUPPORT_AFBC_WIDEBLK) -DAFBC_YUV420_EXTRA_MB_ROW_NEEDED=$(AFBC_YUV420_EXTRA_MB_ROW_NEEDED) -DGRALLOC_INIT_AFBC=$(GRALLOC_INIT_AFBC) -DRK_GRAPHICS_VER=\"$(MAJOR_VERSION)\" -DUSE_AFBC_LAYER=$(USE_AFBC_LAYER)
+LOCAL_CFLAGS +=-DRK_DRM_GRALLOC=1 -DRK_DRM_GRALLOC_DEBUG=0 -DENABLE_ROCKCHIP -DPLATFORM_SDK_VERSION=$(PLATFORM_SDK_VERSION) -D$(GRALLOC_DEPTH) -DMALI_ARCHITECTURE_UTGARD=$(MALI_ARCHITECTURE_UTGARD) -DDISABLE_FRAMEBUFFER_HAL=$(DISABLE_FRAMEBUFFER_HAL) -DMALI_AFBC_GRALLOC=$(MALI_AFBC_GRALLOC) -DMALI_SUPPORT_AFBC_WIDEBLK=$(MALI_SUPPORT_AFBC_WIDEBLK) -DMALI_USE_YUV_AFBC_WIDEBLK=$(MALI_USE_YUV_AFBC_WIDEBLK) -DAFBC_YUV420_EXTRA_MB_ROW_NEEDED=$(AFBC_YUV420_EXTRA_MB_ROW_NEEDED) -DGRALLOC_INIT_AFBC=$(GRALLOC_INIT_AFBC) -DRK_GRAPHICS_VER=\"$(MAJOR_VERSION)\" -DUSE_AFBC_LAYER=$(USE_AFBC_LAYER)
 
 ifeq ($(TARGET_USES_HWC2),true)
     LOCAL_CFLAGS += -DUSE_HWC2
 endif
 
-# disable arm_format_selection on rk platforms, by default.
+# select internal_format by the weights in formatdef_files/, by default.
+# set RK_GRALLOC_FORMAT_SELECTION := 0 to fall back to the fixed mapping (map_flex_formats() only).
+RK_GRALLOC_FORMAT_SELECTION ?= 1
+ifneq ($(RK_GRALLOC_FORMAT_SELECTION),1)
 LOCAL_CFLAGS += -DGRALLOC_ARM_FORMAT_SELECTION_DISABLE
+endif
 LOCAL_CFLAGS += -DGRALLOC_LIBRARY_BUILD=1 -DGRALLOC_USE_GRALLOC1_API=1
 
 ifeq ($(GRALLOC_FB_SWAP_RED_BLUE),1)
@@ -295,6 +310,9 @@ LOCAL_MODULE_TAGS := optional
 LOCAL_MODULE_RELATIVE_PATH := hw
 include $(BUILD_SHARED_LIBRARY)
 
+include $(LOCAL_PATH)/tests/Android.mk
+include $(LOCAL_PATH)/tools/Android.mk
+
 endif # DRM_GPU_DRIVERS=prebuilt
 endif # DRM_GPU_DRIVERS
 
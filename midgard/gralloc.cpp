@@ -114,6 +114,115 @@ static int drm_mod_perform(const struct gralloc_module_t *mod, int op, ...)
 		}
 		break;
 #endif
+	case GRALLOC_MODULE_PERFORM_SET_CPU_ONLY_IMPORT:
+		{
+			int enable = va_arg(args, int);
+
+			err = gralloc_drm_set_cpu_only_import(dmod->drm, enable);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_SET_PROCESS_LOCAL_SUBALLOC:
+		{
+			int enable = va_arg(args, int);
+
+			err = gralloc_drm_set_process_local_suballoc(dmod->drm, enable);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_SET_LAZY_COMMIT:
+		{
+			int enable = va_arg(args, int);
+
+			err = gralloc_drm_set_lazy_commit(dmod->drm, enable);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_SET_LOCK_VIEW:
+		{
+			buffer_handle_t hnd = va_arg(args, buffer_handle_t);
+			int view = va_arg(args, int);
+			struct gralloc_drm_bo_t *bo = gralloc_drm_bo_from_handle(hnd);
+
+			if (bo != NULL) {
+				err = gralloc_drm_bo_set_lock_view(bo, view);
+				gralloc_drm_bo_decref(bo);
+			}
+			else
+				err = -EINVAL;
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_RESHAPE:
+		{
+			buffer_handle_t hnd = va_arg(args, buffer_handle_t);
+			int width = va_arg(args, int);
+			int height = va_arg(args, int);
+			int format = va_arg(args, int);
+			int usage = va_arg(args, int);
+			struct gralloc_drm_bo_t *bo = gralloc_drm_bo_from_handle(hnd);
+
+			if (bo != NULL) {
+				err = gralloc_drm_bo_reshape(bo, width, height, format, usage);
+				gralloc_drm_bo_decref(bo);
+			}
+			else
+				err = -EINVAL;
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_COMMIT:
+		{
+			buffer_handle_t hnd = va_arg(args, buffer_handle_t);
+			struct gralloc_drm_bo_t *bo = gralloc_drm_bo_from_handle(hnd);
+
+			if (bo != NULL) {
+				err = gralloc_drm_bo_commit(bo);
+				gralloc_drm_bo_decref(bo);
+			}
+			else
+				err = -EINVAL;
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_RESOLVE_FORMAT:
+		{
+			buffer_handle_t hnd = va_arg(args, buffer_handle_t);
+			uint32_t *pitches = va_arg(args, uint32_t *);
+			uint32_t *offsets = va_arg(args, uint32_t *);
+			uint32_t *handles = va_arg(args, uint32_t *);
+
+			err = gralloc_drm_resolve_format(hnd, pitches, offsets, handles);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_TRIM:
+		{
+			uint64_t target_bytes = va_arg(args, uint64_t);
+			struct gralloc_drm_trim_result_t *result = va_arg(args, struct gralloc_drm_trim_result_t *);
+
+			err = gralloc_drm_trim(dmod->drm, target_bytes, result);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_GET_MEM_LEDGER:
+		{
+			struct gralloc_drm_mem_ledger_t *ledger = va_arg(args, struct gralloc_drm_mem_ledger_t *);
+
+			err = gralloc_drm_get_mem_ledger(dmod->drm, ledger);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_GET_VDEC_METADATA:
+		{
+			buffer_handle_t hnd = va_arg(args, buffer_handle_t);
+			uint32_t *offset = va_arg(args, uint32_t *);
+			uint32_t *size = va_arg(args, uint32_t *);
+
+			err = gralloc_drm_handle_get_vdec_metadata(hnd, offset, size);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_GET_DRM_FORMAT:
+		{
+			buffer_handle_t hnd = va_arg(args, buffer_handle_t);
+			uint32_t *fourcc = va_arg(args, uint32_t *);
+			uint64_t *modifier = va_arg(args, uint64_t *);
+			uint32_t *num_planes = va_arg(args, uint32_t *);
+
+			err = gralloc_drm_handle_get_drm_format(hnd, fourcc, modifier, num_planes);
+		}
+		break;
 	case GRALLOC_MODULE_PERFORM_GET_HADNLE_PHY_ADDR:
 		{
 			buffer_handle_t hnd = va_arg(args, buffer_handle_t);
@@ -307,77 +416,36 @@ static int drm_mod_lock_ycbcr(gralloc_module_t const* module,
 
 	if (usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK)) {
 		char *cpu_addr;
-		int y_stride = hnd->byte_stride;
-		/* Ensure height is aligned for subsampled chroma
-		 *before calculating buffer parameters
-		 */
-		int adjusted_height = GRALLOC_ALIGN(hnd->height, 2);
-		int y_size =  y_stride * adjusted_height;
-
-		int u_offset = 0;
-		int v_offset = 0;
-		int c_stride = 0;
-		int step = 0;
-
-        uint64_t base_format = (hnd->internal_format) & MALI_GRALLOC_INTFMT_FMT_MASK;
-
-		int ret = gralloc_drm_bo_lock(bo, hnd->usage,
-				0, 0, hnd->width, hnd->height,(void **)&cpu_addr);
-
-		switch (base_format)
-		{
-			// case GRALLOC_ARM_HAL_FORMAT_INDEXED_NV12:
-			case MALI_GRALLOC_FORMAT_INTERNAL_NV12:
-            case HAL_PIXEL_FORMAT_YCrCb_NV12:
-			case HAL_PIXEL_FORMAT_YCbCr_420_888:
-				c_stride = y_stride;
-				/* Y plane, UV plane */
-				u_offset = y_size;
-				v_offset = y_size + 1;
-				step = 2;
-				break;
-
-			// case GRALLOC_ARM_HAL_FORMAT_INDEXED_NV21:
-            case MALI_GRALLOC_FORMAT_INTERNAL_NV21:
-				c_stride = y_stride;
-				/* Y plane, UV plane */
-				v_offset = y_size;
-				u_offset = y_size + 1;
-				step = 2;
-				break;
-
-			case HAL_PIXEL_FORMAT_YV12:
-			// case GRALLOC_ARM_HAL_FORMAT_INDEXED_YV12:
-            // case MALI_GRALLOC_FORMAT_INTERNAL_YV12:
-			{
-				int c_size;
-
-				/* Stride alignment set to 16 as the SW access flags
-				 *were set
-				 */
-				c_stride = GRALLOC_ALIGN(hnd->byte_stride / 2, 16);
-				c_size = c_stride * (adjusted_height / 2);
-				/* Y plane, V plane, U plane */
-				v_offset = y_size;
-				u_offset = y_size + c_size;
-				step = 1;
-				break;
-			}
-
-			default:
-				ALOGE("Can't lock buffer %p: wrong format %" PRIu64 "",
-								hnd, hnd->internal_format);
-				ret = -EINVAL;
-				break;
+		/* plane layout 已经在 alloc 时计算并保存在 handle 中, 非 NATIVE 视图的 layout 保存在 bo 中. */
+		bool native_view = (GRALLOC_DRM_LOCK_VIEW_NATIVE == bo->lock_view);
+		uint32_t num_planes = native_view ? hnd->num_planes : bo->view_num_planes;
+		const struct gralloc_drm_plane_info_t *plane_info = native_view ? hnd->plane_info : bo->view_plane_info;
+		const struct gralloc_drm_ycbcr_info_t *ycbcr_info = native_view ? &(hnd->ycbcr_info) : &(bo->view_ycbcr_info);
+
+		if (0 == num_planes) {
+			ALOGE("Can't lock buffer %p: wrong format %" PRIu64 "",
+							hnd, hnd->internal_format);
+			ret = -EINVAL;
+		}
+		/* bit-packed 格式 (chroma_step 为 0) 没有合法的 android_ycbcr 描述. */
+		else if (ycbcr_info->c_stride != 0 && 0 == ycbcr_info->chroma_step) {
+			ALOGE("Can't lock_ycbcr buffer %p: format 0x%" PRIx64 " is bit-packed, use lock() instead",
+							hnd, hnd->internal_format);
+			ret = -EINVAL;
+		}
+		else {
+			ret = gralloc_drm_bo_lock(bo, hnd->usage,
+					0, 0, hnd->width, hnd->height,(void **)&cpu_addr);
 		}
 
 		if (!ret) {
-			ycbcr->y = cpu_addr;
-			ycbcr->cb = cpu_addr + u_offset;
-			ycbcr->cr = cpu_addr + v_offset;
-			ycbcr->ystride = y_stride;
-			ycbcr->cstride = c_stride;
-			ycbcr->chroma_step = step;
+			ycbcr->y = cpu_addr + plane_info[0].offset;
+			/* c_stride 为 0 : 格式没有 chroma (Y8, Y16). */
+			ycbcr->cb = ycbcr_info->c_stride ? cpu_addr + ycbcr_info->cb_offset : NULL;
+			ycbcr->cr = ycbcr_info->c_stride ? cpu_addr + ycbcr_info->cr_offset : NULL;
+			ycbcr->ystride = plane_info[0].byte_stride;
+			ycbcr->cstride = ycbcr_info->c_stride;
+			ycbcr->chroma_step = ycbcr_info->chroma_step;
 		}
 	}
 
@@ -462,6 +530,13 @@ static int drm_mod_alloc_gpu0(alloc_device_t *dev,
 	return 0;
 }
 
+static void drm_mod_dump_gpu0(struct alloc_device_t *dev, char *buff, int buff_len)
+{
+	struct drm_module_t *dmod = (struct drm_module_t *) dev->common.module;
+
+	gralloc_drm_dump(dmod->drm, buff, buff_len);
+}
+
 static int drm_mod_open_gpu0(struct drm_module_t *dmod, hw_device_t **dev)
 {
 	struct alloc_device_t *alloc;
@@ -475,6 +550,8 @@ static int drm_mod_open_gpu0(struct drm_module_t *dmod, hw_device_t **dev)
 	if (err)
 		return err;
 
+	gralloc_drm_open_alloc_device(dmod->drm);
+
 	alloc = new alloc_device_t;
 	if (!alloc)
 		return -EINVAL;
@@ -487,7 +564,7 @@ static int drm_mod_open_gpu0(struct drm_module_t *dmod, hw_device_t **dev)
 
 	alloc->alloc = drm_mod_alloc_gpu0;
 	alloc->free = drm_mod_free_gpu0;
-	alloc->dump = NULL;
+	alloc->dump = drm_mod_dump_gpu0;
 
 	*dev = &alloc->common;
 
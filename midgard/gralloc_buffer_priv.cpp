@@ -19,6 +19,8 @@
 #include <cutils/ashmem.h>
 #include <log/log.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "gralloc_drm.h"
 #include "gralloc_drm_handle.h"
@@ -104,6 +106,77 @@ out:
 	return rval;
 }
 
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+/*
+ * Same as gralloc_buffer_attr_allocate(), but backs the attribute region
+ * with a memfd. Unlike an ashmem region, a memfd has an inode of its own,
+ * so gralloc can watch (inotify IN_DELETE_SELF) for the moment every
+ * process holding the handle has closed it.
+ *
+ * Return 0 on success.
+ */
+int gralloc_buffer_attr_allocate_memfd(struct gralloc_drm_handle_t *hnd)
+{
+	int rval = -1;
+
+	if (!hnd)
+	{
+		goto out;
+	}
+
+	if (hnd->share_attr_fd >= 0)
+	{
+		ALOGW("Warning share attribute fd already exists during create. Closing.");
+		close(hnd->share_attr_fd);
+	}
+
+	hnd->share_attr_fd = (int)syscall(__NR_memfd_create, "gralloc_shared_attr", MFD_CLOEXEC);
+	if (hnd->share_attr_fd < 0)
+	{
+		ALOGE("Failed to create memfd for shared attribute region");
+		goto err_memfd;
+	}
+
+	if (ftruncate(hnd->share_attr_fd, PAGE_SIZE) != 0)
+	{
+		ALOGE("Failed to size memfd for shared attribute region");
+		goto err_memfd;
+	}
+
+	hnd->attr_base = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, hnd->share_attr_fd, 0);
+
+	if (hnd->attr_base != MAP_FAILED)
+	{
+		/* See gralloc_buffer_attr_allocate(). */
+		memset(hnd->attr_base, 0xff, PAGE_SIZE);
+
+		munmap(hnd->attr_base, PAGE_SIZE);
+		hnd->attr_base = MAP_FAILED;
+	}
+	else
+	{
+		ALOGE("Failed to mmap shared attribute region");
+		goto err_memfd;
+	}
+
+	rval = 0;
+	goto out;
+
+err_memfd:
+
+	if (hnd->share_attr_fd >= 0)
+	{
+		close(hnd->share_attr_fd);
+		hnd->share_attr_fd = -1;
+	}
+
+out:
+	return rval;
+}
+
 /*
  * Frees the shared memory allocated for attribute storage.
  * Only to be used by gralloc internally.
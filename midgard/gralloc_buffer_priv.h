@@ -53,6 +53,14 @@ typedef struct attr_region attr_region;
  */
 int gralloc_buffer_attr_allocate(struct gralloc_drm_handle_t *hnd);
 
+/*
+ * Same as gralloc_buffer_attr_allocate(), but backed by a memfd whose
+ * release by every holder of the handle can be watched with inotify.
+ *
+ * Return 0 on success.
+ */
+int gralloc_buffer_attr_allocate_memfd(struct gralloc_drm_handle_t *hnd);
+
 /*
  * Frees the shared memory allocated for attribute storage.
  * Only to be used by gralloc internally.
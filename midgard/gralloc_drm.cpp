@@ -32,6 +32,7 @@
 #include <cutils/atomic.h>
 #include <cutils/properties.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -42,7 +43,9 @@
 
 #include "gralloc_drm.h"
 #include "gralloc_drm_priv.h"
+#include "gralloc_drm_tracker.h"
 #include "gralloc_buffer_priv.h"
+#include "mali_gralloc_formats.h"
 
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
@@ -120,6 +123,8 @@ struct gralloc_drm_t *gralloc_drm_create(void)
 		return NULL;
 	}
 
+	gralloc_drm_tracker_init();
+
 	return drm;
 }
 
@@ -142,6 +147,140 @@ int gralloc_drm_get_fd(struct gralloc_drm_t *drm)
 	return drm->fd;
 }
 
+/*
+ * Make later imports in this process CPU-only.
+ */
+int gralloc_drm_set_cpu_only_import(struct gralloc_drm_t *drm, int enable)
+{
+	if (!drm->drv->set_cpu_only_import)
+		return -ENOSYS;
+
+	drm->drv->set_cpu_only_import(drm->drv, enable);
+	return 0;
+}
+
+/*
+ * Let later small allocations of this process share parent bos.
+ * Only for processes that never hand buffers to other clients.
+ */
+int gralloc_drm_set_process_local_suballoc(struct gralloc_drm_t *drm, int enable)
+{
+	if (!drm->drv->set_process_local_suballoc)
+		return -ENOSYS;
+
+	drm->drv->set_process_local_suballoc(drm->drv, enable);
+	return 0;
+}
+
+/*
+ * Let later allocations of this process defer their backing until first use.
+ */
+int gralloc_drm_set_lazy_commit(struct gralloc_drm_t *drm, int enable)
+{
+	if (!drm->drv->set_lazy_commit)
+		return -ENOSYS;
+
+	drm->drv->set_lazy_commit(drm->drv, enable);
+	return 0;
+}
+
+/*
+ * Called when the current process opens the alloc device, i.e. allocates buffers itself.
+ */
+void gralloc_drm_open_alloc_device(struct gralloc_drm_t *drm)
+{
+	if (drm->drv->open_alloc_device)
+		drm->drv->open_alloc_device(drm->drv);
+}
+
+/*
+ * Release cached resources of the current process under memory pressure.
+ */
+int gralloc_drm_trim(struct gralloc_drm_t *drm, uint64_t target_bytes, struct gralloc_drm_trim_result_t *result)
+{
+	struct gralloc_drm_trim_result_t local;
+
+	if (!result)
+		result = &local;
+	memset(result, 0, sizeof(*result));
+
+	if (!drm->drv->trim)
+		return 0;
+
+	return drm->drv->trim(drm->drv, target_bytes, result);
+}
+
+/*
+ * Compute the layout of a buffer the way alloc would, without allocating it.
+ */
+int gralloc_drm_compute_layout(struct gralloc_drm_t *drm, int width, int height, int format, int usage,
+		struct gralloc_drm_layout_t *layout)
+{
+	if (!layout)
+		return -EINVAL;
+
+	memset(layout, 0, sizeof(*layout));
+	if (!drm->drv->compute_layout)
+		return -ENOSYS;
+
+	return drm->drv->compute_layout(drm->drv, width, height, format, usage, layout);
+}
+
+/*
+ * Get the accounting of buffer memory held by the current process.
+ */
+int gralloc_drm_get_mem_ledger(struct gralloc_drm_t *drm, struct gralloc_drm_mem_ledger_t *ledger)
+{
+	if (!ledger)
+		return -EINVAL;
+
+	if (!drm->drv->get_mem_ledger)
+		return -ENOSYS;
+
+	return drm->drv->get_mem_ledger(drm->drv, ledger);
+}
+
+/*
+ * Get the decoder metadata tail of a registered buffer.
+ */
+int gralloc_drm_handle_get_vdec_metadata(buffer_handle_t _handle, uint32_t *offset, uint32_t *size)
+{
+	int ret = 0;
+	struct gralloc_drm_handle_t *handle = gralloc_drm_handle(_handle);
+
+	if (!handle || !offset || !size)
+	{
+		gralloc_drm_unlock_handle(_handle);
+		return -EINVAL;
+	}
+
+	if (unlikely(handle->data_owner != gralloc_drm_pid)) {
+		ret = -EPERM;
+		ALOGE("handle get vdec metadata before register buffer.");
+	} else {
+		*offset = handle->metadata_offset;
+		*size = handle->metadata_size;
+	}
+
+	gralloc_drm_unlock_handle(_handle);
+	return ret;
+}
+
+/*
+ * Dump the debug state of a DRM device object.
+ */
+void gralloc_drm_dump(struct gralloc_drm_t *drm, char *buff, int buff_len)
+{
+	if (!buff || buff_len <= 0)
+		return;
+
+	buff[0] = '\0';
+	if (drm && drm->drv && drm->drv->dump)
+		drm->drv->dump(drm->drv, buff, buff_len);
+
+	gralloc_drm_tracker_dump(buff, buff_len);
+}
+
 /*
  * Validate a buffer handle and return the associated bo.
  * 某些 case 中还完成对 buffer 的 import 操作, 见对参数 'drm' 的说明.
@@ -183,13 +322,16 @@ static struct gralloc_drm_bo_t *validate_handle(buffer_handle_t _handle,
 			//bo = drm->drv->alloc(drm->drv, handle);
 			bo = drm_gem_rockchip_alloc(drm->drv, handle);  // .trick : "alloc" : 这里实现将完成 import 操作.
 		}
-		else /* an invalid handle */
+		else { /* an invalid handle */
+			ALOGE("can't import a handle without prime_fd, size : %d", handle->size);
 			bo = NULL;
+		}
 		if (bo) {
 			bo->drm = drm;
 			bo->imported = 1;
 			bo->handle = handle;
 			bo->refcount = 0;
+			gralloc_drm_tracker_on_create(bo);
 		}
 
 		handle->data_owner = gralloc_drm_get_pid();
@@ -220,6 +362,15 @@ int gralloc_drm_handle_register(buffer_handle_t handle, struct gralloc_drm_t *dr
         bo->handle = (struct gralloc_drm_handle_t *)handle;
     }
 
+    /* 在 alloc 的进程中 register, 表示 buffer 将被设备使用. */
+    if (!bo->imported) {
+        int err = gralloc_drm_bo_commit(bo);
+        if (err) {
+            pthread_mutex_unlock(&bo_mutex);
+            return err;
+        }
+    }
+
     bo->refcount++;
     pthread_mutex_unlock(&bo_mutex);
 
@@ -271,7 +422,11 @@ static struct gralloc_drm_handle_t *create_bo_handle(int width,
 	handle->format = format;
 	handle->usage = usage;
 	handle->prime_fd = -1;
+	handle->offset = 0;
 	handle->layer_count = 1;
+	handle->metadata_offset = 0;
+	handle->metadata_size = 0;
+	handle->generation = 0;
 
 #if RK_DRM_GRALLOC
 #ifdef USE_HWC2
@@ -327,6 +482,8 @@ struct gralloc_drm_bo_t *gralloc_drm_bo_create(struct gralloc_drm_t *drm,
 
     handle->format = (int)(handle->internal_format); // 'internal_format' 并未使用 ARM 的高位扩展标识.
 
+	gralloc_drm_tracker_on_create(bo);
+
 	return bo;
 }
 
@@ -342,19 +499,21 @@ static void gralloc_drm_bo_destroy(struct gralloc_drm_bo_t *bo)
 	if (bo->refcount)
 		return;
 
+	/* the handle outlives the bo and leaks, report where it was created */
+	if (!imported && handle->ref) {
+		ALOGE("gralloc_drm_bo_destroy: handle %p still has ref=%d, not freed", handle, handle->ref);
+		gralloc_drm_tracker_log_bo(bo, "handle still referenced at destroy");
+	}
+	gralloc_drm_tracker_on_destroy(bo);
+
 //	bo->drm->drv->free(bo->drm->drv, bo);
 	drm_gem_rockchip_free(NULL, bo);
 	if (imported) {
 		handle->data_owner = 0;
 		handle->data = 0;
 	}
-	else {
-	    if(!handle->ref)
-		{
-		    delete handle;
-		}
-		else
-		    ALOGE("zxl:gralloc_drm_bo_destroy handle ref=%d",handle->ref);
+	else if (!handle->ref) {
+		delete handle;
 	}
 }
 
@@ -424,21 +583,70 @@ buffer_handle_t gralloc_drm_bo_get_handle(struct gralloc_drm_bo_t *bo, int *stri
 	return &bo->handle->base;
 }
 
+/*
+ * Get the GEM handle of a registered buffer in the current process.
+ * @return
+ *      0 if the buffer is not registered, or was imported for CPU access only.
+ */
+int gralloc_drm_get_gem_handle(buffer_handle_t _handle)
+{
+	struct gralloc_drm_handle_t *handle = gralloc_drm_handle(_handle);
+	int gem_handle = 0;
+
+	if (handle && handle->data && !gralloc_drm_bo_commit(handle->data))
+		gem_handle = handle->data->fb_handle;
+
+	gralloc_drm_unlock_handle(_handle);
+	return gem_handle;
+}
+
 /*
  * Query YUV component offsets for a buffer handle
  */
-void gralloc_drm_resolve_format(buffer_handle_t _handle,
+int gralloc_drm_resolve_format(buffer_handle_t _handle,
 	uint32_t *pitches, uint32_t *offsets, uint32_t *handles)
 {
 	struct gralloc_drm_handle_t *handle = gralloc_drm_handle(_handle);
-	struct gralloc_drm_bo_t *bo = handle->data;
-	struct gralloc_drm_t *drm = bo->drm;
+	struct gralloc_drm_bo_t *bo = handle ? handle->data : NULL;
+	int ret = -EINVAL;
 
 	/* if handle exists and driver implements resolve_format */
-	if (handle && drm->drv->resolve_format)
-		drm->drv->resolve_format(drm->drv, bo,
-			pitches, offsets, handles);
-    gralloc_drm_unlock_handle(_handle);
+	if (bo && pitches && offsets && handles) {
+		if (gralloc_drm_bo_commit(bo))
+			ret = -ENOMEM;
+		else if (bo->drm->drv->resolve_format) {
+			ret = bo->drm->drv->resolve_format(bo->drm->drv, bo,
+				pitches, offsets, handles);
+		}
+		else
+			ret = -ENOSYS;
+	}
+	gralloc_drm_unlock_handle(_handle);
+	return ret;
+}
+
+/*
+ * Get the number of planes (of separate pitches) in a buffer of 'hal_format'.
+ */
+unsigned int planes_for_format(struct gralloc_drm_t *drm, int hal_format)
+{
+	(void)drm;
+
+	switch (hal_format) {
+	case HAL_PIXEL_FORMAT_YV12:
+		return 3;
+	case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+	case HAL_PIXEL_FORMAT_YCbCr_422_SP:
+	case HAL_PIXEL_FORMAT_YCbCr_420_888:
+	case HAL_PIXEL_FORMAT_YCrCb_NV12:
+	case HAL_PIXEL_FORMAT_YCrCb_NV12_10:
+	case HAL_PIXEL_FORMAT_YCbCr_422_SP_10:
+	case HAL_PIXEL_FORMAT_YCrCb_420_SP_10:
+	case HAL_PIXEL_FORMAT_YCbCr_444_888:
+		return 2;
+	default:
+		return 1;
+	}
 }
 
 /*
@@ -465,6 +673,12 @@ int gralloc_drm_bo_lock(struct gralloc_drm_bo_t *bo,
 	if (bo->lock_count && (bo->locked_for & usage) != usage)
 		return -EINVAL;
 
+	if (!bo->lock_count) {
+		int err = gralloc_drm_bo_commit(bo);
+		if (err)
+			return err;
+	}
+
 	usage |= bo->locked_for;
 
 	if (usage & (GRALLOC_USAGE_SW_WRITE_MASK |
@@ -482,6 +696,7 @@ int gralloc_drm_bo_lock(struct gralloc_drm_bo_t *bo,
 
 	bo->lock_count++;
 	bo->locked_for |= usage;
+	gralloc_drm_tracker_on_lock(bo);
 
 	return 0;
 }
@@ -494,6 +709,7 @@ void gralloc_drm_bo_unlock(struct gralloc_drm_bo_t *bo)
 	int mapped = bo->locked_for &
 		(GRALLOC_USAGE_SW_WRITE_MASK | GRALLOC_USAGE_SW_READ_MASK);
 
+	gralloc_drm_tracker_on_unlock(bo, bo->lock_count);
 	if (!bo->lock_count)
 		return;
 
@@ -505,6 +721,52 @@ void gralloc_drm_bo_unlock(struct gralloc_drm_bo_t *bo)
 		bo->locked_for = 0;
 }
 
+/*
+ * Select the data view returned by later locks of a bo.
+ */
+int gralloc_drm_bo_set_lock_view(struct gralloc_drm_bo_t *bo, int view)
+{
+	if (bo->lock_count)
+		return -EBUSY;
+
+	if (!bo->drm->drv->set_lock_view)
+		return (view == GRALLOC_DRM_LOCK_VIEW_NATIVE) ? 0 : -ENOSYS;
+
+	return bo->drm->drv->set_lock_view(bo->drm->drv, bo, view);
+}
+
+/*
+ * Reshape a bo in place, see GRALLOC_MODULE_PERFORM_RESHAPE.
+ */
+int gralloc_drm_bo_reshape(struct gralloc_drm_bo_t *bo, int width, int height, int format, int usage)
+{
+	if (bo->lock_count)
+		return -EBUSY;
+
+	if (width <= 0 || height <= 0)
+		return -EINVAL;
+
+	/* only the allocating process may reshape, other processes re-import the reshaped handle */
+	if (bo->imported)
+		return -EPERM;
+
+	if (!bo->drm->drv->reshape)
+		return -ENOSYS;
+
+	return bo->drm->drv->reshape(bo->drm->drv, bo, width, height, format, usage);
+}
+
+/*
+ * Allocate the memory of a bo whose backing was deferred, see GRALLOC_MODULE_PERFORM_COMMIT.
+ */
+int gralloc_drm_bo_commit(struct gralloc_drm_bo_t *bo)
+{
+	if (bo->imported || !bo->drm->drv->commit)
+		return 0;
+
+	return bo->drm->drv->commit(bo->drm->drv, bo);
+}
+
 #ifdef USE_HWC2
 int gralloc_drm_handle_get_rk_ashmem(buffer_handle_t _handle, struct rk_ashmem_t* rk_ashmem)
     // "rk_ashmem_t" : 定义在 hardware/libhardware/include/hardware/gralloc.h 中
@@ -583,6 +845,53 @@ int gralloc_drm_handle_set_rk_ashmem(buffer_handle_t _handle, struct rk_ashmem_t
 }
 #endif
 
+/*
+ * Get the DRM fourcc, format modifier and plane count of a registered buffer,
+ * the AFBC modifier bits follow the attributes recorded in the buffer's attribute region.
+ */
+int gralloc_drm_handle_get_drm_format(buffer_handle_t _handle,
+	uint32_t *fourcc, uint64_t *modifier, uint32_t *num_planes)
+{
+	int ret = 0;
+	struct gralloc_drm_handle_t *handle = gralloc_drm_handle(_handle);
+	mali_gralloc_drm_format drm_format;
+
+	if (!handle || !fourcc || !modifier || !num_planes)
+	{
+		gralloc_drm_unlock_handle(_handle);
+		return -EINVAL;
+	}
+
+	if (unlikely(handle->data_owner != gralloc_drm_pid)) {
+		ret = -EPERM;
+		ALOGE("handle get drm format before register buffer.");
+	} else {
+		ret = mali_gralloc_get_drm_format(handle->internal_format, &drm_format);
+	}
+
+	if (0 == ret) {
+		if ((handle->internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK)
+			&& gralloc_buffer_attr_map(handle, 0) == 0) {
+			int use_yuv_transform = 0;
+			int use_sparse_alloc = 0;
+
+			if (gralloc_buffer_attr_read(handle, GRALLOC_ARM_BUFFER_ATTR_AFBC_YUV_TRANS, &use_yuv_transform) == 0
+				&& gralloc_buffer_attr_read(handle, GRALLOC_ARM_BUFFER_ATTR_AFBC_SPARSE_ALLOC, &use_sparse_alloc) == 0)
+				drm_format.modifier = mali_gralloc_drm_modifier_set_afbc_attrs(drm_format.modifier,
+											  use_yuv_transform,
+											  use_sparse_alloc);
+			gralloc_buffer_attr_unmap(handle);
+		}
+
+		*fourcc = drm_format.fourcc;
+		*modifier = drm_format.modifier;
+		*num_planes = drm_format.num_planes;
+	}
+
+	gralloc_drm_unlock_handle(_handle);
+	return ret;
+}
+
 int gralloc_drm_handle_get_phy_addr(buffer_handle_t _handle, uint32_t *phy_addr)
 {
 	int ret = 0;
@@ -599,7 +908,7 @@ int gralloc_drm_handle_get_phy_addr(buffer_handle_t _handle, uint32_t *phy_addr)
 		ret = -EPERM;
 		ALOGE("handle get prime fd before register buffer.");
 	} else {
-		ret = 0;
+		ret = handle->data ? gralloc_drm_bo_commit(handle->data) : 0;
 		*phy_addr = handle->phy_addr;
 	}
 
@@ -622,7 +931,7 @@ int gralloc_drm_handle_get_prime_fd(buffer_handle_t _handle, int *fd)
 		ret = -EPERM;
 		ALOGE("handle get prime fd before register buffer.");
 	} else {
-		ret = 0;
+		ret = handle->data ? gralloc_drm_bo_commit(handle->data) : 0;
 		*fd = handle->prime_fd;
 	}
 
@@ -49,8 +49,15 @@ enum {
     GRALLOC_USAGE_TO_USE_ARM_P010       = 0x0A000000U,
     /* would like to use a fbdc(afbc) format. */
     GRALLOC_USAGE_TO_USE_FBDC_FMT       = 0x09000000U,
-    /* use Physically Continuous memory */
+    /* use Physically Continuous memory, never fall back, the consumer may use the physical address */
     GRALLOC_USAGE_TO_USE_PHY_CONT      = 0x08000000U,
+    /* same as GRALLOC_USAGE_TO_USE_PHY_CONT */
+    GRALLOC_USAGE_TO_USE_PHY_CONT_STRICT = 0x0D000000U,
+    /* prefer Physically Continuous memory, fall back to IOMMU memory when CMA allocation fails.
+     * only for consumers that never use the physical address, it is 0 after a fall back. */
+    GRALLOC_USAGE_TO_USE_PHY_CONT_OR_IOMMU = 0x0F000000U,
+    /* NV12 / NV12_10 buffer not written by the video decoder, no metadata tail. */
+    GRALLOC_USAGE_TO_USE_NO_VDEC_METADATA = 0x0C000000U,
 };
 
 /**
@@ -73,6 +80,142 @@ enum {
   
   GRALLOC_MODULE_PERFORM_GET_RK_ASHMEM             = 0x08100014U,
   GRALLOC_MODULE_PERFORM_SET_RK_ASHMEM             = 0x08100016U,
+
+  /* 声明当前进程只需要 CPU 访问之后 import 的 buffer :
+   * 不再 import 为 gem_obj, CPU 映射直接 mmap buffer 的 dma_buf.
+   * 只影响之后被 register 的 buffer.
+   *
+   * perform(const struct gralloc_module_t *mod,
+   *     int op,
+   *     int enable);
+   */
+  GRALLOC_MODULE_PERFORM_SET_CPU_ONLY_IMPORT       = 0x08100018U,
+
+  /* 设置当前进程中 lock 'buffer' 时 CPU 看到的数据视图, 'view' 是 GRALLOC_DRM_LOCK_VIEW_*.
+   * 'buffer' 必须已经被 register, 且当前没有被 lock.
+   *
+   * perform(const struct gralloc_module_t *mod,
+   *     int op,
+   *     buffer_handle_t buffer,
+   *     int view);
+   */
+  GRALLOC_MODULE_PERFORM_SET_LOCK_VIEW             = 0x0810001AU,
+
+  /* 获取 'buffer' 在当前进程中各 plane 的 pitch, offset 和 gem_handle, 可直接用于 drmModeAddFB2() 等.
+   * 三个数组的长度都是 GRALLOC_DRM_RESOLVE_MAX_PLANES, 未使用的 plane 的项为 0.
+   * 各项在 buffer 被 alloc 或 register 时计算, 调用不会重新计算 layout.
+   * 'buffer' 必须已经被 register.
+   *
+   * perform(const struct gralloc_module_t *mod,
+   *     int op,
+   *     buffer_handle_t buffer,
+   *     uint32_t *pitches,
+   *     uint32_t *offsets,
+   *     uint32_t *handles);
+   */
+  GRALLOC_MODULE_PERFORM_RESOLVE_FORMAT            = 0x0810001CU,
+
+  /* 获取 'buffer' 的 DRM fourcc, format modifier (未压缩时是 DRM_FORMAT_MOD_LINEAR) 和 plane 数,
+   * 与 GRALLOC_MODULE_PERFORM_RESOLVE_FORMAT 的结果一起, 可直接用于 drmModeAddFB2WithModifiers().
+   * AFBC modifier 中的 YTR, SPARSE 按 buffer 的 attribute region 中的记录设置.
+   * 'buffer' 必须已经被 register.
+   *
+   * perform(const struct gralloc_module_t *mod,
+   *     int op,
+   *     buffer_handle_t buffer,
+   *     uint32_t *fourcc,
+   *     uint64_t *modifier,
+   *     uint32_t *num_planes);
+   */
+  GRALLOC_MODULE_PERFORM_GET_DRM_FORMAT            = 0x0810001EU,
+
+  /* 获取 video_decoder buffer (NV12, NV12_10) 中 YUV 数据之后的 metadata 区的 offset 和 byte 数,
+   * 'size' 为 0 表示 buffer 没有 metadata 区. 'buffer' 必须已经被 register.
+   * metadata 区的大小由 decoder 通过 property "vendor.gralloc.vdec_metadata_size" 声明, 在 alloc 时确定;
+   * decoder 应在使用前检查 'size' 不小于自己的需要 (比如 buffer 是在声明之前 alloc 的).
+   *
+   * perform(const struct gralloc_module_t *mod,
+   *     int op,
+   *     buffer_handle_t buffer,
+   *     uint32_t *offset,
+   *     uint32_t *size);
+   */
+  GRALLOC_MODULE_PERFORM_GET_VDEC_METADATA         = 0x08100020U,
+
+  /* 获取当前进程持有的 graphic buffer 内存的统计 : 总量, 峰值, 按格式, usage, flags 的分类, 以及最大的若干 buffer.
+   * 同样的内容也通过 alloc_device_t::dump 输出.
+   *
+   * perform(const struct gralloc_module_t *mod,
+   *     int op,
+   *     struct gralloc_drm_mem_ledger_t *ledger);
+   */
+  GRALLOC_MODULE_PERFORM_GET_MEM_LEDGER            = 0x08100024U,
+
+  /* 在当前进程中就地改变 'buffer' 的 width, height, format 和 usage, 不重新分配内存 :
+   * 按 alloc 的逻辑计算新的 layout, 若 buffer 的内存容纳得下, 且 cachable, 物理连续等要求不变,
+   * 则改写 handle 中的 geometry, stride, internal_format, plane layout 等, 并将 handle 的 generation 加 1.
+   * 'buffer' 必须是当前进程 alloc 的, 且当前没有被 lock; 其 lock view 被重置为 GRALLOC_DRM_LOCK_VIEW_NATIVE.
+   * handle 的 producer_usage 和 consumer_usage 不变.
+   * 只有 alloc buffer 的进程可以 reshape, 对 import 的 buffer 返回 -EPERM :
+   * 各进程的 format caps 可能不同, 在其他进程中重新计算 layout 的结果可能不一致.
+   * 其他进程中的 handle 不受影响, alloc 的进程需要重新发送 handle, 其他进程 unregister 旧的 handle 并 register 新的 handle,
+   * import 时沿用 handle 中的 internal_format 和 layout. 可以通过 handle 的 generation 检查双方的 layout 是否一致.
+   * 返回 -ENOSPC 表示 buffer 容纳不下新的 layout, 调用者应该重新 alloc.
+   *
+   * perform(const struct gralloc_module_t *mod,
+   *     int op,
+   *     buffer_handle_t buffer,
+   *     int width,
+   *     int height,
+   *     int format,
+   *     int usage);
+   */
+  GRALLOC_MODULE_PERFORM_RESHAPE                   = 0x08100026U,
+
+  /* 在内存紧张时释放当前进程中 gralloc 的缓存 (GRALLOC_DRM_TRIM_*), 按 GRALLOC_DRM_TRIM_* 的顺序,
+   * 直到释放的总量不小于 'target_bytes'; 'target_bytes' 为 0 表示全部释放.
+   * 'result' 可以是 NULL, 否则返回各缓存释放的 byte 数.
+   * property "vendor.gralloc.psi_trim" 为 true 时, 进程中的 gralloc 还会在 PSI 报告内存压力时自动 trim.
+   *
+   * perform(const struct gralloc_module_t *mod,
+   *     int op,
+   *     uint64_t target_bytes,
+   *     struct gralloc_drm_trim_result_t *result);
+   */
+  GRALLOC_MODULE_PERFORM_TRIM                      = 0x08100028U,
+
+  /* 为 'buffer' 分配推迟了的 backing memory, 对已经有 backing 的 buffer 什么都不做.
+   * 开启 lazy commit (见 GRALLOC_MODULE_PERFORM_SET_LAZY_COMMIT) 之后, alloc 只计算 layout 并填写 handle,
+   * 直到 buffer 在当前进程中被 register, lock, 查询 prime_fd, phy_addr, gem handle, 或者通过本 op 才实际分配.
+   * 尚未 commit 的 buffer 的 prime_fd 是一个 placeholder (unix socket), 可以和其他 fd 一样被传递到其他进程 :
+   * 其他进程 register 时通过 placeholder 请求 alloc 的进程 commit, 然后 import 得到的 dma_buf.
+   * 因此 alloc 的进程不需要在共享 buffer 之前 commit, 但在所有进程都关闭 handle 之前必须保持运行.
+   * 不 register 而直接使用 handle 中的 prime_fd 的进程得到的是 placeholder, 不是 dma_buf.
+   *
+   * perform(const struct gralloc_module_t *mod,
+   *     int op,
+   *     buffer_handle_t buffer);
+   */
+  GRALLOC_MODULE_PERFORM_COMMIT                    = 0x0810002AU,
+
+  /* 声明当前进程之后 alloc 的小 buffer 不会交给其他 client, 允许它们共享 parent bo (sub-alloc) :
+   * 这些 buffer 的 handle 中是整个 parent bo 的 dma_buf, 得到其中一个 buffer 的进程可以访问同一 parent bo 中的其他 buffer.
+   * 为多个 client alloc buffer 的进程 (比如 allocator service) 不能开启. 默认关闭.
+   *
+   * perform(const struct gralloc_module_t *mod,
+   *     int op,
+   *     int enable);
+   */
+  GRALLOC_MODULE_PERFORM_SET_PROCESS_LOCAL_SUBALLOC = 0x0810002EU,
+
+  /* 设置当前进程之后 alloc 的 buffer 是否推迟分配 backing memory (见 GRALLOC_MODULE_PERFORM_COMMIT).
+   * 初值来自 property "vendor.gralloc.lazy_commit", 默认关闭.
+   *
+   * perform(const struct gralloc_module_t *mod,
+   *     int op,
+   *     int enable);
+   */
+  GRALLOC_MODULE_PERFORM_SET_LAZY_COMMIT           = 0x08100030U,
   
   /* perform(const struct gralloc_module_t *mod,
    *     int op,
@@ -113,7 +256,147 @@ enum {
     HAL_PIXEL_FORMAT_YCrCb_NV12         = 0x15, // YUY2
     HAL_PIXEL_FORMAT_YCrCb_NV12_10      = 0x17, // YUY2_10bit
     HAL_PIXEL_FORMAT_YCbCr_422_SP_10    = 0x18, //
-    HAL_PIXEL_FORMAT_YCrCb_420_SP_10    = 0x19, //
+    HAL_PIXEL_FORMAT_YCrCb_420_SP_10    = 0x19, // alias of HAL_PIXEL_FORMAT_YCrCb_NV12_10
+    /* NV24 没有私有的格式值 : 以 system/graphics.h 中的 HAL_PIXEL_FORMAT_YCbCr_444_888 alloc, 其 layout 是 NV24. */
+};
+
+/**
+ * lock 时 CPU 看到的数据视图.
+ * @see GRALLOC_MODULE_PERFORM_SET_LOCK_VIEW.
+ */
+enum {
+    /* buffer 中的原始数据. */
+    GRALLOC_DRM_LOCK_VIEW_NATIVE        = 0,
+    /*
+     * 仅用于 HAL_PIXEL_FORMAT_YCrCb_NV12_10 :
+     * lock 返回由 buffer 数据解包得到的 P010 (每个 sample 16 bit) 副本,
+     * 若以 SW_WRITE usage lock, unlock 时副本被重新打包写回 buffer.
+     * 副本的 layout 只能通过 lock_ycbcr() 获取.
+     */
+    GRALLOC_DRM_LOCK_VIEW_P010          = 1,
+    /* 2 : 保留. 曾是只读的 AFBC 解码视图, CPU 一侧不能解码 GPU 渲染的 (entropy coded) 内容, 已移除. */
+    /*
+     * 仅用于 RGB 格式的 AFBC buffer (basic, wideblk, tiled headers, 不含 split block) :
+     * lock 返回线性副本, 行间距是 handle 的 byte_stride, 副本的初始内容是 buffer 数据解码的结果;
+     * 若以 SW_WRITE usage lock, unlock 时副本在 CPU 一侧被编码为 AFBC 写回 buffer (sparse, 不使用 YTR).
+     * 用于由 CPU 产生内容, 而由 GPU 或 VOP 以 AFBC 读取的 buffer.
+     * 本视图只为格式兼容而存在 (consumer 只接受 AFBC 时, CPU 仍可写入), 不减少带宽 :
+     * 编码只写纯色, 复制和未压缩的 block, 一般内容的 payload 与线性数据相当, 另加 header 区.
+     * 需要减少带宽时, 应由 GPU 渲染 AFBC, 或以线性格式 alloc.
+     * 只能解码纯色, 未压缩和复制的 block (由本视图写入, 或刚 alloc 的 buffer);
+     * buffer 中有 GPU 渲染的内容 (entropy coded 的 subblock) 时 lock 失败, 返回 -ENOTSUP.
+     * 见 rk_afbc_encode().
+     */
+    GRALLOC_DRM_LOCK_VIEW_AFBC_ENCODE_ON_UNLOCK = 3,
+};
+
+/* gralloc_drm_resolve_format() 返回的 pitches, offsets, handles 数组的长度. */
+#define GRALLOC_DRM_RESOLVE_MAX_PLANES 4
+
+/**
+ * 当前进程持有的 graphic buffer 内存的统计 (ledger) 中, buffer 按格式的分类.
+ * @see GRALLOC_MODULE_PERFORM_GET_MEM_LEDGER.
+ */
+enum {
+    GRALLOC_DRM_LEDGER_FORMAT_RGB = 0,
+    GRALLOC_DRM_LEDGER_FORMAT_YUV,
+    /* AFBC 压缩的 buffer, 不论 RGB 或 YUV. */
+    GRALLOC_DRM_LEDGER_FORMAT_AFBC,
+    /* BLOB, RAW 等其他格式. */
+    GRALLOC_DRM_LEDGER_FORMAT_OTHER,
+    GRALLOC_DRM_LEDGER_FORMAT_COUNT,
+};
+
+/**
+ * ledger 中, buffer 按 usage 的分类, 依次匹配, 取第一个符合的类别.
+ */
+enum {
+    /* GRALLOC_USAGE_HW_VIDEO_ENCODER, 或 video_decoder 使用的格式 (NV12, NV12_10). */
+    GRALLOC_DRM_LEDGER_USAGE_VIDEO = 0,
+    /* GRALLOC_USAGE_HW_CAMERA_MASK. */
+    GRALLOC_DRM_LEDGER_USAGE_CAMERA,
+    /* GRALLOC_USAGE_HW_FB, 或 只有 GRALLOC_USAGE_HW_COMPOSER 而没有 GPU usage. */
+    GRALLOC_DRM_LEDGER_USAGE_SCANOUT,
+    /* GRALLOC_USAGE_HW_TEXTURE, GRALLOC_USAGE_HW_RENDER. */
+    GRALLOC_DRM_LEDGER_USAGE_GPU,
+    /* 其他, 通常是只有 SW usage 的 buffer. */
+    GRALLOC_DRM_LEDGER_USAGE_OTHER,
+    GRALLOC_DRM_LEDGER_USAGE_COUNT,
+};
+
+/**
+ * 可以被 trim 的 gralloc 缓存, 也是 trim 时依次释放的顺序.
+ * @see GRALLOC_MODULE_PERFORM_TRIM.
+ */
+enum {
+    /* sub-alloc 的 chunk 中, 已经没有 live buffer, 但仍被保留用于之后分配的 chunk. */
+    GRALLOC_DRM_TRIM_SUBALLOC_CHUNKS = 0,
+    /* 当前没有被 lock 的 buffer 的 lock view 副本, 下次 lock 时重新分配. */
+    GRALLOC_DRM_TRIM_LOCK_VIEW_SHADOWS,
+    /* 当前没有被 lock 的 buffer 被缓存的 CPU 映射, 下次 lock 时重新映射. */
+    GRALLOC_DRM_TRIM_CPU_MAPPINGS,
+    GRALLOC_DRM_TRIM_CACHE_COUNT,
+};
+
+/**
+ * trim 释放的各缓存的 byte 数, 对 GRALLOC_DRM_TRIM_CPU_MAPPINGS 是解除映射的 byte 数.
+ */
+struct gralloc_drm_trim_result_t {
+    uint64_t reclaimed_bytes[GRALLOC_DRM_TRIM_CACHE_COUNT];
+};
+
+/**
+ * 按 alloc 的逻辑计算得到的 buffer layout, 见 gralloc_drm_compute_layout().
+ */
+struct gralloc_drm_layout_t {
+    uint64_t internal_format;
+    /* AllocType 的名称, 比如 "linear", "afbc". */
+    const char *alloc_type;
+    int byte_stride;
+    size_t size;
+    /* 紧密排列 (无任何对齐和 padding) 时的 byte 数, 包括 video_decoder 的 metadata 区. 无法计算时为 0. */
+    uint64_t packed_size;
+};
+
+/* ledger 中列出的最大的 buffer 的个数. */
+#define GRALLOC_DRM_LEDGER_TOP_N 8
+
+struct gralloc_drm_ledger_bucket_t {
+    uint64_t bytes;
+    uint64_t count;
+};
+
+/**
+ * 当前进程持有的 graphic buffer 内存的统计.
+ * 除 *_peak_bytes 外都是当前值; 各分类的统计包括 alloc 和 import 的 buffer.
+ */
+struct gralloc_drm_mem_ledger_t {
+    /* 当前进程 alloc 的 buffer. */
+    struct gralloc_drm_ledger_bucket_t allocated;
+    uint64_t allocated_peak_bytes;
+    /* 从其他进程 import 的 buffer. */
+    struct gralloc_drm_ledger_bucket_t imported;
+    uint64_t imported_peak_bytes;
+
+    struct gralloc_drm_ledger_bucket_t by_format[GRALLOC_DRM_LEDGER_FORMAT_COUNT];
+    struct gralloc_drm_ledger_bucket_t by_usage[GRALLOC_DRM_LEDGER_USAGE_COUNT];
+    /* 按 alloc 或 import 时的 ROCKCHIP_BO_* flags. */
+    struct gralloc_drm_ledger_bucket_t cachable;
+    struct gralloc_drm_ledger_bucket_t contig;
+    struct gralloc_drm_ledger_bucket_t secure;
+
+    /* 'top' 中有效的元素个数. */
+    uint32_t num_top;
+    /* 按 size 降序排列的最大的 buffer. */
+    struct {
+        uint64_t size;
+        uint64_t internal_format;
+        int width;
+        int height;
+        int format;
+        int usage;
+        int imported;
+    } top[GRALLOC_DRM_LEDGER_TOP_N];
 };
 
 struct gralloc_drm_t;
@@ -135,6 +418,52 @@ void gralloc_drm_destroy(struct gralloc_drm_t *drm);
 
 int gralloc_drm_get_fd(struct gralloc_drm_t *drm);
 
+/**
+ * 设置当前进程之后 import 的 buffer 是否只用于 CPU 访问.
+ */
+int gralloc_drm_set_cpu_only_import(struct gralloc_drm_t *drm, int enable);
+
+/**
+ * 设置当前进程之后 alloc 的小 buffer 是否 sub-alloc, 只用于不把 buffer 交给其他 client 的进程.
+ */
+int gralloc_drm_set_process_local_suballoc(struct gralloc_drm_t *drm, int enable);
+
+/**
+ * 设置当前进程之后 alloc 的 buffer 是否推迟分配 backing memory.
+ */
+int gralloc_drm_set_lazy_commit(struct gralloc_drm_t *drm, int enable);
+
+/**
+ * 在当前进程打开 alloc device (即自己 alloc buffer) 时调用, 准备只有 allocator 进程需要的资源.
+ */
+void gralloc_drm_open_alloc_device(struct gralloc_drm_t *drm);
+
+/**
+ * 按 GRALLOC_DRM_TRIM_* 的顺序释放 gralloc 的缓存, 直到释放的总量不小于 'target_bytes', 'target_bytes' 为 0 表示全部释放.
+ * 'result' 可以是 NULL.
+ */
+int gralloc_drm_trim(struct gralloc_drm_t *drm, uint64_t target_bytes, struct gralloc_drm_trim_result_t *result);
+
+/**
+ * 按 alloc 的逻辑计算 'width' x 'height', 'format', 'usage' 的 buffer 的 layout, 不分配内存.
+ * 只供离线评估 layout 开销的工具 (tools/gralloc_layout_eval.cpp) 使用, 不通过 gralloc module 暴露.
+ *
+ * @return
+ *      0 : 成功; -EINVAL : 不支持的 format 或尺寸; -ENOSYS : driver 不支持.
+ */
+int gralloc_drm_compute_layout(struct gralloc_drm_t *drm, int width, int height, int format, int usage,
+                               struct gralloc_drm_layout_t *layout);
+
+/**
+ * 获取当前进程持有的 graphic buffer 内存的统计.
+ */
+int gralloc_drm_get_mem_ledger(struct gralloc_drm_t *drm, struct gralloc_drm_mem_ledger_t *ledger);
+
+/**
+ * 将 gralloc_drm_device 的调试信息 和 统计数据 以文本形式写入 'buff'.
+ */
+void gralloc_drm_dump(struct gralloc_drm_t *drm, char *buff, int buff_len);
+
 /**
  * 获取指定 hal_pixel_format 的 bytes_per_pixel.
  */
@@ -170,7 +499,10 @@ static inline int gralloc_drm_get_bpp(int format)
 	case HAL_PIXEL_FORMAT_YCrCb_420_SP:
 	case HAL_PIXEL_FORMAT_YCbCr_420_888:
 #if RK_DRM_GRALLOC
+	case HAL_PIXEL_FORMAT_YCbCr_444_888:
 	case HAL_PIXEL_FORMAT_YCrCb_NV12_10:
+	case HAL_PIXEL_FORMAT_YCrCb_420_SP_10:
+	case HAL_PIXEL_FORMAT_YCbCr_422_SP_10:
 	case MALI_GRALLOC_FORMAT_INTERNAL_P010:
 #endif
 	case HAL_PIXEL_FORMAT_BLOB:
@@ -226,11 +558,14 @@ struct gralloc_drm_bo_t *gralloc_drm_bo_from_handle(buffer_handle_t handle);
 int gralloc_drm_free_bo_from_handle(buffer_handle_t handle);
 buffer_handle_t gralloc_drm_bo_get_handle(struct gralloc_drm_bo_t *bo, int *stride);
 int gralloc_drm_get_gem_handle(buffer_handle_t handle);
-void gralloc_drm_resolve_format(buffer_handle_t _handle, uint32_t *pitches, uint32_t *offsets, uint32_t *handles);
+int gralloc_drm_resolve_format(buffer_handle_t _handle, uint32_t *pitches, uint32_t *offsets, uint32_t *handles);
 unsigned int planes_for_format(struct gralloc_drm_t *drm, int hal_format);
 
 int gralloc_drm_bo_lock(struct gralloc_drm_bo_t *bo, int x, int y, int w, int h, int enable_write, void **addr);
 void gralloc_drm_bo_unlock(struct gralloc_drm_bo_t *bo);
+int gralloc_drm_bo_set_lock_view(struct gralloc_drm_bo_t *bo, int view);
+int gralloc_drm_bo_reshape(struct gralloc_drm_bo_t *bo, int width, int height, int format, int usage);
+int gralloc_drm_bo_commit(struct gralloc_drm_bo_t *bo);
 
 #ifdef USE_HWC2
 int gralloc_drm_handle_get_rk_ashmem(buffer_handle_t _handle, struct rk_ashmem_t* rk_ashmem);
@@ -238,6 +573,8 @@ int gralloc_drm_handle_set_rk_ashmem(buffer_handle_t _handle, struct rk_ashmem_t
 #endif
 
 int gralloc_drm_handle_get_phy_addr(buffer_handle_t _handle, uint32_t *phy_addr);
+int gralloc_drm_handle_get_drm_format(buffer_handle_t _handle, uint32_t *fourcc, uint64_t *modifier, uint32_t *num_planes);
+int gralloc_drm_handle_get_vdec_metadata(buffer_handle_t _handle, uint32_t *offset, uint32_t *size);
 
 int gralloc_drm_handle_get_prime_fd(buffer_handle_t _handle, int *fd);
 
@@ -106,6 +106,36 @@ typedef enum
 
 struct gralloc_drm_bo_t;
 
+/* buffer 中 plane 的最大个数. */
+#define GRALLOC_DRM_MAX_PLANES 3
+
+/**
+ * 一个 plane 在 buffer 中的 layout.
+ */
+struct gralloc_drm_plane_info_t {
+	/* plane 起始位置相对 buffer 起始的 offset, 单位 byte. */
+	uint32_t offset;
+	/* plane 中相邻两行之间的 byte 数. */
+	uint32_t byte_stride;
+};
+
+/**
+ * 供 lock_ycbcr() 使用的 chroma 描述, 各 offset 都相对 buffer 起始.
+ * 'c_stride' 为 0 表示格式没有 chroma (Y8, Y16), lock_ycbcr() 返回的 cb, cr 都是 NULL.
+ */
+struct gralloc_drm_ycbcr_info_t {
+	uint32_t cb_offset;
+	uint32_t cr_offset;
+	uint32_t c_stride;
+	/*
+	 * 水平相邻的两个 chroma sample 之间的 byte 数.
+	 * 0 表示 sample 不按 byte 对齐 (NV12_10, NV16_10, Y410, Y0L2 等 bit-packed 格式),
+	 * 不能用 android_ycbcr 描述, lock_ycbcr() 对这类 buffer 返回 -EINVAL;
+	 * CPU 访问应使用 lock() 并按 plane_info 自行解包, 或者 (对 NV12_10) 先设置 P010 lock view.
+	 */
+	uint32_t chroma_step;
+};
+
 /**
  * 对应 arm_gralloc 中的 private_handle_t.
  */
@@ -144,6 +174,7 @@ struct gralloc_drm_handle_t {
         int        ref;
         int        pixel_stride;
 
+        /* buffer 数据在 prime_fd 引用的 dma_buf 中的 offset, 对 sub-alloc 的小 buffer 非 0. */
         union {
                 off_t    offset;
                 uint64_t padding4;
@@ -194,6 +225,31 @@ struct gralloc_drm_handle_t {
         // value 是 pid, buffer 被 alloc 的时候 首次有效设置.
 
 	uint32_t layer_count;
+
+	/*
+	 * ABI : 以下字段追加在 'layer_count' 之后, 使 GRALLOC_DRM_HANDLE_NUM_INTS 变大.
+	 * 直接解析 gralloc_drm_handle_t 的其他模块 (hwcomposer, librga, libmpp 等) 按精确的 numInts 校验 handle,
+	 * 必须与本 gralloc 一同更新, 且只能继续在末尾追加字段, 不能改变已有字段的 offset.
+	 * 只读取 'layer_count' 及之前字段的 consumer 可以改为检查 numInts 不小于旧值, 从而兼容新旧两种 handle.
+	 */
+
+	/*
+	 * buffer 中各 plane 的 layout, 由 driver 在 alloc 时计算.
+	 * 'num_planes' 为 0 表示 layout 未知 (比如 AFBC 格式).
+	 */
+	uint32_t num_planes;
+	struct gralloc_drm_plane_info_t plane_info[GRALLOC_DRM_MAX_PLANES];
+	struct gralloc_drm_ycbcr_info_t ycbcr_info;
+
+	/*
+	 * video_decoder buffer (NV12, NV12_10) 中 YUV 数据之后的 metadata 区, offset 相对 buffer 起始, 单位 byte.
+	 * 'metadata_size' 为 0 表示 buffer 没有 metadata 区, 此时 'metadata_offset' 也是 0.
+	 */
+	uint32_t metadata_offset;
+	uint32_t metadata_size;
+
+	/* 每次 GRALLOC_MODULE_PERFORM_RESHAPE 成功改变 layout 时加 1, alloc 时为 0. */
+	uint32_t generation;
 };
 
 /**
@@ -192,7 +192,7 @@ batch_init(struct intel_info *info)
 	return ret;
 }
 
-static void intel_resolve_format(struct gralloc_drm_drv_t *drv,
+static int intel_resolve_format(struct gralloc_drm_drv_t *drv,
 		struct gralloc_drm_bo_t *bo,
 		uint32_t *pitches, uint32_t *offsets, uint32_t *handles)
 {
@@ -236,6 +236,8 @@ static void intel_resolve_format(struct gralloc_drm_drv_t *drv,
 			handles[1] = handles[0];
 			break;
 	}
+
+	return 0;
 }
 
 static drm_intel_bo *alloc_ibo(struct intel_info *info,
@@ -105,10 +105,47 @@ struct gralloc_drm_drv_t {
 	void (*unmap)(struct gralloc_drm_drv_t *drv,
 		      struct gralloc_drm_bo_t *bo);
 
-	/* query component offsets, strides and handles for a format */
-	void (*resolve_format)(struct gralloc_drm_drv_t *drv,
+	/* query component offsets, strides and handles for a format, -ENODEV if the bo has no GEM object here */
+	int (*resolve_format)(struct gralloc_drm_drv_t *drv,
 		     struct gralloc_drm_bo_t *bo,
 		     uint32_t *pitches, uint32_t *offsets, uint32_t *handles);
+
+	/* select the data view returned by later CPU maps of a bo, may be NULL */
+	int (*set_lock_view)(struct gralloc_drm_drv_t *drv,
+			     struct gralloc_drm_bo_t *bo, int view);
+
+	/* change the geometry, format and usage of a bo in place if its memory can hold the new layout, may be NULL */
+	int (*reshape)(struct gralloc_drm_drv_t *drv,
+		       struct gralloc_drm_bo_t *bo,
+		       int width, int height, int format, int usage);
+
+	/* allocate the memory of a bo whose backing was deferred at alloc time, may be NULL */
+	int (*commit)(struct gralloc_drm_drv_t *drv, struct gralloc_drm_bo_t *bo);
+
+	/* import later buffers for CPU access only (no GEM object), may be NULL */
+	void (*set_cpu_only_import)(struct gralloc_drm_drv_t *drv, int enable);
+
+	/* sub-allocate later small buffers of this process from shared parent bos, may be NULL */
+	void (*set_process_local_suballoc)(struct gralloc_drm_drv_t *drv, int enable);
+
+	/* defer the backing of later allocations of this process until first use, may be NULL */
+	void (*set_lazy_commit)(struct gralloc_drm_drv_t *drv, int enable);
+
+	/* release cached resources until 'target_bytes' (0 : all) are reclaimed, may be NULL */
+	int (*trim)(struct gralloc_drm_drv_t *drv, uint64_t target_bytes, struct gralloc_drm_trim_result_t *result);
+
+	/* compute the layout of a buffer the way alloc would, without allocating, may be NULL */
+	int (*compute_layout)(struct gralloc_drm_drv_t *drv, int width, int height, int format, int usage,
+			struct gralloc_drm_layout_t *layout);
+
+	/* get the accounting of buffer memory held by the current process, may be NULL */
+	int (*get_mem_ledger)(struct gralloc_drm_drv_t *drv, struct gralloc_drm_mem_ledger_t *ledger);
+
+	/* prepare resources only an allocating process needs, when it opens the alloc device, may be NULL */
+	void (*open_alloc_device)(struct gralloc_drm_drv_t *drv);
+
+	/* dump debug state and statistics as text, may be NULL */
+	void (*dump)(struct gralloc_drm_drv_t *drv, char *buff, int buff_len);
 };
 
 /**
@@ -131,7 +168,21 @@ struct gralloc_drm_bo_t {
      */
 	int locked_for;
 
+    /**
+     * 当前进程中 lock 时 CPU 看到的数据视图, GRALLOC_DRM_LOCK_VIEW_*.
+     * 不是 NATIVE 时, view_* 描述视图的 plane layout, 由 driver 的 set_lock_view 填充.
+     */
+	int lock_view;
+	uint32_t view_num_planes;
+	struct gralloc_drm_plane_info_t view_plane_info[GRALLOC_DRM_MAX_PLANES];
+	struct gralloc_drm_ycbcr_info_t view_ycbcr_info;
+
 	unsigned int refcount;
+
+    /**
+     * 当前 bo 在 buffer tracker 中的记录, tracker 没有开启时是 NULL. 见 gralloc_drm_tracker.h.
+     */
+	struct gralloc_drm_track_record_t *track;
 };
 
 struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_pipe(int fd, const char *name);
@@ -29,6 +29,8 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <drm.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
 #include <sys/types.h>
 
 extern "C" {
@@ -47,11 +49,23 @@ extern "C" {
 #include "gralloc_buffer_priv.h"
 #include "mali_gralloc_formats.h"
 #include "mali_gralloc_usages.h"
+#include "gralloc_drm_rockchip_convert.h"
+#include "gralloc_drm_rockchip_afbc.h"
+#include "gralloc_drm_rockchip_ledger.h"
+#include "gralloc_drm_rockchip_arena.h"
+#include "gralloc_drm_rockchip_commit.h"
 #endif //end of MALI_AFBC_GRALLOC
 #endif //end of RK_DRM_GRALLOC
 
 #include <stdbool.h>
+#include <limits.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <cutils/atomic.h>
 
 #include <utils/KeyedVector.h>
 #include <utils/Mutex.h>
@@ -63,10 +77,56 @@ extern "C" {
 #define UNUSED(...) (void)(__VA_ARGS__)
 
 #if RK_CTS_WORKROUND
-#define VIEW_CTS_FILE		"/data/data/android.view.cts/view_cts.ini"
+#define VIEW_CTS_DIR		"/data/data/android.view.cts"
+#define VIEW_CTS_FILE_NAME	"view_cts.ini"
+#define VIEW_CTS_FILE		VIEW_CTS_DIR "/" VIEW_CTS_FILE_NAME
 #define VIEW_CTS_PROG_NAME	"android.view.cts"
 #define VIEW_CTS_HINT		"view_cts"
 #define BIG_SCALE_HINT		"big_scale"
+
+/*
+ * 可选的 format caps 覆盖文件, 每行形如 "gpu=0x..." 或 "dpu=0x...", 值为 MALI_GRALLOC_FORMAT_CAPABILITY_* 的组合.
+ * 用于在不重新编译的情况下, 对特定的产品或调试场景 修正 运行时探测得到的 caps.
+ */
+#define RK_FORMAT_CAPS_OVERRIDE_FILE	"/vendor/etc/gralloc_format_caps.conf"
+/* VOP plane 的 "FEATURE" property 中, 表示该 plane 支持 AFBC 解码的 enum 的 name. */
+#define RK_VOP_PLANE_FEATURE_AFBDC	"afbdc"
+
+/*
+ * video_decoder 的 NV12 / NV12_10 buffer 中, YUV 数据之后的 metadata 区的 byte 数, 由 decoder 根据 codec 声明.
+ * 在每次 alloc 时读取, 所以 decoder (或产品配置) 在运行时设置后, 对 allocator 进程中之后的 alloc 也有效.
+ * 未设置或为 0 时, 视 decoder 为不知道 metadata 区的旧 decoder, 保留原先的 2 * byte_stride * height 的 buffer size.
+ */
+#define RK_VDEC_METADATA_SIZE_PROPERTY	"vendor.gralloc.vdec_metadata_size"
+/*
+ * 为 true 时忽略 RK_VDEC_METADATA_SIZE_PROPERTY, decoder buffer 都保留原先的 buffer size.
+ * 用于同时含有旧 decoder (在 YUV 数据之后使用未声明的空间) 的产品.
+ */
+#define RK_VDEC_LEGACY_RESERVE_PROPERTY	"vendor.gralloc.vdec_legacy_reserve"
+/* metadata 区的起始 offset 的对齐值. */
+#define RK_VDEC_METADATA_ALIGN	64
+
+/* 物理连续 (CMA) buffer 的 size class 的个数, class i 对应 size 在 (2^(i-1), 2^i] MiB 中的 buffer. */
+#define RK_CMA_SIZE_CLASSES	8
+/* 物理连续 buffer 的分配耗时的默认预算, 超出预算的分配只被统计, 单位 ms. */
+#define RK_CMA_DEFAULT_LATENCY_BUDGET_MS	50
+/* 某个 size class 分配失败之后, 默认在多长时间内不再尝试该 class 及更大的 class, 单位 ms. */
+#define RK_CMA_DEFAULT_BACKOFF_MS	2000
+
+/* 从共享的 parent bo (chunk) 中分配 (sub-alloc) 的 buffer 的最大 byte 数. */
+#define RK_SUBALLOC_MAX_SIZE	(64 * 1024)
+/* chunk 的 byte 数. */
+#define RK_SUBALLOC_CHUNK_SIZE	(256 * 1024)
+/* sub-alloc 的 buffer 在 chunk 中的 offset 的对齐值. */
+#define RK_SUBALLOC_ALIGN	256
+
+/* layout 开销统计中 (base_format, AllocType) 分类的最大个数, 超出的 buffer 只计入 unclassified. */
+#define RK_LAYOUT_OVERHEAD_MAX_ENTRIES	32
+
+/* PSI 报告内存压力的接口, 及注册的 trigger : 1s 的窗口中, 有 task 因内存 stall 的总时长达到 150ms. */
+#define RK_PSI_MEMORY_FILE	"/proc/pressure/memory"
+#define RK_PSI_MEMORY_TRIGGER	"some 150000 1000000"
+
 typedef unsigned int       u32;
 typedef enum
 {
@@ -76,6 +136,29 @@ typedef enum
 	IMG_INT_TYPE		,                       /*!< (Signed) Int type */
 	IMG_FLAG_TYPE                               /*!< Flag Type */
 }IMG_DATA_TYPE;
+
+#define APP_HINT_MAX_ENTRIES	32
+#define APP_HINT_MAX_LEN	64
+
+/*
+ * app_hint_file 中的一条 hint, 例如 "[android.view.cts]" 下的 "big_scale=0".
+ */
+typedef struct
+{
+	char section[APP_HINT_MAX_LEN];	/* 不含 '[' 和 ']'. */
+	char name[APP_HINT_MAX_LEN];
+	char value[APP_HINT_MAX_LEN];
+} app_hint_entry_t;
+
+/*
+ * app_hint_file 被解析之后在内存中的形式.
+ * 只在 app_hint_file 被修改之后 (由 inotify 通知) 重新解析, lock 路径上不再访问文件.
+ */
+typedef struct
+{
+	app_hint_entry_t entries[APP_HINT_MAX_ENTRIES];
+	int count;
+} app_hint_table_t;
 #endif
 
 struct dma_buf_sync {
@@ -115,6 +198,13 @@ struct drm_rockchip_gem_phys {
 	uint32_t phy_addr;
 };
 
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ	22
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE	23
+#endif
+
 #define DRM_ROCKCHIP_GEM_GET_PHYS	0x04
 #define DRM_IOCTL_ROCKCHIP_GEM_GET_PHYS		DRM_IOWR(DRM_COMMAND_BASE + \
 		DRM_ROCKCHIP_GEM_GET_PHYS, struct drm_rockchip_gem_phys)
@@ -159,6 +249,161 @@ public:
     }
 };
 
+/**
+ * 和 bo 首次被 lock 有关的统计, 通过 alloc_device_t::dump 输出.
+ * 所有时间的单位都是 ns.
+ */
+struct rk_drm_map_stats_t {
+    /* 首次被 lock 的 bo 的个数, 以及对应的 map 操作 (包括 prefault) 的耗时. */
+    uint64_t first_lock_count;
+    uint64_t first_lock_total_ns;
+    uint64_t first_lock_max_ns;
+
+    /*
+     * 首次 lock 到对应 unlock 之间, 调用线程上发生的 minor page fault 的个数.
+     * 只统计在同一线程中 lock 和 unlock 的情况.
+     */
+    uint64_t first_lock_window_samples;
+    uint64_t first_lock_window_faults;
+
+    /* 被 prefault 的 bo 的个数, 覆盖的 page 数, prefault 本身触发的 fault 数 和 耗时. */
+    uint64_t prefault_count;
+    uint64_t prefault_pages;
+    uint64_t prefault_faults;
+    uint64_t prefault_total_ns;
+};
+
+/**
+ * 新分配的 buffer 的清零方式.
+ * kernel 分配的 gem_obj 已经被清零, 默认只初始化 AFBC header;
+ * property "vendor.gralloc.zero_full" 为 true (kernel heap 不清零, 或安全要求) 时, 对所有 CPU 可访问的 buffer 完整清零.
+ */
+enum rk_zero_policy_t {
+    /* 不处理 : secure buffer, 或者数据总是被 producer (camera, video_decoder) 完整写入的 buffer. */
+    RK_ZERO_NONE = 0,
+    /* 只初始化 AFBC header. */
+    RK_ZERO_AFBC_HEADERS,
+    /* 完整清零, 对 AFBC buffer 之后再初始化 header. */
+    RK_ZERO_FULL,
+};
+
+/* 新 buffer 清零的统计, 时间的单位是 ns. */
+struct rk_zero_stats_t {
+    uint64_t skipped;
+    uint64_t header_inits;
+    uint64_t full_clears;
+    uint64_t full_bytes;
+    uint64_t full_total_ns;
+    uint64_t full_max_ns;
+};
+
+/*
+ * GRALLOC_DRM_LOCK_VIEW_AFBC_ENCODE_ON_UNLOCK 的编码的统计.
+ * 编码只使用纯色 superblock 和复制 subblock 压缩, 'payload_bytes' 与 'linear_bytes' 之比反映内容中平坦和重复的部分.
+ */
+struct rk_afbc_encode_stats_t {
+    uint64_t encodes;
+    uint64_t linear_bytes;
+    uint64_t payload_bytes;
+    uint64_t total_ns;
+};
+
+/*
+ * layout 开销 : buffer layout 的 byte 数与紧密排列 (无 stride 对齐, AFBC header 和对齐, plane 对齐等) 的 byte 数之差.
+ * 按 (base_format, AllocType) 分类累计.
+ */
+struct rk_layout_overhead_entry_t {
+    uint64_t base_format;
+    /* AllocType. */
+    int alloc_type;
+    uint64_t count;
+    uint64_t layout_bytes;
+    uint64_t packed_bytes;
+};
+
+struct rk_layout_overhead_t {
+    rk_layout_overhead_entry_t entries[RK_LAYOUT_OVERHEAD_MAX_ENTRIES];
+    uint32_t num_entries;
+    /* 分类已满, 或者无法计算紧密排列的 byte 数的 buffer 的个数, 及其 layout 的 byte 数. */
+    uint64_t unclassified_count;
+    uint64_t unclassified_bytes;
+};
+
+/**
+ * 供小 buffer sub-alloc 的 parent bo.
+ * chunk 中的空间只按 'used' 顺序分配, 不重用 :
+ * 已经 free 的 buffer 可能仍被其他进程 import 并访问, 重用其空间会使两个 buffer 重叠.
+ * chunk 不再用于分配 (retired) 且其中的 buffer 都被 free 之后, chunk 被回收,
+ * 底层的 dma_buf 在其他进程也 free 了对应的 buffer 之后才被释放.
+ */
+struct rk_suballoc_chunk_t {
+    /* parent bo, 及其 dma_buf 的 fd, sub-alloc 的 buffer 的 handle 中的 prime_fd 是该 fd 的 dup. */
+    struct rockchip_bo* bo;
+    int prime_fd;
+    /* chunk 的 ROCKCHIP_BO_* flags. */
+    uint32_t flags;
+    /* 已经分配的 byte 数. */
+    size_t used;
+    /* 从 chunk 中分配, 且尚未被 free 的 buffer 的个数. */
+    uint32_t live;
+};
+
+/* sub-alloc 的统计. */
+struct rk_suballoc_stats_t {
+    uint64_t chunks_created;
+    uint64_t chunks_reclaimed;
+    /* sub-alloc 的 buffer 的个数, 和当前 live 的个数. */
+    uint64_t buffers;
+    uint64_t live_buffers;
+};
+
+/* scanout arena 的统计, 区域的分配和碎片化见 rk_range_arena_stats_t. */
+struct rk_scanout_arena_stats_t {
+    /* 从 arena 中分配的 buffer 的个数. */
+    uint64_t served;
+    /* arena 没有预留, 没有足够大的空闲区域, 或者无法跟踪区域的释放, 改为单独分配的次数. */
+    uint64_t fallbacks;
+    /* 所有进程都关闭了 handle, 区域被放回 arena 的 buffer 的个数. */
+    uint64_t released;
+};
+
+/* lazy commit (推迟分配 backing memory) 的统计. */
+struct rk_lazy_stats_t {
+    /* alloc 时被推迟分配的 buffer 的个数, 其中之后被 commit 的个数, 以及 commit 失败的次数. */
+    uint64_t deferred;
+    uint64_t committed;
+    uint64_t commit_failures;
+    /* 'committed' 中由 import 的进程通过 placeholder 请求 commit 的个数. */
+    uint64_t committed_by_importers;
+    /* 直到所有进程都关闭了 handle 都没有 commit 的 buffer 的个数, 及其 (因此没有分配的) byte 数. */
+    uint64_t never_committed;
+    uint64_t never_committed_bytes;
+    /* 当前尚未 commit 的 buffer 的个数和 byte 数. */
+    uint64_t uncommitted;
+    uint64_t uncommitted_bytes;
+};
+
+/**
+ * 物理连续 (CMA) buffer 的分配策略的状态和统计, 通过 alloc_device_t::dump 输出.
+ * 所有时间的单位都是 ns.
+ */
+struct rk_cma_stats_t {
+    /* 实际尝试的物理连续分配的次数, 其中成功的次数, 以及耗时. */
+    uint64_t attempts;
+    uint64_t successes;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    /* 成功但超出 latency 预算的次数. */
+    uint64_t over_budget;
+    /* 因为对应的 size class 近期失败, 而未尝试物理连续分配的次数. */
+    uint64_t skipped;
+    /* 改为分配非物理连续 (IOMMU) buffer 的次数. */
+    uint64_t fallbacks;
+
+    /* 各 size class 最近一次失败的时间, 0 表示没有. */
+    uint64_t last_failure_ns[RK_CMA_SIZE_CLASSES];
+};
+
 /**
  * 基于 rk_drm 的, 对 driver_of_gralloc_drm_device_t 的具体实现,
  * 即 .DP : rk_driver_of_gralloc_drm_device_t.
@@ -201,6 +446,120 @@ struct rk_driver_of_gralloc_drm_device_t {
      * .DP : drm_lock
      */
     mutable Mutex m_drm_lock;
+
+    /*-------------------------------------------------------*/
+    // .DP : prefault :
+    // 对 usage 包含 SW_READ_OFTEN 或 SW_WRITE_OFTEN 的 buffer, 在首次 lock 时一次性建立 CPU 映射的页表,
+    // 避免 app 的 render/upload 线程在首次访问时逐页地 fault (4K RGBA buffer 约 8000 次).
+
+    /* 是否开启 prefault, 由 property "vendor.gralloc.prefault" 配置, 默认关闭. */
+    bool m_prefault_enabled;
+
+    /*-------------------------------------------------------*/
+    // .DP : dma_buf_mmap :
+    // 对 import 的 buffer, CPU 映射直接 mmap 其 prime_fd (dma_buf), 而不经过 gem_obj 的 mmap_offset.
+
+    /* 对所有 import 的 buffer 使用 dma_buf_mmap, 由 property "vendor.gralloc.dmabuf_mmap" 配置. */
+    bool m_map_imported_via_dma_buf;
+
+    /*
+     * 当前进程只需要 CPU 访问 import 的 buffer (软件编码器, 缩略图, 截屏工具等),
+     * import 时不调用 drmPrimeFDToHandle(), 也不创建 rockchip_bo.
+     * 通过 GRALLOC_MODULE_PERFORM_SET_CPU_ONLY_IMPORT 设置.
+     */
+    volatile int32_t m_cpu_only_import;
+
+    /* 当前进程持有的 buffer 内存的统计. */
+    rk_mem_ledger_t m_mem_ledger;
+
+    rk_drm_map_stats_t m_map_stats;
+
+    /* 物理连续 buffer 的分配耗时的预算, 和失败之后的 backoff 时长, 单位 ns. */
+    uint64_t m_cma_latency_budget_ns;
+    uint64_t m_cma_backoff_ns;
+    rk_cma_stats_t m_cma_stats;
+
+    /*
+     * 是否对小 buffer 做 sub-alloc. 同一 chunk 中的 buffer 共享 dma_buf, 只能属于同一个 client,
+     * 因此只在当前进程通过 GRALLOC_MODULE_PERFORM_SET_PROCESS_LOCAL_SUBALLOC 声明 buffer 不交给其他 client 时开启.
+     */
+    volatile int32_t m_suballoc_enabled;
+    /* 当前用于分配的 chunk, 按是否 ROCKCHIP_BO_CACHABLE 索引, 没有时为 NULL. */
+    rk_suballoc_chunk_t* m_suballoc_chunks[2];
+    rk_suballoc_stats_t m_suballoc_stats;
+    /* 保护 'm_suballoc_chunks', 各 chunk 和 'm_suballoc_stats'. */
+    Mutex m_suballoc_lock;
+
+    /*
+     * alloc 时是否推迟分配 backing memory, 直到 buffer 被使用.
+     * 初值来自 property "vendor.gralloc.lazy_commit", 可以通过 GRALLOC_MODULE_PERFORM_SET_LAZY_COMMIT 改变.
+     */
+    volatile int32_t m_lazy_commit_enabled;
+    rk_lazy_stats_t m_lazy_stats;
+    /* 串行化 commit, 并保护 'm_lazy_stats', 'm_commit_server' 和各 rk_commit_entry_t. */
+    Mutex m_lazy_lock;
+    /* 为当前进程推迟分配的 buffer 的 placeholder 服务, 在第一次推迟分配时创建. */
+    rk_commit_server_t* m_commit_server;
+
+    /*
+     * scanout arena : 预留的一个物理连续的大 bo, framebuffer 和 overlay buffer 从中分配,
+     * 避免长时间运行之后 CMA 碎片化使大 buffer 的物理连续分配变慢或失败.
+     * 'm_arena_size' 来自 property "vendor.gralloc.scanout_arena_mb", 0 表示关闭.
+     * arena 在当前进程打开 alloc device 时预留, 只有 allocator 进程持有; 'm_arena_bo' 在预留之前是 NULL.
+     *
+     * arena 中 buffer 的 handle 引用整个 arena 的 dma_buf, 'offset' 是 buffer 在其中的位置.
+     * 这些 buffer 的 attr region 是 memfd, 并在 'm_arena_inotify_fd' 上被 watch (IN_DELETE_SELF) :
+     * 只有在所有进程都关闭了 handle (memfd 的最后一个引用被释放) 之后, buffer 的区域才被放回 arena.
+     * 'm_arena_watches' 是 watch descriptor 到区域 offset 的映射.
+     */
+    size_t m_arena_size;
+    struct rockchip_bo* m_arena_bo;
+    int m_arena_prime_fd;
+    uint32_t m_arena_phy_addr;
+    int m_arena_inotify_fd;
+    KeyedVector<int, size_t> m_arena_watches;
+    rk_range_arena_t m_arena;
+    rk_scanout_arena_stats_t m_arena_stats;
+    /* 保护上述 arena 的成员. */
+    Mutex m_arena_lock;
+
+    /* 各缓存被 trim 释放的累计 byte 数, 以及 trim 的次数. */
+    uint64_t m_trimmed_bytes[GRALLOC_DRM_TRIM_CACHE_COUNT];
+    uint64_t m_trim_count;
+
+    /*
+     * PSI 内存压力监视线程, 在收到通知时 trim 'm_psi_trim_target' byte.
+     * 'm_psi_fd' 为 -1 表示线程没有运行; 向 'm_psi_wake_fds[1]' 写入使线程退出.
+     */
+    int m_psi_fd;
+    int m_psi_wake_fds[2];
+    pthread_t m_psi_thread;
+    uint64_t m_psi_trim_target;
+
+    /* 是否对所有 CPU 可访问的新 buffer 完整清零, 见 rk_zero_policy_t. */
+    bool m_zero_full;
+    rk_zero_stats_t m_zero_stats;
+    /* 完整清零使用的常驻线程池, 在 driver 初始化时创建. 为 NULL 时在 alloc 的线程中清零. */
+    rk_clear_pool_t* m_clear_pool;
+
+    rk_afbc_encode_stats_t m_afbc_encode_stats;
+
+    /* 当前进程 alloc 的 buffer 的 layout 开销的累计. */
+    rk_layout_overhead_t m_layout_overhead;
+
+    /* 保护 'm_map_stats', 'm_cma_stats', 'm_zero_stats', 'm_afbc_encode_stats', 'm_layout_overhead' 和 trim 的统计. */
+    mutable Mutex m_stats_lock;
+
+    /*-------------------------------------------------------*/
+    // .DP : format_caps :
+    // GPU 和 VOP 支持的 AFBC 等特性, 在当前进程第一次 alloc buffer 时 探测一次, 之后 format 选择 只对其做 bitmask 判断.
+    // 只 import buffer 的进程 (app, SurfaceFlinger 等) 不探测, 不会 dlopen libGLES_mali.so.
+    // 见 rk_get_format_caps().
+
+    mali_gralloc_runtime_caps m_format_caps;
+    bool m_format_caps_discovered;
+    /* 保护 'm_format_caps' 和 'm_format_caps_discovered'. */
+    Mutex m_format_caps_lock;
 };
 
 /**
@@ -214,15 +573,98 @@ struct rk_driver_of_gralloc_drm_device_t {
  */
 static struct rk_driver_of_gralloc_drm_device_t* s_rk_drv = NULL;
 
+/**
+ * 推迟分配的 buffer 的 commit 状态, 是其 placeholder 在 'm_commit_server' 中的 cookie.
+ * 生命期与 placeholder 相同 : 所有进程都关闭了 handle 之后才被释放, 因此 alloc 的进程 free 之后, import 的进程仍然可以请求 commit.
+ * 成员由 rk_driver_of_gralloc_drm_device_t::m_lazy_lock 保护.
+ */
+typedef struct rk_commit_entry
+{
+    struct rk_driver_of_gralloc_drm_device_t* rk_drv;
+    /*
+     * alloc 结束时 handle 的副本, commit 使用其中的 layout 和 usage.
+     * 'handle.prime_fd' 在 commit 之前是 -1, 之后是 backing 的 dma_buf, 由本 entry 持有.
+     */
+    struct gralloc_drm_handle_t handle;
+    /* commit 时分配的 ROCKCHIP_BO_* flags. */
+    uint32_t flags;
+    /* 待分配的 byte 数, 0 表示 alloc 尚未完成 (或已失败), 不能 commit. */
+    size_t capacity;
+} rk_commit_entry_t;
+
 /* rockchip_gralloc_drm_buffer_object. */
 struct rockchip_buffer {
     /* 基类子对象. */
 	struct gralloc_drm_bo_t base;
 
-    /* rk_drm_bo. */
+    /* rk_drm_bo. 对 cpu_only_import 的 buffer 是 NULL. */
 	struct rockchip_bo *bo;
+
+    /* alloc 或 import 时使用的 ROCKCHIP_BO_* flags. */
+	uint32_t flags;
+
+    /* 通过 dma_buf_mmap 得到的 CPU 映射, 未映射时为 NULL. */
+	void *dma_buf_vaddr;
+	size_t dma_buf_map_size;
+
+    /* 非 0 表示当前 bo 已经被 lock 过. 由首次 lock 成功的线程通过 CAS 设置, 只有该线程执行 rk_drm_on_first_lock(). */
+	volatile int32_t locked_once;
+    /* 当前 bo 的 CPU 映射是否已经被 prefault. */
+	bool prefaulted;
+    /*
+     * 首次 lock 的线程的 tid 和 当时该线程的 minor page fault 计数,
+     * 用于在 unmap 时统计首次 lock 期间的 fault 数. 'first_lock_tid' 为 0 表示不需要统计.
+     * 'first_lock_minflt' 在 'first_lock_tid' 被 release_store 之前写入, 由 CAS 清除 'first_lock_tid' 的线程读取.
+     */
+	volatile int32_t first_lock_tid;
+	long first_lock_minflt;
+
+    /* base.lock_view 不是 NATIVE 时, CPU 访问的副本, 在首次 map 时分配. */
+	void *view_shadow;
+	size_t view_shadow_size;
+    /* 最外层 map 得到的 buffer 自身的 CPU 映射, 用于在 unmap 时写回副本. */
+	void *view_native_addr;
+
+    /* resolve_format 返回的各 plane 的 pitch, offset 和 gem_handle, 在 alloc 或 import 时计算. */
+	uint32_t resolved_pitches[GRALLOC_DRM_RESOLVE_MAX_PLANES];
+	uint32_t resolved_offsets[GRALLOC_DRM_RESOLVE_MAX_PLANES];
+	uint32_t resolved_handles[GRALLOC_DRM_RESOLVE_MAX_PLANES];
+
+    /* 当前 buffer 在 rk_driver_of_gralloc_drm_device_t::m_mem_ledger 中的记录. */
+	rk_mem_ledger_entry_t ledger_entry;
+
+    /* 在当前进程中 sub-alloc 的 buffer 所在的 chunk, 否则为 NULL. */
+	rk_suballoc_chunk_t* suballoc_chunk;
+
+    /*
+     * 非 0 表示 alloc 时推迟了 backing memory 的分配, 且当前进程尚未 commit :
+     * 'bo' 是 NULL, handle 的 prime_fd 是 placeholder (见 gralloc_drm_rockchip_commit.h), 'commit_entry' 是其 commit 状态.
+     */
+	volatile int32_t backing_deferred;
+	rk_commit_entry_t* commit_entry;
+
+    /* buffer 可以容纳的 byte 数, 即 alloc 或 import 时的 size, reshape 之后的 size 不能超过该值. */
+	size_t capacity;
+
+    /*
+     * > 0 : 正在进行的 CPU 访问 (map 到 unmap 之间, set_lock_view, reshape) 的个数;
+     * -1 : 正在被 trim, 上述操作需要等待.
+     */
+	volatile int32_t cpu_access_refs;
+    /* map 中持有的 'cpu_access_refs' 的个数. unlock 的次数可能多于 map 的次数, 不能直接在 unmap 中释放. */
+	int map_refs;
 };
 
+/*
+ * 'buf' 在当前进程中是否有 gem_obj, 即 'buf->bo' 是否有效.
+ * cpu_only_import 的 buffer, 以及推迟了 backing memory 分配且尚未 commit 的 buffer 没有 gem_obj.
+ * 需要 gem_obj 的 driver 入口在开始处检查, 没有时返回错误 (比如 -ENODEV), 或者改用 dma_buf (比如 CPU 映射).
+ */
+static inline bool rk_has_gem_obj(const struct rockchip_buffer* buf)
+{
+    return buf->bo != NULL;
+}
+
 /*---------------------------------------------------------------------------*/
 // for rk_drm_adapter :
 //
@@ -364,6 +806,9 @@ static void rk_drm_adapter_close_gem_obj(struct rk_driver_of_gralloc_drm_device_
 // Default YUV stride aligment in Android
 #define YUV_ANDROID_PLANE_ALIGN 16
 
+/* rk 的 VPU 和 RGA 要求 YUV buffer 的 byte_stride 对齐到 16. */
+#define RK_VPU_RGA_STRIDE_ALIGN 16
+
 /*
  * Type of allocation
  */
@@ -382,6 +827,23 @@ typedef enum AllocType
 	AFBC_TILED_HEADERS_WIDEBLK,
 }   AllocType;
 
+/*
+ * rk_compute_buffer_layout() 计算得到的 buffer layout.
+ */
+typedef struct rk_buffer_layout
+{
+    uint64_t internal_format;
+    AllocType alloc_type;
+    int pixel_stride;
+    int byte_stride;
+    size_t size;
+    int internal_width;
+    int internal_height;
+    /* metadata 区的 byte 数和 offset, 只用于 video_decoder 的 buffer (NV12, NV12_10). */
+    size_t vdec_metadata_size;
+    size_t vdec_metadata_offset;
+} rk_buffer_layout_t;
+
 /*
  * Computes the strides and size for an RGB buffer
  *
@@ -918,6 +1380,54 @@ static bool get_yuv_y410_stride_and_size(int width, int height, int *pixel_strid
 	return true;
 }
 
+/*
+ *  Calculate strides and size for Y8 / Y16 (luma only) format buffer.
+ *
+ * @param width             [in]    Buffer width.
+ * @param height            [in]    Buffer height.
+ * @param bytes_per_sample  [in]    1 for Y8, 2 for Y16.
+ * @param plane_align       [in]    Byte stride alignment, see get_yuv_plane_align().
+ *                                  Android requires the stride of Y8 / Y16 to be a multiple of 16 pixels,
+ *                                  which is always kept.
+ * @param pixel_stride      [out]   Pixel stride; number of pixels between
+ *                                  consecutive rows.
+ * @param byte_stride       [out]   Byte stride; number of bytes between
+ *                                  consecutive rows.
+ * @param size              [out]   Size of the buffer in bytes.
+ *
+ * @return true if the calculation was successful; false otherwise (invalid
+ * parameter)
+ */
+static bool get_yuv_y8_y16_stride_and_size(int width, int height, int bytes_per_sample, int plane_align,
+                                           int *pixel_stride, int *byte_stride, size_t *size)
+{
+	int y_byte_stride;
+
+	if (width <= 0 || height <= 0 || bytes_per_sample <= 0)
+	{
+		return false;
+	}
+
+	y_byte_stride = GRALLOC_ALIGN(GRALLOC_ALIGN(width, YUV_ANDROID_PLANE_ALIGN) * bytes_per_sample, plane_align);
+
+	if (size != NULL)
+	{
+		*size = (size_t)y_byte_stride * height;
+	}
+
+	if (byte_stride != NULL)
+	{
+		*byte_stride = y_byte_stride;
+	}
+
+	if (pixel_stride != NULL)
+	{
+		*pixel_stride = y_byte_stride / bytes_per_sample;
+	}
+
+	return true;
+}
+
 /*
  *  Calculate strides and strides for YUV420_10BIT_AFBC (Compressed, 4:2:0) format buffer.
  *
@@ -1175,18 +1685,72 @@ static bool get_camera_formats_stride_and_size(int w, int h, uint64_t format, in
 }
 
 
-static bool get_rk_nv12_stride_and_size(int width, int height, int* pixel_stride, int* byte_stride, size_t* size)
+/*
+ * 计算 rk 的 NV12 (8 bit) 或 NV12_10 (10 bit packed) video_decoder buffer 的 stride 和 size.
+ * video_decoder 要求的 byte_stride 已经通过 'width' 传入.
+ * buffer 由 YUV 数据 (luma_stride * height 的 Y plane 和 一半高度的 UV plane)
+ * 和其后的 'metadata_size' byte 的 metadata 区组成, metadata 区的起始 offset 按 RK_VDEC_METADATA_ALIGN 对齐.
+ *
+ * metadata_offset : 返回 metadata 区的 offset. 'metadata_size' 为 0 时, 是 YUV 数据的 byte 数.
+ */
+static bool get_rk_nv12_stride_and_size(int width, int height, size_t metadata_size,
+                                        int* pixel_stride, int* byte_stride, size_t* size, size_t* metadata_offset)
 {
     /**
      * .KP : from CSY : video_decoder 要求的 byte_stride of buffer in NV12, 已经通过 width 传入.
      * 对 NV12, byte_stride 就是 pixel_stride, 也就是 luma_stride.
+     * 对 NV12_10, 原理上, byte_stride 和 pixel_stride 不同,
+     * 但是目前对于 NV12_10, rk_hwc, 将 private_module_t::stride 作为 byte_stride 使用.
      */
     int luma_stride = width;
+    size_t yuv_size;
+
+    if ( width <= 0 || height <= 0 )
+    {
+        return false;
+    }
+
+    yuv_size = (size_t)luma_stride * height + (size_t)luma_stride * (GRALLOC_ALIGN(height, 2) / 2);
+
+    *metadata_offset = (0 == metadata_size) ? yuv_size : GRALLOC_ALIGN(yuv_size, RK_VDEC_METADATA_ALIGN);
+    *size = *metadata_offset + metadata_size;
+    *byte_stride = luma_stride;
+    *pixel_stride = luma_stride;
+
+    return true;
+}
+
+static bool get_rk_nv12_10bit_stride_and_size(int width, int height, size_t metadata_size,
+                                              int* pixel_stride, int* byte_stride, size_t* size, size_t* metadata_offset)
+{
+    if (width % 2 != 0 || height % 2 != 0)
+    {
+        return false;
+    }
+
+    return get_rk_nv12_stride_and_size(width, height, metadata_size, pixel_stride, byte_stride, size, metadata_offset);
+}
+
+/*
+ * 计算 8 bit semi-planar YUV (NV16, NV24) buffer 的 stride 和 size.
+ * 'width' 是像素宽度, luma 的 byte_stride 按 'plane_align' 和 RK_VPU_RGA_STRIDE_ALIGN 对齐,
+ * chroma plane 的 stride 是 luma stride 的 'chroma_stride_halves' / 2 倍, 行数与 luma 相同.
+ */
+static bool get_rk_yuv_sp_stride_and_size(int width, int height, int chroma_stride_halves, int plane_align,
+                                          int* pixel_stride, int* byte_stride, size_t* size)
+{
+    int luma_stride;
+
+    if ( width <= 0 || height <= 0 )
+    {
+        return false;
+    }
+
+    luma_stride = GRALLOC_ALIGN(GRALLOC_ALIGN(width, RK_VPU_RGA_STRIDE_ALIGN), plane_align);
 
     if (size != NULL)
     {
-        /* .KP : from CSY : video_decoder 需要的 buffer 中除了 YUV 数据还有其他 metadata, 要更多的空间. 2 * w * h 一定够. */
-        *size = 2 * luma_stride * height;
+        *size = (size_t)luma_stride * height * (2 + chroma_stride_halves) / 2;
     }
 
     if (byte_stride != NULL)
@@ -1202,30 +1766,194 @@ static bool get_rk_nv12_stride_and_size(int width, int height, int* pixel_stride
     return true;
 }
 
-static bool get_rk_nv12_10bit_stride_and_size (int width, int height, int* pixel_stride, int* byte_stride, size_t* size)
+/*
+ * 计算 rk 的 10 bit packed 4:2:2 semi-planar (NV16_10) buffer 的 stride 和 size.
+ * 与 NV12_10 相同, video_decoder 要求的 byte_stride 通过 width 传入.
+ */
+static bool get_rk_nv16_10bit_stride_and_size(int width, int height, int* pixel_stride, int* byte_stride, size_t* size)
 {
-
-    if (width % 2 != 0 || height % 2 != 0)
+    if ( width <= 0 || height <= 0 || width % RK_VPU_RGA_STRIDE_ALIGN != 0 )
     {
+        ALOGE("invalid byte_stride of NV16_10 : %d.", width);
         return false;
     }
 
-    /**
-     * .KP : from CSY : video_decoder 要求的 byte_stride of buffer in NV12_10, 已经通过 width 传入.
-     * 对 NV12_10, 原理上, byte_stride 和 pixel_stride 不同.
-     */
     *byte_stride = width;
-
-    /* .KP : from CSY : video_decoder 需要的 buffer 中除了 YUV 数据还有其他 metadata, 要更多的空间. 2 * w * h 一定够. */
-    *size = 2 * width * height;
-
+    /* Y plane 和 UV plane 的行数相同. */
+    *size = (size_t)2 * width * height;
+    /* 与 NV12_10 相同, rk_hwc 将 pixel_stride 作为 byte_stride 使用. */
     *pixel_stride = *byte_stride;
-    // 字面上, 这是错误的,
-    // 但是目前对于 NV12_10, rk_hwc, 将 private_module_t::stride 作为 byte_stride 使用.
 
     return true;
 }
 
+/*
+ * 返回 YUV 格式的 plane 使用的 stride 对齐值.
+ * Mali subsystem prefers higher stride alignment values (128 bytes) for YUV, but software components assume
+ * default of 16.
+ */
+static int get_yuv_plane_align(int usage)
+{
+    if (usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK))
+    {
+        return YUV_ANDROID_PLANE_ALIGN;
+    }
+
+    return YUV_MALI_PLANE_ALIGN;
+}
+
+/*-------------------------------------------------------*/
+// .DP : yuv_plane_layout : 未压缩 YUV 格式在 buffer 中的 plane layout.
+
+/*
+ * 描述一种未压缩 YUV 格式的 plane layout.
+ * plane 0 从 buffer 起始处开始, 之后的 plane 紧接前一个 plane 存放.
+ */
+typedef struct
+{
+    uint64_t base_format;
+    int num_planes;
+    /* chroma plane 相对 luma plane 的垂直下采样因子. */
+    int vss;
+    /*
+     * chroma plane 的 stride, 单位是 luma stride 的一半 :
+     * 1 : luma stride 的一半 (再按 plane_align 对齐); 2 : 与 luma stride 相同; 4 : luma stride 的 2 倍 (4:4:4 semi-planar).
+     */
+    int chroma_stride_halves;
+    /* plane 0 中一个 stride 覆盖的像素行数. */
+    int rows_per_stride;
+    /* 第一个 cb, cr sample 所在的 plane, 以及在该 plane 中的 byte offset. */
+    int cb_plane;
+    int cb_offset;
+    int cr_plane;
+    int cr_offset;
+    /* 参见 gralloc_drm_ycbcr_info_t::chroma_step, 0 表示格式不能用 android_ycbcr 描述. */
+    int chroma_step;
+} rk_yuv_plane_layout_t;
+
+static const rk_yuv_plane_layout_t s_yuv_plane_layouts[] =
+{
+    /* base_format                              planes vss cs  rows  cb      cr      step */
+    { MALI_GRALLOC_FORMAT_INTERNAL_NV12,        2,     2,  2,  1,    1, 0,   1, 1,   2 },
+    { HAL_PIXEL_FORMAT_YCrCb_NV12,              2,     2,  2,  1,    1, 0,   1, 1,   2 },
+    /* flexible 格式在 alloc 时被映射为 NV12, 这里覆盖 internal_format 仍是 YCbCr_420_888 的 handle. */
+    { MALI_GRALLOC_FORMAT_INTERNAL_YUV420_888,  2,     2,  2,  1,    1, 0,   1, 1,   2 },
+    { MALI_GRALLOC_FORMAT_INTERNAL_NV21,        2,     2,  2,  1,    1, 1,   1, 0,   2 },
+    { HAL_PIXEL_FORMAT_YCrCb_420_SP,            2,     2,  2,  1,    1, 1,   1, 0,   2 },
+    /* Y plane, V plane, U plane */
+    { MALI_GRALLOC_FORMAT_INTERNAL_YV12,        3,     2,  1,  1,    2, 0,   1, 0,   1 },
+    /* YUYV */
+    { HAL_PIXEL_FORMAT_YCbCr_422_I,             1,     1,  2,  1,    0, 1,   0, 3,   4 },
+    /* 16 bit Y plane, 16 bit UV plane */
+    { MALI_GRALLOC_FORMAT_INTERNAL_P010,        2,     2,  2,  1,    1, 0,   1, 2,   4 },
+    { MALI_GRALLOC_FORMAT_INTERNAL_P210,        2,     1,  2,  1,    1, 0,   1, 2,   4 },
+    /* 16 bit YUYV */
+    { MALI_GRALLOC_FORMAT_INTERNAL_Y210,        1,     1,  2,  1,    0, 2,   0, 6,   8 },
+    /* AVYU 2-10-10-10 */
+    { MALI_GRALLOC_FORMAT_INTERNAL_Y410,        1,     1,  2,  1,    0, 0,   0, 0,   0 },
+    /* YUYAAYVYAA, 一个 stride 覆盖 2 行. */
+    { MALI_GRALLOC_FORMAT_INTERNAL_Y0L2,        1,     2,  2,  2,    0, 0,   0, 0,   0 },
+    /* NV16, NV24 */
+    { HAL_PIXEL_FORMAT_YCbCr_422_SP,            2,     1,  2,  1,    1, 0,   1, 1,   2 },
+    { HAL_PIXEL_FORMAT_YCbCr_444_888,           2,     1,  4,  1,    1, 0,   1, 1,   2 },
+    /* rk 的 10 bit packed Y plane, UV plane. YCrCb_420_SP_10 是 NV12_10 的别名. */
+    { HAL_PIXEL_FORMAT_YCrCb_NV12_10,           2,     2,  2,  1,    1, 0,   1, 0,   0 },
+    { HAL_PIXEL_FORMAT_YCrCb_420_SP_10,         2,     2,  2,  1,    1, 0,   1, 0,   0 },
+    { HAL_PIXEL_FORMAT_YCbCr_422_SP_10,         2,     1,  2,  1,    1, 0,   1, 0,   0 },
+    /* 只有 Y plane, 没有 chroma. */
+    { MALI_GRALLOC_FORMAT_INTERNAL_Y8,          1,     1,  2,  1,   -1, 0,  -1, 0,   0 },
+    { MALI_GRALLOC_FORMAT_INTERNAL_Y16,         1,     1,  2,  1,   -1, 0,  -1, 0,   0 },
+};
+
+static const rk_yuv_plane_layout_t* get_yuv_plane_layout(uint64_t base_format)
+{
+    size_t i;
+
+    for ( i = 0; i < sizeof(s_yuv_plane_layouts) / sizeof(s_yuv_plane_layouts[0]); i++ )
+    {
+        if ( s_yuv_plane_layouts[i].base_format == base_format )
+        {
+            return &s_yuv_plane_layouts[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * 根据 s_yuv_plane_layouts, 计算未压缩 YUV buffer 中各 plane 的 offset, stride 和 chroma 描述.
+ * 对其他格式, '*num_planes' 被置为 0.
+ *
+ * byte_stride : plane 0 的 byte_stride.
+ * height : buffer 的高度, 单位是像素行.
+ * plane_align : chroma plane 的 stride 对齐值.
+ * plane_info : 长度为 GRALLOC_DRM_MAX_PLANES 的数组.
+ */
+static void fill_yuv_plane_layout(uint64_t base_format,
+                                  AllocType alloc_type,
+                                  int byte_stride,
+                                  int height,
+                                  int plane_align,
+                                  uint32_t* num_planes,
+                                  struct gralloc_drm_plane_info_t* plane_info,
+                                  struct gralloc_drm_ycbcr_info_t* ycbcr_info)
+{
+    const rk_yuv_plane_layout_t* layout = get_yuv_plane_layout(base_format);
+    uint32_t offset = 0;
+    int i;
+
+    memset(plane_info, 0, sizeof(*plane_info) * GRALLOC_DRM_MAX_PLANES);
+    memset(ycbcr_info, 0, sizeof(*ycbcr_info) );
+    *num_planes = 0;
+
+    if ( NULL == layout || alloc_type != UNCOMPRESSED )
+    {
+        return;
+    }
+
+    /* 4:2:0 格式的 clump 是 2x2 像素, 高度要对齐到 2. */
+    if ( 2 == layout->vss )
+    {
+        height = GRALLOC_ALIGN(height, 2);
+    }
+
+    for ( i = 0; i < layout->num_planes; i++ )
+    {
+        int stride = byte_stride;
+        int rows = height / layout->rows_per_stride;
+
+        if ( i > 0 )
+        {
+            if ( 1 == layout->chroma_stride_halves )
+            {
+                stride = GRALLOC_ALIGN(byte_stride / 2, plane_align);
+            }
+            else
+            {
+                stride = byte_stride * layout->chroma_stride_halves / 2;
+            }
+            rows = height / layout->vss;
+        }
+
+        plane_info[i].offset = offset;
+        plane_info[i].byte_stride = stride;
+
+        offset += stride * rows;
+    }
+    *num_planes = layout->num_planes;
+
+    /* 没有 chroma 的格式, ycbcr_info 保持全 0. */
+    if ( layout->cb_plane < 0 )
+    {
+        return;
+    }
+
+    ycbcr_info->cb_offset = plane_info[layout->cb_plane].offset + layout->cb_offset;
+    ycbcr_info->cr_offset = plane_info[layout->cr_plane].offset + layout->cr_offset;
+    ycbcr_info->c_stride = plane_info[layout->cb_plane].byte_stride;
+    ycbcr_info->chroma_step = layout->chroma_step;
+}
+
 static void init_afbc(uint8_t *buf, uint64_t internal_format, int w, int h)
 {
 	uint32_t n_headers = (w * h) / 64;
@@ -1268,15 +1996,52 @@ static void init_afbc(uint8_t *buf, uint64_t internal_format, int w, int h)
 	}
 }
 
-#endif
-
-#if RK_CTS_WORKROUND
-static bool ConvertCharToData(const char *pszHintName, const char *pszData, void *pReturn, IMG_DATA_TYPE eDataType)
+/*
+ * 在 'handle' 的 attribute region 中记录 AFBC buffer 的编码方式, 供 GPU 和 hwc 解码时使用 :
+ *      use_yuv_transform : RGB 格式由 GPU 写入, 使用 YTR (YUV transform); YUV 格式不使用;
+ *      use_sparse_alloc : 视频解码器 (通过 GRALLOC_USAGE_TO_USE_FBDC_FMT 请求) 按 superblock 的固定位置写入 body.
+ */
+static void init_afbc_attrs(struct gralloc_drm_handle_t *handle, uint64_t internal_format, uint64_t usage)
 {
-	bool bFound = false;
-
+	uint64_t base_format = internal_format & MALI_GRALLOC_INTFMT_FMT_MASK;
+	int use_yuv_transform;
+	int use_sparse_alloc;
 
-	switch(eDataType)
+	switch (base_format)
+	{
+	case MALI_GRALLOC_FORMAT_INTERNAL_YV12:
+	case MALI_GRALLOC_FORMAT_INTERNAL_Y0L2:
+	case MALI_GRALLOC_FORMAT_INTERNAL_Y210:
+	case MALI_GRALLOC_FORMAT_INTERNAL_YUV422_8BIT:
+		use_yuv_transform = 0;
+		break;
+
+	default:
+		use_yuv_transform = 1;
+	}
+	use_sparse_alloc = USAGE_CONTAIN_VALUE(GRALLOC_USAGE_TO_USE_FBDC_FMT, GRALLOC_USAGE_ROT_MASK) ? 1 : 0;
+
+	if ( gralloc_buffer_attr_map(handle, 1) != 0 )
+	{
+		ALOGE("failed to map attr region to init afbc attrs.");
+		return;
+	}
+
+	gralloc_buffer_attr_write(handle, GRALLOC_ARM_BUFFER_ATTR_AFBC_YUV_TRANS, &use_yuv_transform);
+	gralloc_buffer_attr_write(handle, GRALLOC_ARM_BUFFER_ATTR_AFBC_SPARSE_ALLOC, &use_sparse_alloc);
+
+	gralloc_buffer_attr_unmap(handle);
+}
+
+#endif
+
+#if RK_CTS_WORKROUND
+static bool ConvertCharToData(const char *pszHintName, const char *pszData, void *pReturn, IMG_DATA_TYPE eDataType)
+{
+	bool bFound = false;
+
+
+	switch(eDataType)
 	{
 		case IMG_STRING_TYPE:
 		{
@@ -1351,57 +2116,52 @@ static int getProcessCmdLine(char* outBuf, size_t bufSize)
 	if ( NULL == file )
 	{
 		ALOGE("fail to open file (%s)",strerror(errno));
+		return -errno;
 	}
 
 	if ( NULL == fgets(outBuf, bufSize - 1, file) )
 	{
 		ALOGE("fail to read from cmdline_file.");
+		ret = -EINVAL;
 	}
 
-	if ( NULL != file )
-	{
-		fclose(file);
-	}
+	fclose(file);
 
 	return ret;
 }
 
-bool FindAppHintInFile(const char *pszFileName, const char *pszAppName,
-								  const char *pszHintName, void *pReturn,
-								  IMG_DATA_TYPE eDataType)
+/*
+ * 将 'pszFileName' 指定的 app_hint_file 中所有的 hint 解析到 '*pTable' 中.
+ * 若文件不存在, 则创建包含默认 hint 的文件, 并返回 false.
+ */
+static bool LoadAppHintFile(const char *pszFileName, app_hint_table_t *pTable)
 {
 	FILE *regFile;
-	bool bFound = false;
+
+	pTable->count = 0;
 
 	regFile = fopen(pszFileName, "r");
 
 	if(regFile)
 	{
-		char pszTemp[1024], pszApplicationSectionName[1024];
-		int iLineNumber;
-		bool bUseThisSection, bInAppSpecificSection;
-
-		/* Build the section name */
-		snprintf(pszApplicationSectionName, 1024, "[%s]", pszAppName);
-
-		bUseThisSection 		= false;
-		bInAppSpecificSection	= false;
-
-		iLineNumber = -1;
+		char pszTemp[1024];
+		char pszSection[APP_HINT_MAX_LEN] = {0};
+		int iLineNumber = -1;
 
 		while(fgets(pszTemp, 1024, regFile))
 		{
 			size_t uiStrLen;
+			char *pszEq;
+			app_hint_entry_t *pEntry;
 
 			iLineNumber++;
-			ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "FindAppHintInFile iLineNumber=%d pszTemp=%s",iLineNumber,pszTemp);
+			ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "LoadAppHintFile iLineNumber=%d pszTemp=%s",iLineNumber,pszTemp);
 
 			uiStrLen = strlen(pszTemp);
 
 			if (pszTemp[uiStrLen-1]!='\n')
 			{
-			    ALOGE("FindAppHintInFile : Error in %s at line %u",pszFileName,iLineNumber);
-
+				ALOGE("LoadAppHintFile : Error in %s at line %u",pszFileName,iLineNumber);
 				continue;
 			}
 
@@ -1416,73 +2176,42 @@ bool FindAppHintInFile(const char *pszFileName, const char *pszAppName,
 				pszTemp[uiStrLen-1] = '\0';
 			}
 
-			switch (pszTemp[0])
+			if (pszTemp[0] == '[')
 			{
-				case '[':
-				{
-					/* Section */
-					bUseThisSection 		= false;
-					bInAppSpecificSection	= false;
-
-					if (!strcmp("[default]", pszTemp))
-					{
-						bUseThisSection = true;
-					}
-					else if (!strcmp(pszApplicationSectionName, pszTemp))
-					{
-						bUseThisSection 		= true;
-						bInAppSpecificSection 	= true;
-					}
+				/* Section */
+				char *pszEnd = strchr(pszTemp, ']');
 
-					break;
-				}
-				default:
+				if (pszEnd)
 				{
-					char *pszPos;
-
-					if (!bUseThisSection)
-					{
-						/* This line isn't for us */
-						continue;
-					}
-
-					pszPos = strstr(pszTemp, pszHintName);
-
-					if (pszPos!=pszTemp)
-					{
-						/* Hint name isn't at start of string */
-						continue;
-					}
-
-					if (*(pszPos + strlen(pszHintName)) != '=')
-					{
-						/* Hint name isn't exactly correct, or isn't followed by an equals sign */
-						continue;
-					}
-
-					/* Move to after the equals sign */
-					pszPos += strlen(pszHintName) + 1;
-
-					/* Convert anything after the equals sign to the requested data type */
-					bFound = ConvertCharToData(pszHintName, pszPos, pReturn, eDataType);
-
-					if (bFound && bInAppSpecificSection)
-					{
-						/*
-						// If we've found the hint in the application specific section we may
-						// as well drop out now, since this should override any default setting
-						*/
-						fclose(regFile);
+					*pszEnd = '\0';
+				}
+				snprintf(pszSection, sizeof(pszSection), "%s", pszTemp + 1);
+				continue;
+			}
 
-						return true;
-					}
+			pszEq = strchr(pszTemp, '=');
+			if (!pszEq || pszEq == pszTemp || pszSection[0] == '\0')
+			{
+				/* Not a "name=value" line inside a section */
+				continue;
+			}
 
-					break;
-				}
+			if (pTable->count >= APP_HINT_MAX_ENTRIES)
+			{
+				ALOGE("LoadAppHintFile : too many hints in %s, ignore line %u",pszFileName,iLineNumber);
+				break;
 			}
+
+			*pszEq = '\0';
+			pEntry = &pTable->entries[pTable->count++];
+			snprintf(pEntry->section, sizeof(pEntry->section), "%s", pszSection);
+			snprintf(pEntry->name, sizeof(pEntry->name), "%s", pszTemp);
+			snprintf(pEntry->value, sizeof(pEntry->value), "%s", pszEq + 1);
 		}
 
 		fclose(regFile);
+
+		return true;
 	}
 	else
 	{
@@ -1502,6 +2231,45 @@ bool FindAppHintInFile(const char *pszFileName, const char *pszAppName,
 		}
 	}
 
+	return false;
+}
+
+/*
+ * 在已解析的 '*pTable' 中查找 hint.
+ * 和原先在文件中查找的规则相同 : app 所在 section 中的 hint 优先于 "[default]" 中的.
+ */
+static bool FindAppHintInTable(const app_hint_table_t *pTable, const char *pszAppName,
+								const char *pszHintName, void *pReturn,
+								IMG_DATA_TYPE eDataType)
+{
+	bool bFound = false;
+	int i;
+
+	for (i = 0; i < pTable->count; i++)
+	{
+		const app_hint_entry_t *pEntry = &pTable->entries[i];
+		bool bInAppSpecificSection = !strcmp(pszAppName, pEntry->section);
+
+		if (!bInAppSpecificSection && strcmp("default", pEntry->section))
+		{
+			/* This entry isn't for us */
+			continue;
+		}
+
+		if (strcmp(pszHintName, pEntry->name))
+		{
+			continue;
+		}
+
+		bFound = ConvertCharToData(pszHintName, pEntry->value, pReturn, eDataType);
+
+		if (bFound && bInAppSpecificSection)
+		{
+			/* The application specific section overrides any default setting */
+			return true;
+		}
+	}
+
 	return bFound;
 }
 
@@ -1654,12 +2422,165 @@ bool ModifyAppHintInFile(const char *pszFileName, const char *pszAppName,
 
 	return bFound;
 }
+
+/*---------------------------------------------------------------------------*/
+// 进程身份 和 app_hint 只在 module 加载时 / app_hint_file 变化时 解析,
+// drm_gem_rockchip_map() 中只读取下面的缓存值, 不做任何 syscall.
+
+/* 当前进程是否是 "android.view.cts", 在 rk_cts_workround_init() 中确定. */
+static bool s_is_view_cts_process = false;
+
+/* BIG_SCALE_HINT 的当前值, 由 rk_cts_refresh_app_hints() 更新. */
+static volatile int32_t s_view_cts_big_scale = 0;
+
+/* 保护 s_view_cts_hints. */
+static Mutex s_view_cts_hints_lock;
+static app_hint_table_t s_view_cts_hints;
+
+static void rk_cts_refresh_app_hints()
+{
+	int big_scale = 0;
+
+	Mutex::Autolock _l(s_view_cts_hints_lock);
+
+	LoadAppHintFile(VIEW_CTS_FILE, &s_view_cts_hints);
+	FindAppHintInTable(&s_view_cts_hints, VIEW_CTS_PROG_NAME, BIG_SCALE_HINT, &big_scale, IMG_INT_TYPE);
+
+	android_atomic_release_store(big_scale, &s_view_cts_big_scale);
+	ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "app hints refreshed, big_scale=%d", big_scale);
+}
+
+/*
+ * 监视 VIEW_CTS_DIR, 在 VIEW_CTS_FILE_NAME 被写入, 替换 或 删除 之后重新解析.
+ */
+static void* rk_cts_app_hints_watcher(void* arg)
+{
+	int inotify_fd = (int)(intptr_t)arg;
+	char events[sizeof(struct inotify_event) + NAME_MAX + 1]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+
+	for (;;)
+	{
+		ssize_t len = read(inotify_fd, events, sizeof(events));
+		char *p;
+		bool changed = false;
+
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			ALOGE("failed to read inotify events: %s", strerror(errno));
+			break;
+		}
+
+		for (p = events; p < events + len; )
+		{
+			struct inotify_event *ev = (struct inotify_event *)p;
+
+			if (ev->len && !strcmp(ev->name, VIEW_CTS_FILE_NAME))
+				changed = true;
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+
+		if (changed)
+			rk_cts_refresh_app_hints();
+	}
+
+	close(inotify_fd);
+	return NULL;
+}
+
+/*
+ * 在 driver 创建时调用一次 : 确定进程身份, 对 "android.view.cts" 解析 app_hint_file 并开始监视其变化.
+ */
+static void rk_cts_workround_init()
+{
+	char cmdline[256] = {0};
+	int inotify_fd;
+	pthread_t thread;
+	pthread_attr_t attr;
+
+	if (getProcessCmdLine(cmdline, sizeof(cmdline)) != 0
+		|| strcmp(cmdline, VIEW_CTS_PROG_NAME))
+	{
+		return;
+	}
+
+	s_is_view_cts_process = true;
+	rk_cts_refresh_app_hints();
+
+	inotify_fd = inotify_init1(IN_CLOEXEC);
+	if (inotify_fd < 0)
+	{
+		ALOGE("inotify_init1 failed (%s), app hints won't be refreshed", strerror(errno));
+		return;
+	}
+
+	if (inotify_add_watch(inotify_fd, VIEW_CTS_DIR,
+				IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE) < 0)
+	{
+		ALOGE("failed to watch %s (%s), app hints won't be refreshed", VIEW_CTS_DIR, strerror(errno));
+		close(inotify_fd);
+		return;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, rk_cts_app_hints_watcher, (void*)(intptr_t)inotify_fd) != 0)
+	{
+		ALOGE("failed to create app hints watcher thread");
+		close(inotify_fd);
+	}
+	pthread_attr_destroy(&attr);
+}
 #endif
 
+/*
+ * 创建完整清零使用的线程池, worker 数是在线 CPU 数 (不超过 RK_CONVERT_MAX_THREADS) 减 1, 当前线程处理其余的一段.
+ */
+static rk_clear_pool_t* rk_create_clear_pool()
+{
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int n_threads = ( (n_cpus > RK_CONVERT_MAX_THREADS) ? RK_CONVERT_MAX_THREADS : (int)n_cpus) - 1;
+
+    return rk_clear_pool_create(n_threads);
+}
+
+/*
+ * 若 PSI 监视线程正在运行, 通知其退出并等待.
+ */
+static void rk_stop_psi_monitor(struct rk_driver_of_gralloc_drm_device_t* rk_drv)
+{
+    char c = 0;
+
+    if ( rk_drv->m_psi_fd < 0 )
+    {
+        return;
+    }
+
+    if ( write(rk_drv->m_psi_wake_fds[1], &c, 1) != 1 )
+    {
+        ALOGE("failed to wake psi monitor, err : %s", strerror(errno) );
+    }
+    pthread_join(rk_drv->m_psi_thread, NULL);
+
+    close(rk_drv->m_psi_wake_fds[0]);
+    close(rk_drv->m_psi_wake_fds[1]);
+    close(rk_drv->m_psi_fd);
+    rk_drv->m_psi_fd = -1;
+}
+
+static void rk_scanout_arena_destroy(struct rk_driver_of_gralloc_drm_device_t* rk_drv);
+
 static void drm_gem_rockchip_destroy(struct gralloc_drm_drv_t *drv)
 {
 	struct rk_driver_of_gralloc_drm_device_t *rk_drv = (struct rk_driver_of_gralloc_drm_device_t *)drv;
 
+    rk_stop_psi_monitor(rk_drv);
+    /* server 的线程可能正在 commit, 先于 clear pool 和 drm 退出. */
+    rk_commit_server_destroy(rk_drv->m_commit_server);
+    rk_clear_pool_destroy(rk_drv->m_clear_pool);
+    rk_scanout_arena_destroy(rk_drv);
     rk_drm_adapter_term(rk_drv);
 
 	if (rk_drv->rk_drm_dev)
@@ -1710,812 +2631,3947 @@ void get_dmabuf_name(size_t size, char* name)
              nowTime.tm_hour, nowTime.tm_min, nowTime.tm_sec, (int)(tv.tv_usec / 1000) );
 }
 
-/**
- * rk_driver_of_gralloc_drm_device 中对 driver_of_gralloc_drm_device 的 alloc 方法的具体实现.
- * 注意 :
- *      本方法 同时实现 alloc buffer 和 import buffer 的功能,
- *      若传入的 'handle->prime_fd' < 0, 则将执行 alloc;
- *      若传入的 'handle->prime_fd' >= 0, 则将执行 import.
+/*
+ * 返回待 alloc 的, 尺寸为 'width' x 'height' 的 video_decoder buffer 中 metadata 区的 byte 数.
+ * 只用于 alloc 和 reshape (按新的尺寸计算), import 时沿用 handle 中 alloc 时 (通常在另一个进程中) 确定的值.
+ * 'width' 是 video_decoder 要求的 byte_stride.
+ *
+ * decoder 声明了 RK_VDEC_METADATA_SIZE_PROPERTY 时, 使用声明的值, buffer 只比 YUV 数据大这么多.
+ * 否则 (或 RK_VDEC_LEGACY_RESERVE_PROPERTY 为 true 时), 保留原先的 2 * byte_stride * height 的 buffer size,
+ * 其中 YUV 数据之后的部分都作为 metadata 区, 不知道 metadata 区的 decoder 仍然可以使用原先的空间.
  */
-struct gralloc_drm_bo_t *drm_gem_rockchip_alloc(
-		struct gralloc_drm_drv_t *drv,
-		struct gralloc_drm_handle_t *handle)
+static size_t rk_get_vdec_metadata_size(int usage, int width, int height)
 {
-	struct rk_driver_of_gralloc_drm_device_t *rk_drv = (struct rk_driver_of_gralloc_drm_device_t *)drv;
-	struct rockchip_buffer *buf;
-#if  !RK_DRM_GRALLOC
-        int ret, cpp, pitch, aligned_width, aligned_height;
-        uint32_t size, gem_handle;
-#else
-	int ret;
-	size_t size;
-	uint32_t gem_handle;
-	AllocType alloc_type = UNCOMPRESSED;
-	int internalWidth,internalHeight;
-	uint64_t internal_format;
-        int byte_stride;   // Stride of the buffer in bytes
-        int pixel_stride;  // Stride of the buffer in pixels - as returned in pStride
-        int w = handle->width,h = handle->height;
-        int format = handle->format;
-        int usage = handle->usage;
-        int err;
-        bool fmt_chg = false;
-        int fmt_bak = format;
-        void *addr = NULL;
-#if USE_AFBC_LAYER
-	char framebuffer_size[PROPERTY_VALUE_MAX];
-	uint32_t width, height, vrefresh;
-#endif
-	uint32_t flags = 0;
-	struct drm_rockchip_gem_phys phys_arg;
-    char dmabuf_name[DMA_BUF_NAME_LEN];
+    size_t legacy_size;
+    size_t metadata_offset;
+    int32_t declared_size;
 
-        ALOGD("enter, w : %d, h : %d, format : 0x%x, usage : 0x%x.", w, h, format, usage);
+    if ( USAGE_CONTAIN_VALUE(GRALLOC_USAGE_TO_USE_NO_VDEC_METADATA, GRALLOC_USAGE_ROT_MASK) )
+    {
+        return 0;
+    }
 
-    if ( NULL == rk_drv )
+    declared_size = property_get_int32(RK_VDEC_METADATA_SIZE_PROPERTY, 0);
+    if ( declared_size > 0 && !property_get_bool(RK_VDEC_LEGACY_RESERVE_PROPERTY, false) )
     {
-        rk_drv = s_rk_drv;
+        return (size_t)declared_size;
     }
 
-	phys_arg.phy_addr = 0;
+    if ( width <= 0 || height <= 0 )
+    {
+        return 0;
+    }
 
-	/* Some formats require an internal width and height that may be used by
-	 * consumers/producers.
-	 */
-	internalWidth = w;
-	internalHeight = h;
+    legacy_size = (size_t)2 * width * height;
+    metadata_offset = GRALLOC_ALIGN( (size_t)width * height + (size_t)width * (GRALLOC_ALIGN(height, 2) / 2),
+                                     RK_VDEC_METADATA_ALIGN);
 
-    internal_format = mali_gralloc_select_format(format,
-                                                 MALI_GRALLOC_FORMAT_TYPE_USAGE,
-                                                 usage,
-                                                 w * h);
+    return (legacy_size > metadata_offset) ? legacy_size - metadata_offset : 0;
+}
 
-    /*-------------------------------------------------------*/
-    // for afbc_framebuffer_target_layer
+static inline uint64_t rk_get_time_ns()
+{
+    struct timespec ts;
 
-#if USE_AFBC_LAYER
-	property_get("persist.vendor.framebuffer.main", framebuffer_size, "0x0@60");
-	sscanf(framebuffer_size, "%dx%d@%d", &width, &height, &vrefresh);
-	//Vop cann't support 4K AFBC layer.
-	if (height < 2160)
-	{
-#define MAGIC_USAGE_FOR_AFBC_LAYER     (0x88)
-        /* if current buffer is NOT for fb_target_layer, ... */
-	    if (!(usage & GRALLOC_USAGE_HW_FB)) {
-	            if ( !(GRALLOC_USAGE__RK_EXT__EXTERNAL_DISP == (usage & GRALLOC_USAGE__RK_EXT__EXTERNAL_DISP) ) &&
-	                MAGIC_USAGE_FOR_AFBC_LAYER == (usage & MAGIC_USAGE_FOR_AFBC_LAYER) ) {
-	                internal_format = MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 | MALI_GRALLOC_INTFMT_AFBC_BASIC;
-	                ALOGD("use_afbc_layer: force to set 'internal_format' to 0x%llx for usage '0x%x'.", internal_format, usage);
-	            }
-	    }
-        /* IS for fb_target_layer, ... */
-        else
-        {
-	        if ( !(GRALLOC_USAGE__RK_EXT__EXTERNAL_DISP == (usage & GRALLOC_USAGE__RK_EXT__EXTERNAL_DISP ) )
-                && MAGIC_USAGE_FOR_AFBC_LAYER != (usage & MAGIC_USAGE_FOR_AFBC_LAYER) )
-            {
-                /* if should NOT disable AFBC in fb_target_layer, ... */
-                if ( !should_disable_afbc_in_fb_target_layer() )
-                {
-                    internal_format = MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 | MALI_GRALLOC_INTFMT_AFBC_BASIC;
-
-                    if ( handle->prime_fd < 0 ) // 只在将实际分配 buffer 的时候打印.
-                    {
-                        ALOGI("use_afbc_layer: force to set 'internal_format' to 0x%" PRIx64 " for buffer_for_fb_target_layer.",
-                          internal_format);
-                    }
-                    property_set("vendor.gmali.fbdc_target","1");
-                }
-                /* if SHOULD disable AFBC in fb_target_layer, ... */
-                else
-                {
-                    if ( handle->prime_fd < 0 )
-                    {
-                        ALOGI("debug_only : not to use afbc in fb_target_layer, the original format : 0x%" PRIx64, internal_format);
-                    }
-			        property_set("vendor.gmali.fbdc_target","0");
-                }
-	        }
-	        else
-	        {
-			    property_set("vendor.gmali.fbdc_target","0");
-	        }
-	    }
-	}
-#endif
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-    /*-------------------------------------------------------*/
-    // 来自 arm_gralloc 的逻辑, 根据 internal_format, w, h 等, 计算 side, stride 等.
+/*
+ * 'usage' 的 buffer 的数据是否总是被 producer 完整写入 : camera 输出, 或者 video_decoder 输出的 NV12, NV12_10, AFBC.
+ */
+static bool rk_is_producer_overwrite_usage(uint64_t base_format, int usage)
+{
+    if ( usage & GRALLOC_USAGE_HW_CAMERA_WRITE )
+    {
+        return true;
+    }
 
-    /* Determine AFBC type for this format */
-    if (internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK)
+    if ( USAGE_CONTAIN_VALUE(GRALLOC_USAGE_TO_USE_FBDC_FMT, GRALLOC_USAGE_ROT_MASK) )
     {
-        if (internal_format & MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS)
-        {
-            if (internal_format & MALI_GRALLOC_INTFMT_AFBC_WIDEBLK)
-            {
-                alloc_type = AFBC_TILED_HEADERS_WIDEBLK;
-            }
-            else if (internal_format & MALI_GRALLOC_INTFMT_AFBC_BASIC)
-            {
-                alloc_type = AFBC_TILED_HEADERS_BASIC;
-            }
-            else if (internal_format & MALI_GRALLOC_INTFMT_AFBC_SPLITBLK)
-            {
-                ALOGE("Unsupported format. Splitblk in tiled header configuration.");
-                return NULL;
-            }
-        }
-        else if (usage & MALI_GRALLOC_USAGE_AFBC_PADDING)
-        {
-            alloc_type = AFBC_PADDED;
-        }
-        else if (internal_format & MALI_GRALLOC_INTFMT_AFBC_WIDEBLK)
-        {
-            alloc_type = AFBC_WIDEBLK;
-        }
-        else
-        {
-            alloc_type = AFBC;
-        }
+        return true;
     }
-    
+
+    return ( HAL_PIXEL_FORMAT_YCrCb_NV12 == base_format
+             || HAL_PIXEL_FORMAT_YCrCb_NV12_10 == base_format
+             || HAL_PIXEL_FORMAT_YCrCb_420_SP_10 == base_format )
+           && !USAGE_CONTAIN_VALUE(GRALLOC_USAGE_TO_USE_NO_VDEC_METADATA, GRALLOC_USAGE_ROT_MASK);
+}
+
+/*
+ * 返回 usage 为 'usage', internal_format 为 'internal_format' 的新 buffer 的 rk_zero_policy_t.
+ */
+static rk_zero_policy_t rk_get_zero_policy(const struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                                           uint64_t internal_format,
+                                           int usage)
+{
     uint64_t base_format = internal_format & MALI_GRALLOC_INTFMT_FMT_MASK;
 
-    switch (base_format)
+    /* secure buffer 不能被 CPU 访问, 由 secure heap 负责. */
+    if ( usage & GRALLOC_USAGE_PROTECTED )
     {
-        case HAL_PIXEL_FORMAT_RGBA_8888:
-        case HAL_PIXEL_FORMAT_RGBX_8888:
-        case HAL_PIXEL_FORMAT_BGRA_8888:
-#if PLATFORM_SDK_VERSION >= 26
-        case HAL_PIXEL_FORMAT_RGBA_1010102:
-#endif
-            get_rgb_stride_and_size(w, h, 4, &pixel_stride,
-                    &byte_stride, &size, alloc_type);
-            break;
+        return RK_ZERO_NONE;
+    }
 
-        case HAL_PIXEL_FORMAT_RGB_888:
-            get_rgb_stride_and_size(w, h, 3, &pixel_stride,
-                    &byte_stride, &size, alloc_type);
-            break;
+    if ( rk_drv->m_zero_full )
+    {
+        return RK_ZERO_FULL;
+    }
 
-        case HAL_PIXEL_FORMAT_RGB_565:
-            get_rgb_stride_and_size(w, h, 2, &pixel_stride,
-                    &byte_stride, &size, alloc_type);
-            break;
-#if PLATFORM_SDK_VERSION >= 26
-        case HAL_PIXEL_FORMAT_RGBA_FP16:
-            get_rgb_stride_and_size(w, h, 8, &pixel_stride,
-                                    &byte_stride, &size, alloc_type);
-            break;
+    if ( rk_is_producer_overwrite_usage(base_format, usage) )
+    {
+        return RK_ZERO_NONE;
+    }
+
+#if GRALLOC_INIT_AFBC == 1
+    if ( internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK )
+    {
+        return RK_ZERO_AFBC_HEADERS;
+    }
 #endif
-        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
-        case MALI_GRALLOC_FORMAT_INTERNAL_YV12:
-        case MALI_GRALLOC_FORMAT_INTERNAL_NV12:
-        case MALI_GRALLOC_FORMAT_INTERNAL_NV21:
-            {
-                /* Mali subsystem prefers higher stride alignment values (128 bytes) for YUV, but software components assume
-                 * default of 16. We only need to care about YV12 as it's the only, implicit, HAL YUV format in Android.
-                 */
-                int yv12_align = YUV_MALI_PLANE_ALIGN;
 
-                if (usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK))
-                {
-                    yv12_align = YUV_ANDROID_PLANE_ALIGN;
-                }
+    return RK_ZERO_NONE;
+}
 
-                if (!get_yv12_stride_and_size(w, h, &pixel_stride,
-                            &byte_stride, &size, alloc_type,
-                            &internalHeight, yv12_align))
-                {
-                    return NULL;
-                }
+/*
+ * 将 CPU 映射 'addr' 开始的 'size' byte 由 'rk_drv->m_clear_pool' 并行清零, 对 ROCKCHIP_BO_CACHABLE 的 buffer, 通过 'prime_fd' 同步 cache.
+ */
+static void rk_clear_new_memory(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                                int prime_fd,
+                                uint32_t flags,
+                                void* addr,
+                                size_t size)
+{
+    struct dma_buf_sync sync_args;
+    uint64_t start_ns = rk_get_time_ns();
+    uint64_t elapsed_ns;
 
-                break;
-            }
+    if ( flags & ROCKCHIP_BO_CACHABLE )
+    {
+        sync_args.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE;
+        ioctl(prime_fd, DMA_BUF_IOCTL_SYNC, &sync_args);
+    }
 
-        case HAL_PIXEL_FORMAT_YCbCr_422_I:
-            {
-                /* YUYV 4:2:2 */
-                if (alloc_type != UNCOMPRESSED ||
-                        !get_yuv422_8bit_stride_and_size(w, h,
-                            &pixel_stride, &byte_stride,
-                            &size))
-                {
-                    return NULL;
-                }
+    rk_clear_bytes(rk_drv->m_clear_pool, (uint8_t*)addr, size);
 
-                break;
-            }
+    if ( flags & ROCKCHIP_BO_CACHABLE )
+    {
+        sync_args.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE;
+        ioctl(prime_fd, DMA_BUF_IOCTL_SYNC, &sync_args);
+    }
 
-        case HAL_PIXEL_FORMAT_RAW16:
-        case HAL_PIXEL_FORMAT_RAW12:
-        case HAL_PIXEL_FORMAT_RAW10:
-        case HAL_PIXEL_FORMAT_BLOB:
-            if (alloc_type != UNCOMPRESSED)
-            {
-                return NULL;
-            }
+    elapsed_ns = rk_get_time_ns() - start_ns;
 
-            get_camera_formats_stride_and_size(w, h, base_format, &pixel_stride, &size);
-            /* For Raw/Blob formats stride is defined to be either in bytes or pixels per format */
-            byte_stride = pixel_stride;
-            break;
+    Mutex::Autolock _l(rk_drv->m_stats_lock);
 
-        case MALI_GRALLOC_FORMAT_INTERNAL_Y0L2:
+    rk_drv->m_zero_stats.full_clears++;
+    rk_drv->m_zero_stats.full_bytes += size;
+    rk_drv->m_zero_stats.full_total_ns += elapsed_ns;
+    if ( elapsed_ns > rk_drv->m_zero_stats.full_max_ns )
+    {
+        rk_drv->m_zero_stats.full_max_ns = elapsed_ns;
+    }
+}
 
-            /* YUYAAYUVAA 4:2:0 with and without AFBC */
-            if (alloc_type != UNCOMPRESSED)
-            {
-                if (!get_yuv420_10bit_afbc_stride_and_size(
-                            w, h, &pixel_stride,
-                            &byte_stride, &size, alloc_type, &internalHeight))
-                {
-                    return NULL;
-                }
-            }
-            else
-            {
-                if (!get_yuv_y0l2_stride_and_size(w, h,
-                            &pixel_stride, &byte_stride,
-                            &size))
-                {
-                    return NULL;
-                }
-            }
+/*
+ * 返回 'size' byte 的物理连续 buffer 所属的 size class.
+ */
+static int rk_get_cma_size_class(size_t size)
+{
+    size_t mib = (size + (1 << 20) - 1) >> 20;
+    int size_class = 0;
 
-            break;
+    while ( mib > 1 && size_class < RK_CMA_SIZE_CLASSES - 1 )
+    {
+        mib = (mib + 1) >> 1;
+        size_class++;
+    }
 
-        case MALI_GRALLOC_FORMAT_INTERNAL_P010:
+    return size_class;
+}
 
-            /* Y-UV 4:2:0 */
-            if (alloc_type != UNCOMPRESSED ||
-                    !get_yuv_pX10_stride_and_size(w, h, 2,
-                        &pixel_stride, &byte_stride,
-                        &size))
-            {
-                return NULL;
-            }
+/*
+ * 'size_class' 或更小的 class 是否在 backoff 时长内失败过.
+ * 更大的 buffer 需要更大的连续区域, 小的 class 失败时, 大的 class 也几乎一定失败.
+ */
+static bool rk_is_cma_size_class_backed_off(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                                            int size_class,
+                                            uint64_t now_ns)
+{
+    const rk_cma_stats_t& stats = rk_drv->m_cma_stats;
+    int i;
 
-            break;
+    for ( i = 0; i <= size_class; i++ )
+    {
+        if ( stats.last_failure_ns[i] != 0 && now_ns - stats.last_failure_ns[i] < rk_drv->m_cma_backoff_ns )
+        {
+            return true;
+        }
+    }
 
-        case MALI_GRALLOC_FORMAT_INTERNAL_P210:
+    return false;
+}
 
-            /* Y-UV 4:2:2 */
-            if (alloc_type != UNCOMPRESSED ||
-                    !get_yuv_pX10_stride_and_size(w, h, 1,
-                        &pixel_stride, &byte_stride,
-                        &size))
-            {
-                return NULL;
-            }
+/*
+ * 按 'flags' 分配 'size' byte 的 rockchip_bo. 若 'flags' 要求物理连续 (ROCKCHIP_BO_CONTIG) :
+ *      测量分配耗时, 记录失败的 size class, 成功但超出预算的分配只被统计;
+ *      若 'allow_fallback' 为 true, 在对应的 size class 近期失败过时不再尝试,
+ *      在分配失败时改为分配不要求物理连续的 (IOMMU) buffer, 此时从 '*flags' 中清除 ROCKCHIP_BO_CONTIG.
+ */
+static struct rockchip_bo* rk_create_rockchip_bo_with_cma_policy(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                                                                 size_t size,
+                                                                 uint32_t* flags,
+                                                                 bool allow_fallback)
+{
+    struct rockchip_bo* bo = NULL;
+    int size_class;
+    uint64_t start_ns;
+    uint64_t cost_ns;
+    bool skip = false;
 
-            break;
+    if ( !(*flags & ROCKCHIP_BO_CONTIG) )
+    {
+        return rk_drm_adapter_create_rockchip_bo(rk_drv, size, *flags);
+    }
 
-        case MALI_GRALLOC_FORMAT_INTERNAL_Y210:
+    size_class = rk_get_cma_size_class(size);
+    start_ns = rk_get_time_ns();
 
-            /* YUYV 4:2:2 with and without AFBC */
-            if (alloc_type != UNCOMPRESSED)
-            {
-                if (!get_yuv422_10bit_afbc_stride_and_size(w, h,
-                            &pixel_stride, &byte_stride,
-                            &size, alloc_type))
-                {
-                    return NULL;
-                }
-            }
-            else
+    if ( allow_fallback )
+    {
+        Mutex::Autolock _l(rk_drv->m_stats_lock);
+
+        skip = rk_is_cma_size_class_backed_off(rk_drv, size_class, start_ns);
+        if ( skip )
+        {
+            rk_drv->m_cma_stats.skipped++;
+        }
+    }
+
+    if ( !skip )
+    {
+        bo = rk_drm_adapter_create_rockchip_bo(rk_drv, size, *flags);
+        cost_ns = rk_get_time_ns() - start_ns;
+
+        Mutex::Autolock _l(rk_drv->m_stats_lock);
+        rk_cma_stats_t& stats = rk_drv->m_cma_stats;
+
+        stats.attempts++;
+        stats.total_ns += cost_ns;
+        if ( cost_ns > stats.max_ns )
+        {
+            stats.max_ns = cost_ns;
+        }
+
+        if ( bo != NULL )
+        {
+            stats.successes++;
+            stats.last_failure_ns[size_class] = 0;
+            if ( cost_ns > rk_drv->m_cma_latency_budget_ns )
             {
-                if (!get_yuv_y210_stride_and_size(w, h,
-                            &pixel_stride, &byte_stride,
-                            &size))
-                {
-                    return NULL;
-                }
+                stats.over_budget++;
+                ALOGW("contig alloc of %zu bytes took %" PRIu64 " us, over budget.", size, cost_ns / 1000);
             }
+        }
+        else
+        {
+            stats.last_failure_ns[size_class] = rk_get_time_ns();
+            ALOGW("contig alloc of %zu bytes failed after %" PRIu64 " us.", size, cost_ns / 1000);
+        }
+    }
+
+    if ( NULL == bo && allow_fallback )
+    {
+        *flags &= ~ROCKCHIP_BO_CONTIG;
+        bo = rk_drm_adapter_create_rockchip_bo(rk_drv, size, *flags);
+        if ( bo != NULL )
+        {
+            Mutex::Autolock _l(rk_drv->m_stats_lock);
+
+            rk_drv->m_cma_stats.fallbacks++;
+            ALOGI("fall back to iommu buffer for %zu bytes%s.", size, skip ? ", contig skipped" : "");
+        }
+    }
+
+    return bo;
+}
+
+/*
+ * 'size' byte, 待 alloc 的 buffer 'handle' 是否 sub-alloc.
+ * 只在当前进程开启了 process local sub-alloc 时,
+ * 对不要求物理连续或 secure, 非 AFBC, 不用于 framebuffer 和 video_decoder 的小 buffer 做 sub-alloc.
+ * 这些 buffer 的 handle 中 'offset' 非 0, 只能交给处理 'offset' 的 consumer.
+ */
+static bool rk_should_suballoc(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                               const struct gralloc_drm_handle_t* handle,
+                               uint64_t internal_format,
+                               uint32_t flags,
+                               size_t size)
+{
+    uint64_t base_format = internal_format & MALI_GRALLOC_INTFMT_FMT_MASK;
+
+    if ( !android_atomic_acquire_load(&rk_drv->m_suballoc_enabled) || size > RK_SUBALLOC_MAX_SIZE )
+    {
+        return false;
+    }
+
+    if ( (flags & (ROCKCHIP_BO_CONTIG | ROCKCHIP_BO_SECURE) )
+        || (internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK)
+        || (handle->usage & (GRALLOC_USAGE_HW_FB | GRALLOC_USAGE_PROTECTED) ) )
+    {
+        return false;
+    }
+
+    if ( HAL_PIXEL_FORMAT_YCrCb_NV12 == base_format
+        || HAL_PIXEL_FORMAT_YCrCb_NV12_10 == base_format
+        || HAL_PIXEL_FORMAT_YCrCb_420_SP_10 == base_format )
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * 回收 'chunk'. 调用者必须持有 'rk_drv->m_suballoc_lock'.
+ */
+static void rk_suballoc_destroy_chunk(struct rk_driver_of_gralloc_drm_device_t* rk_drv, rk_suballoc_chunk_t* chunk)
+{
+    ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "reclaim suballoc chunk, prime_fd : %d, used : %zu.", chunk->prime_fd, chunk->used);
+
+    close(chunk->prime_fd);
+    rk_drm_adapter_destroy_rockchip_bo(rk_drv, chunk->bo);
+    delete chunk;
+
+    rk_drv->m_suballoc_stats.chunks_reclaimed++;
+}
+
+/*
+ * 创建 ROCKCHIP_BO_* flags 为 'flags' 的 chunk. 调用者必须持有 'rk_drv->m_suballoc_lock'.
+ */
+static rk_suballoc_chunk_t* rk_suballoc_create_chunk(struct rk_driver_of_gralloc_drm_device_t* rk_drv, uint32_t flags)
+{
+    rk_suballoc_chunk_t* chunk = new rk_suballoc_chunk_t;
+    char dmabuf_name[50];
+
+    chunk->bo = rk_drm_adapter_create_rockchip_bo(rk_drv, RK_SUBALLOC_CHUNK_SIZE, flags);
+    if ( NULL == chunk->bo )
+    {
+        ALOGE("failed to create suballoc chunk.");
+        delete chunk;
+        return NULL;
+    }
+
+    if ( rk_drm_adapter_get_prime_fd(rk_drv, chunk->bo, &(chunk->prime_fd) ) != 0 )
+    {
+        ALOGE("failed to get prime_fd of suballoc chunk.");
+        rk_drm_adapter_destroy_rockchip_bo(rk_drv, chunk->bo);
+        delete chunk;
+        return NULL;
+    }
+
+    get_dmabuf_name(RK_SUBALLOC_CHUNK_SIZE, dmabuf_name);
+    if ( ioctl(chunk->prime_fd, DMA_BUF_SET_NAME, dmabuf_name) != 0 )
+    {
+        ALOGE("failed set name of dma_buf.");
+    }
+
+    /* chunk 中的空间不重用, 只需在创建时清零. */
+    if ( rk_drv->m_zero_full )
+    {
+        void* addr = rk_drm_adapter_map_rockchip_bo(chunk->bo);
+
+        if ( addr != NULL )
+        {
+            rk_clear_new_memory(rk_drv, chunk->prime_fd, flags, addr, RK_SUBALLOC_CHUNK_SIZE);
+        }
+        else
+        {
+            ALOGE("failed to map suballoc chunk for clearing.");
+        }
+    }
+
+    chunk->flags = flags;
+    chunk->used = 0;
+    chunk->live = 0;
+
+    rk_drv->m_suballoc_stats.chunks_created++;
+    return chunk;
+}
+
+/*
+ * 从 chunk 中为 'buf' 分配 'size' byte, 将 handle 的 prime_fd 和 offset 设置为 chunk 的 dma_buf 及其中的位置.
+ * 返回 import 该 dma_buf 得到的, 'buf' 自己的 rockchip_bo, 失败时返回 NULL.
+ */
+static struct rockchip_bo* rk_suballoc_create_bo(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                                                 struct rockchip_buffer* buf,
+                                                 struct gralloc_drm_handle_t* handle,
+                                                 size_t size,
+                                                 uint32_t flags)
+{
+    size_t aligned_size = GRALLOC_ALIGN(size, RK_SUBALLOC_ALIGN);
+    int index = (flags & ROCKCHIP_BO_CACHABLE) ? 1 : 0;
+    rk_suballoc_chunk_t* chunk;
+    struct rockchip_bo* bo;
+    int prime_fd;
+    size_t offset;
+
+    Mutex::Autolock _l(rk_drv->m_suballoc_lock);
+
+    chunk = rk_drv->m_suballoc_chunks[index];
+    if ( NULL == chunk || chunk->used + aligned_size > RK_SUBALLOC_CHUNK_SIZE )
+    {
+        /* retire 当前 chunk, 其中的 buffer 都已经被 free 时, 立即回收. */
+        if ( chunk != NULL && 0 == chunk->live )
+        {
+            rk_suballoc_destroy_chunk(rk_drv, chunk);
+        }
+        rk_drv->m_suballoc_chunks[index] = NULL;
+
+        chunk = rk_suballoc_create_chunk(rk_drv, flags);
+        if ( NULL == chunk )
+        {
+            return NULL;
+        }
+        rk_drv->m_suballoc_chunks[index] = chunk;
+    }
+
+    prime_fd = dup(chunk->prime_fd);
+    if ( prime_fd < 0 )
+    {
+        ALOGE("failed to dup prime_fd of suballoc chunk, err : %s", strerror(errno) );
+        return NULL;
+    }
+
+    offset = chunk->used;
+    bo = rk_drm_adapter_import_dma_buf(rk_drv, prime_fd, flags, offset + size);
+    if ( NULL == bo )
+    {
+        close(prime_fd);
+        return NULL;
+    }
+
+    chunk->used += aligned_size;
+    chunk->live++;
+    rk_drv->m_suballoc_stats.buffers++;
+    rk_drv->m_suballoc_stats.live_buffers++;
+
+    buf->suballoc_chunk = chunk;
+    handle->prime_fd = prime_fd;
+    handle->offset = offset;
+
+    ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "suballoc %zu bytes at offset %zu, prime_fd : %d.", size, offset, prime_fd);
+    return bo;
+}
+
+/*
+ * 'buf' 被 free 时调用, 若 'buf' 是当前进程中 sub-alloc 的, 且 chunk 已经 retired 并为空, 回收 chunk.
+ */
+static void rk_suballoc_release(struct rk_driver_of_gralloc_drm_device_t* rk_drv, struct rockchip_buffer* buf)
+{
+    rk_suballoc_chunk_t* chunk = buf->suballoc_chunk;
+    int index;
+
+    if ( NULL == chunk )
+    {
+        return;
+    }
+
+    Mutex::Autolock _l(rk_drv->m_suballoc_lock);
+
+    buf->suballoc_chunk = NULL;
+    chunk->live--;
+    rk_drv->m_suballoc_stats.live_buffers--;
+
+    index = (chunk->flags & ROCKCHIP_BO_CACHABLE) ? 1 : 0;
+    if ( 0 == chunk->live && chunk != rk_drv->m_suballoc_chunks[index] )
+    {
+        rk_suballoc_destroy_chunk(rk_drv, chunk);
+    }
+}
+
+/*
+ * 'size' byte, ROCKCHIP_BO_* flags 为 'flags' 的待 alloc 的 buffer 'handle' 是否从 scanout arena 分配.
+ * 只对要求物理连续, 用于 framebuffer 或 overlay (HWC) 的 buffer 使用 arena.
+ * arena 是一个非 cachable, 非 secure 的 bo, 要求其他 flags 的 buffer 不使用 arena.
+ * 这些 buffer 的 handle 中 'offset' 可能非 0, 'phy_addr' 已经包含 'offset'.
+ */
+static bool rk_should_use_scanout_arena(const struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                                        const struct gralloc_drm_handle_t* handle,
+                                        uint32_t flags)
+{
+    if ( 0 == rk_drv->m_arena_size )
+    {
+        return false;
+    }
+
+    if ( !(flags & ROCKCHIP_BO_CONTIG) || (flags & (ROCKCHIP_BO_SECURE | ROCKCHIP_BO_CACHABLE) ) )
+    {
+        return false;
+    }
+
+    return ( handle->usage & (GRALLOC_USAGE_HW_FB | GRALLOC_USAGE_HW_COMPOSER) ) != 0;
+}
+
+/*
+ * 预留 scanout arena, 并创建跟踪其中区域释放的 inotify 实例. 调用者必须持有 'rk_drv->m_arena_lock'.
+ */
+static int rk_scanout_arena_reserve(struct rk_driver_of_gralloc_drm_device_t* rk_drv)
+{
+    struct drm_rockchip_gem_phys phys_arg;
+    char dmabuf_name[DMA_BUF_NAME_LEN];
+    int ret;
+
+    rk_drv->m_arena_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if ( rk_drv->m_arena_inotify_fd < 0 )
+    {
+        ALOGE("failed to create inotify instance for scanout arena, err : %s", strerror(errno) );
+        return -errno;
+    }
+
+    rk_drv->m_arena_bo = rk_drm_adapter_create_rockchip_bo(rk_drv, rk_drv->m_arena_size, ROCKCHIP_BO_CONTIG);
+    if ( NULL == rk_drv->m_arena_bo )
+    {
+        ALOGE("failed to reserve scanout arena of %zu bytes.", rk_drv->m_arena_size);
+        ret = -ENOMEM;
+        goto err_close_inotify;
+    }
+
+    ret = rk_drm_adapter_get_prime_fd(rk_drv, rk_drv->m_arena_bo, &(rk_drv->m_arena_prime_fd) );
+    if ( ret != 0 )
+    {
+        ALOGE("failed to get prime_fd of scanout arena.");
+        goto err_destroy_bo;
+    }
+
+    phys_arg.handle = rk_drm_adapter_get_gem_handle(rk_drv->m_arena_bo);
+    phys_arg.phy_addr = 0;
+    ret = drmIoctl(rk_drv->fd_of_drm_dev, DRM_IOCTL_ROCKCHIP_GEM_GET_PHYS, &phys_arg);
+    if ( ret != 0 || 0 == phys_arg.phy_addr )
+    {
+        /* 不是物理连续的 arena 不能满足 scanout buffer 的要求. */
+        ALOGE("failed to get phy address of scanout arena: %s", strerror(errno) );
+        close(rk_drv->m_arena_prime_fd);
+        rk_drv->m_arena_prime_fd = -1;
+        ret = -ENOMEM;
+        goto err_destroy_bo;
+    }
+    rk_drv->m_arena_phy_addr = phys_arg.phy_addr;
+
+    get_dmabuf_name(rk_drv->m_arena_size, dmabuf_name);
+    if ( ioctl(rk_drv->m_arena_prime_fd, DMA_BUF_SET_NAME, dmabuf_name) != 0 )
+    {
+        ALOGE("failed set name of dma_buf.");
+    }
+
+    rk_range_arena_init(&rk_drv->m_arena, rk_drv->m_arena_size, RK_ARENA_DEFAULT_ALIGN);
+
+    ALOGI("reserved scanout arena : %zu bytes at phys 0x%x.", rk_drv->m_arena_size, rk_drv->m_arena_phy_addr);
+    return 0;
+
+err_destroy_bo:
+    rk_drm_adapter_destroy_rockchip_bo(rk_drv, rk_drv->m_arena_bo);
+    rk_drv->m_arena_bo = NULL;
+err_close_inotify:
+    close(rk_drv->m_arena_inotify_fd);
+    rk_drv->m_arena_inotify_fd = -1;
+    return ret;
+}
+
+/*
+ * 读取 'm_arena_inotify_fd' 上已经到达的事件, 将 handle 已经在所有进程中被关闭的 buffer 的区域放回 arena.
+ * 调用者必须持有 'rk_drv->m_arena_lock'.
+ */
+static void rk_scanout_arena_reap(struct rk_driver_of_gralloc_drm_device_t* rk_drv)
+{
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event) ) ) );
+    const struct inotify_event* event;
+    ssize_t len;
+    ssize_t index;
+
+    if ( rk_drv->m_arena_inotify_fd < 0 )
+    {
+        return;
+    }
+
+    while ( (len = read(rk_drv->m_arena_inotify_fd, events, sizeof(events) ) ) > 0 )
+    {
+        for ( char* ptr = events; ptr < events + len; ptr += sizeof(struct inotify_event) + event->len )
+        {
+            event = (const struct inotify_event*)ptr;
+
+            if ( event->mask & IN_Q_OVERFLOW )
+            {
+                /* 丢失的事件对应的区域不会再被释放, 只是减少 arena 的可用容量. */
+                ALOGW("inotify queue of scanout arena overflowed, some ranges stay busy.");
+                continue;
+            }
+
+            /* 每个 watch 先后收到 IN_DELETE_SELF 和 IN_IGNORED, 只处理先到的一个. */
+            if ( !(event->mask & (IN_DELETE_SELF | IN_IGNORED) ) )
+            {
+                continue;
+            }
+
+            index = rk_drv->m_arena_watches.indexOfKey(event->wd);
+            if ( index < 0 )
+            {
+                continue;
+            }
+
+            ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "scanout arena range at offset %zu is released.",
+                     rk_drv->m_arena_watches.valueAt(index) );
+            rk_range_arena_free(&rk_drv->m_arena, rk_drv->m_arena_watches.valueAt(index) );
+            rk_drv->m_arena_watches.removeItemsAt(index);
+            rk_drv->m_arena_stats.released++;
+        }
+    }
+}
+
+/*
+ * 从 scanout arena 中为 'buf' 分配 'size' byte 的区域, 通过 'offset' 返回其位置, 通过 'prime_fd' 返回 arena 的 dma_buf 的一个 dup.
+ * 同时为 'handle' 创建 memfd 的 attr region, 并 watch 它的释放 :
+ * handle 的 fd 总是一起被传递和关闭, attr region 的最后一个引用被释放, 说明所有进程都已经关闭了 handle, 区域才可以被再次分配.
+ * 返回 import 该 dma_buf 得到的, 'buf' 自己的 rockchip_bo. 失败时返回 NULL, 'handle' 没有 attr region.
+ */
+static struct rockchip_bo* rk_scanout_arena_take_range(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                                                       struct rockchip_buffer* buf,
+                                                       struct gralloc_drm_handle_t* handle,
+                                                       size_t size,
+                                                       size_t* offset,
+                                                       int* prime_fd)
+{
+    Mutex::Autolock _l(rk_drv->m_arena_lock);
+    struct rockchip_bo* bo;
+    char watch_path[64];
+    int wd;
+
+    if ( NULL == rk_drv->m_arena_bo )
+    {
+        rk_drv->m_arena_stats.fallbacks++;
+        return NULL;
+    }
+
+    rk_scanout_arena_reap(rk_drv);
+
+    if ( rk_range_arena_alloc(&rk_drv->m_arena, size, offset) != 0 )
+    {
+        ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "scanout arena is exhausted, size : %zu.", size);
+        rk_drv->m_arena_stats.fallbacks++;
+        return NULL;
+    }
+
+    if ( gralloc_buffer_attr_allocate_memfd(handle) != 0 )
+    {
+        goto err_free_range;
+    }
+
+    snprintf(watch_path, sizeof(watch_path), "/proc/self/fd/%d", handle->share_attr_fd);
+    wd = inotify_add_watch(rk_drv->m_arena_inotify_fd, watch_path, IN_DELETE_SELF);
+    if ( wd < 0 )
+    {
+        ALOGE("failed to watch attr region of scanout arena buffer, err : %s", strerror(errno) );
+        goto err_free_attr;
+    }
+
+    *prime_fd = dup(rk_drv->m_arena_prime_fd);
+    if ( *prime_fd < 0 )
+    {
+        ALOGE("failed to dup prime_fd of scanout arena, err : %s", strerror(errno) );
+        goto err_rm_watch;
+    }
+
+    bo = rk_drm_adapter_import_dma_buf(rk_drv, *prime_fd, buf->flags, *offset + size);
+    if ( NULL == bo )
+    {
+        close(*prime_fd);
+        *prime_fd = -1;
+        goto err_rm_watch;
+    }
+
+    rk_drv->m_arena_watches.add(wd, *offset);
+    rk_drv->m_arena_stats.served++;
+    return bo;
+
+err_rm_watch:
+    /* 之后到达的 IN_IGNORED 不在 'm_arena_watches' 中, 被忽略. */
+    inotify_rm_watch(rk_drv->m_arena_inotify_fd, wd);
+err_free_attr:
+    gralloc_buffer_attr_free(handle);
+err_free_range:
+    rk_range_arena_free(&rk_drv->m_arena, *offset);
+    rk_drv->m_arena_stats.fallbacks++;
+    return NULL;
+}
+
+/*
+ * 从 scanout arena 中为 'buf' 分配 'size' byte, 将 handle 的 prime_fd, offset 和 phy_addr 设置为 arena 的 dma_buf 及其中的位置,
+ * 并按 'internal_format' 和 usage 清零或初始化 AFBC header.
+ * 返回 'buf' 自己的 rockchip_bo. arena 不可用或已满时返回 NULL, 调用者改为单独分配.
+ */
+static struct rockchip_bo* rk_scanout_arena_create_bo(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                                                      struct rockchip_buffer* buf,
+                                                      struct gralloc_drm_handle_t* handle,
+                                                      size_t size,
+                                                      uint64_t internal_format)
+{
+    uint64_t base_format = internal_format & MALI_GRALLOC_INTFMT_FMT_MASK;
+    int usage = handle->usage;
+    struct rockchip_bo* bo;
+    rk_zero_policy_t zero_policy;
+    int prime_fd = -1;
+    size_t offset = 0;
+    void* addr;
+
+    bo = rk_scanout_arena_take_range(rk_drv, buf, handle, size, &offset, &prime_fd);
+    if ( NULL == bo )
+    {
+        return NULL;
+    }
+
+    handle->prime_fd = prime_fd;
+    handle->offset = offset;
+    handle->phy_addr = rk_drv->m_arena_phy_addr + (uint32_t)offset;
+
+    ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "scanout arena alloc %zu bytes at offset %zu, prime_fd : %d.", size, offset, prime_fd);
+
+    /* attr region 已经在这里创建, drm_gem_rockchip_alloc() 不会再对它调用 init_afbc_attrs(). */
+    if ( internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK )
+    {
+        init_afbc_attrs(handle, internal_format, usage);
+    }
+
+    /* arena 中的区域可能被之前的 buffer 使用过, 内容不是 kernel 清零的, 除了总是被 producer 完整写入的 buffer, 都需要完整清零. */
+    zero_policy = rk_get_zero_policy(rk_drv, internal_format, usage);
+    if ( !rk_is_producer_overwrite_usage(base_format, usage) )
+    {
+        zero_policy = RK_ZERO_FULL;
+    }
+
+    if ( RK_ZERO_NONE == zero_policy )
+    {
+        Mutex::Autolock _l(rk_drv->m_stats_lock);
+        rk_drv->m_zero_stats.skipped++;
+        return bo;
+    }
+
+    addr = rk_drm_adapter_map_rockchip_bo(bo);
+    if ( NULL == addr )
+    {
+        /* 保持 buffer 可用, 只是没有清零. */
+        ALOGE("failed to map scanout arena buffer for clearing.");
+        return bo;
+    }
+    addr = (uint8_t*)addr + offset;
+
+    if ( RK_ZERO_FULL == zero_policy )
+    {
+        rk_clear_new_memory(rk_drv, prime_fd, buf->flags, addr, size);
+    }
+
+#if GRALLOC_INIT_AFBC == 1
+    if ( internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK )
+    {
+        init_afbc((uint8_t*)addr, internal_format, handle->width, handle->height);
+
+        Mutex::Autolock _l(rk_drv->m_stats_lock);
+        rk_drv->m_zero_stats.header_inits++;
+    }
+#endif
+
+    return bo;
+}
+
+/*
+ * 释放当前进程对 scanout arena 的引用. 底层的 dma_buf 在所有进程都关闭了其中 buffer 的 handle 之后才被释放.
+ */
+static void rk_scanout_arena_destroy(struct rk_driver_of_gralloc_drm_device_t* rk_drv)
+{
+    Mutex::Autolock _l(rk_drv->m_arena_lock);
+
+    if ( NULL == rk_drv->m_arena_bo )
+    {
+        return;
+    }
+
+    close(rk_drv->m_arena_inotify_fd);
+    rk_drv->m_arena_inotify_fd = -1;
+    rk_drv->m_arena_watches.clear();
+    close(rk_drv->m_arena_prime_fd);
+    rk_drv->m_arena_prime_fd = -1;
+    rk_drm_adapter_destroy_rockchip_bo(rk_drv, rk_drv->m_arena_bo);
+    rk_drv->m_arena_bo = NULL;
+}
+
+/*
+ * rk_driver_of_gralloc_drm_device 中对 driver_of_gralloc_drm_device 的 open_alloc_device 方法的具体实现.
+ * 只有 allocator 进程打开 alloc device, scanout arena 在这里 (通常在启动阶段, CMA 还没有碎片化时) 预留.
+ */
+static void drm_gem_rockchip_open_alloc_device(struct gralloc_drm_drv_t* drv)
+{
+    struct rk_driver_of_gralloc_drm_device_t* rk_drv = (struct rk_driver_of_gralloc_drm_device_t*)drv;
+
+    if ( 0 == rk_drv->m_arena_size )
+    {
+        return;
+    }
+
+    Mutex::Autolock _l(rk_drv->m_arena_lock);
+
+    /* 预留失败时 arena 保持关闭, 下次打开 alloc device 时重试. */
+    if ( NULL == rk_drv->m_arena_bo )
+    {
+        rk_scanout_arena_reserve(rk_drv);
+    }
+}
+
+/*
+ * 返回 ledger 中 'base_format' 的 buffer 所属的 GRALLOC_DRM_LEDGER_FORMAT_*.
+ */
+static int rk_get_ledger_format_class(uint64_t base_format, uint64_t internal_format)
+{
+    if ( internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK )
+    {
+        return GRALLOC_DRM_LEDGER_FORMAT_AFBC;
+    }
+
+    if ( get_yuv_plane_layout(base_format) != NULL )
+    {
+        return GRALLOC_DRM_LEDGER_FORMAT_YUV;
+    }
+
+    switch ( base_format )
+    {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+        case HAL_PIXEL_FORMAT_RGB_888:
+        case HAL_PIXEL_FORMAT_RGB_565:
+        case HAL_PIXEL_FORMAT_BGRA_8888:
+#if PLATFORM_SDK_VERSION >= 26
+        case HAL_PIXEL_FORMAT_RGBA_1010102:
+        case HAL_PIXEL_FORMAT_RGBA_FP16:
+#endif
+            return GRALLOC_DRM_LEDGER_FORMAT_RGB;
+
+        default:
+            return GRALLOC_DRM_LEDGER_FORMAT_OTHER;
+    }
+}
+
+/*
+ * 返回 ledger 中 'usage' 的 buffer 所属的 GRALLOC_DRM_LEDGER_USAGE_*.
+ */
+static int rk_get_ledger_usage_class(uint64_t base_format, int usage)
+{
+    if ( (usage & GRALLOC_USAGE_HW_VIDEO_ENCODER)
+        || HAL_PIXEL_FORMAT_YCrCb_NV12 == base_format
+        || HAL_PIXEL_FORMAT_YCrCb_NV12_10 == base_format
+        || HAL_PIXEL_FORMAT_YCrCb_420_SP_10 == base_format )
+    {
+        return GRALLOC_DRM_LEDGER_USAGE_VIDEO;
+    }
+
+    if ( usage & GRALLOC_USAGE_HW_CAMERA_MASK )
+    {
+        return GRALLOC_DRM_LEDGER_USAGE_CAMERA;
+    }
+
+    if ( (usage & GRALLOC_USAGE_HW_FB)
+        || ( (usage & GRALLOC_USAGE_HW_COMPOSER)
+            && !(usage & (GRALLOC_USAGE_HW_TEXTURE | GRALLOC_USAGE_HW_RENDER) ) ) )
+    {
+        return GRALLOC_DRM_LEDGER_USAGE_SCANOUT;
+    }
+
+    if ( usage & (GRALLOC_USAGE_HW_TEXTURE | GRALLOC_USAGE_HW_RENDER) )
+    {
+        return GRALLOC_DRM_LEDGER_USAGE_GPU;
+    }
+
+    return GRALLOC_DRM_LEDGER_USAGE_OTHER;
+}
+
+/*
+ * 将 alloc 或 import 完成的 'buf' 加入 'rk_drv' 的 ledger.
+ */
+static void rk_add_to_mem_ledger(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                                 struct rockchip_buffer* buf,
+                                 uint64_t base_format,
+                                 bool imported)
+{
+    const struct gralloc_drm_handle_t* handle = buf->base.handle;
+    rk_mem_ledger_entry_t* entry = &buf->ledger_entry;
+
+    entry->size = handle->size;
+    entry->imported = imported;
+    entry->format_class = rk_get_ledger_format_class(base_format, handle->internal_format);
+    entry->usage_class = rk_get_ledger_usage_class(base_format, handle->usage);
+    entry->attrs = ( (buf->flags & ROCKCHIP_BO_CACHABLE) ? RK_LEDGER_ATTR_CACHABLE : 0 )
+                   | ( (buf->flags & ROCKCHIP_BO_CONTIG) ? RK_LEDGER_ATTR_CONTIG : 0 )
+                   | ( (buf->flags & ROCKCHIP_BO_SECURE) ? RK_LEDGER_ATTR_SECURE : 0 );
+    entry->width = handle->width;
+    entry->height = handle->height;
+    entry->format = handle->format;
+    entry->usage = handle->usage;
+    entry->internal_format = handle->internal_format;
+
+    rk_mem_ledger_add(&rk_drv->m_mem_ledger, entry);
+}
+
+/*
+ * 根据 'buf' 的 handle 中的 plane layout, 计算并保存 resolve_format 返回的各 plane 的 pitch, offset 和 gem_handle.
+ * layout 未知 (比如 AFBC 格式) 的 buffer 被视为只有一个 plane.
+ */
+static void rk_store_resolved_planes(struct rockchip_buffer* buf)
+{
+    const struct gralloc_drm_handle_t* handle = buf->base.handle;
+    uint32_t base_offset = (uint32_t)(handle->offset);
+    uint32_t gem_handle = (uint32_t)(buf->base.fb_handle);
+    uint32_t i;
+
+    memset(buf->resolved_pitches, 0, sizeof(buf->resolved_pitches) );
+    memset(buf->resolved_offsets, 0, sizeof(buf->resolved_offsets) );
+    memset(buf->resolved_handles, 0, sizeof(buf->resolved_handles) );
+
+    if ( 0 == handle->num_planes )
+    {
+        buf->resolved_pitches[0] = handle->byte_stride;
+        buf->resolved_offsets[0] = base_offset;
+        buf->resolved_handles[0] = gem_handle;
+        return;
+    }
+
+    for ( i = 0; i < handle->num_planes && i < GRALLOC_DRM_RESOLVE_MAX_PLANES; i++ )
+    {
+        buf->resolved_pitches[i] = handle->plane_info[i].byte_stride;
+        buf->resolved_offsets[i] = base_offset + handle->plane_info[i].offset;
+        buf->resolved_handles[i] = gem_handle;
+    }
+}
+
+/*
+ * rk_driver_of_gralloc_drm_device 中对 driver_of_gralloc_drm_device 的 resolve_format 方法的具体实现.
+ * 只返回 alloc 或 import 时保存的结果, 不重新计算.
+ * 'buf' 在当前进程中没有 gem_obj 时返回 -ENODEV.
+ */
+static int drm_gem_rockchip_resolve_format(struct gralloc_drm_drv_t *drv,
+                                            struct gralloc_drm_bo_t *bo,
+                                            uint32_t *pitches,
+                                            uint32_t *offsets,
+                                            uint32_t *handles)
+{
+    const struct rockchip_buffer* buf = (const struct rockchip_buffer*)bo;
+
+    UNUSED(drv);
+
+    /* 没有 gem_obj 的 buffer 不能被 KMS import. */
+    if ( !rk_has_gem_obj(buf) )
+    {
+        ALOGE("can't resolve format of a buffer without gem_obj, prime_fd : %d.", bo->handle->prime_fd);
+        return -ENODEV;
+    }
+
+    memcpy(pitches, buf->resolved_pitches, sizeof(buf->resolved_pitches) );
+    memcpy(offsets, buf->resolved_offsets, sizeof(buf->resolved_offsets) );
+    memcpy(handles, buf->resolved_handles, sizeof(buf->resolved_handles) );
+    return 0;
+}
+
+/*
+ * 返回 alloc 或 import 'format', 'usage' 的 buffer 时使用的 ROCKCHIP_BO_* flags, cachable 或 物理连续 等.
+ */
+static uint32_t rk_get_bo_flags(int format, int usage)
+{
+	uint32_t flags = 0;
+
+	if ( (usage & GRALLOC_USAGE_SW_READ_MASK) == GRALLOC_USAGE_SW_READ_OFTEN
+		|| format == HAL_PIXEL_FORMAT_YCrCb_NV12_10
+		|| format == HAL_PIXEL_FORMAT_YCrCb_420_SP_10
+		|| format == HAL_PIXEL_FORMAT_YCbCr_422_SP_10)
+	{
+		ALOGD("to ask for cachable buffer for CPU read, usage : 0x%x", usage);
+		//set cache flag
+		flags = ROCKCHIP_BO_CACHABLE;
+	}
+
+	if(USAGE_CONTAIN_VALUE(GRALLOC_USAGE_TO_USE_PHY_CONT,GRALLOC_USAGE_ROT_MASK)
+		|| USAGE_CONTAIN_VALUE(GRALLOC_USAGE_TO_USE_PHY_CONT_STRICT,GRALLOC_USAGE_ROT_MASK)
+		|| USAGE_CONTAIN_VALUE(GRALLOC_USAGE_TO_USE_PHY_CONT_OR_IOMMU,GRALLOC_USAGE_ROT_MASK))
+	{
+		flags |= ROCKCHIP_BO_CONTIG; // 预期要求 CMA 内存.
+		ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "try to use Physically Continuous memory\n");
+	}
+
+	if(usage & GRALLOC_USAGE_PROTECTED)
+	{
+		flags |= ROCKCHIP_BO_SECURE;
+		ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "try to use secure memory\n");
+	}
+
+	return flags;
+}
+
+/*
+ * 根据 'usage' 中的 private usage, 设置 'handle' 的 yuv_info.
+ */
+static void rk_fill_yuv_info(struct gralloc_drm_handle_t* handle, int usage)
+{
+    switch (usage & MALI_GRALLOC_USAGE_YUV_CONF_MASK)
+    {
+        case MALI_GRALLOC_USAGE_YUV_CONF_0:
+            if(USAGE_CONTAIN_VALUE(GRALLOC_USAGE_TO_USE_ARM_P010,GRALLOC_USAGE_ROT_MASK))
+            {
+				handle->yuv_info = MALI_YUV_BT709_WIDE; // for rk_hdr.
+            }
+			else
+            {
+				handle->yuv_info = MALI_YUV_BT601_NARROW;
+            }
+			break;
+
+        case MALI_GRALLOC_USAGE_YUV_CONF_1:
+            handle->yuv_info = MALI_YUV_BT601_WIDE;
+            break;
+
+        case MALI_GRALLOC_USAGE_YUV_CONF_2:
+            handle->yuv_info = MALI_YUV_BT709_NARROW;
+            break;
+
+        case MALI_GRALLOC_USAGE_YUV_CONF_3:
+            handle->yuv_info = MALI_YUV_BT709_WIDE;
+            break;
+    }
+}
+
+static const mali_gralloc_runtime_caps* rk_get_format_caps(struct rk_driver_of_gralloc_drm_device_t* rk_drv);
+
+/*
+ * 根据 'handle' 中的 width, height, format 和 usage, 计算 buffer 的 layout.
+ * 若 'handle->prime_fd' >= 0 (import), 沿用 handle 中 alloc 时确定的 internal_format 和 metadata 区的大小.
+ *
+ * @return
+ *      0 : 成功; -EINVAL : 不支持的 format 或尺寸.
+ */
+static int rk_compute_buffer_layout(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                                    const struct gralloc_drm_handle_t* handle,
+                                    rk_buffer_layout_t* layout)
+{
+	AllocType alloc_type = UNCOMPRESSED;
+	int internalWidth,internalHeight;
+	uint64_t internal_format;
+	uint64_t base_format;
+	size_t size;
+        int byte_stride;   // Stride of the buffer in bytes
+        int pixel_stride;  // Stride of the buffer in pixels - as returned in pStride
+        int w = handle->width,h = handle->height;
+        int format = handle->format;
+        int usage = handle->usage;
+	size_t vdec_metadata_size = 0;
+	size_t vdec_metadata_offset = 0;
+#if USE_AFBC_LAYER
+	char framebuffer_size[PROPERTY_VALUE_MAX];
+	uint32_t width, height, vrefresh;
+#endif
+
+	UNUSED(format);
+
+	/* Some formats require an internal width and height that may be used by
+	 * consumers/producers.
+	 */
+	internalWidth = w;
+	internalHeight = h;
+
+    /* import 时 internal_format 沿用 handle 中的 (见下文), 不需要 format caps. */
+    internal_format = mali_gralloc_select_format(format,
+                                                 MALI_GRALLOC_FORMAT_TYPE_USAGE,
+                                                 usage,
+                                                 w * h,
+                                                 (handle->prime_fd < 0 || 0 == handle->internal_format)
+                                                     ? rk_get_format_caps(rk_drv)
+                                                     : NULL);
+
+    /*-------------------------------------------------------*/
+    // for afbc_framebuffer_target_layer
+
+#if USE_AFBC_LAYER
+	property_get("persist.vendor.framebuffer.main", framebuffer_size, "0x0@60");
+	sscanf(framebuffer_size, "%dx%d@%d", &width, &height, &vrefresh);
+	//Vop cann't support 4K AFBC layer.
+	if (height < 2160)
+	{
+#define MAGIC_USAGE_FOR_AFBC_LAYER     (0x88)
+        /* if current buffer is NOT for fb_target_layer, ... */
+	    if (!(usage & GRALLOC_USAGE_HW_FB)) {
+	            if ( !(GRALLOC_USAGE__RK_EXT__EXTERNAL_DISP == (usage & GRALLOC_USAGE__RK_EXT__EXTERNAL_DISP) ) &&
+	                MAGIC_USAGE_FOR_AFBC_LAYER == (usage & MAGIC_USAGE_FOR_AFBC_LAYER) ) {
+	                internal_format = MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 | MALI_GRALLOC_INTFMT_AFBC_BASIC;
+	                ALOGD("use_afbc_layer: force to set 'internal_format' to 0x%llx for usage '0x%x'.", internal_format, usage);
+	            }
+	    }
+        /* IS for fb_target_layer, ... */
+        else
+        {
+	        if ( !(GRALLOC_USAGE__RK_EXT__EXTERNAL_DISP == (usage & GRALLOC_USAGE__RK_EXT__EXTERNAL_DISP ) )
+                && MAGIC_USAGE_FOR_AFBC_LAYER != (usage & MAGIC_USAGE_FOR_AFBC_LAYER) )
+            {
+                /* if should NOT disable AFBC in fb_target_layer, ... */
+                if ( !should_disable_afbc_in_fb_target_layer() )
+                {
+                    internal_format = MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 | MALI_GRALLOC_INTFMT_AFBC_BASIC;
+
+                    if ( handle->prime_fd < 0 ) // 只在将实际分配 buffer 的时候打印.
+                    {
+                        ALOGI("use_afbc_layer: force to set 'internal_format' to 0x%" PRIx64 " for buffer_for_fb_target_layer.",
+                          internal_format);
+                    }
+                    property_set("vendor.gmali.fbdc_target","1");
+                }
+                /* if SHOULD disable AFBC in fb_target_layer, ... */
+                else
+                {
+                    if ( handle->prime_fd < 0 )
+                    {
+                        ALOGI("debug_only : not to use afbc in fb_target_layer, the original format : 0x%" PRIx64, internal_format);
+                    }
+			        property_set("vendor.gmali.fbdc_target","0");
+                }
+	        }
+	        else
+	        {
+			    property_set("vendor.gmali.fbdc_target","0");
+	        }
+	    }
+	}
+#endif
+
+    /* 若是 import 另一个进程分配的 buffer, 则沿用分配时选定的 internal_format,
+     * 各进程探测得到的 format_caps 可能不同 (比如 libGLES_mali.so 只在部分进程中可以 dlopen). */
+    if ( handle->prime_fd >= 0 && handle->internal_format != 0 )
+    {
+        internal_format = handle->internal_format;
+    }
+
+    /*-------------------------------------------------------*/
+    // 来自 arm_gralloc 的逻辑, 根据 internal_format, w, h 等, 计算 side, stride 等.
+
+    /* Determine AFBC type for this format */
+    if (internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK)
+    {
+        if (internal_format & MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS)
+        {
+            if (internal_format & MALI_GRALLOC_INTFMT_AFBC_WIDEBLK)
+            {
+                alloc_type = AFBC_TILED_HEADERS_WIDEBLK;
+            }
+            else if (internal_format & MALI_GRALLOC_INTFMT_AFBC_BASIC)
+            {
+                alloc_type = AFBC_TILED_HEADERS_BASIC;
+            }
+            else if (internal_format & MALI_GRALLOC_INTFMT_AFBC_SPLITBLK)
+            {
+                ALOGE("Unsupported format. Splitblk in tiled header configuration.");
+                return -EINVAL;
+            }
+        }
+        else if (usage & MALI_GRALLOC_USAGE_AFBC_PADDING)
+        {
+            alloc_type = AFBC_PADDED;
+        }
+        else if (internal_format & MALI_GRALLOC_INTFMT_AFBC_WIDEBLK)
+        {
+            alloc_type = AFBC_WIDEBLK;
+        }
+        else
+        {
+            alloc_type = AFBC;
+        }
+    }
+    
+    base_format = internal_format & MALI_GRALLOC_INTFMT_FMT_MASK;
+
+    if ( HAL_PIXEL_FORMAT_YCrCb_NV12 == base_format
+        || HAL_PIXEL_FORMAT_YCrCb_NV12_10 == base_format
+        || HAL_PIXEL_FORMAT_YCrCb_420_SP_10 == base_format )
+    {
+        vdec_metadata_size = (handle->prime_fd >= 0) ? handle->metadata_size : rk_get_vdec_metadata_size(usage, w, h);
+    }
+
+    switch (base_format)
+    {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+        case HAL_PIXEL_FORMAT_BGRA_8888:
+#if PLATFORM_SDK_VERSION >= 26
+        case HAL_PIXEL_FORMAT_RGBA_1010102:
+#endif
+            get_rgb_stride_and_size(w, h, 4, &pixel_stride,
+                    &byte_stride, &size, alloc_type);
+            break;
+
+        case HAL_PIXEL_FORMAT_RGB_888:
+            get_rgb_stride_and_size(w, h, 3, &pixel_stride,
+                    &byte_stride, &size, alloc_type);
+            break;
+
+        case HAL_PIXEL_FORMAT_RGB_565:
+            get_rgb_stride_and_size(w, h, 2, &pixel_stride,
+                    &byte_stride, &size, alloc_type);
+            break;
+#if PLATFORM_SDK_VERSION >= 26
+        case HAL_PIXEL_FORMAT_RGBA_FP16:
+            get_rgb_stride_and_size(w, h, 8, &pixel_stride,
+                                    &byte_stride, &size, alloc_type);
+            break;
+#endif
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+        case MALI_GRALLOC_FORMAT_INTERNAL_YV12:
+        case MALI_GRALLOC_FORMAT_INTERNAL_NV12:
+        case MALI_GRALLOC_FORMAT_INTERNAL_NV21:
+            {
+                /* We only need to care about YV12 as it's the only, implicit, HAL YUV format in Android. */
+                int yv12_align = get_yuv_plane_align(usage);
+
+                if (!get_yv12_stride_and_size(w, h, &pixel_stride,
+                            &byte_stride, &size, alloc_type,
+                            &internalHeight, yv12_align))
+                {
+                    return -EINVAL;
+                }
+
+                break;
+            }
+
+        case HAL_PIXEL_FORMAT_YCbCr_422_I:
+            {
+                /* YUYV 4:2:2 */
+                if (alloc_type != UNCOMPRESSED ||
+                        !get_yuv422_8bit_stride_and_size(w, h,
+                            &pixel_stride, &byte_stride,
+                            &size))
+                {
+                    return -EINVAL;
+                }
+
+                break;
+            }
+
+        case HAL_PIXEL_FORMAT_RAW16:
+        case HAL_PIXEL_FORMAT_RAW12:
+        case HAL_PIXEL_FORMAT_RAW10:
+        case HAL_PIXEL_FORMAT_BLOB:
+            if (alloc_type != UNCOMPRESSED)
+            {
+                return -EINVAL;
+            }
+
+            get_camera_formats_stride_and_size(w, h, base_format, &pixel_stride, &size);
+            /* For Raw/Blob formats stride is defined to be either in bytes or pixels per format */
+            byte_stride = pixel_stride;
+            break;
+
+        case MALI_GRALLOC_FORMAT_INTERNAL_Y0L2:
+
+            /* YUYAAYUVAA 4:2:0 with and without AFBC */
+            if (alloc_type != UNCOMPRESSED)
+            {
+                if (!get_yuv420_10bit_afbc_stride_and_size(
+                            w, h, &pixel_stride,
+                            &byte_stride, &size, alloc_type, &internalHeight))
+                {
+                    return -EINVAL;
+                }
+            }
+            else
+            {
+                if (!get_yuv_y0l2_stride_and_size(w, h,
+                            &pixel_stride, &byte_stride,
+                            &size))
+                {
+                    return -EINVAL;
+                }
+            }
+
+            break;
+
+        case MALI_GRALLOC_FORMAT_INTERNAL_P010:
+
+            /* Y-UV 4:2:0 */
+            if (alloc_type != UNCOMPRESSED ||
+                    !get_yuv_pX10_stride_and_size(w, h, 2,
+                        &pixel_stride, &byte_stride,
+                        &size))
+            {
+                return -EINVAL;
+            }
+
+            break;
+
+        case MALI_GRALLOC_FORMAT_INTERNAL_P210:
+
+            /* Y-UV 4:2:2 */
+            if (alloc_type != UNCOMPRESSED ||
+                    !get_yuv_pX10_stride_and_size(w, h, 1,
+                        &pixel_stride, &byte_stride,
+                        &size))
+            {
+                return -EINVAL;
+            }
+
+            break;
+
+        case MALI_GRALLOC_FORMAT_INTERNAL_Y210:
+
+            /* YUYV 4:2:2 with and without AFBC */
+            if (alloc_type != UNCOMPRESSED)
+            {
+                if (!get_yuv422_10bit_afbc_stride_and_size(w, h,
+                            &pixel_stride, &byte_stride,
+                            &size, alloc_type))
+                {
+                    return -EINVAL;
+                }
+            }
+            else
+            {
+                if (!get_yuv_y210_stride_and_size(w, h,
+                            &pixel_stride, &byte_stride,
+                            &size))
+                {
+                    return -EINVAL;
+                }
+            }
+
+            break;
+
+        case MALI_GRALLOC_FORMAT_INTERNAL_Y410:
+
+            /* AVYU 2-10-10-10 */
+            if (alloc_type != UNCOMPRESSED ||
+                    !get_yuv_y410_stride_and_size(w, h, &pixel_stride,
+                        &byte_stride, &size))
+            {
+                return -EINVAL;
+            }
+
+            break;
+
+        case MALI_GRALLOC_FORMAT_INTERNAL_Y8:
+        case MALI_GRALLOC_FORMAT_INTERNAL_Y16:
+
+            /* luma only, 8 or 16 bit per sample */
+            if (alloc_type != UNCOMPRESSED ||
+                    !get_yuv_y8_y16_stride_and_size(w, h,
+                        (MALI_GRALLOC_FORMAT_INTERNAL_Y8 == base_format) ? 1 : 2,
+                        get_yuv_plane_align(usage),
+                        &pixel_stride, &byte_stride, &size))
+            {
+                return -EINVAL;
+            }
+
+            break;
+
+        case MALI_GRALLOC_FORMAT_INTERNAL_YUV422_8BIT:
+
+            /* 8BIT AFBC YUV4:2:2 testing usage */
+
+            /* We only support compressed for this format right now.
+             * Below will fail in case format is uncompressed.
+             */
+            if (!get_afbc_yuv422_8bit_stride_and_size(w, h,
+                        &pixel_stride, &byte_stride,
+                        &size, alloc_type))
+            {
+                return -EINVAL;
+            }
+
+            break;
+
+            /*
+             * Additional custom formats can be added here
+             * and must fill the variables pixel_stride, byte_stride and size.
+             */
+        case HAL_PIXEL_FORMAT_YCrCb_NV12:
+            if (!get_rk_nv12_stride_and_size(w, h, vdec_metadata_size,
+                                             &pixel_stride, &byte_stride, &size, &vdec_metadata_offset))
+            {
+                ALOGE("get_rk_nv12_stride_and_size failed");
+                return -EINVAL;
+            }
+            ALOGI("for nv12, w : %d, h : %d, pixel_stride : %d, byte_stride : %d, size : %zu; internalHeight : %d.",
+                    w,
+                    h,
+                    pixel_stride,
+                    byte_stride,
+                    size,
+                    internalHeight);
+            break;
+
+        case HAL_PIXEL_FORMAT_YCbCr_422_SP:
+        case HAL_PIXEL_FORMAT_YCbCr_444_888:
+            /* NV16, NV24 */
+            if (alloc_type != UNCOMPRESSED ||
+                    !get_rk_yuv_sp_stride_and_size(w, h,
+                        (HAL_PIXEL_FORMAT_YCbCr_444_888 == base_format) ? 4 : 2,
+                        get_yuv_plane_align(usage),
+                        &pixel_stride, &byte_stride, &size))
+            {
+                return -EINVAL;
+            }
+            break;
+
+        case HAL_PIXEL_FORMAT_YCbCr_422_SP_10:
+            if (alloc_type != UNCOMPRESSED ||
+                    !get_rk_nv16_10bit_stride_and_size(w, h, &pixel_stride, &byte_stride, &size))
+            {
+                return -EINVAL;
+            }
+            break;
+
+        case HAL_PIXEL_FORMAT_YCrCb_NV12_10:
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP_10:
+            if (!get_rk_nv12_10bit_stride_and_size(w, h, vdec_metadata_size,
+                                                   &pixel_stride, &byte_stride, &size, &vdec_metadata_offset))
+            {
+                ALOGE("err.");
+                return -EINVAL;
+            }
+
+            ALOGI("for nv12_10, w : %d, h : %d, pixel_stride : %d, byte_stride : %d, size : %zu; internalHeight : %d.",
+                    w,
+                    h,
+                    pixel_stride,
+                    byte_stride,
+                    size,
+                    internalHeight);
+            break;
+
+        default:
+            ALOGE("unexpected 'base_format' : 0x%" PRIx64, base_format);
+            return -EINVAL;
+    }
+
+    layout->internal_format = internal_format;
+    layout->alloc_type = alloc_type;
+    layout->pixel_stride = pixel_stride;
+    layout->byte_stride = byte_stride;
+    layout->size = size;
+    layout->internal_width = internalWidth;
+    layout->internal_height = internalHeight;
+    layout->vdec_metadata_size = vdec_metadata_size;
+    layout->vdec_metadata_offset = vdec_metadata_offset;
+
+    return 0;
+}
+
+/*
+ * 返回 'base_format' 紧密排列时每个像素的 bit 数, 不支持的格式返回 0.
+ * 对 BLOB 和 rk 的 video_decoder 格式 (NV12, NV12_10, NV16_10), width 已经是 byte 数 (byte_stride),
+ * 返回的是每个 width 单位的 bit 数, decoder 对 byte_stride 的对齐不计入开销.
+ */
+static uint32_t rk_get_packed_bits_per_pixel(uint64_t base_format)
+{
+    switch ( base_format )
+    {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+        case HAL_PIXEL_FORMAT_BGRA_8888:
+#if PLATFORM_SDK_VERSION >= 26
+        case HAL_PIXEL_FORMAT_RGBA_1010102:
+#endif
+        case MALI_GRALLOC_FORMAT_INTERNAL_P210:
+        case MALI_GRALLOC_FORMAT_INTERNAL_Y210:
+        case MALI_GRALLOC_FORMAT_INTERNAL_Y410:
+            return 32;
+#if PLATFORM_SDK_VERSION >= 26
+        case HAL_PIXEL_FORMAT_RGBA_FP16:
+            return 64;
+#endif
+        case HAL_PIXEL_FORMAT_RGB_888:
+        case HAL_PIXEL_FORMAT_YCbCr_444_888:
+        case MALI_GRALLOC_FORMAT_INTERNAL_P010:
+            return 24;
+        case HAL_PIXEL_FORMAT_RGB_565:
+        case HAL_PIXEL_FORMAT_YCbCr_422_I:
+        case HAL_PIXEL_FORMAT_YCbCr_422_SP:
+        case MALI_GRALLOC_FORMAT_INTERNAL_YUV422_8BIT:
+        case MALI_GRALLOC_FORMAT_INTERNAL_Y0L2:
+        case MALI_GRALLOC_FORMAT_INTERNAL_Y16:
+        case HAL_PIXEL_FORMAT_RAW16:
+        case HAL_PIXEL_FORMAT_YCbCr_422_SP_10:
+            return 16;
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+        case MALI_GRALLOC_FORMAT_INTERNAL_YV12:
+        case MALI_GRALLOC_FORMAT_INTERNAL_NV12:
+        case MALI_GRALLOC_FORMAT_INTERNAL_NV21:
+        case HAL_PIXEL_FORMAT_YCrCb_NV12:
+        case HAL_PIXEL_FORMAT_YCrCb_NV12_10:
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP_10:
+        case HAL_PIXEL_FORMAT_RAW12:
+            return 12;
+        case HAL_PIXEL_FORMAT_RAW10:
+            return 10;
+        case MALI_GRALLOC_FORMAT_INTERNAL_Y8:
+        case HAL_PIXEL_FORMAT_BLOB:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * 返回 'layout' 对应的紧密排列的 byte 数, 包括 video_decoder 的 metadata 区. 不支持的格式返回 0.
+ */
+static uint64_t rk_get_packed_size(const rk_buffer_layout_t* layout, int width, int height)
+{
+    uint64_t base_format = layout->internal_format & MALI_GRALLOC_INTFMT_FMT_MASK;
+    uint32_t bits = rk_get_packed_bits_per_pixel(base_format);
+
+    if ( 0 == bits || width <= 0 || height <= 0 )
+    {
+        return 0;
+    }
+
+    return ( (uint64_t)width * height * bits + 7) / 8 + layout->vdec_metadata_size;
+}
+
+/*
+ * 将 layout 'layout' (紧密排列时为 'packed_size' byte) 计入 'overhead'.
+ */
+static void rk_layout_overhead_add(rk_layout_overhead_t* overhead, const rk_buffer_layout_t* layout, uint64_t packed_size)
+{
+    uint64_t base_format = layout->internal_format & MALI_GRALLOC_INTFMT_FMT_MASK;
+    rk_layout_overhead_entry_t* entry = NULL;
+    uint32_t i;
+
+    for ( i = 0; i < overhead->num_entries; i++ )
+    {
+        if ( overhead->entries[i].base_format == base_format && overhead->entries[i].alloc_type == layout->alloc_type )
+        {
+            entry = &overhead->entries[i];
+            break;
+        }
+    }
+
+    if ( NULL == entry && packed_size != 0 && overhead->num_entries < RK_LAYOUT_OVERHEAD_MAX_ENTRIES )
+    {
+        entry = &overhead->entries[overhead->num_entries++];
+        entry->base_format = base_format;
+        entry->alloc_type = layout->alloc_type;
+        entry->count = 0;
+        entry->layout_bytes = 0;
+        entry->packed_bytes = 0;
+    }
+
+    if ( NULL == entry || 0 == packed_size )
+    {
+        overhead->unclassified_count++;
+        overhead->unclassified_bytes += layout->size;
+        return;
+    }
+
+    entry->count++;
+    entry->layout_bytes += layout->size;
+    entry->packed_bytes += packed_size;
+}
+
+static const char* rk_get_alloc_type_name(int alloc_type)
+{
+    switch ( alloc_type )
+    {
+        case UNCOMPRESSED:                  return "linear";
+        case AFBC:                          return "afbc";
+        case AFBC_WIDEBLK:                  return "afbc_wideblk";
+        case AFBC_PADDED:                   return "afbc_padded";
+        case AFBC_TILED_HEADERS_BASIC:      return "afbc_tiled";
+        case AFBC_TILED_HEADERS_WIDEBLK:    return "afbc_tiled_wideblk";
+        default:                            return "unknown";
+    }
+}
+
+/*
+ * 返回 'layout_bytes' 相对 'packed_bytes' 的开销, 单位 1/1000.
+ */
+static int64_t rk_get_overhead_permille(uint64_t layout_bytes, uint64_t packed_bytes)
+{
+    if ( 0 == packed_bytes )
+    {
+        return 0;
+    }
+
+    return ( (int64_t)layout_bytes - (int64_t)packed_bytes) * 1000 / (int64_t)packed_bytes;
+}
+
+/*
+ * 将 'overhead' 以文本形式追加到 'buff' 中已有的字符串之后, 'title' 是第一行的标题.
+ */
+static void rk_layout_overhead_format(const rk_layout_overhead_t* overhead, const char* title, char* buff, int buff_len)
+{
+    uint64_t layout_bytes = 0;
+    uint64_t packed_bytes = 0;
+    int64_t permille;
+    size_t len;
+    uint32_t i;
+
+    for ( i = 0; i < overhead->num_entries; i++ )
+    {
+        layout_bytes += overhead->entries[i].layout_bytes;
+        packed_bytes += overhead->entries[i].packed_bytes;
+    }
+    permille = rk_get_overhead_permille(layout_bytes, packed_bytes);
+
+    len = strlen(buff);
+    snprintf(buff + len, buff_len - len,
+             "%s : layout %" PRIu64 " KB, packed %" PRIu64 " KB, overhead %" PRId64 ".%" PRId64 "%%, unclassified %" PRIu64 " (%" PRIu64 " KB)\n",
+             title,
+             layout_bytes / 1024,
+             packed_bytes / 1024,
+             permille / 10,
+             (permille < 0 ? -permille : permille) % 10,
+             overhead->unclassified_count,
+             overhead->unclassified_bytes / 1024);
+
+    for ( i = 0; i < overhead->num_entries; i++ )
+    {
+        const rk_layout_overhead_entry_t* entry = &overhead->entries[i];
+
+        permille = rk_get_overhead_permille(entry->layout_bytes, entry->packed_bytes);
+
+        len = strlen(buff);
+        snprintf(buff + len, buff_len - len,
+                 "  format 0x%" PRIx64 " %s : count %" PRIu64 ", layout %" PRIu64 " KB, packed %" PRIu64 " KB, overhead %" PRId64 ".%" PRId64 "%%\n",
+                 entry->base_format,
+                 rk_get_alloc_type_name(entry->alloc_type),
+                 entry->count,
+                 entry->layout_bytes / 1024,
+                 entry->packed_bytes / 1024,
+                 permille / 10,
+                 (permille < 0 ? -permille : permille) % 10);
+    }
+}
+
+/*
+ * 将当前进程 alloc 的 buffer 'handle' 的 layout 'layout' 计入 layout 开销的统计.
+ */
+static void rk_record_layout_overhead(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                                      const struct gralloc_drm_handle_t* handle,
+                                      const rk_buffer_layout_t* layout)
+{
+    uint64_t packed_size = rk_get_packed_size(layout, handle->width, handle->height);
+
+    ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "layout overhead, w : %d, h : %d, internal_format : 0x%" PRIx64 ", size : %zu, packed : %" PRIu64,
+             handle->width, handle->height, layout->internal_format, layout->size, packed_size);
+
+    Mutex::Autolock _l(rk_drv->m_stats_lock);
+    rk_layout_overhead_add(&rk_drv->m_layout_overhead, layout, packed_size);
+}
+
+/*
+ * rk_driver_of_gralloc_drm_device 中对 driver_of_gralloc_drm_device 的 compute_layout 方法的具体实现.
+ * 按 alloc 的逻辑计算 layout 及其紧密排列的 byte 数, 不分配任何内存.
+ */
+static int drm_gem_rockchip_compute_layout(struct gralloc_drm_drv_t *drv, int width, int height, int format, int usage,
+                                           struct gralloc_drm_layout_t *out)
+{
+    struct rk_driver_of_gralloc_drm_device_t* rk_drv = (struct rk_driver_of_gralloc_drm_device_t*)drv;
+    struct gralloc_drm_handle_t handle;
+    rk_buffer_layout_t layout;
+    int ret;
+
+    memset(&handle, 0, sizeof(handle) );
+    handle.width = width;
+    handle.height = height;
+    handle.format = format;
+    handle.usage = usage;
+    handle.prime_fd = -1;
+
+    ret = rk_compute_buffer_layout(rk_drv, &handle, &layout);
+    if ( ret != 0 )
+    {
+        return ret;
+    }
+
+    out->internal_format = layout.internal_format;
+    out->alloc_type = rk_get_alloc_type_name(layout.alloc_type);
+    out->byte_stride = layout.byte_stride;
+    out->size = layout.size;
+    out->packed_size = rk_get_packed_size(&layout, width, height);
+
+    return 0;
+}
+
+/**
+ * rk_driver_of_gralloc_drm_device 中对 driver_of_gralloc_drm_device 的 alloc 方法的具体实现.
+ * 注意 :
+ *      本方法 同时实现 alloc buffer 和 import buffer 的功能,
+ *      若传入的 'handle->prime_fd' < 0, 则将执行 alloc;
+ *      若传入的 'handle->prime_fd' >= 0, 则将执行 import.
+ */
+/*
+ * 为 'buf' 分配 'size' byte 的 backing memory (rockchip_bo 和 dma_buf), 设置 handle 的 prime_fd 和 phy_addr.
+ * 'buf->flags' 是预期的 ROCKCHIP_BO_* flags, 物理连续分配 fall back 时被更新.
+ * 按 rk_zero_policy_t 清零, 或初始化 AFBC ('internal_format') header.
+ *
+ * @return
+ *      0 : 成功; -ENOMEM : 失败, 此时 'buf->bo' 是 NULL, handle 的 prime_fd 是 -1.
+ */
+static int rk_create_backing(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                             struct rockchip_buffer* buf,
+                             struct gralloc_drm_handle_t* handle,
+                             size_t size,
+                             uint64_t internal_format)
+{
+    int usage = handle->usage;
+    uint32_t flags = buf->flags;
+    uint32_t gem_handle;
+    char dmabuf_name[DMA_BUF_NAME_LEN];
+    rk_zero_policy_t zero_policy;
+    int ret;
+
+    /* 只有明确允许的 usage fall back, 其他要求物理连续的 consumer 可能使用 phy_addr. */
+    buf->bo = rk_create_rockchip_bo_with_cma_policy(rk_drv, size, &flags,
+                                                    USAGE_CONTAIN_VALUE(GRALLOC_USAGE_TO_USE_PHY_CONT_OR_IOMMU,
+                                                                        GRALLOC_USAGE_ROT_MASK) );
+    buf->flags = flags;
+    if ( NULL == buf->bo )
+    {
+        ALOGE("failed to create(alloc) bo %dx%dx%zd\n", handle->width, handle->height, size);
+        return -ENOMEM;
+    }
+
+    ret = rk_drm_adapter_get_prime_fd(rk_drv, buf->bo, &(handle->prime_fd) );
+    if ( ret != 0 )
+    {
+        ALOGE("failed to get prime_fd from rockchip_bo.");
+        goto err_destroy_bo;
+    }
+
+    get_dmabuf_name(size, dmabuf_name);
+    ALOGI("dmabuf_name : %s", dmabuf_name);
+    /* 设置 dma_buf 的 name. */
+    ret = ioctl(handle->prime_fd, DMA_BUF_SET_NAME, dmabuf_name);
+    if ( ret != 0 )
+    {
+        ALOGE("failed set name of dma_buf.");
+    }
+
+    gem_handle = rk_drm_adapter_get_gem_handle(buf->bo);
+    buf->base.fb_handle = gem_handle;
+
+    if ( buf->flags & ROCKCHIP_BO_CONTIG )
+    {
+        struct drm_rockchip_gem_phys phys_arg;
+
+        phys_arg.handle = gem_handle;
+        phys_arg.phy_addr = 0;
+        ret = drmIoctl(rk_drv->fd_of_drm_dev,
+                       DRM_IOCTL_ROCKCHIP_GEM_GET_PHYS,
+                       &phys_arg);
+        if (ret)
+            ALOGE("failed to get phy address: %s\n", strerror(errno));
+        ALOGD_IF(RK_DRM_GRALLOC_DEBUG,"get phys 0x%x\n", phys_arg.phy_addr);
+
+        if ( phys_arg.phy_addr != 0 )
+        {
+            handle->phy_addr = phys_arg.phy_addr;
+        }
+    }
+
+    /* 只在需要清零或初始化 AFBC header 时建立 CPU 映射. */
+    zero_policy = rk_get_zero_policy(rk_drv, internal_format, usage);
+    if ( RK_ZERO_NONE == zero_policy )
+    {
+        Mutex::Autolock _l(rk_drv->m_stats_lock);
+        rk_drv->m_zero_stats.skipped++;
+    }
+    else
+    {
+        void* addr = rk_drm_adapter_map_rockchip_bo(buf->bo);
+
+        if (!addr) {
+            ALOGE("failed to map bo");
+            // LOG_ALWAYS_FATAL("failed to map bo");
+            close(handle->prime_fd);
+            handle->prime_fd = -1;
+            goto err_destroy_bo;
+        }
+
+        if ( RK_ZERO_FULL == zero_policy )
+        {
+            rk_clear_new_memory(rk_drv, handle->prime_fd, buf->flags, addr, size);
+        }
+
+#if GRALLOC_INIT_AFBC == 1
+        if ( internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK )
+        {
+            ALOGD("to init afbc_buffer, addr : %p", addr);
+            init_afbc((uint8_t*)addr, internal_format, handle->width, handle->height);
+
+            Mutex::Autolock _l(rk_drv->m_stats_lock);
+            rk_drv->m_zero_stats.header_inits++;
+        }
+#endif
+    }
+
+    return 0;
+
+err_destroy_bo:
+    rk_drm_adapter_destroy_rockchip_bo(rk_drv, buf->bo);
+    buf->bo = NULL;
+    buf->base.fb_handle = 0;
+    return -ENOMEM;
+}
+
+/*
+ * 待 alloc 的 buffer 'handle' 是否推迟分配 backing memory.
+ * 需要在 alloc 时就确定物理地址, 或者用于 framebuffer 和 secure 的 buffer 不推迟.
+ */
+static bool rk_should_defer_backing(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                                    const struct gralloc_drm_handle_t* handle,
+                                    uint32_t flags)
+{
+    if ( !android_atomic_acquire_load(&rk_drv->m_lazy_commit_enabled) )
+    {
+        return false;
+    }
+
+    if ( (flags & (ROCKCHIP_BO_CONTIG | ROCKCHIP_BO_SECURE) )
+        || (handle->usage & (GRALLOC_USAGE_HW_FB | GRALLOC_USAGE_PROTECTED) ) )
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * 为 'entry' 分配 backing memory, 已经分配时什么都不做. 调用者持有 'm_lazy_lock'.
+ * 'buf' 非 NULL 表示 alloc 的进程自己 commit, 创建的 rockchip_bo 交给 'buf'; 否则 (为 import 的进程) 只保留 dma_buf.
+ */
+static int rk_commit_entry_locked(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                                  rk_commit_entry_t* entry,
+                                  struct rockchip_buffer* buf)
+{
+    struct rockchip_buffer backing;
+
+    if ( entry->handle.prime_fd >= 0 )
+    {
+        return 0;
+    }
+    if ( 0 == entry->capacity )
+    {
+        return -EAGAIN;
+    }
+
+    memset(&backing, 0, sizeof(backing) );
+    backing.flags = entry->flags;
+    if ( rk_create_backing(rk_drv, &backing, &entry->handle, entry->capacity, entry->handle.internal_format) != 0 )
+    {
+        rk_drv->m_lazy_stats.commit_failures++;
+        return -ENOMEM;
+    }
+    entry->flags = backing.flags;
+
+    rk_drv->m_lazy_stats.committed++;
+    rk_drv->m_lazy_stats.uncommitted--;
+    rk_drv->m_lazy_stats.uncommitted_bytes -= entry->capacity;
+
+    if ( buf != NULL )
+    {
+        buf->bo = backing.bo;
+        buf->base.fb_handle = backing.base.fb_handle;
+    }
+    else
+    {
+        rk_drm_adapter_destroy_rockchip_bo(rk_drv, backing.bo);
+        rk_drv->m_lazy_stats.committed_by_importers++;
+    }
+
+    return 0;
+}
+
+/*
+ * rk_commit_fn : 在 'm_commit_server' 的线程中, 为请求 commit 的 import 进程 commit 'cookie' (rk_commit_entry_t).
+ */
+static int rk_commit_entry_for_importer(void* cookie)
+{
+    rk_commit_entry_t* entry = (rk_commit_entry_t*)cookie;
+    struct rk_driver_of_gralloc_drm_device_t* rk_drv = entry->rk_drv;
+    Mutex::Autolock _l(rk_drv->m_lazy_lock);
+    int ret;
+
+    ret = rk_commit_entry_locked(rk_drv, entry, NULL);
+    if ( ret != 0 )
+    {
+        ALOGE("failed to commit deferred buffer for importer, size : %zu, err : %d.", entry->capacity, ret);
+        return ret;
+    }
+
+    ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "committed deferred buffer for importer, size : %zu, prime_fd : %d.",
+             entry->capacity, entry->handle.prime_fd);
+    /* 'entry' 只在同一线程中的 rk_release_commit_entry() 中被释放, 返回之后 fd 仍然有效. */
+    return entry->handle.prime_fd;
+}
+
+/*
+ * rk_commit_release_fn : 所有进程都关闭了 'cookie' (rk_commit_entry_t) 的 placeholder, 释放 entry 持有的 dma_buf.
+ */
+static void rk_release_commit_entry(void* cookie)
+{
+    rk_commit_entry_t* entry = (rk_commit_entry_t*)cookie;
+    struct rk_driver_of_gralloc_drm_device_t* rk_drv = entry->rk_drv;
+
+    {
+        Mutex::Autolock _l(rk_drv->m_lazy_lock);
+
+        if ( entry->handle.prime_fd >= 0 )
+        {
+            close(entry->handle.prime_fd);
+        }
+        else if ( entry->capacity != 0 )
+        {
+            rk_drv->m_lazy_stats.never_committed++;
+            rk_drv->m_lazy_stats.never_committed_bytes += entry->capacity;
+            rk_drv->m_lazy_stats.uncommitted--;
+            rk_drv->m_lazy_stats.uncommitted_bytes -= entry->capacity;
+        }
+    }
+
+    free(entry);
+}
+
+/*
+ * 为推迟分配的 'buf' 创建 commit_entry 和 placeholder, 将 placeholder 作为 'handle' 的 prime_fd.
+ * 失败 (比如在 fork 出的子进程中) 时 buffer 不推迟分配.
+ */
+static int rk_create_commit_placeholder(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                                        struct rockchip_buffer* buf,
+                                        struct gralloc_drm_handle_t* handle)
+{
+    rk_commit_entry_t* entry = (rk_commit_entry_t*)calloc(1, sizeof(*entry) );
+    int fd;
+
+    if ( NULL == entry )
+    {
+        return -ENOMEM;
+    }
+    entry->rk_drv = rk_drv;
+    entry->handle.prime_fd = -1;
+    entry->flags = buf->flags;
+
+    Mutex::Autolock _l(rk_drv->m_lazy_lock);
+
+    if ( NULL == rk_drv->m_commit_server )
+    {
+        rk_drv->m_commit_server = rk_commit_server_create(rk_commit_entry_for_importer, rk_release_commit_entry);
+        if ( NULL == rk_drv->m_commit_server )
+        {
+            free(entry);
+            return -ENOMEM;
+        }
+    }
+
+    fd = rk_commit_server_add(rk_drv->m_commit_server, entry);
+    if ( fd < 0 )
+    {
+        free(entry);
+        return fd;
+    }
+
+    handle->prime_fd = fd;
+    buf->commit_entry = entry;
+    return 0;
+}
+
+/*
+ * import 的 'handle' 的 prime_fd 是 placeholder : 请求 alloc 的进程 commit, 以得到的 dma_buf 替换 handle 中的 placeholder.
+ * fd 的值不变, 持有同一 handle 的其他进程中的 placeholder 不受影响.
+ */
+static int rk_replace_commit_placeholder(struct gralloc_drm_handle_t* handle)
+{
+    int fd = rk_commit_request(handle->prime_fd, RK_COMMIT_REQUEST_TIMEOUT_MS);
+
+    if ( fd < 0 )
+    {
+        ALOGE("failed to request commit of deferred buffer, placeholder : %d, err : %d.", handle->prime_fd, fd);
+        return fd;
+    }
+
+    if ( dup2(fd, handle->prime_fd) < 0 )
+    {
+        int err = errno;
+
+        ALOGE("failed to replace placeholder %d, err : %s.", handle->prime_fd, strerror(err) );
+        close(fd);
+        return -err;
+    }
+    close(fd);
+
+    ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "replaced placeholder with committed dma_buf, prime_fd : %d.", handle->prime_fd);
+    return 0;
+}
+
+struct gralloc_drm_bo_t *drm_gem_rockchip_alloc(
+		struct gralloc_drm_drv_t *drv,
+		struct gralloc_drm_handle_t *handle)
+{
+	struct rk_driver_of_gralloc_drm_device_t *rk_drv = (struct rk_driver_of_gralloc_drm_device_t *)drv;
+	struct rockchip_buffer *buf;
+#if  !RK_DRM_GRALLOC
+        int ret, cpp, pitch, aligned_width, aligned_height;
+        uint32_t size, gem_handle;
+#else
+	size_t size;
+	AllocType alloc_type;
+	int internalWidth,internalHeight;
+	uint64_t internal_format;
+        int byte_stride;   // Stride of the buffer in bytes
+        int pixel_stride;  // Stride of the buffer in pixels - as returned in pStride
+        int w = handle->width,h = handle->height;
+        int format = handle->format;
+        int usage = handle->usage;
+        int err;
+        bool fmt_chg = false;
+        int fmt_bak = format;
+	uint32_t flags = 0;
+	rk_buffer_layout_t layout;
+	uint64_t base_format;
+	size_t vdec_metadata_size;
+	size_t vdec_metadata_offset;
+    /* 'handle' 引用的 buffer 是否已经 (在另一个进程中) 被分配, 即当前是 import. */
+	const bool is_import = (handle->prime_fd >= 0);
+
+        ALOGD("enter, w : %d, h : %d, format : 0x%x, usage : 0x%x.", w, h, format, usage);
+
+    if ( NULL == rk_drv )
+    {
+        rk_drv = s_rk_drv;
+    }
+
+	if ( rk_compute_buffer_layout(rk_drv, handle, &layout) != 0 )
+	{
+		return NULL;
+	}
+
+	internal_format = layout.internal_format;
+	alloc_type = layout.alloc_type;
+	pixel_stride = layout.pixel_stride;
+	byte_stride = layout.byte_stride;
+	size = layout.size;
+	internalWidth = layout.internal_width;
+	internalHeight = layout.internal_height;
+	vdec_metadata_size = layout.vdec_metadata_size;
+	vdec_metadata_offset = layout.vdec_metadata_offset;
+	base_format = internal_format & MALI_GRALLOC_INTFMT_FMT_MASK;
+
+    /*-------------------------------------------------------*/
+
+#if (1 == MALI_ARCHITECTURE_UTGARD)
+	/* match the framebuffer format */
+	if (usage & GRALLOC_USAGE_HW_FB)
+	{
+#ifdef GRALLOC_16_BITS
+		format = HAL_PIXEL_FORMAT_RGB_565;
+#else
+		format = HAL_PIXEL_FORMAT_RGBA_8888;
+#endif //end of GRALLOC_16_BITS
+	}
+#endif //end of MALI_ARCHITECTURE_UTGARD
+#endif //end of RK_DRM_GRALLOC
+
+    /*-------------------------------------------------------*/
+
+	buf = (struct rockchip_buffer*)calloc(1, sizeof(*buf));
+	if (!buf) {
+#if RK_DRM_GRALLOC
+		ALOGE("Failed to allocate buffer wrapper\n");
+#else
+                ALOGE("Failed to allocate buffer wrapper\n");
+#endif
+		return NULL;
+	}
+    buf->bo = NULL;
+
+    /*-------------------------------------------------------*/
+
+#if !RK_DRM_GRALLOC
+        cpp = gralloc_drm_get_bpp(handle->format);
+        if (!cpp) {
+                ALOGE("unrecognized format 0x%x", handle->format);
+                return NULL;
+        }
+
+	aligned_width = handle->width;
+	aligned_height = handle->height;
+	gralloc_drm_align_geometry(handle->format,
+			&aligned_width, &aligned_height);
+
+	/* TODO: We need to sort out alignment */
+	pitch = ALIGN(aligned_width * cpp, 64);
+	size = aligned_height * pitch;
+
+	if (handle->format == HAL_PIXEL_FORMAT_YCbCr_420_888) {
+		/*
+		 * WAR for H264 decoder requiring additional space
+		 * at the end of destination buffers.
+		 */
+		uint32_t w_mbs, h_mbs;
+
+		w_mbs = ALIGN(handle->width, 16) / 16;
+		h_mbs = ALIGN(handle->height, 16) / 16;
+		size += 64 * w_mbs * h_mbs;
+	}
+#endif
+
+    /*-------------------------------------------------------*/
+    // 根据 'usage' 预置待 alloc 或 import 的 flags, cachable 或 物理连续 等.
+
+	flags = rk_get_bo_flags(format, usage);
+
+	/* alloc 时物理连续分配可能已经 fall back 到 IOMMU buffer, 此时 handle 中没有物理地址. */
+	if ( is_import && (flags & ROCKCHIP_BO_CONTIG) && 0 == handle->phy_addr )
+	{
+		flags &= ~ROCKCHIP_BO_CONTIG;
+	}
+
+    /*-------------------------------------------------------*/
+    // 完成 alloc 或 import buffer.
+
+	buf->flags = flags;
+
+    /* 若 buufer 实际上已经分配 (通常在另一个进程中), 则 将 buffer import 到 当前进程, ... */
+	if (handle->prime_fd >= 0) {
+        /* alloc 的进程推迟了分配且尚未 commit 的 buffer, 先请求 alloc 的进程 commit. */
+        if ( rk_commit_is_placeholder(handle->prime_fd) && rk_replace_commit_placeholder(handle) != 0 )
+        {
+            goto failed_to_import_dma_buf;
+        }
+
+        /* 若当前进程只需要 CPU 访问, 则不 import 为 gem_object, 之后的 CPU 映射直接 mmap dma_buf. */
+        if ( android_atomic_acquire_load(&rk_drv->m_cpu_only_import) )
+        {
+            ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "cpu only import, prime_fd : %d.", handle->prime_fd);
+        }
+        else
+        {
+            /* 将 prime_fd 引用的 dma_buf, import 为 当前进程的 gem_object, 得到对应的 gem_handle 的 value. */
+            /* 对 sub-alloc 的 buffer, 映射从 parent bo 的起始覆盖到 buffer 的末尾. */
+            buf->bo = rk_drm_adapter_import_dma_buf(rk_drv, handle->prime_fd, flags, (size_t)handle->offset + size);
+            if ( NULL == buf->bo )
+            {
+                ALOGE("failed to import dma_buf, prime_fd : %d.", handle->prime_fd);
+                goto failed_to_import_dma_buf;
+            }
+            buf->base.fb_handle = rk_drm_adapter_get_gem_handle(buf->bo);
+        }
+	}
+    else if ( rk_should_suballoc(rk_drv, handle, internal_format, flags, size) )
+    {
+        /* 从共享的 chunk 中分配, 不创建独立的 gem_obj 和 dma_buf. */
+        buf->bo = rk_suballoc_create_bo(rk_drv, buf, handle, size, flags);
+        if ( NULL == buf->bo )
+        {
+            ALOGE("failed to suballoc bo, size : %zu", size);
+            goto failed_to_alloc_buf;
+        }
+        buf->base.fb_handle = rk_drm_adapter_get_gem_handle(buf->bo);
+    }
+    else if ( rk_should_use_scanout_arena(rk_drv, handle, flags)
+              && (buf->bo = rk_scanout_arena_create_bo(rk_drv, buf, handle, size, internal_format) ) != NULL )
+    {
+        /* 从预留的 scanout arena 中分配, arena 不可用或已满时在下面推迟或单独分配. */
+        buf->base.fb_handle = rk_drm_adapter_get_gem_handle(buf->bo);
+    }
+    else if ( rk_should_defer_backing(rk_drv, handle, flags)
+              && rk_create_commit_placeholder(rk_drv, buf, handle) == 0 )
+    {
+        /*
+         * 只计算 layout 并填写 handle, prime_fd 是 placeholder.
+         * backing memory 在 drm_gem_rockchip_commit() 中, 或在 import 的进程通过 placeholder 请求时分配.
+         */
+        buf->backing_deferred = 1;
+    }
+    else    // if (handle->prime_fd >= 0), 即 buffer 未实际分配, 将 分配, ...
+    {
+        if ( rk_create_backing(rk_drv, buf, handle, size, internal_format) != 0 )
+        {
+            goto failed_to_alloc_buf;
+        }
+	}   // if (handle->prime_fd >= 0)
+
+    /*-------------------------------------------------------*/
+
+#if RK_DRM_GRALLOC
+#if MALI_AFBC_GRALLOC == 1
+        /*
+         * If handle has been dup,then the fd is a negative number.
+         * Either you should close it or don't allocate the fd agagin.
+         * Otherwize,it will leak fd.
+         */
+        if(handle->share_attr_fd < 0)
+        {
+                err = gralloc_buffer_attr_allocate( handle );
+                //ALOGD("err=%d,isfb=%x,[%d,%x]",err,usage & GRALLOC_USAGE_HW_FB,hnd->share_attr_fd,hnd->attr_base);
+                if( err < 0 )
+                {
+                        if ( (usage & GRALLOC_USAGE_HW_FB) )
+                        {
+                                /*
+                                 * Having the attribute region is not critical for the framebuffer so let it pass.
+                                 */
+                                err = 0;
+                        }
+                        else
+                        {
+                                drm_gem_rockchip_free( drv, &buf->base );
+                                goto err_unref;
+                        }
+                }
+                else if ( internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK )
+                {
+                        init_afbc_attrs(handle, internal_format, usage);
+                }
+		}
+#endif
+#ifdef USE_HWC2
+	/*
+	 * If handle has been dup,then the fd is a negative number.
+	 * Either you should close it or don't allocate the fd agagin.
+	 * Otherwize,it will leak fd.
+	 */
+	if(handle->ashmem_fd < 0)
+	{
+			err = gralloc_rk_ashmem_allocate( handle );
+			//ALOGD("err=%d,isfb=%x,[%d,%x]",err,usage & GRALLOC_USAGE_HW_FB,hnd->share_attr_fd,hnd->attr_base);
+			if( err < 0 )
+			{
+					if ( (usage & GRALLOC_USAGE_HW_FB) )
+					{
+							/*
+							 * Having the attribute region is not critical for the framebuffer so let it pass.
+							 */
+							err = 0;
+					}
+					else
+					{
+							drm_gem_rockchip_free( drv, &buf->base );
+							goto err_unref;
+					}
+			}
+	}
+#endif
+
+    /*-------------------------------------------------------*/
+    // 处理 private usage.
+
+    rk_fill_yuv_info(handle, usage);
+    
+    /*-------------------------------------------------------*/
+
+        handle->stride = byte_stride;//pixel_stride;
+        handle->pixel_stride = pixel_stride;
+        handle->byte_stride = byte_stride;
+        handle->format = fmt_chg ? fmt_bak : format;
+        handle->size = size;
+        handle->internalWidth = internalWidth;
+        handle->internalHeight = internalHeight;
+        handle->internal_format = internal_format;
+        fill_yuv_plane_layout(base_format, alloc_type, byte_stride, h, get_yuv_plane_align(usage),
+                              &(handle->num_planes), handle->plane_info, &(handle->ycbcr_info) );
+        handle->metadata_offset = (vdec_metadata_size != 0) ? (uint32_t)vdec_metadata_offset : 0;
+        handle->metadata_size = (uint32_t)vdec_metadata_size;
+#else
+        handle->stride = pitch;
+#endif
+        handle->name = 0;
+	buf->base.handle = handle;
+	buf->capacity = size;
+	rk_store_resolved_planes(buf);
+	if ( buf->backing_deferred )
+	{
+		/* commit 时才计入 ledger. */
+		Mutex::Autolock _l(rk_drv->m_lazy_lock);
+
+		/* 之后 (包括 alloc 的进程 free 之后) 为 import 的进程 commit 时使用. */
+		buf->commit_entry->handle = *handle;
+		buf->commit_entry->handle.prime_fd = -1;
+		buf->commit_entry->capacity = size;
+
+		rk_drv->m_lazy_stats.deferred++;
+		rk_drv->m_lazy_stats.uncommitted++;
+		rk_drv->m_lazy_stats.uncommitted_bytes += size;
+	}
+	else
+	{
+		rk_add_to_mem_ledger(rk_drv, buf, base_format, is_import);
+	}
+	if ( !is_import )
+	{
+		rk_record_layout_overhead(rk_drv, handle, &layout);
+	}
+
+        ALOGD("leave, w : %d, h : %d, format : 0x%x,internal_format : 0x%" PRIx64 ", usage : 0x%x. size=%d,pixel_stride=%d,byte_stride=%d",
+                handle->width, handle->height, handle->format,internal_format, handle->usage, handle->size,
+                pixel_stride,byte_stride);
+        ALOGD("leave: prime_fd=%d,share_attr_fd=%d",handle->prime_fd,handle->share_attr_fd);
+
+	return &buf->base;
+
+err_unref:
+    if ( rk_has_gem_obj(buf) )
+    {
+        rk_drm_adapter_destroy_rockchip_bo(rk_drv, buf->bo);
+    }
+    rk_suballoc_release(rk_drv, buf);
+
+failed_to_import_dma_buf:
+failed_to_alloc_buf:
+	free(buf);
+	return NULL;
+}
+
+void drm_gem_rockchip_free(struct gralloc_drm_drv_t *drv,
+		struct gralloc_drm_bo_t *bo)
+{
+	struct rockchip_buffer *buf = (struct rockchip_buffer *)bo;
+    struct rk_driver_of_gralloc_drm_device_t *rk_drv = (struct rk_driver_of_gralloc_drm_device_t *)drv;
+    struct gralloc_drm_handle_t *gr_handle = gralloc_drm_handle((buffer_handle_t)bo->handle);
+
+    if ( NULL == rk_drv )
+    {
+        rk_drv = s_rk_drv;
+    }
+
+        if (!gr_handle)
+        {
+                ALOGE("%s: invalid handle",__FUNCTION__);
+                gralloc_drm_unlock_handle((buffer_handle_t)bo->handle);
+                return;
+        }
+
+#if RK_DRM_GRALLOC
+#if MALI_AFBC_GRALLOC == 1
+	gralloc_buffer_attr_free( gr_handle );
+#endif
+
+#ifdef USE_HWC2
+	gralloc_rk_ashmem_free( gr_handle );
+#endif
+	if (gr_handle->prime_fd)
+		close(gr_handle->prime_fd);
+
+	gr_handle->prime_fd = -1;
+#endif
+        gralloc_drm_unlock_handle((buffer_handle_t)bo->handle);
+
+    /* 先从 ledger 中移除, 之后 trim 不会再访问 'buf'. */
+    rk_mem_ledger_remove(&rk_drv->m_mem_ledger, &buf->ledger_entry);
+
+    /* 尚未 commit 的 buffer 的 commit_entry 在所有进程都关闭了 placeholder (上面关闭了当前进程的 prime_fd) 之后被释放. */
+
+    if ( buf->dma_buf_vaddr != NULL )
+    {
+        munmap(buf->dma_buf_vaddr, buf->dma_buf_map_size);
+        buf->dma_buf_vaddr = NULL;
+    }
+
+    free(buf->view_shadow);
+    buf->view_shadow = NULL;
+
+    ALOGD("rk_drv : %p", rk_drv);
+    if ( rk_has_gem_obj(buf) )
+    {
+        rk_drm_adapter_destroy_rockchip_bo(rk_drv, buf->bo); // rk_drv : 0x0
+    }
+    rk_suballoc_release(rk_drv, buf);
+
+	free(buf);
+}
+
+/*
+ * rk_driver_of_gralloc_drm_device 中对 driver_of_gralloc_drm_device 的 commit 方法的具体实现.
+ * 为 alloc 时推迟了分配的 'bo' 分配 backing memory, 大小为 'capacity' (reshape 可能已经改变了 layout),
+ * 并以 dma_buf 替换当前进程的 handle 中的 placeholder.
+ * import 的进程可能已经请求过 commit, 此时 import 已有的 dma_buf.
+ */
+static int drm_gem_rockchip_commit(struct gralloc_drm_drv_t *drv, struct gralloc_drm_bo_t *bo)
+{
+    struct rk_driver_of_gralloc_drm_device_t* rk_drv = (struct rk_driver_of_gralloc_drm_device_t*)drv;
+    struct rockchip_buffer* buf = (struct rockchip_buffer*)bo;
+    struct gralloc_drm_handle_t* handle = bo->handle;
+    rk_commit_entry_t* entry;
+    int ret;
+
+    if ( !android_atomic_acquire_load(&buf->backing_deferred) )
+    {
+        return 0;
+    }
+
+    Mutex::Autolock _l(rk_drv->m_lazy_lock);
+
+    /* 另一个线程已经完成 commit. */
+    if ( !buf->backing_deferred )
+    {
+        return 0;
+    }
+
+    entry = buf->commit_entry;
+    ret = rk_commit_entry_locked(rk_drv, entry, buf);
+    if ( ret != 0 )
+    {
+        return ret;
+    }
+
+    if ( !rk_has_gem_obj(buf) )
+    {
+        buf->bo = rk_drm_adapter_import_dma_buf(rk_drv, entry->handle.prime_fd, entry->flags, buf->capacity);
+        if ( NULL == buf->bo )
+        {
+            ALOGE("failed to import committed dma_buf, prime_fd : %d.", entry->handle.prime_fd);
+            return -ENOMEM;
+        }
+        buf->base.fb_handle = rk_drm_adapter_get_gem_handle(buf->bo);
+    }
+
+    /* fd 的值不变, 已经交给其他进程的 handle 中的 placeholder 不受影响, 仍由 'entry' 服务. */
+    if ( dup2(entry->handle.prime_fd, handle->prime_fd) < 0 )
+    {
+        ret = -errno;
+        ALOGE("failed to replace placeholder %d, err : %s.", handle->prime_fd, strerror(-ret) );
+        return ret;
+    }
+
+    buf->flags = entry->flags;
+    handle->phy_addr = entry->handle.phy_addr;
+    rk_store_resolved_planes(buf);
+    rk_add_to_mem_ledger(rk_drv, buf, handle->internal_format & MALI_GRALLOC_INTFMT_FMT_MASK, false);
+    /* 当前进程的 placeholder 已经关闭, 'entry' 可能在其他进程关闭 placeholder 之后随时被释放. */
+    buf->commit_entry = NULL;
+    android_atomic_release_store(0, &buf->backing_deferred);
+
+    ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "committed deferred buffer, size : %zu, prime_fd : %d.", buf->capacity, handle->prime_fd);
+    return 0;
+}
+
+/*
+ * 返回调用线程到目前为止发生的 minor page fault 的个数.
+ */
+static inline long rk_get_thread_minflt()
+{
+    struct rusage usage;
+
+    if ( getrusage(RUSAGE_THREAD, &usage) != 0 )
+    {
+        return 0;
+    }
+
+    return usage.ru_minflt;
+}
+
+static inline bool rk_should_prefault(const struct rk_driver_of_gralloc_drm_device_t* rk_drv, int usage)
+{
+    return rk_drv->m_prefault_enabled
+        && ( (usage & GRALLOC_USAGE_SW_READ_MASK) == GRALLOC_USAGE_SW_READ_OFTEN
+            || (usage & GRALLOC_USAGE_SW_WRITE_MASK) == GRALLOC_USAGE_SW_WRITE_OFTEN );
+}
+
+/*
+ * 预先建立 'addr' 开始, 长度为 'size' 的 CPU 映射的页表.
+ * 优先使用 MADV_POPULATE_WRITE/READ (和 MAP_POPULATE 等效), kernel 不支持时, 逐页访问一次 :
+ * 'for_write' 时读出每页的首个 byte 再写回, 使 write fault 也在这里发生, 否则只读.
+ *
+ * @return
+ *      被 prefault 的 page 的个数.
+ */
+static size_t rk_prefault_mapping(void* addr, size_t size, bool for_write)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t n_pages = (size + page_size - 1) / page_size;
+    volatile uint8_t* p = (volatile uint8_t*)addr;
+    size_t i;
+
+    if ( 0 == madvise(addr, size, for_write ? MADV_POPULATE_WRITE : MADV_POPULATE_READ) )
+    {
+        return n_pages;
+    }
+
+    if ( errno != EINVAL )
+    {
+        ALOGW("madvise populate failed, err : %s", strerror(errno));
+        return 0;
+    }
+
+    /* kernel < 5.14, 没有 MADV_POPULATE_*. */
+    for ( i = 0; i < n_pages; i++ )
+    {
+        if ( for_write )
+        {
+            p[i * page_size] = p[i * page_size];
+        }
+        else
+        {
+            (void)p[i * page_size];
+        }
+    }
+
+    return n_pages;
+}
+
+/*
+ * 对 HAL_PIXEL_FORMAT_YCrCb_NV12_10 (及其别名 YCrCb_420_SP_10), handle->width 实际上是 video_decoder 要求的 byte_stride,
+ * 每行的 10 bit sample 数由 byte_stride 得到.
+ */
+static int get_nv12_10_samples_per_row(const struct gralloc_drm_handle_t* handle)
+{
+    return handle->byte_stride * 8 / 10;
+}
+
+/*
+ * 获取 RGB 格式的 AFBC buffer 'handle' 的 superblock layout, 与 alloc 时 get_rgb_stride_and_size() 的计算一致.
+ * @return
+ *      若 buffer 不是可以在 CPU 一侧解码的 AFBC buffer, 返回 -EINVAL.
+ */
+static int get_afbc_layout(const struct gralloc_drm_handle_t* handle, rk_afbc_layout_t* layout)
+{
+    uint64_t internal_format = handle->internal_format;
+    int w_aligned;
+    int h_aligned;
+    int buffer_byte_alignment = AFBC_BODY_BUFFER_BYTE_ALIGNMENT;
+
+    if ( 0 == (internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK)
+        || (internal_format & MALI_GRALLOC_INTFMT_AFBC_SPLITBLK) )
+    {
+        return -EINVAL;
+    }
+
+    switch ( internal_format & MALI_GRALLOC_INTFMT_FMT_MASK )
+    {
+        case MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888:
+        case MALI_GRALLOC_FORMAT_INTERNAL_RGBX_8888:
+        case MALI_GRALLOC_FORMAT_INTERNAL_BGRA_8888:
+            layout->bytes_per_pixel = 4;
+            break;
+        case MALI_GRALLOC_FORMAT_INTERNAL_RGB_888:
+            layout->bytes_per_pixel = 3;
+            break;
+        case MALI_GRALLOC_FORMAT_INTERNAL_RGB_565:
+            layout->bytes_per_pixel = 2;
+            break;
+        default:
+            return -EINVAL;
+    }
+
+    layout->width = handle->width;
+    layout->height = handle->height;
+    layout->tiled_headers = (internal_format & MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS) != 0;
+
+    if ( internal_format & MALI_GRALLOC_INTFMT_AFBC_WIDEBLK )
+    {
+        layout->sb_width = 32;
+        layout->sb_height = 8;
+    }
+    else
+    {
+        layout->sb_width = AFBC_PIXELS_PER_BLOCK;
+        layout->sb_height = AFBC_PIXELS_PER_BLOCK;
+    }
+
+    if ( layout->tiled_headers )
+    {
+        bool wideblk = (internal_format & MALI_GRALLOC_INTFMT_AFBC_WIDEBLK) != 0;
+
+        w_aligned = GRALLOC_ALIGN(handle->width, wideblk ? AFBC_TILED_HEADERS_WIDEBLK_WIDTH_ALIGN : AFBC_TILED_HEADERS_BASIC_WIDTH_ALIGN);
+        h_aligned = GRALLOC_ALIGN(handle->height, wideblk ? AFBC_TILED_HEADERS_WIDEBLK_HEIGHT_ALIGN : AFBC_TILED_HEADERS_BASIC_HEIGHT_ALIGN);
+        buffer_byte_alignment = 4 * AFBC_BODY_BUFFER_BYTE_ALIGNMENT;
+    }
+    else if ( handle->usage & MALI_GRALLOC_USAGE_AFBC_PADDING )
+    {
+        w_aligned = GRALLOC_ALIGN(handle->width, 64);
+        h_aligned = GRALLOC_ALIGN(handle->height, AFBC_NORMAL_HEIGHT_ALIGN);
+    }
+    else if ( internal_format & MALI_GRALLOC_INTFMT_AFBC_WIDEBLK )
+    {
+        w_aligned = GRALLOC_ALIGN(handle->width, AFBC_WIDEBLK_WIDTH_ALIGN);
+        h_aligned = GRALLOC_ALIGN(handle->height, AFBC_WIDEBLK_HEIGHT_ALIGN);
+    }
+    else
+    {
+        w_aligned = GRALLOC_ALIGN(handle->width, AFBC_NORMAL_WIDTH_ALIGN);
+        h_aligned = GRALLOC_ALIGN(handle->height, AFBC_NORMAL_HEIGHT_ALIGN);
+    }
+
+    layout->sb_cols = w_aligned / layout->sb_width;
+    layout->sb_rows = h_aligned / layout->sb_height;
+    /* header 区中 header 的个数总是按 16x16 的 block 计算. */
+    layout->body_offset = GRALLOC_ALIGN( (size_t)(w_aligned / AFBC_PIXELS_PER_BLOCK) * (h_aligned / AFBC_PIXELS_PER_BLOCK)
+                                         * AFBC_HEADER_BUFFER_BYTES_PER_BLOCKENTRY,
+                                         buffer_byte_alignment);
+    layout->buffer_size = handle->size;
+
+    return 0;
+}
+
+/*
+ * 将 'buf' 的线性副本 'buf->view_shadow' 编码为 AFBC, 写入 'native' (buffer 自身的映射),
+ * 并在 buffer 的 attribute region 中记录编码方式, 供 GPU 和 hwc 解码时使用.
+ */
+static int rk_encode_afbc_view(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                               struct rockchip_buffer* buf,
+                               const rk_afbc_layout_t* layout,
+                               uint8_t* native)
+{
+    struct gralloc_drm_handle_t* handle = buf->base.handle;
+    size_t payload_size = 0;
+    int use_yuv_transform = 0;
+    int use_sparse_alloc = 1;
+    uint64_t start_ns = rk_get_time_ns();
+    int ret;
+
+    ret = rk_afbc_encode( (const uint8_t*)(buf->view_shadow), handle->byte_stride, layout, native, &payload_size);
+    if ( ret != 0 )
+    {
+        ALOGE("failed to encode afbc buffer %p, internal_format : 0x%" PRIx64 ", ret : %d.",
+              handle, handle->internal_format, ret);
+        return ret;
+    }
+
+    {
+        Mutex::Autolock _l(rk_drv->m_stats_lock);
+
+        rk_drv->m_afbc_encode_stats.encodes++;
+        rk_drv->m_afbc_encode_stats.linear_bytes += (uint64_t)layout->width * layout->height * layout->bytes_per_pixel;
+        rk_drv->m_afbc_encode_stats.payload_bytes += payload_size;
+        rk_drv->m_afbc_encode_stats.total_ns += rk_get_time_ns() - start_ns;
+    }
+
+    ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "encoded afbc buffer %p, %dx%d, payload : %zu bytes, linear : %zu bytes.",
+             handle, layout->width, layout->height, payload_size,
+             (size_t)layout->width * layout->height * layout->bytes_per_pixel);
+
+    if ( gralloc_buffer_attr_map(handle, 1) != 0 )
+    {
+        ALOGE("failed to map attr region of buffer %p to update afbc attrs.", handle);
+        return 0;
+    }
+
+    gralloc_buffer_attr_write(handle, GRALLOC_ARM_BUFFER_ATTR_AFBC_YUV_TRANS, &use_yuv_transform);
+    gralloc_buffer_attr_write(handle, GRALLOC_ARM_BUFFER_ATTR_AFBC_SPARSE_ALLOC, &use_sparse_alloc);
+
+    gralloc_buffer_attr_unmap(handle);
+    return 0;
+}
+
+/*
+ * 在 CPU 一侧, 将 'buf' 的数据在 'native' (buffer 自身的映射) 和 'buf->view_shadow' 之间转换.
+ * to_view : true, native -> view; false, view -> native.
+ */
+static int rk_convert_lock_view(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                                struct rockchip_buffer* buf,
+                                const struct gralloc_drm_handle_t* handle,
+                                void* native,
+                                bool to_view)
+{
+    const struct gralloc_drm_bo_t* bo = &(buf->base);
+    uint8_t* native_base = (uint8_t*)native;
+    uint8_t* view_base = (uint8_t*)(buf->view_shadow);
+    int samples;
+    uint32_t i;
+
+    if ( GRALLOC_DRM_LOCK_VIEW_AFBC_ENCODE_ON_UNLOCK == bo->lock_view )
+    {
+        rk_afbc_layout_t layout;
+        int ret;
+
+        ret = get_afbc_layout(handle, &layout);
+        if ( ret != 0 )
+        {
+            ALOGE("buffer %p is not a cpu accessible afbc buffer, internal_format : 0x%" PRIx64,
+                  handle, handle->internal_format);
+            return ret;
+        }
+
+        if ( !to_view )
+        {
+            return rk_encode_afbc_view(rk_drv, buf, &layout, native_base);
+        }
+
+        /*
+         * buffer 中有 GPU 写入的压缩数据时, CPU 无法解码, lock 失败.
+         * 不能以空白的副本代替 : unlock 时副本被整体编码写回, CPU 只修改了一部分时, buffer 中其余的内容将丢失.
+         */
+        ret = rk_afbc_decode(native_base, &layout, view_base, handle->byte_stride);
+        if ( -ENOTSUP == ret )
+        {
+            ALOGE("afbc buffer %p has compressed (gpu rendered) blocks, can not be locked with view %d.",
+                  handle, bo->lock_view);
+        }
+        else if ( ret != 0 )
+        {
+            ALOGE("failed to decode afbc buffer %p, internal_format : 0x%" PRIx64 ", ret : %d.",
+                  handle, handle->internal_format, ret);
+        }
+        return ret;
+    }
+
+    samples = get_nv12_10_samples_per_row(handle);
+
+    for ( i = 0; i < bo->view_num_planes && i < handle->num_planes; i++ )
+    {
+        int rows = (0 == i) ? handle->height : GRALLOC_ALIGN(handle->height, 2) / 2;
+        uint8_t* src = native_base + handle->plane_info[i].offset;
+        uint8_t* dst = view_base + bo->view_plane_info[i].offset;
+
+        if ( to_view )
+        {
+            rk_unpack_10bit_to_p010(src, handle->plane_info[i].byte_stride,
+                                    dst, bo->view_plane_info[i].byte_stride,
+                                    samples, rows);
+        }
+        else
+        {
+            rk_pack_p010_to_10bit(dst, bo->view_plane_info[i].byte_stride,
+                                  src, handle->plane_info[i].byte_stride,
+                                  samples, rows);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * 开始一次会访问 'buf' 的缓存 (CPU 映射, lock view 副本) 的操作, 若 'buf' 正在被 trim, 等待 trim 完成.
+ */
+static void rk_begin_cpu_access(struct rockchip_buffer* buf)
+{
+    for (;;)
+    {
+        int32_t refs = android_atomic_acquire_load(&buf->cpu_access_refs);
+
+        if ( refs >= 0 && 0 == android_atomic_acquire_cas(refs, refs + 1, &buf->cpu_access_refs) )
+        {
+            return;
+        }
+
+        if ( refs < 0 )
+        {
+            sched_yield();
+        }
+    }
+}
+
+static void rk_end_cpu_access(struct rockchip_buffer* buf)
+{
+    android_atomic_dec(&buf->cpu_access_refs);
+}
+
+/*
+ * 设置 'bo' 的 lock view, 调用者必须已经调用 rk_begin_cpu_access().
+ */
+static int rk_set_lock_view(struct gralloc_drm_drv_t *drv,
+                            struct gralloc_drm_bo_t *bo,
+                            int view)
+{
+    struct rockchip_buffer* buf = (struct rockchip_buffer*)bo;
+    struct gralloc_drm_handle_t* handle = bo->handle;
+    uint64_t base_format = handle->internal_format & MALI_GRALLOC_INTFMT_FMT_MASK;
+
+    UNUSED(drv);
+
+    switch ( view )
+    {
+        case GRALLOC_DRM_LOCK_VIEW_NATIVE:
+            break;
+
+        case GRALLOC_DRM_LOCK_VIEW_P010:
+        {
+            int samples;
+            size_t size;
+
+            if ( (base_format != HAL_PIXEL_FORMAT_YCrCb_NV12_10 && base_format != HAL_PIXEL_FORMAT_YCrCb_420_SP_10)
+                || 0 == handle->num_planes )
+            {
+                ALOGE("p010 view is only for uncompressed NV12_10, internal_format : 0x%" PRIx64,
+                      handle->internal_format);
+                return -EINVAL;
+            }
+
+            samples = get_nv12_10_samples_per_row(handle);
+            fill_yuv_plane_layout(MALI_GRALLOC_FORMAT_INTERNAL_P010,
+                                  UNCOMPRESSED,
+                                  GRALLOC_ALIGN(samples * 2, YUV_ANDROID_PLANE_ALIGN),
+                                  handle->height,
+                                  YUV_ANDROID_PLANE_ALIGN,
+                                  &(bo->view_num_planes),
+                                  bo->view_plane_info,
+                                  &(bo->view_ycbcr_info) );
+
+            size = bo->view_plane_info[1].offset
+                   + (size_t)bo->view_plane_info[1].byte_stride * (GRALLOC_ALIGN(handle->height, 2) / 2);
+            if ( buf->view_shadow != NULL && buf->view_shadow_size != size )
+            {
+                free(buf->view_shadow);
+                buf->view_shadow = NULL;
+            }
+            buf->view_shadow_size = size;
+            break;
+        }
+
+        case GRALLOC_DRM_LOCK_VIEW_AFBC_ENCODE_ON_UNLOCK:
+        {
+            rk_afbc_layout_t layout;
+            size_t size;
+
+            if ( get_afbc_layout(handle, &layout) != 0 )
+            {
+                ALOGE("afbc lock view is only for rgb afbc buffers without split block, internal_format : 0x%" PRIx64,
+                      handle->internal_format);
+                return -EINVAL;
+            }
+
+            /* 线性 RGB 只有一个 plane. */
+            bo->view_num_planes = 1;
+            memset(bo->view_plane_info, 0, sizeof(bo->view_plane_info) );
+            memset(&(bo->view_ycbcr_info), 0, sizeof(bo->view_ycbcr_info) );
+            bo->view_plane_info[0].byte_stride = handle->byte_stride;
+
+            size = (size_t)handle->byte_stride * handle->height;
+            if ( buf->view_shadow != NULL && buf->view_shadow_size != size )
+            {
+                free(buf->view_shadow);
+                buf->view_shadow = NULL;
+            }
+            buf->view_shadow_size = size;
+            break;
+        }
+
+        default:
+            ALOGE("unknown lock view : %d", view);
+            return -EINVAL;
+    }
+
+    if ( GRALLOC_DRM_LOCK_VIEW_NATIVE == view )
+    {
+        free(buf->view_shadow);
+        buf->view_shadow = NULL;
+        buf->view_shadow_size = 0;
+        bo->view_num_planes = 0;
+    }
+
+    bo->lock_view = view;
+    return 0;
+}
+
+/*
+ * rk_driver_of_gralloc_drm_device 中对 driver_of_gralloc_drm_device 的 set_lock_view 方法的具体实现.
+ */
+static int drm_gem_rockchip_set_lock_view(struct gralloc_drm_drv_t *drv,
+                                          struct gralloc_drm_bo_t *bo,
+                                          int view)
+{
+    struct rockchip_buffer* buf = (struct rockchip_buffer*)bo;
+    int ret;
+
+    rk_begin_cpu_access(buf);
+    ret = rk_set_lock_view(drv, bo, view);
+    rk_end_cpu_access(buf);
+
+    return ret;
+}
+
+/*
+ * 按 alloc 的逻辑计算新的 layout, 若 buffer 容纳得下, 且需要的 ROCKCHIP_BO_* flags 不变, 则就地改写 handle.
+ * 只用于当前进程 alloc 的 buffer, layout 与 alloc 时一样由当前进程的 format caps 决定.
+ * 调用者必须已经调用 rk_begin_cpu_access().
+ */
+static int rk_reshape(struct gralloc_drm_drv_t *drv,
+                      struct gralloc_drm_bo_t *bo,
+                      int width,
+                      int height,
+                      int format,
+                      int usage)
+{
+    struct rk_driver_of_gralloc_drm_device_t* rk_drv = (struct rk_driver_of_gralloc_drm_device_t*)drv;
+    struct rockchip_buffer* buf = (struct rockchip_buffer*)bo;
+    struct gralloc_drm_handle_t* handle = bo->handle;
+    struct gralloc_drm_handle_t probe = *handle;
+    rk_buffer_layout_t layout;
+    uint64_t base_format;
+
+    if ( bo->imported )
+    {
+        ALOGE("can't reshape an imported buffer, only the allocating process can.");
+        return -EPERM;
+    }
+
+    /* 按新的参数, 以 alloc (而不是 import) 的方式选择 internal_format 和计算 layout, metadata 区也按新的尺寸计算. */
+    probe.width = width;
+    probe.height = height;
+    probe.format = format;
+    probe.usage = usage;
+    probe.prime_fd = -1;
+
+    if ( rk_compute_buffer_layout(rk_drv, &probe, &layout) != 0 )
+    {
+        ALOGE("failed to compute layout for reshape, w : %d, h : %d, format : 0x%x, usage : 0x%x.",
+              width, height, format, usage);
+        return -EINVAL;
+    }
+
+    if ( layout.size > buf->capacity )
+    {
+        ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "can't reshape in place, size : %zu, capacity : %zu.", layout.size, buf->capacity);
+        return -ENOSPC;
+    }
+
+    if ( rk_get_bo_flags(format, usage) != rk_get_bo_flags(handle->format, handle->usage) )
+    {
+        ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "can't reshape in place, bo flags changed, usage : 0x%x -> 0x%x.",
+                 handle->usage, usage);
+        return -EINVAL;
+    }
+
+#if MALI_AFBC_GRALLOC == 1
+    if ( (layout.internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK) && handle->share_attr_fd < 0 )
+    {
+        ALOGE("can't reshape to afbc without attr region.");
+        return -EINVAL;
+    }
+#endif
+
+    /* 副本的 layout 依赖原来的 geometry. */
+    rk_set_lock_view(drv, bo, GRALLOC_DRM_LOCK_VIEW_NATIVE);
+
+    base_format = layout.internal_format & MALI_GRALLOC_INTFMT_FMT_MASK;
+
+    handle->width = width;
+    handle->height = height;
+    handle->format = format;
+    handle->usage = usage;
+    handle->stride = layout.byte_stride;
+    handle->pixel_stride = layout.pixel_stride;
+    handle->byte_stride = layout.byte_stride;
+    handle->size = layout.size;
+    handle->internalWidth = layout.internal_width;
+    handle->internalHeight = layout.internal_height;
+    handle->internal_format = layout.internal_format;
+    fill_yuv_plane_layout(base_format, layout.alloc_type, layout.byte_stride, height, get_yuv_plane_align(usage),
+                          &(handle->num_planes), handle->plane_info, &(handle->ycbcr_info) );
+    handle->metadata_offset = (layout.vdec_metadata_size != 0) ? (uint32_t)layout.vdec_metadata_offset : 0;
+    handle->metadata_size = (uint32_t)layout.vdec_metadata_size;
+    rk_fill_yuv_info(handle, usage);
+
+    if ( layout.internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK )
+    {
+#if GRALLOC_INIT_AFBC == 1
+        void* addr = NULL;
+
+        /* 与 alloc 相同, 数据总是被 producer 完整写入的 buffer 不初始化 header. */
+        if ( rk_has_gem_obj(buf) && rk_get_zero_policy(rk_drv, layout.internal_format, usage) != RK_ZERO_NONE )
+        {
+            addr = rk_drm_adapter_map_rockchip_bo(buf->bo);
+        }
+
+        if ( addr != NULL )
+        {
+            init_afbc((uint8_t*)addr + handle->offset, layout.internal_format, width, height);
+        }
+#endif
+#if MALI_AFBC_GRALLOC == 1
+        init_afbc_attrs(handle, layout.internal_format, usage);
+#endif
+    }
+
+    handle->generation++;
+    rk_store_resolved_planes(buf);
+
+    if ( !buf->backing_deferred )
+    {
+        rk_mem_ledger_remove(&rk_drv->m_mem_ledger, &buf->ledger_entry);
+        rk_add_to_mem_ledger(rk_drv, buf, base_format, false);
+    }
+    else
+    {
+        Mutex::Autolock _l(rk_drv->m_lazy_lock);
+        rk_commit_entry_t* entry = buf->commit_entry;
+
+        /* 尚未被任何进程 commit 时, 之后按新的 layout 初始化 backing. */
+        if ( entry != NULL && entry->handle.prime_fd < 0 )
+        {
+            entry->handle = *handle;
+            entry->handle.prime_fd = -1;
+        }
+    }
+
+    ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "reshaped, w : %d, h : %d, format : 0x%x, internal_format : 0x%" PRIx64 ", size : %zu, generation : %u.",
+             width, height, format, layout.internal_format, layout.size, handle->generation);
+    return 0;
+}
+
+/*
+ * rk_driver_of_gralloc_drm_device 中对 driver_of_gralloc_drm_device 的 reshape 方法的具体实现.
+ */
+static int drm_gem_rockchip_reshape(struct gralloc_drm_drv_t *drv,
+                                    struct gralloc_drm_bo_t *bo,
+                                    int width,
+                                    int height,
+                                    int format,
+                                    int usage)
+{
+    struct rockchip_buffer* buf = (struct rockchip_buffer*)bo;
+    int ret;
+
+    rk_begin_cpu_access(buf);
+    ret = rk_reshape(drv, bo, width, height, format, usage);
+    rk_end_cpu_access(buf);
+
+    return ret;
+}
+
+/*
+ * 通过 mmap 'buf' 的 dma_buf 得到 CPU 映射, 映射将被缓存, 直到 'buf' 被 free.
+ */
+static void* rk_map_dma_buf(struct rockchip_buffer* buf, int prime_fd, size_t size)
+{
+    if ( NULL == buf->dma_buf_vaddr )
+    {
+        void* vaddr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, prime_fd, 0);
+
+        if ( MAP_FAILED == vaddr )
+        {
+            ALOGE("failed to mmap dma_buf, prime_fd : %d, size : %zu, err : %s", prime_fd, size, strerror(errno) );
+            return NULL;
+        }
+
+        buf->dma_buf_vaddr = vaddr;
+        buf->dma_buf_map_size = size;
+    }
+
+    return buf->dma_buf_vaddr;
+}
+
+/*
+ * 在 'buf' 首次被 lock (map 成功) 之后调用 : 按需 prefault, 并更新 rk_drm_map_stats_t.
+ *
+ * @param addr
+ *      'buf' 的 CPU 映射的地址.
+ * @param map_size
+ *      该映射的 byte 数.
+ * @param start_ns
+ *      本次 map 操作开始的时间.
+ */
+static void rk_drm_on_first_lock(struct rk_driver_of_gralloc_drm_device_t* rk_drv,
+                                 struct rockchip_buffer* buf,
+                                 int usage,
+                                 void* addr,
+                                 size_t map_size,
+                                 uint64_t start_ns)
+{
+    uint64_t prefault_start_ns = 0;
+    uint64_t now_ns;
+    uint64_t latency_ns;
+    long minflt = 0;
+    size_t n_pages = 0;
+    bool do_prefault;
+    rk_drm_map_stats_t& stats = rk_drv->m_map_stats;
+
+    /* 多个线程同时首次 lock 时, 只有一个线程继续. */
+    if ( android_atomic_acquire_cas(0, 1, &buf->locked_once) != 0 )
+    {
+        return;
+    }
+
+    do_prefault = !buf->prefaulted && rk_should_prefault(rk_drv, usage);
+
+    if ( do_prefault )
+    {
+        prefault_start_ns = rk_get_time_ns();
+        minflt = rk_get_thread_minflt();
+        n_pages = rk_prefault_mapping(addr, map_size, (usage & GRALLOC_USAGE_SW_WRITE_MASK) != 0);
+        buf->prefaulted = true;
+    }
+
+    buf->first_lock_minflt = rk_get_thread_minflt();
+    android_atomic_release_store(gettid(), &buf->first_lock_tid);
+
+    now_ns = rk_get_time_ns();
+    latency_ns = now_ns - start_ns;
+
+    Mutex::Autolock _l(rk_drv->m_stats_lock);
+
+    stats.first_lock_count++;
+    stats.first_lock_total_ns += latency_ns;
+    if ( latency_ns > stats.first_lock_max_ns )
+    {
+        stats.first_lock_max_ns = latency_ns;
+    }
+
+    if ( do_prefault )
+    {
+        stats.prefault_count++;
+        stats.prefault_pages += n_pages;
+        stats.prefault_faults += buf->first_lock_minflt - minflt;
+        stats.prefault_total_ns += now_ns - prefault_start_ns;
+    }
+}
+
+static int drm_gem_rockchip_map(struct gralloc_drm_drv_t *drv,
+		struct gralloc_drm_bo_t *bo, int x, int y, int w, int h,
+		int enable_write, void **addr)
+{
+	struct rockchip_buffer *buf = (struct rockchip_buffer *)bo;
+	struct rk_driver_of_gralloc_drm_device_t *rk_drv = (struct rk_driver_of_gralloc_drm_device_t *)drv;
+	struct gralloc_drm_handle_t *gr_handle = gralloc_drm_handle((buffer_handle_t)bo->handle);
+	struct dma_buf_sync sync_args;
+	int ret = 0, ret2 = 0;
+	bool first_lock = (0 == android_atomic_acquire_load(&buf->locked_once) );
+	uint64_t first_lock_start_ns = 0;
+	void *base_addr = NULL;
+	size_t map_size = 0;
+
+	UNUSED(x);
+	UNUSED(y);
+	UNUSED(w);
+	UNUSED(h);
+	UNUSED(enable_write);
+
+	/* 持有到对应的 unmap, 期间 CPU 映射和 lock view 副本不会被 trim. */
+	rk_begin_cpu_access(buf);
+
+	if (gr_handle->usage & GRALLOC_USAGE_PROTECTED)
+	{
+		*addr = NULL;
+		ALOGE("The secure buffer cann't be map");
+	}
+	else
+	{
+		if ( first_lock )
+		{
+			first_lock_start_ns = rk_get_time_ns();
+		}
+
+		/* sub-alloc 的 buffer 的数据从映射中的 'offset' 处开始. */
+		/* 没有 gem_obj 的 buffer (cpu_only_import) 只能通过 dma_buf 映射. */
+		if ( !rk_has_gem_obj(buf) || (bo->imported && rk_drv->m_map_imported_via_dma_buf) )
+		{
+			map_size = (size_t)gr_handle->offset + gr_handle->size;
+			base_addr = rk_map_dma_buf(buf, gr_handle->prime_fd, map_size);
+		}
+		else
+		{
+			map_size = buf->bo->size;
+			base_addr = rk_drm_adapter_map_rockchip_bo(buf->bo);
+		}
+		*addr = (base_addr != NULL) ? (uint8_t*)base_addr + gr_handle->offset : NULL;
+		if (!*addr) {
+			ALOGE("failed to map bo");
+			// LOG_ALWAYS_FATAL("failed to map bo");
+			ret = -1;
+		}
+#if RK_CTS_WORKROUND
+		else if (s_is_view_cts_process) {
+			int big_scale = android_atomic_acquire_load(&s_view_cts_big_scale);
+			static int iCnt = 0;
+
+			if(big_scale && (gr_handle->usage == 0x603 || gr_handle->usage == 0x203) ) {
+                /* 在 CPU 一侧将 buffer 中的数据设置为 case 预期的 value. */
+				memset(*addr,0xFF,gr_handle->height*gr_handle->byte_stride);
+				ALOGD_IF(1, "memset 0xff byte_stride=%d iCnt=%d",gr_handle->byte_stride,iCnt);
+				iCnt++;
+			}
+			if(iCnt == 400 && big_scale)
+			{
+				ModifyAppHintInFile(VIEW_CTS_FILE, VIEW_CTS_PROG_NAME, BIG_SCALE_HINT, &big_scale, 0, IMG_INT_TYPE);
+				android_atomic_release_store(0, &s_view_cts_big_scale);
+				ALOGD_IF(1,"reset big_scale");
+			}
+		}
+#endif
+
+		if ( *addr != NULL && first_lock )
+		{
+			rk_drm_on_first_lock(rk_drv, buf, gr_handle->usage, base_addr, map_size, first_lock_start_ns);
+		}
+	}
+
+	if(buf && (buf->flags & ROCKCHIP_BO_CACHABLE))
+	{
+		sync_args.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW;
+		ret2 = ioctl(bo->handle->prime_fd, DMA_BUF_IOCTL_SYNC, &sync_args);
+            // "DMA_BUF_SYNC_START", "DMA_BUF_IOCTL_SYNC" :
+            //      安全地获取 dma_buf 的 访问,
+            //      实现和 GPU 等设备对 buffer 访问操作的互斥, 即实现 "lock" 的语义.
+            //      这里, 对应的 ("DMA_BUF_SYNC_END", "DMA_BUF_IOCTL_SYNC") 在 drm_gem_rockchip_unmap 中被调用.
+
+		if (ret2 != 0)
+			ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "%s:DMA_BUF_IOCTL_SYNC start failed", __FUNCTION__);
+	}
+
+	/* 对非 NATIVE 视图, 在最外层 lock 时 (cache 已经 invalidate) 生成副本, 返回副本的地址. */
+	if ( *addr != NULL && bo->lock_view != GRALLOC_DRM_LOCK_VIEW_NATIVE )
+	{
+		if ( 0 == bo->lock_count )
+		{
+			if ( NULL == buf->view_shadow
+				&& 0 != posix_memalign(&(buf->view_shadow), 64, buf->view_shadow_size) )
+			{
+				ALOGE("failed to alloc shadow of lock view, size : %zu", buf->view_shadow_size);
+				buf->view_shadow = NULL;
+			}
+
+			if ( buf->view_shadow != NULL )
+			{
+				ret = rk_convert_lock_view(rk_drv, buf, gr_handle, *addr, true);
+				buf->view_native_addr = (0 == ret) ? *addr : NULL;
+			}
+			else
+			{
+				ret = -ENOMEM;
+			}
+		}
+
+		if ( 0 == ret )
+		{
+			*addr = buf->view_shadow;
+		}
+		else
+		{
+			/* lock 失败, 不会有对应的 unmap. */
+			*addr = NULL;
+			if ( buf->flags & ROCKCHIP_BO_CACHABLE )
+			{
+				sync_args.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW;
+				ioctl(bo->handle->prime_fd, DMA_BUF_IOCTL_SYNC, &sync_args);
+			}
+		}
+	}
+
+	if ( 0 == ret )
+	{
+		buf->map_refs++;
+	}
+	else
+	{
+		rk_end_cpu_access(buf);
+	}
+
+	gralloc_drm_unlock_handle((buffer_handle_t)bo->handle);
+	return ret;
+}
+
+static void drm_gem_rockchip_unmap(struct gralloc_drm_drv_t *drv,
+		struct gralloc_drm_bo_t *bo)
+{
+	struct rockchip_buffer *buf = (struct rockchip_buffer *)bo;
+	struct rk_driver_of_gralloc_drm_device_t *rk_drv = (struct rk_driver_of_gralloc_drm_device_t *)drv;
+	struct dma_buf_sync sync_args;
+	int ret = 0;
+	int32_t first_lock_tid = android_atomic_acquire_load(&buf->first_lock_tid);
+
+	/* 首次 lock 和 unlock 在同一线程中, 统计期间发生的 fault. */
+	if ( first_lock_tid != 0 && 0 == android_atomic_acquire_cas(first_lock_tid, 0, &buf->first_lock_tid) )
+	{
+		if ( first_lock_tid == gettid() )
+		{
+			long faults = rk_get_thread_minflt() - buf->first_lock_minflt;
+			Mutex::Autolock _l(rk_drv->m_stats_lock);
+
+			rk_drv->m_map_stats.first_lock_window_samples++;
+			rk_drv->m_map_stats.first_lock_window_faults += faults;
+		}
+	}
+
+	/* 最外层 unlock 时, 将以 SW_WRITE 访问过的副本写回 buffer. */
+	if ( bo->lock_view != GRALLOC_DRM_LOCK_VIEW_NATIVE
+		&& 1 == bo->lock_count
+		&& buf->view_native_addr != NULL )
+	{
+		if ( bo->locked_for & GRALLOC_USAGE_SW_WRITE_MASK )
+		{
+			rk_convert_lock_view(rk_drv, buf, bo->handle, buf->view_native_addr, false);
+		}
+		buf->view_native_addr = NULL;
+	}
+
+	if(buf && (buf->flags & ROCKCHIP_BO_CACHABLE))
+	{
+		sync_args.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW;
+		ioctl(bo->handle->prime_fd, DMA_BUF_IOCTL_SYNC, &sync_args);
+		if (ret != 0)
+			ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "%s:DMA_BUF_IOCTL_SYNC end failed", __FUNCTION__);
+	}
+
+	if ( buf->map_refs > 0 )
+	{
+		buf->map_refs--;
+		rk_end_cpu_access(buf);
+	}
+}
+
+#if RK_DRM_GRALLOC
+static int drm_init_version()
+{
+        char value[PROPERTY_VALUE_MAX];
+
+        property_get("vendor.gralloc.version", value, "NULL");
+        if(!strcmp(value,"NULL"))
+        {
+                ALOGD(RK_GRAPHICS_VER);
+        }
+
+        return 0;
+}
+#endif
+
+/*
+ * rk_driver_of_gralloc_drm_device 中对 driver_of_gralloc_drm_device 的 set_cpu_only_import 方法的具体实现.
+ */
+static void drm_gem_rockchip_set_cpu_only_import(struct gralloc_drm_drv_t *drv, int enable)
+{
+	struct rk_driver_of_gralloc_drm_device_t *rk_drv = (struct rk_driver_of_gralloc_drm_device_t *)drv;
+
+	ALOGI("cpu only import : %s", enable ? "on" : "off");
+	android_atomic_release_store(enable ? 1 : 0, &rk_drv->m_cpu_only_import);
+}
+
+/*
+ * rk_driver_of_gralloc_drm_device 中对 driver_of_gralloc_drm_device 的 set_process_local_suballoc 方法的具体实现.
+ */
+static void drm_gem_rockchip_set_process_local_suballoc(struct gralloc_drm_drv_t *drv, int enable)
+{
+	struct rk_driver_of_gralloc_drm_device_t *rk_drv = (struct rk_driver_of_gralloc_drm_device_t *)drv;
+
+	ALOGI("process local suballoc : %s", enable ? "on" : "off");
+	android_atomic_release_store(enable ? 1 : 0, &rk_drv->m_suballoc_enabled);
+}
+
+/*
+ * rk_driver_of_gralloc_drm_device 中对 driver_of_gralloc_drm_device 的 set_lazy_commit 方法的具体实现.
+ */
+static void drm_gem_rockchip_set_lazy_commit(struct gralloc_drm_drv_t *drv, int enable)
+{
+	struct rk_driver_of_gralloc_drm_device_t *rk_drv = (struct rk_driver_of_gralloc_drm_device_t *)drv;
+
+	ALOGI("lazy commit : %s", enable ? "on" : "off");
+	android_atomic_release_store(enable ? 1 : 0, &rk_drv->m_lazy_commit_enabled);
+}
+
+/*---------------------------------------------------------------------------*/
+// format_caps
 
-            break;
+/*
+ * 返回 fd_of_drm_dev 对应的 VOP 是否有 plane 支持 AFBC 解码, 通过 plane 的 "FEATURE" property 判断.
+ * 返回 -1 表示 kernel 未提供 "FEATURE" property, 无法判断.
+ */
+static int rk_query_vop_afbc_support(int fd)
+{
+	drmModePlaneResPtr plane_res;
+	int ret = -1;
+	uint32_t i;
 
-        case MALI_GRALLOC_FORMAT_INTERNAL_Y410:
+	/* 需要 universal_planes, 才能看到 primary 和 cursor plane. */
+	drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
 
-            /* AVYU 2-10-10-10 */
-            if (alloc_type != UNCOMPRESSED ||
-                    !get_yuv_y410_stride_and_size(w, h, &pixel_stride,
-                        &byte_stride, &size))
-            {
-                return NULL;
-            }
+	plane_res = drmModeGetPlaneResources(fd);
+	if ( NULL == plane_res )
+	{
+		ALOGW("failed to get plane resources, err : %s.", strerror(errno) );
+		return -1;
+	}
 
-            break;
+	for ( i = 0; i < plane_res->count_planes && ret != 1; i++ )
+	{
+		drmModeObjectPropertiesPtr props;
+		uint32_t j;
 
-        case MALI_GRALLOC_FORMAT_INTERNAL_YUV422_8BIT:
+		props = drmModeObjectGetProperties(fd, plane_res->planes[i], DRM_MODE_OBJECT_PLANE);
+		if ( NULL == props )
+		{
+			continue;
+		}
 
-            /* 8BIT AFBC YUV4:2:2 testing usage */
+		for ( j = 0; j < props->count_props; j++ )
+		{
+			drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[j]);
+			int k;
 
-            /* We only support compressed for this format right now.
-             * Below will fail in case format is uncompressed.
-             */
-            if (!get_afbc_yuv422_8bit_stride_and_size(w, h,
-                        &pixel_stride, &byte_stride,
-                        &size, alloc_type))
-            {
-                return NULL;
-            }
+			if ( NULL == prop )
+			{
+				continue;
+			}
 
-            break;
+			if ( 0 == strcmp(prop->name, "FEATURE") && (prop->flags & DRM_MODE_PROP_BITMASK) )
+			{
+				ret = (ret < 0) ? 0 : ret;
 
-            /*
-             * Additional custom formats can be added here
-             * and must fill the variables pixel_stride, byte_stride and size.
-             */
-        case HAL_PIXEL_FORMAT_YCrCb_NV12:
-            if (!get_rk_nv12_stride_and_size(w, h, &pixel_stride, &byte_stride, &size))
-            {
-                ALOGE("get_rk_nv12_stride_and_size failed");
-                return NULL;
-            }
-            ALOGI("for nv12, w : %d, h : %d, pixel_stride : %d, byte_stride : %d, size : %zu; internalHeight : %d.",
-                    w,
-                    h,
-                    pixel_stride,
-                    byte_stride,
-                    size,
-                    internalHeight);
-            break;
+				for ( k = 0; k < prop->count_enums; k++ )
+				{
+					if ( 0 == strcmp(prop->enums[k].name, RK_VOP_PLANE_FEATURE_AFBDC)
+					     && (props->prop_values[j] & (1ULL << prop->enums[k].value) ) )
+					{
+						ret = 1;
+					}
+				}
+			}
 
-        case HAL_PIXEL_FORMAT_YCrCb_NV12_10:
-            if (!get_rk_nv12_10bit_stride_and_size(w, h, &pixel_stride, &byte_stride, &size))
-            {
-                ALOGE("err.");
-                return NULL;
-            }
+			drmModeFreeProperty(prop);
+		}
 
-            ALOGI("for nv12_10, w : %d, h : %d, pixel_stride : %d, byte_stride : %d, size : %zu; internalHeight : %d.",
-                    w,
-                    h,
-                    pixel_stride,
-                    byte_stride,
-                    size,
-                    internalHeight);
-            break;
+		drmModeFreeObjectProperties(props);
+	}
 
-        default:
-            ALOGE("unexpected 'base_format' : 0x%" PRIx64, base_format);
-            return NULL;
-    }
+	drmModeFreePlaneResources(plane_res);
 
-    /*-------------------------------------------------------*/
+	return ret;
+}
 
-#if (1 == MALI_ARCHITECTURE_UTGARD)
-	/* match the framebuffer format */
-	if (usage & GRALLOC_USAGE_HW_FB)
+/*
+ * 从 RK_FORMAT_CAPS_OVERRIDE_FILE 读取对 'caps' 的覆盖 (若该文件存在).
+ */
+static void rk_apply_format_caps_override(mali_gralloc_runtime_caps *caps)
+{
+	FILE *file;
+	char line[128];
+
+	file = fopen(RK_FORMAT_CAPS_OVERRIDE_FILE, "r");
+	if ( NULL == file )
 	{
-#ifdef GRALLOC_16_BITS
-		format = HAL_PIXEL_FORMAT_RGB_565;
-#else
-		format = HAL_PIXEL_FORMAT_RGBA_8888;
-#endif //end of GRALLOC_16_BITS
+		return;
 	}
-#endif //end of MALI_ARCHITECTURE_UTGARD
-#endif //end of RK_DRM_GRALLOC
 
-    /*-------------------------------------------------------*/
+	while ( fgets(line, sizeof(line), file) != NULL )
+	{
+		char key[16];
+		uint64_t value;
 
-	buf = (struct rockchip_buffer*)calloc(1, sizeof(*buf));
-	if (!buf) {
-#if RK_DRM_GRALLOC
-		ALOGE("Failed to allocate buffer wrapper\n");
-#else
-                ALOGE("Failed to allocate buffer wrapper\n");
-#endif
-		return NULL;
-	}
-    buf->bo = NULL;
+		if ( '#' == line[0] || sscanf(line, "%15[^=]=%" SCNx64, key, &value) != 2 )
+		{
+			continue;
+		}
 
-    /*-------------------------------------------------------*/
+		if ( 0 == strcmp(key, "gpu") )
+		{
+			caps->gpu.caps_mask = value;
+		}
+		else if ( 0 == strcmp(key, "dpu") )
+		{
+			caps->dpu.caps_mask = value;
+		}
+		else
+		{
+			ALOGW("unknown key '%s' in %s.", key, RK_FORMAT_CAPS_OVERRIDE_FILE);
+		}
+	}
 
-#if !RK_DRM_GRALLOC
-        cpp = gralloc_drm_get_bpp(handle->format);
-        if (!cpp) {
-                ALOGE("unrecognized format 0x%x", handle->format);
-                return NULL;
-        }
+	fclose(file);
 
-	aligned_width = handle->width;
-	aligned_height = handle->height;
-	gralloc_drm_align_geometry(handle->format,
-			&aligned_width, &aligned_height);
+	ALOGI("format caps overridden by %s.", RK_FORMAT_CAPS_OVERRIDE_FILE);
+}
 
-	/* TODO: We need to sort out alignment */
-	pitch = ALIGN(aligned_width * cpp, 64);
-	size = aligned_height * pitch;
+/*
+ * 探测 GPU 和 VOP 的 format caps, 结果保存在 'rk_drv->m_format_caps' 中.
+ * 依次 : 由编译配置得到的默认值, libGLES_mali.so 导出的 GPU caps, VOP plane 的 "FEATURE" property, 覆盖文件.
+ */
+static void rk_discover_format_caps(struct rk_driver_of_gralloc_drm_device_t *rk_drv)
+{
+	mali_gralloc_runtime_caps *caps = &(rk_drv->m_format_caps);
+	mali_gralloc_format_caps gpu_caps;
+	int vop_afbc;
 
-	if (handle->format == HAL_PIXEL_FORMAT_YCbCr_420_888) {
-		/*
-		 * WAR for H264 decoder requiring additional space
-		 * at the end of destination buffers.
-		 */
-		uint32_t w_mbs, h_mbs;
+	memset(caps, 0, sizeof(*caps) );
+	caps->gpu.caps_mask = MALI_GRALLOC_FORMAT_CAPABILITY_OPTIONS_PRESENT;
+	caps->dpu.caps_mask = MALI_GRALLOC_FORMAT_CAPABILITY_OPTIONS_PRESENT;
 
-		w_mbs = ALIGN(handle->width, 16) / 16;
-		h_mbs = ALIGN(handle->height, 16) / 16;
-		size += 64 * w_mbs * h_mbs;
-	}
+#if MALI_AFBC_GRALLOC == 1
+	caps->gpu.caps_mask |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_BASIC | MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_SPLITBLK;
+#if MALI_SUPPORT_AFBC_WIDEBLK == 1
+	caps->gpu.caps_mask |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_WIDEBLK;
 #endif
+#endif
+#if USE_AFBC_LAYER
+	caps->dpu.caps_mask |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_BASIC;
+#endif
+	/* 现有 VOP 的 AFBDC 只解码 RGB 格式, 可以读取 AFBC YUV 的 VOP 需通过覆盖文件声明. */
+	caps->dpu.caps_mask |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_YUV_NOREAD;
 
-    /*-------------------------------------------------------*/
-    // 根据 'usage' 预置待 alloc 或 import 的 flags, cachable 或 物理连续 等.
-
-	if ( (usage & GRALLOC_USAGE_SW_READ_MASK) == GRALLOC_USAGE_SW_READ_OFTEN
-		|| format == HAL_PIXEL_FORMAT_YCrCb_NV12_10)
+	mali_gralloc_get_gpu_caps(&gpu_caps);
+	if ( gpu_caps.caps_mask & MALI_GRALLOC_FORMAT_CAPABILITY_OPTIONS_PRESENT )
 	{
-		ALOGD("to ask for cachable buffer for CPU read, usage : 0x%x", usage);
-		//set cache flag
-		flags = ROCKCHIP_BO_CACHABLE;
+		caps->gpu = gpu_caps;
 	}
 
-	if(USAGE_CONTAIN_VALUE(GRALLOC_USAGE_TO_USE_PHY_CONT,GRALLOC_USAGE_ROT_MASK))
+	vop_afbc = rk_query_vop_afbc_support(rk_drv->fd_of_drm_dev);
+	if ( 1 == vop_afbc )
 	{
-		flags |= ROCKCHIP_BO_CONTIG; // 预期要求 CMA 内存.
-		ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "try to use Physically Continuous memory\n");
+		caps->dpu.caps_mask |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_BASIC;
 	}
-
-	if(usage & GRALLOC_USAGE_PROTECTED)
+	else if ( 0 == vop_afbc )
 	{
-		flags |= ROCKCHIP_BO_SECURE;
-		ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "try to use secure memory\n");
-	}
-
-    /*-------------------------------------------------------*/
-    // 完成 alloc 或 import buffer.
-
-    /* 若 buufer 实际上已经分配 (通常在另一个进程中), 则 将 buffer import 到 当前进程, ... */
-	if (handle->prime_fd >= 0) {
-        /* 将 prime_fd 引用的 dma_buf, import 为 当前进程的 gem_object, 得到对应的 gem_handle 的 value. */
-        buf->bo = rk_drm_adapter_import_dma_buf(rk_drv, handle->prime_fd, flags, size);
-		if ( NULL == buf->bo )
-        {
-			ALOGE("failed to import dma_buf, prime_fd : %d.", handle->prime_fd);
-            goto failed_to_import_dma_buf;
-		}
+		caps->dpu.caps_mask &= ~MALI_GRALLOC_FORMAT_CAPABILITY_AFBCENABLE_MASK;
 	}
-    else    // if (handle->prime_fd >= 0), 即 buffer 未实际分配, 将 分配, ...
-    {
-		buf->bo = rk_drm_adapter_create_rockchip_bo(rk_drv, size, flags);
-		if ( NULL == buf->bo )
-        {
-			ALOGE("failed to create(alloc) bo %dx%dx%dx%zd\n",
-				handle->height, pixel_stride,byte_stride, size);
-			goto failed_to_alloc_buf;
-		}
 
-        ret = rk_drm_adapter_get_prime_fd(rk_drv, buf->bo, &(handle->prime_fd) );
-		if ( ret != 0 ) {
-            ALOGE("failed to get prime_fd from rockchip_bo.");
-			goto failed_to_get_prime_fd;
-		}
-
-        get_dmabuf_name(size, dmabuf_name);
-        ALOGI("dmabuf_name : %s", dmabuf_name);
-        /* 设置 dma_buf 的 name. */
-        ret = ioctl(handle->prime_fd, DMA_BUF_SET_NAME, dmabuf_name);
-        if ( ret != 0 )
-        {
-            ALOGE("failed set name of dma_buf.");
-        }
+	rk_apply_format_caps_override(caps);
 
-        gem_handle = rk_drm_adapter_get_gem_handle(buf->bo);
+	ALOGI("format caps : gpu : 0x%" PRIx64 ", dpu : 0x%" PRIx64 ".", caps->gpu.caps_mask, caps->dpu.caps_mask);
+}
 
-		buf->base.fb_handle = gem_handle;
+/*
+ * 返回 format caps, 当前进程中第一次调用时探测.
+ */
+static const mali_gralloc_runtime_caps* rk_get_format_caps(struct rk_driver_of_gralloc_drm_device_t* rk_drv)
+{
+	Mutex::Autolock _l(rk_drv->m_format_caps_lock);
 
-		if(USAGE_CONTAIN_VALUE(GRALLOC_USAGE_TO_USE_PHY_CONT,GRALLOC_USAGE_ROT_MASK))
-		{
-			phys_arg.handle = gem_handle;
-			ret = drmIoctl(rk_drv->fd_of_drm_dev,
-                           DRM_IOCTL_ROCKCHIP_GEM_GET_PHYS,
-                           &phys_arg);
-			if (ret)
-				ALOGE("failed to get phy address: %s\n", strerror(errno));
-			ALOGD_IF(RK_DRM_GRALLOC_DEBUG,"get phys 0x%x\n", phys_arg.phy_addr);
-		}
+	if ( !rk_drv->m_format_caps_discovered )
+	{
+		rk_discover_format_caps(rk_drv);
+		rk_drv->m_format_caps_discovered = true;
+	}
 
-#if GRALLOC_INIT_AFBC == 1
-        if (!(usage & GRALLOC_USAGE_PROTECTED))
-        {
-                addr = rk_drm_adapter_map_rockchip_bo(buf->bo);
-                if (!addr) {
-                        ALOGE("failed to map bo");
-                        // LOG_ALWAYS_FATAL("failed to map bo");
-                        goto err_unref;
-                }
-        }
+	return &(rk_drv->m_format_caps);
+}
 
-        if ( internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK )
-        {
-            if ( addr != NULL )
-            {
-                ALOGD("to init afbc_buffer, addr : %p", addr);
-                init_afbc((uint8_t*)addr, internal_format, w, h);
-            }
-            else
-            {
-                ALOGE("can't init afbc_buffer.");
-            }
-        }
-#endif /* GRALLOC_INIT_AFBC == 1 */
-	}   // if (handle->prime_fd >= 0)
+/*
+ * rk_driver_of_gralloc_drm_device 中对 driver_of_gralloc_drm_device 的 dump 方法的具体实现.
+ */
+static void drm_gem_rockchip_dump(struct gralloc_drm_drv_t *drv, char *buff, int buff_len)
+{
+	struct rk_driver_of_gralloc_drm_device_t *rk_drv = (struct rk_driver_of_gralloc_drm_device_t *)drv;
+	rk_drm_map_stats_t stats;
+	rk_cma_stats_t cma_stats;
+	rk_suballoc_stats_t suballoc_stats;
+	rk_lazy_stats_t lazy_stats;
+	rk_zero_stats_t zero_stats;
+	rk_afbc_encode_stats_t afbc_encode_stats;
+	rk_scanout_arena_stats_t arena_stats;
+	rk_range_arena_stats_t arena_ranges;
+	bool arena_reserved;
+	uint64_t trimmed_bytes[GRALLOC_DRM_TRIM_CACHE_COUNT];
+	uint64_t trim_count;
+	rk_layout_overhead_t* layout_overhead;
+	mali_gralloc_runtime_caps format_caps;
+	bool format_caps_discovered;
+	size_t len;
 
-    /*-------------------------------------------------------*/
+	{
+		Mutex::Autolock _l(rk_drv->m_format_caps_lock);
+		format_caps = rk_drv->m_format_caps;
+		format_caps_discovered = rk_drv->m_format_caps_discovered;
+	}
+	{
+		Mutex::Autolock _l(rk_drv->m_stats_lock);
+		stats = rk_drv->m_map_stats;
+		cma_stats = rk_drv->m_cma_stats;
+		zero_stats = rk_drv->m_zero_stats;
+		afbc_encode_stats = rk_drv->m_afbc_encode_stats;
+		memcpy(trimmed_bytes, rk_drv->m_trimmed_bytes, sizeof(trimmed_bytes) );
+		trim_count = rk_drv->m_trim_count;
+	}
+	layout_overhead = (rk_layout_overhead_t*)malloc(sizeof(*layout_overhead) );
+	if ( layout_overhead != NULL )
+	{
+		Mutex::Autolock _l(rk_drv->m_stats_lock);
+		*layout_overhead = rk_drv->m_layout_overhead;
+	}
+	{
+		Mutex::Autolock _l(rk_drv->m_suballoc_lock);
+		suballoc_stats = rk_drv->m_suballoc_stats;
+	}
+	{
+		Mutex::Autolock _l(rk_drv->m_lazy_lock);
+		lazy_stats = rk_drv->m_lazy_stats;
+	}
+	{
+		Mutex::Autolock _l(rk_drv->m_arena_lock);
+		rk_scanout_arena_reap(rk_drv);
+		arena_stats = rk_drv->m_arena_stats;
+		arena_reserved = (rk_drv->m_arena_bo != NULL);
+		rk_range_arena_get_stats(&rk_drv->m_arena, &arena_ranges);
+	}
 
-#if RK_DRM_GRALLOC
-#if MALI_AFBC_GRALLOC == 1
-        /*
-         * If handle has been dup,then the fd is a negative number.
-         * Either you should close it or don't allocate the fd agagin.
-         * Otherwize,it will leak fd.
-         */
-        if(handle->share_attr_fd < 0)
-        {
-                err = gralloc_buffer_attr_allocate( handle );
-                //ALOGD("err=%d,isfb=%x,[%d,%x]",err,usage & GRALLOC_USAGE_HW_FB,hnd->share_attr_fd,hnd->attr_base);
-                if( err < 0 )
-                {
-                        if ( (usage & GRALLOC_USAGE_HW_FB) )
-                        {
-                                /*
-                                 * Having the attribute region is not critical for the framebuffer so let it pass.
-                                 */
-                                err = 0;
-                        }
-                        else
-                        {
-                                drm_gem_rockchip_free( drv, &buf->base );
-                                goto err_unref;
-                        }
-                }
-		}
-#endif
-#ifdef USE_HWC2
-	/*
-	 * If handle has been dup,then the fd is a negative number.
-	 * Either you should close it or don't allocate the fd agagin.
-	 * Otherwize,it will leak fd.
-	 */
-	if(handle->ashmem_fd < 0)
+	snprintf(buff, buff_len,
+	         "rk gralloc map stats (prefault %s):\n"
+	         "  first lock : count %" PRIu64 ", avg %" PRIu64 " us, max %" PRIu64 " us\n"
+	         "  first lock window faults : %" PRIu64 " in %" PRIu64 " samples, avg %" PRIu64 "\n"
+	         "  prefault : bos %" PRIu64 ", pages %" PRIu64 ", faults %" PRIu64 ", total %" PRIu64 " us\n",
+	         rk_drv->m_prefault_enabled ? "on" : "off",
+	         stats.first_lock_count,
+	         stats.first_lock_count ? stats.first_lock_total_ns / stats.first_lock_count / 1000 : 0,
+	         stats.first_lock_max_ns / 1000,
+	         stats.first_lock_window_faults,
+	         stats.first_lock_window_samples,
+	         stats.first_lock_window_samples ? stats.first_lock_window_faults / stats.first_lock_window_samples : 0,
+	         stats.prefault_count,
+	         stats.prefault_pages,
+	         stats.prefault_faults,
+	         stats.prefault_total_ns / 1000);
+
+	len = strlen(buff);
+	if ( format_caps_discovered )
+	{
+		snprintf(buff + len, buff_len - len,
+		         "rk gralloc format caps : gpu 0x%" PRIx64 ", dpu 0x%" PRIx64 "\n",
+		         format_caps.gpu.caps_mask,
+		         format_caps.dpu.caps_mask);
+	}
+	else
 	{
-			err = gralloc_rk_ashmem_allocate( handle );
-			//ALOGD("err=%d,isfb=%x,[%d,%x]",err,usage & GRALLOC_USAGE_HW_FB,hnd->share_attr_fd,hnd->attr_base);
-			if( err < 0 )
-			{
-					if ( (usage & GRALLOC_USAGE_HW_FB) )
-					{
-							/*
-							 * Having the attribute region is not critical for the framebuffer so let it pass.
-							 */
-							err = 0;
-					}
-					else
-					{
-							drm_gem_rockchip_free( drv, &buf->base );
-							goto err_unref;
-					}
-			}
+		snprintf(buff + len, buff_len - len, "rk gralloc format caps : not discovered (no alloc yet)\n");
 	}
-#endif
 
-    /*-------------------------------------------------------*/
-    // 处理 private usage.
+	len = strlen(buff);
+	snprintf(buff + len, buff_len - len,
+	         "rk gralloc contig alloc (budget %" PRIu64 " ms, backoff %" PRIu64 " ms):\n"
+	         "  attempts %" PRIu64 ", successes %" PRIu64 ", avg %" PRIu64 " us, max %" PRIu64 " us, over budget %" PRIu64 "\n"
+	         "  skipped %" PRIu64 ", fallbacks %" PRIu64 "\n",
+	         rk_drv->m_cma_latency_budget_ns / 1000000,
+	         rk_drv->m_cma_backoff_ns / 1000000,
+	         cma_stats.attempts,
+	         cma_stats.successes,
+	         cma_stats.attempts ? cma_stats.total_ns / cma_stats.attempts / 1000 : 0,
+	         cma_stats.max_ns / 1000,
+	         cma_stats.over_budget,
+	         cma_stats.skipped,
+	         cma_stats.fallbacks);
+
+	len = strlen(buff);
+	snprintf(buff + len, buff_len - len,
+	         "rk gralloc suballoc (%s) : buffers %" PRIu64 ", live %" PRIu64 ", chunks created %" PRIu64 ", reclaimed %" PRIu64 "\n",
+	         rk_drv->m_suballoc_enabled ? "on" : "off",
+	         suballoc_stats.buffers,
+	         suballoc_stats.live_buffers,
+	         suballoc_stats.chunks_created,
+	         suballoc_stats.chunks_reclaimed);
+
+	len = strlen(buff);
+	snprintf(buff + len, buff_len - len,
+	         "rk gralloc zeroing (%s) : skipped %" PRIu64 ", afbc header inits %" PRIu64 ", full clears %" PRIu64 " (%" PRIu64 " KB, avg %" PRIu64 " us, max %" PRIu64 " us)\n",
+	         rk_drv->m_zero_full ? "full" : "kernel",
+	         zero_stats.skipped,
+	         zero_stats.header_inits,
+	         zero_stats.full_clears,
+	         zero_stats.full_bytes / 1024,
+	         zero_stats.full_clears ? zero_stats.full_total_ns / zero_stats.full_clears / 1000 : 0,
+	         zero_stats.full_max_ns / 1000);
+
+	len = strlen(buff);
+	snprintf(buff + len, buff_len - len,
+	         "rk gralloc afbc encode on unlock : encodes %" PRIu64 ", avg %" PRIu64 " us, payload %" PRIu64 " KB of linear %" PRIu64 " KB\n",
+	         afbc_encode_stats.encodes,
+	         afbc_encode_stats.encodes ? afbc_encode_stats.total_ns / afbc_encode_stats.encodes / 1000 : 0,
+	         afbc_encode_stats.payload_bytes / 1024,
+	         afbc_encode_stats.linear_bytes / 1024);
+
+	len = strlen(buff);
+	snprintf(buff + len, buff_len - len,
+	         "rk gralloc lazy commit (%s) : deferred %" PRIu64 ", committed %" PRIu64 " (%" PRIu64 " by importers), failures %" PRIu64 "\n"
+	         "  never committed %" PRIu64 " (%" PRIu64 " KB), uncommitted now %" PRIu64 " (%" PRIu64 " KB)\n",
+	         rk_drv->m_lazy_commit_enabled ? "on" : "off",
+	         lazy_stats.deferred,
+	         lazy_stats.committed,
+	         lazy_stats.committed_by_importers,
+	         lazy_stats.commit_failures,
+	         lazy_stats.never_committed,
+	         lazy_stats.never_committed_bytes / 1024,
+	         lazy_stats.uncommitted,
+	         lazy_stats.uncommitted_bytes / 1024);
+
+	len = strlen(buff);
+	snprintf(buff + len, buff_len - len,
+	         "rk gralloc scanout arena (%s, %zu KB) : served %" PRIu64 ", released %" PRIu64 ", fallbacks %" PRIu64 ", failures %" PRIu64 "\n"
+	         "  used %zu KB in %u, free %zu KB in %u, largest free %zu KB, fragmentation %u.%u%%\n",
+	         arena_reserved ? "reserved" : (rk_drv->m_arena_size != 0 ? "unreserved" : "off"),
+	         rk_drv->m_arena_size / 1024,
+	         arena_stats.served,
+	         arena_stats.released,
+	         arena_stats.fallbacks,
+	         arena_ranges.failures,
+	         arena_ranges.used_bytes / 1024,
+	         arena_ranges.used_count,
+	         arena_ranges.free_bytes / 1024,
+	         arena_ranges.free_count,
+	         arena_ranges.largest_free / 1024,
+	         arena_ranges.fragmentation_permille / 10,
+	         arena_ranges.fragmentation_permille % 10);
+
+	len = strlen(buff);
+	snprintf(buff + len, buff_len - len,
+	         "rk gralloc trim (psi %s) : count %" PRIu64 ", suballoc chunks %" PRIu64 " KB, lock view shadows %" PRIu64 " KB, cpu mappings %" PRIu64 " KB\n",
+	         rk_drv->m_psi_fd >= 0 ? "on" : "off",
+	         trim_count,
+	         trimmed_bytes[GRALLOC_DRM_TRIM_SUBALLOC_CHUNKS] / 1024,
+	         trimmed_bytes[GRALLOC_DRM_TRIM_LOCK_VIEW_SHADOWS] / 1024,
+	         trimmed_bytes[GRALLOC_DRM_TRIM_CPU_MAPPINGS] / 1024);
+
+	if ( layout_overhead != NULL )
+	{
+		rk_layout_overhead_format(layout_overhead, "rk gralloc layout overhead of allocated buffers", buff, buff_len);
+		free(layout_overhead);
+	}
 
-    switch (usage & MALI_GRALLOC_USAGE_YUV_CONF_MASK)
-    {
-        case MALI_GRALLOC_USAGE_YUV_CONF_0:
-            if(USAGE_CONTAIN_VALUE(GRALLOC_USAGE_TO_USE_ARM_P010,GRALLOC_USAGE_ROT_MASK))
-            {
-				handle->yuv_info = MALI_YUV_BT709_WIDE; // for rk_hdr.
-            }
-			else
-            {
-				handle->yuv_info = MALI_YUV_BT601_NARROW;
-            }
-			break;
+	{
+		struct gralloc_drm_mem_ledger_t ledger;
 
-        case MALI_GRALLOC_USAGE_YUV_CONF_1:
-            handle->yuv_info = MALI_YUV_BT601_WIDE;
-            break;
+		rk_mem_ledger_snapshot(&rk_drv->m_mem_ledger, &ledger);
+		rk_mem_ledger_format(&ledger, buff, buff_len);
+	}
+}
 
-        case MALI_GRALLOC_USAGE_YUV_CONF_2:
-            handle->yuv_info = MALI_YUV_BT709_NARROW;
-            break;
+/*
+ * rk_driver_of_gralloc_drm_device 中对 driver_of_gralloc_drm_device 的 get_mem_ledger 方法的具体实现.
+ */
+static int drm_gem_rockchip_get_mem_ledger(struct gralloc_drm_drv_t *drv, struct gralloc_drm_mem_ledger_t *ledger)
+{
+	struct rk_driver_of_gralloc_drm_device_t *rk_drv = (struct rk_driver_of_gralloc_drm_device_t *)drv;
 
-        case MALI_GRALLOC_USAGE_YUV_CONF_3:
-            handle->yuv_info = MALI_YUV_BT709_WIDE;
-            break;
-    }
-    
-    /*-------------------------------------------------------*/
+	rk_mem_ledger_snapshot(&rk_drv->m_mem_ledger, ledger);
+	return 0;
+}
 
-	if(phys_arg.phy_addr && phys_arg.phy_addr != handle->phy_addr)
-	{
-		handle->phy_addr = phys_arg.phy_addr;
-	}
+/* 遍历 ledger 以 trim 各 buffer 的缓存时使用的上下文. */
+struct rk_trim_context_t {
+    /* GRALLOC_DRM_TRIM_*. */
+    int cache;
+    /* 为 0 表示 trim 全部. */
+    uint64_t target_bytes;
+    /* 本次 trim 中, 此前各缓存已经释放的 byte 数. */
+    uint64_t reclaimed_before;
+    /* 当前缓存已经释放的 byte 数. */
+    uint64_t reclaimed;
+};
 
-        handle->stride = byte_stride;//pixel_stride;
-        handle->pixel_stride = pixel_stride;
-        handle->byte_stride = byte_stride;
-        handle->format = fmt_chg ? fmt_bak : format;
-        handle->size = size;
-        handle->offset = 0;
-        handle->internalWidth = internalWidth;
-        handle->internalHeight = internalHeight;
-        handle->internal_format = internal_format;
-#else
-        handle->stride = pitch;
-#endif
-        handle->name = 0;
-	buf->base.handle = handle;
+/*
+ * rk_mem_ledger_for_each() 的回调, 释放 'entry' 对应的 buffer 的 'ctx->cache' 缓存.
+ * 跳过正在进行 CPU 访问的 buffer.
+ */
+static bool rk_trim_buffer_cache(rk_mem_ledger_entry_t* entry, void* arg)
+{
+    struct rk_trim_context_t* ctx = (struct rk_trim_context_t*)arg;
+    struct rockchip_buffer* buf =
+        (struct rockchip_buffer*)( (uint8_t*)entry - offsetof(struct rockchip_buffer, ledger_entry) );
 
-        ALOGD("leave, w : %d, h : %d, format : 0x%x,internal_format : 0x%" PRIx64 ", usage : 0x%x. size=%d,pixel_stride=%d,byte_stride=%d",
-                handle->width, handle->height, handle->format,internal_format, handle->usage, handle->size,
-                pixel_stride,byte_stride);
-        ALOGD("leave: prime_fd=%d,share_attr_fd=%d",handle->prime_fd,handle->share_attr_fd);
+    if ( android_atomic_acquire_cas(0, -1, &buf->cpu_access_refs) != 0 )
+    {
+        return true;
+    }
 
-	return &buf->base;
+    if ( GRALLOC_DRM_TRIM_LOCK_VIEW_SHADOWS == ctx->cache )
+    {
+        /* 'view_shadow_size' 被保留, 下次 lock 时重新分配副本. */
+        if ( buf->view_shadow != NULL )
+        {
+            free(buf->view_shadow);
+            buf->view_shadow = NULL;
+            ctx->reclaimed += buf->view_shadow_size;
+        }
+    }
+    else if ( GRALLOC_DRM_TRIM_CPU_MAPPINGS == ctx->cache )
+    {
+        /* 下次 lock 时重新建立映射. */
+        if ( buf->dma_buf_vaddr != NULL )
+        {
+            munmap(buf->dma_buf_vaddr, buf->dma_buf_map_size);
+            buf->dma_buf_vaddr = NULL;
+            ctx->reclaimed += buf->dma_buf_map_size;
+            buf->prefaulted = false;
+        }
+        if ( rk_has_gem_obj(buf) && buf->bo->vaddr != NULL )
+        {
+            struct rockchip_bo* gem_bo = buf->bo;
 
-failed_to_get_prime_fd:
-err_unref:
-    rk_drm_adapter_destroy_rockchip_bo(rk_drv, buf->bo);
+            munmap(gem_bo->vaddr, gem_bo->size);
+            gem_bo->vaddr = NULL;
+            ctx->reclaimed += gem_bo->size;
+            buf->prefaulted = false;
+        }
+    }
 
-failed_to_import_dma_buf:
-failed_to_alloc_buf:
-	free(buf);
-	return NULL;
+    android_atomic_release_store(0, &buf->cpu_access_refs);
+
+    return 0 == ctx->target_bytes || ctx->reclaimed_before + ctx->reclaimed < ctx->target_bytes;
 }
 
-void drm_gem_rockchip_free(struct gralloc_drm_drv_t *drv,
-		struct gralloc_drm_bo_t *bo)
+/*
+ * 回收当前没有 live buffer 的 sub-alloc chunk, 返回释放的 byte 数.
+ * retired 的 chunk 在为空时已经被回收, 这里只需处理各当前 chunk.
+ */
+static uint64_t rk_trim_suballoc_chunks(struct rk_driver_of_gralloc_drm_device_t* rk_drv)
 {
-	struct rockchip_buffer *buf = (struct rockchip_buffer *)bo;
-    struct rk_driver_of_gralloc_drm_device_t *rk_drv = (struct rk_driver_of_gralloc_drm_device_t *)drv;
-    struct gralloc_drm_handle_t *gr_handle = gralloc_drm_handle((buffer_handle_t)bo->handle);
+    uint64_t reclaimed = 0;
+    int i;
 
-    if ( NULL == rk_drv )
+    Mutex::Autolock _l(rk_drv->m_suballoc_lock);
+
+    for ( i = 0; i < 2; i++ )
     {
-        rk_drv = s_rk_drv;
+        rk_suballoc_chunk_t* chunk = rk_drv->m_suballoc_chunks[i];
+
+        if ( chunk != NULL && 0 == chunk->live )
+        {
+            rk_suballoc_destroy_chunk(rk_drv, chunk);
+            rk_drv->m_suballoc_chunks[i] = NULL;
+            reclaimed += RK_SUBALLOC_CHUNK_SIZE;
+        }
     }
 
-        if (!gr_handle)
+    return reclaimed;
+}
+
+/*
+ * rk_driver_of_gralloc_drm_device 中对 driver_of_gralloc_drm_device 的 trim 方法的具体实现.
+ * 按 GRALLOC_DRM_TRIM_* 的顺序依次 trim 各缓存, 直到释放的总 byte 数达到 'target_bytes'.
+ */
+static int drm_gem_rockchip_trim(struct gralloc_drm_drv_t *drv,
+                                 uint64_t target_bytes,
+                                 struct gralloc_drm_trim_result_t *result)
+{
+    struct rk_driver_of_gralloc_drm_device_t* rk_drv = (struct rk_driver_of_gralloc_drm_device_t*)drv;
+    uint64_t total = 0;
+    int cache;
+
+    for ( cache = 0; cache < GRALLOC_DRM_TRIM_CACHE_COUNT; cache++ )
+    {
+        if ( target_bytes != 0 && total >= target_bytes )
         {
-                ALOGE("%s: invalid handle",__FUNCTION__);
-                gralloc_drm_unlock_handle((buffer_handle_t)bo->handle);
-                return;
+            break;
         }
 
-#if RK_DRM_GRALLOC
-#if MALI_AFBC_GRALLOC == 1
-	gralloc_buffer_attr_free( gr_handle );
-#endif
+        if ( GRALLOC_DRM_TRIM_SUBALLOC_CHUNKS == cache )
+        {
+            result->reclaimed_bytes[cache] = rk_trim_suballoc_chunks(rk_drv);
+        }
+        else
+        {
+            struct rk_trim_context_t ctx;
+
+            ctx.cache = cache;
+            ctx.target_bytes = target_bytes;
+            ctx.reclaimed_before = total;
+            ctx.reclaimed = 0;
+            rk_mem_ledger_for_each(&rk_drv->m_mem_ledger, rk_trim_buffer_cache, &ctx);
+            result->reclaimed_bytes[cache] = ctx.reclaimed;
+        }
 
-#ifdef USE_HWC2
-	gralloc_rk_ashmem_free( gr_handle );
-#endif
-	if (gr_handle->prime_fd)
-		close(gr_handle->prime_fd);
+        total += result->reclaimed_bytes[cache];
+    }
 
-	gr_handle->prime_fd = -1;
-#endif
-        gralloc_drm_unlock_handle((buffer_handle_t)bo->handle);
+    {
+        Mutex::Autolock _l(rk_drv->m_stats_lock);
 
-    ALOGD("rk_drv : %p", rk_drv);
-    rk_drm_adapter_destroy_rockchip_bo(rk_drv, buf->bo); // rk_drv : 0x0
+        rk_drv->m_trim_count++;
+        for ( cache = 0; cache < GRALLOC_DRM_TRIM_CACHE_COUNT; cache++ )
+        {
+            rk_drv->m_trimmed_bytes[cache] += result->reclaimed_bytes[cache];
+        }
+    }
 
-	free(buf);
+    ALOGI("trimmed %" PRIu64 " bytes (target %" PRIu64 ") : suballoc chunks %" PRIu64 ", lock view shadows %" PRIu64 ", cpu mappings %" PRIu64 ".",
+          total,
+          target_bytes,
+          result->reclaimed_bytes[GRALLOC_DRM_TRIM_SUBALLOC_CHUNKS],
+          result->reclaimed_bytes[GRALLOC_DRM_TRIM_LOCK_VIEW_SHADOWS],
+          result->reclaimed_bytes[GRALLOC_DRM_TRIM_CPU_MAPPINGS]);
+    return 0;
 }
 
-static int drm_gem_rockchip_map(struct gralloc_drm_drv_t *drv,
-		struct gralloc_drm_bo_t *bo, int x, int y, int w, int h,
-		int enable_write, void **addr)
+/*
+ * PSI 监视线程, 每次收到内存压力的通知时 trim 一次.
+ */
+static void* rk_psi_monitor_thread(void* arg)
 {
-	struct rockchip_buffer *buf = (struct rockchip_buffer *)bo;
-	struct gralloc_drm_handle_t *gr_handle = gralloc_drm_handle((buffer_handle_t)bo->handle);
-	struct dma_buf_sync sync_args;
-	int ret = 0, ret2 = 0;
+    struct rk_driver_of_gralloc_drm_device_t* rk_drv = (struct rk_driver_of_gralloc_drm_device_t*)arg;
+    struct pollfd fds[2];
 
-	UNUSED(drv);
-	UNUSED(x);
-	UNUSED(y);
-	UNUSED(w);
-	UNUSED(h);
-	UNUSED(enable_write);
+    fds[0].fd = rk_drv->m_psi_fd;
+    fds[0].events = POLLPRI;
+    fds[1].fd = rk_drv->m_psi_wake_fds[0];
+    fds[1].events = POLLIN;
 
-	if (gr_handle->usage & GRALLOC_USAGE_PROTECTED)
-	{
-		*addr = NULL;
-		ALOGE("The secure buffer cann't be map");
-	}
-	else
-	{
-		*addr = rk_drm_adapter_map_rockchip_bo(buf->bo);
-		if (!*addr) {
-			ALOGE("failed to map bo");
-			// LOG_ALWAYS_FATAL("failed to map bo");
-			ret = -1;
-		}
-#if RK_CTS_WORKROUND
-		else {
-			int big_scale;
-			static int iCnt = 0;
-			char cmdline[256] = {0};
+    for (;;)
+    {
+        if ( poll(fds, 2, -1) < 0 )
+        {
+            if ( EINTR == errno )
+            {
+                continue;
+            }
+            ALOGE("failed to poll psi, err : %s", strerror(errno) );
+            break;
+        }
 
-			getProcessCmdLine(cmdline, sizeof(cmdline));
+        if ( fds[1].revents != 0 )
+        {
+            break;
+        }
 
-			if(!strcmp(cmdline,"android.view.cts"))
-			{
-				FindAppHintInFile(VIEW_CTS_FILE, VIEW_CTS_PROG_NAME, BIG_SCALE_HINT, &big_scale, IMG_INT_TYPE);
-				if(big_scale && (gr_handle->usage == 0x603 || gr_handle->usage == 0x203) ) {
-                    /* 在 CPU 一侧将 buffer 中的数据设置为 case 预期的 value. */
-					memset(*addr,0xFF,gr_handle->height*gr_handle->byte_stride);
-					ALOGD_IF(1, "memset 0xff byte_stride=%d iCnt=%d",gr_handle->byte_stride,iCnt);
-					iCnt++;
-				}
-				if(iCnt == 400 && big_scale)
-				{
-					ModifyAppHintInFile(VIEW_CTS_FILE, VIEW_CTS_PROG_NAME, BIG_SCALE_HINT, &big_scale, 0, IMG_INT_TYPE);
-					ALOGD_IF(1,"reset big_scale");
-				}
-			}
-		}
-#endif
-	}
+        if ( fds[0].revents & POLLERR )
+        {
+            ALOGE("psi trigger is gone, stop monitoring.");
+            break;
+        }
 
-	if(buf && buf->bo && (buf->bo->flags & ROCKCHIP_BO_CACHABLE))
-	{
-		sync_args.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW;
-		ret2 = ioctl(bo->handle->prime_fd, DMA_BUF_IOCTL_SYNC, &sync_args);
-            // "DMA_BUF_SYNC_START", "DMA_BUF_IOCTL_SYNC" :
-            //      安全地获取 dma_buf 的 访问,
-            //      实现和 GPU 等设备对 buffer 访问操作的互斥, 即实现 "lock" 的语义.
-            //      这里, 对应的 ("DMA_BUF_SYNC_END", "DMA_BUF_IOCTL_SYNC") 在 drm_gem_rockchip_unmap 中被调用.
+        if ( fds[0].revents & POLLPRI )
+        {
+            struct gralloc_drm_trim_result_t result;
 
-		if (ret2 != 0)
-			ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "%s:DMA_BUF_IOCTL_SYNC start failed", __FUNCTION__);
-	}
+            memset(&result, 0, sizeof(result) );
+            drm_gem_rockchip_trim(&rk_drv->base, rk_drv->m_psi_trim_target, &result);
+        }
+    }
 
-	gralloc_drm_unlock_handle((buffer_handle_t)bo->handle);
-	return ret;
+    return NULL;
 }
 
-static void drm_gem_rockchip_unmap(struct gralloc_drm_drv_t *drv,
-		struct gralloc_drm_bo_t *bo)
+/*
+ * 若 property "vendor.gralloc.psi_trim" 为 true, 注册 PSI trigger 并启动监视线程.
+ * kernel 不支持 PSI 时, 只输出 log.
+ */
+static void rk_start_psi_monitor(struct rk_driver_of_gralloc_drm_device_t* rk_drv)
 {
-	struct rockchip_buffer *buf = (struct rockchip_buffer *)bo;
-	struct dma_buf_sync sync_args;
-	int ret = 0;
+    int32_t target_kb;
 
-	UNUSED(drv);
+    rk_drv->m_psi_fd = -1;
 
-	if(buf && buf->bo && (buf->bo->flags & ROCKCHIP_BO_CACHABLE))
-	{
-		sync_args.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW;
-		ioctl(bo->handle->prime_fd, DMA_BUF_IOCTL_SYNC, &sync_args);
-		if (ret != 0)
-			ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "%s:DMA_BUF_IOCTL_SYNC end failed", __FUNCTION__);
-	}
-}
+    if ( !property_get_bool("vendor.gralloc.psi_trim", false) )
+    {
+        return;
+    }
 
-#if RK_DRM_GRALLOC
-static int drm_init_version()
-{
-        char value[PROPERTY_VALUE_MAX];
+    target_kb = property_get_int32("vendor.gralloc.psi_trim_target_kb", 0);
+    rk_drv->m_psi_trim_target = (target_kb > 0) ? (uint64_t)target_kb * 1024 : 0;
 
-        property_get("vendor.gralloc.version", value, "NULL");
-        if(!strcmp(value,"NULL"))
-        {
-                ALOGD(RK_GRAPHICS_VER);
-        }
+    rk_drv->m_psi_fd = open(RK_PSI_MEMORY_FILE, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if ( rk_drv->m_psi_fd < 0 )
+    {
+        ALOGW("psi is not available, err : %s", strerror(errno) );
+        return;
+    }
 
-        return 0;
+    if ( write(rk_drv->m_psi_fd, RK_PSI_MEMORY_TRIGGER, strlen(RK_PSI_MEMORY_TRIGGER) + 1) < 0 )
+    {
+        ALOGW("failed to register psi trigger, err : %s", strerror(errno) );
+        goto err_close_psi;
+    }
+
+    if ( pipe2(rk_drv->m_psi_wake_fds, O_CLOEXEC) != 0 )
+    {
+        ALOGE("failed to create pipe, err : %s", strerror(errno) );
+        goto err_close_psi;
+    }
+
+    if ( pthread_create(&rk_drv->m_psi_thread, NULL, rk_psi_monitor_thread, rk_drv) != 0 )
+    {
+        ALOGE("failed to create psi monitor thread");
+        close(rk_drv->m_psi_wake_fds[0]);
+        close(rk_drv->m_psi_wake_fds[1]);
+        goto err_close_psi;
+    }
+
+    ALOGI("psi monitor started, trim target : %" PRIu64 " bytes.", rk_drv->m_psi_trim_target);
+    return;
+
+err_close_psi:
+    close(rk_drv->m_psi_fd);
+    rk_drv->m_psi_fd = -1;
 }
-#endif
 
 /**
  * 创建并返回 rk_driver_of_gralloc_drm_device 实例.
@@ -2555,12 +6611,64 @@ struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_rockchip(int fd)
 
     rk_drm_adapter_init(rk_drv);
 
+#if RK_CTS_WORKROUND
+    rk_cts_workround_init();
+#endif
+
 	rk_drv->fd_of_drm_dev = fd;
 	rk_drv->base.destroy = drm_gem_rockchip_destroy;
 	rk_drv->base.alloc = drm_gem_rockchip_alloc; // "rk_drv->base" : .type : gralloc_drm_drv_t
 	rk_drv->base.free = drm_gem_rockchip_free;
 	rk_drv->base.map = drm_gem_rockchip_map;
 	rk_drv->base.unmap = drm_gem_rockchip_unmap;
+	rk_drv->base.resolve_format = drm_gem_rockchip_resolve_format;
+	rk_drv->base.set_lock_view = drm_gem_rockchip_set_lock_view;
+	rk_drv->base.reshape = drm_gem_rockchip_reshape;
+	rk_drv->base.commit = drm_gem_rockchip_commit;
+	rk_drv->base.set_cpu_only_import = drm_gem_rockchip_set_cpu_only_import;
+	rk_drv->base.set_process_local_suballoc = drm_gem_rockchip_set_process_local_suballoc;
+	rk_drv->base.set_lazy_commit = drm_gem_rockchip_set_lazy_commit;
+	rk_drv->base.get_mem_ledger = drm_gem_rockchip_get_mem_ledger;
+	rk_drv->base.trim = drm_gem_rockchip_trim;
+	rk_drv->base.compute_layout = drm_gem_rockchip_compute_layout;
+	rk_drv->base.open_alloc_device = drm_gem_rockchip_open_alloc_device;
+	rk_drv->base.dump = drm_gem_rockchip_dump;
+
+	rk_drv->m_prefault_enabled = property_get_bool("vendor.gralloc.prefault", false);
+	rk_drv->m_map_imported_via_dma_buf = property_get_bool("vendor.gralloc.dmabuf_mmap", false);
+	rk_drv->m_cpu_only_import = 0;
+	memset(&rk_drv->m_map_stats, 0, sizeof(rk_drv->m_map_stats) );
+	rk_drv->m_cma_latency_budget_ns =
+		(uint64_t)property_get_int32("vendor.gralloc.cma_budget_ms", RK_CMA_DEFAULT_LATENCY_BUDGET_MS) * 1000000;
+	rk_drv->m_cma_backoff_ns =
+		(uint64_t)property_get_int32("vendor.gralloc.cma_backoff_ms", RK_CMA_DEFAULT_BACKOFF_MS) * 1000000;
+	memset(&rk_drv->m_cma_stats, 0, sizeof(rk_drv->m_cma_stats) );
+	rk_drv->m_suballoc_enabled = 0;
+	rk_drv->m_suballoc_chunks[0] = NULL;
+	rk_drv->m_suballoc_chunks[1] = NULL;
+	memset(&rk_drv->m_suballoc_stats, 0, sizeof(rk_drv->m_suballoc_stats) );
+	rk_drv->m_zero_full = property_get_bool("vendor.gralloc.zero_full", false);
+	memset(&rk_drv->m_zero_stats, 0, sizeof(rk_drv->m_zero_stats) );
+	rk_drv->m_clear_pool = rk_create_clear_pool();
+	memset(&rk_drv->m_afbc_encode_stats, 0, sizeof(rk_drv->m_afbc_encode_stats) );
+	memset(&rk_drv->m_layout_overhead, 0, sizeof(rk_drv->m_layout_overhead) );
+	rk_drv->m_lazy_commit_enabled = property_get_bool("vendor.gralloc.lazy_commit", false) ? 1 : 0;
+	memset(&rk_drv->m_lazy_stats, 0, sizeof(rk_drv->m_lazy_stats) );
+	rk_drv->m_commit_server = NULL;
+	rk_drv->m_arena_size = (size_t)property_get_int32("vendor.gralloc.scanout_arena_mb", 0) * 1024 * 1024;
+	rk_drv->m_arena_bo = NULL;
+	rk_drv->m_arena_prime_fd = -1;
+	rk_drv->m_arena_phy_addr = 0;
+	rk_drv->m_arena_inotify_fd = -1;
+	rk_range_arena_init(&rk_drv->m_arena, 0, RK_ARENA_DEFAULT_ALIGN);
+	memset(&rk_drv->m_arena_stats, 0, sizeof(rk_drv->m_arena_stats) );
+	rk_mem_ledger_init(&rk_drv->m_mem_ledger);
+	memset(rk_drv->m_trimmed_bytes, 0, sizeof(rk_drv->m_trimmed_bytes) );
+	rk_drv->m_trim_count = 0;
+
+	memset(&rk_drv->m_format_caps, 0, sizeof(rk_drv->m_format_caps) );
+	rk_drv->m_format_caps_discovered = false;
+	rk_start_psi_monitor(rk_drv);
 
 	return &rk_drv->base;
 }
@@ -0,0 +1,779 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_drm_rockchip_afbc.cpp
+ *      对 gralloc_drm_rockchip_afbc.h 中接口的具体实现.
+ */
+
+#define LOG_TAG "GRALLOC-ROCKCHIP"
+
+#include <log/log.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "gralloc_drm_rockchip_afbc.h"
+
+/*---------------------------------------------------------------------------*/
+
+#define SUBBLOCK_DIM    4
+
+/*
+ * 16x16 superblock 中, 按解码顺序的各 subblock 的位置 { x, y }, 单位是 subblock.
+ * 即 :
+ *       2  1 14 13
+ *       3  0 15 12
+ *       4  7  8 11
+ *       5  6  9 10
+ */
+static const uint8_t k_sb16_subblock_pos[RK_AFBC_SUBBLOCKS_PER_SUPERBLOCK][2] =
+{
+    { 1, 1 }, { 1, 0 }, { 0, 0 }, { 0, 1 },
+    { 0, 2 }, { 0, 3 }, { 1, 3 }, { 1, 2 },
+    { 2, 2 }, { 2, 3 }, { 3, 3 }, { 3, 2 },
+    { 3, 1 }, { 3, 0 }, { 2, 0 }, { 2, 1 },
+};
+
+/*
+ * 32x8 superblock 中, 按解码顺序的各 subblock 的位置 : 按列, 每列 2 个 subblock, 自上而下.
+ */
+static const uint8_t k_sb32x8_subblock_pos[RK_AFBC_SUBBLOCKS_PER_SUPERBLOCK][2] =
+{
+    { 0, 0 }, { 0, 1 }, { 1, 0 }, { 1, 1 },
+    { 2, 0 }, { 2, 1 }, { 3, 0 }, { 3, 1 },
+    { 4, 0 }, { 4, 1 }, { 5, 0 }, { 5, 1 },
+    { 6, 0 }, { 6, 1 }, { 7, 0 }, { 7, 1 },
+};
+
+static inline uint32_t read_le32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * 返回 'header' 中第 'index' 个 (解码顺序) subblock 的 size.
+ */
+static inline uint32_t get_subblock_size(const uint8_t* header, int index)
+{
+    int bit = 32 + 6 * index;
+    const uint8_t* p = header + (bit >> 3);
+    /* 6 bit 的 size 最多跨越 2 个 byte. */
+    uint32_t v = (uint32_t)p[0] | ((bit & 7) > 2 ? ((uint32_t)p[1] << 8) : 0);
+
+    return (v >> (bit & 7)) & 0x3F;
+}
+
+/*
+ * 返回 superblock (sx, sy) 的 header 在 header 区中的序号.
+ */
+static inline size_t get_header_index(const rk_afbc_layout_t* layout, int sx, int sy)
+{
+    if ( layout->tiled_headers )
+    {
+        size_t tile = (size_t)(sy >> 3) * (layout->sb_cols >> 3) + (sx >> 3);
+
+        return tile * 64 + (sy & 7) * 8 + (sx & 7);
+    }
+
+    return (size_t)sy * layout->sb_cols + sx;
+}
+
+/*
+ * 将一个 subblock 的 'rows' 行, 每行 'cols' 个像素, 从 'src' (紧密排列的 4x4 像素) 写到 'dst'.
+ */
+static inline void write_subblock(const uint8_t* src, int bytes_per_pixel,
+                                  uint8_t* dst, int dst_stride, int cols, int rows)
+{
+    int row_bytes = SUBBLOCK_DIM * bytes_per_pixel;
+    int r;
+
+    /* 常见的情况 : 4 byte 的像素, 完整的行, 每行正好 16 byte. */
+    if ( 4 == bytes_per_pixel && SUBBLOCK_DIM == cols )
+    {
+        for ( r = 0; r < rows; r++ )
+        {
+#if defined(__aarch64__)
+            vst1q_u8(dst + (size_t)r * dst_stride, vld1q_u8(src + r * row_bytes) );
+#elif defined(__SSE2__)
+            _mm_storeu_si128( (__m128i*)(dst + (size_t)r * dst_stride),
+                              _mm_loadu_si128( (const __m128i*)(src + r * row_bytes) ) );
+#else
+            memcpy(dst + (size_t)r * dst_stride, src + r * row_bytes, row_bytes);
+#endif
+        }
+        return;
+    }
+
+    for ( r = 0; r < rows; r++ )
+    {
+        memcpy(dst + (size_t)r * dst_stride, src + r * row_bytes, cols * bytes_per_pixel);
+    }
+}
+
+/*
+ * 以 'color' 填充 'dst' 中 'cols' x 'rows' 的区域.
+ */
+static void fill_solid(const uint8_t* color, int bytes_per_pixel,
+                       uint8_t* dst, int dst_stride, int cols, int rows)
+{
+    int r;
+    int c;
+
+    if ( 4 == bytes_per_pixel )
+    {
+        uint32_t pixel;
+
+        memcpy(&pixel, color, sizeof(pixel) );
+
+        for ( r = 0; r < rows; r++ )
+        {
+            uint8_t* p = dst + (size_t)r * dst_stride;
+
+            c = 0;
+#if defined(__aarch64__)
+            {
+                uint8x16_t v = vreinterpretq_u8_u32(vdupq_n_u32(pixel) );
+
+                for ( ; c + 4 <= cols; c += 4 )
+                {
+                    vst1q_u8(p + c * 4, v);
+                }
+            }
+#elif defined(__SSE2__)
+            {
+                __m128i v = _mm_set1_epi32( (int)pixel);
+
+                for ( ; c + 4 <= cols; c += 4 )
+                {
+                    _mm_storeu_si128( (__m128i*)(p + c * 4), v);
+                }
+            }
+#endif
+            for ( ; c < cols; c++ )
+            {
+                memcpy(p + c * 4, &pixel, 4);
+            }
+        }
+        return;
+    }
+
+    for ( r = 0; r < rows; r++ )
+    {
+        uint8_t* p = dst + (size_t)r * dst_stride;
+
+        for ( c = 0; c < cols; c++ )
+        {
+            memcpy(p + c * bytes_per_pixel, color, bytes_per_pixel);
+        }
+    }
+}
+
+/*
+ * 检查 superblock (sx, sy) 是否可以被 decode_superblock() 解码.
+ */
+static int check_superblock(const uint8_t* src, const rk_afbc_layout_t* layout, int sx, int sy)
+{
+    const uint8_t* header = src + get_header_index(layout, sx, sy) * RK_AFBC_HEADER_SIZE;
+    size_t uncompressed_size = (size_t)SUBBLOCK_DIM * SUBBLOCK_DIM * layout->bytes_per_pixel;
+    uint32_t offset = read_le32(header);
+    size_t pos = offset;
+    int i;
+
+    if ( 0 == offset )
+    {
+        return 0;
+    }
+
+    for ( i = 0; i < RK_AFBC_SUBBLOCKS_PER_SUPERBLOCK; i++ )
+    {
+        uint32_t size = get_subblock_size(header, i);
+
+        if ( 0 == size )
+        {
+            if ( 0 == i )
+            {
+                ALOGE("superblock (%d, %d) : first subblock is a copy.", sx, sy);
+                return -EINVAL;
+            }
+        }
+        else if ( 1 == size )
+        {
+            if ( pos + uncompressed_size > layout->buffer_size )
+            {
+                ALOGE("superblock (%d, %d) : body out of buffer, offset : %u.", sx, sy, offset);
+                return -EINVAL;
+            }
+            pos += uncompressed_size;
+        }
+        else
+        {
+            return -ENOTSUP;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * 解码 superblock (sx, sy).
+ */
+static int decode_superblock(const uint8_t* src, const rk_afbc_layout_t* layout,
+                             int sx, int sy, uint8_t* dst, int dst_stride)
+{
+    const uint8_t* header = src + get_header_index(layout, sx, sy) * RK_AFBC_HEADER_SIZE;
+    const uint8_t (*subblock_pos)[2] = (16 == layout->sb_width) ? k_sb16_subblock_pos : k_sb32x8_subblock_pos;
+    int bpp = layout->bytes_per_pixel;
+    int x0 = sx * layout->sb_width;
+    int y0 = sy * layout->sb_height;
+    int cols = layout->width - x0;
+    int rows = layout->height - y0;
+    uint32_t offset = read_le32(header);
+    size_t uncompressed_size = (size_t)SUBBLOCK_DIM * SUBBLOCK_DIM * bpp;
+    const uint8_t* prev = NULL;
+    size_t pos;
+    int i;
+
+    cols = (cols > layout->sb_width) ? layout->sb_width : cols;
+    rows = (rows > layout->sb_height) ? layout->sb_height : rows;
+    dst += (size_t)y0 * dst_stride + (size_t)x0 * bpp;
+
+    if ( 0 == offset )
+    {
+        fill_solid(header + 8, bpp, dst, dst_stride, cols, rows);
+        return 0;
+    }
+
+    pos = offset;
+
+    for ( i = 0; i < RK_AFBC_SUBBLOCKS_PER_SUPERBLOCK; i++ )
+    {
+        uint32_t size = get_subblock_size(header, i);
+        int x = subblock_pos[i][0] * SUBBLOCK_DIM;
+        int y = subblock_pos[i][1] * SUBBLOCK_DIM;
+        const uint8_t* data;
+
+        if ( 0 == size )
+        {
+            if ( NULL == prev )
+            {
+                ALOGE("superblock (%d, %d) : first subblock is a copy.", sx, sy);
+                return -EINVAL;
+            }
+            data = prev;
+        }
+        else if ( 1 == size )
+        {
+            if ( pos + uncompressed_size > layout->buffer_size )
+            {
+                ALOGE("superblock (%d, %d) : body out of buffer, offset : %u.", sx, sy, offset);
+                return -EINVAL;
+            }
+            data = src + pos;
+            pos += uncompressed_size;
+        }
+        else
+        {
+            return -ENOTSUP;
+        }
+
+        if ( x < cols && y < rows )
+        {
+            write_subblock(data, bpp,
+                           dst + (size_t)y * dst_stride + (size_t)x * bpp, dst_stride,
+                           (cols - x > SUBBLOCK_DIM) ? SUBBLOCK_DIM : cols - x,
+                           (rows - y > SUBBLOCK_DIM) ? SUBBLOCK_DIM : rows - y);
+        }
+        prev = data;
+    }
+
+    return 0;
+}
+
+/*
+ * 将 superblock (sx, sy) 的像素读入 'pixels' (紧密排列, sb_width x sb_height),
+ * 超出 [0, width) x [0, height) 的像素取最近的边缘像素, 使边缘的 superblock 仍可以被编码为纯色.
+ */
+static void gather_superblock(const uint8_t* src, int src_stride, const rk_afbc_layout_t* layout,
+                              int sx, int sy, uint8_t* pixels)
+{
+    int bpp = layout->bytes_per_pixel;
+    int x0 = sx * layout->sb_width;
+    int y0 = sy * layout->sb_height;
+    int cols = layout->width - x0;
+    int y;
+
+    cols = (cols > layout->sb_width) ? layout->sb_width : cols;
+
+    for ( y = 0; y < layout->sb_height; y++ )
+    {
+        int src_y = (y0 + y < layout->height) ? y0 + y : layout->height - 1;
+        uint8_t* row = pixels + (size_t)y * layout->sb_width * bpp;
+        int x;
+
+        if ( cols > 0 )
+        {
+            memcpy(row, src + (size_t)src_y * src_stride + (size_t)x0 * bpp, (size_t)cols * bpp);
+            for ( x = cols; x < layout->sb_width; x++ )
+            {
+                memcpy(row + x * bpp, row + (cols - 1) * bpp, bpp);
+            }
+        }
+        else
+        {
+            const uint8_t* edge = src + (size_t)src_y * src_stride + (size_t)(layout->width - 1) * bpp;
+
+            for ( x = 0; x < layout->sb_width; x++ )
+            {
+                memcpy(row + x * bpp, edge, bpp);
+            }
+        }
+    }
+}
+
+/*
+ * 返回 'pixels' 中的 'n' 个像素是否都相同.
+ */
+static bool is_solid(const uint8_t* pixels, int n, int bytes_per_pixel)
+{
+    int i;
+
+    if ( 4 == bytes_per_pixel )
+    {
+        uint32_t first;
+        uint32_t pixel;
+
+        memcpy(&first, pixels, 4);
+        i = 1;
+#if defined(__aarch64__)
+        {
+            uint32x4_t v_first = vdupq_n_u32(first);
+
+            for ( i = 0; i + 4 <= n; i += 4 )
+            {
+                uint32x4_t eq = vceqq_u32(vreinterpretq_u32_u8(vld1q_u8(pixels + i * 4) ), v_first);
+
+                if ( vminvq_u32(eq) != 0xFFFFFFFFU )
+                {
+                    return false;
+                }
+            }
+        }
+#elif defined(__SSE2__)
+        {
+            __m128i v_first = _mm_set1_epi32( (int)first);
+
+            for ( i = 0; i + 4 <= n; i += 4 )
+            {
+                __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128( (const __m128i*)(pixels + i * 4) ), v_first);
+
+                if ( _mm_movemask_epi8(eq) != 0xFFFF )
+                {
+                    return false;
+                }
+            }
+        }
+#endif
+        for ( ; i < n; i++ )
+        {
+            memcpy(&pixel, pixels + i * 4, 4);
+            if ( pixel != first )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    for ( i = 1; i < n; i++ )
+    {
+        if ( memcmp(pixels + i * bytes_per_pixel, pixels, bytes_per_pixel) != 0 )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline void set_subblock_size(uint8_t* header, int index, uint32_t size)
+{
+    int bit = 32 + 6 * index;
+    int b;
+
+    for ( b = 0; b < 6; b++, bit++ )
+    {
+        if ( size & (1U << b) )
+        {
+            header[bit >> 3] |= (uint8_t)(1U << (bit & 7) );
+        }
+    }
+}
+
+/*
+ * 编码 superblock (sx, sy).
+ * superblock 的 body 位于 'layout->body_offset' 之后按 superblock 序号分配的固定位置 (sparse),
+ * 以便各 superblock 可以被独立 (并行) 地编码.
+ *
+ * @return
+ *      superblock 实际使用的 body 的 byte 数.
+ */
+static size_t encode_superblock(const uint8_t* src, int src_stride, const rk_afbc_layout_t* layout,
+                                int sx, int sy, uint8_t* dst, uint8_t* pixels)
+{
+    const uint8_t (*subblock_pos)[2] = (16 == layout->sb_width) ? k_sb16_subblock_pos : k_sb32x8_subblock_pos;
+    int bpp = layout->bytes_per_pixel;
+    int sb_pixels = layout->sb_width * layout->sb_height;
+    size_t uncompressed_size = (size_t)SUBBLOCK_DIM * SUBBLOCK_DIM * bpp;
+    size_t sb_index = (size_t)sy * layout->sb_cols + sx;
+    size_t offset = layout->body_offset + sb_index * sb_pixels * bpp;
+    uint8_t header[RK_AFBC_HEADER_SIZE];
+    uint8_t subblock[2][SUBBLOCK_DIM * SUBBLOCK_DIM * 4];
+    size_t pos = 0;
+    int i;
+
+    memset(header, 0, sizeof(header) );
+    gather_superblock(src, src_stride, layout, sx, sy, pixels);
+
+    if ( is_solid(pixels, sb_pixels, bpp) )
+    {
+        memcpy(header + 8, pixels, bpp);
+    }
+    else
+    {
+        header[0] = (uint8_t)offset;
+        header[1] = (uint8_t)(offset >> 8);
+        header[2] = (uint8_t)(offset >> 16);
+        header[3] = (uint8_t)(offset >> 24);
+
+        for ( i = 0; i < RK_AFBC_SUBBLOCKS_PER_SUPERBLOCK; i++ )
+        {
+            uint8_t* cur = subblock[i & 1];
+            const uint8_t* prev = subblock[(i & 1) ^ 1];
+            int x = subblock_pos[i][0] * SUBBLOCK_DIM;
+            int y = subblock_pos[i][1] * SUBBLOCK_DIM;
+            int r;
+
+            for ( r = 0; r < SUBBLOCK_DIM; r++ )
+            {
+                memcpy(cur + r * SUBBLOCK_DIM * bpp,
+                       pixels + ( (size_t)(y + r) * layout->sb_width + x) * bpp,
+                       SUBBLOCK_DIM * bpp);
+            }
+
+            if ( i > 0 && 0 == memcmp(cur, prev, uncompressed_size) )
+            {
+                /* size 0 : 与前一个 subblock 相同. */
+                continue;
+            }
+
+            set_subblock_size(header, i, 1);
+            memcpy(dst + offset + pos, cur, uncompressed_size);
+            pos += uncompressed_size;
+        }
+    }
+
+    memcpy(dst + get_header_index(layout, sx, sy) * RK_AFBC_HEADER_SIZE, header, sizeof(header) );
+    return pos;
+}
+
+/*---------------------------------------------------------------------------*/
+
+typedef struct
+{
+    /* true : 编码 linear -> afbc; false : 解码 afbc -> linear. */
+    bool encode;
+    const uint8_t* src;
+    int src_stride;
+    const rk_afbc_layout_t* layout;
+    uint8_t* dst;
+    int dst_stride;
+    /* 处理 superblock 行 [first_row, last_row) 中的列 [0, cols). */
+    int first_row;
+    int last_row;
+    int cols;
+    int result;
+    /* 编码时, 实际使用的 body 的 byte 数. */
+    size_t body_bytes;
+} afbc_job_t;
+
+static void run_afbc_job(afbc_job_t* job)
+{
+    const rk_afbc_layout_t* layout = job->layout;
+    uint8_t* pixels = NULL;
+    int sx;
+    int sy;
+
+    job->result = 0;
+    job->body_bytes = 0;
+
+    if ( job->encode )
+    {
+        pixels = (uint8_t*)malloc( (size_t)layout->sb_width * layout->sb_height * layout->bytes_per_pixel);
+        if ( NULL == pixels )
+        {
+            job->result = -ENOMEM;
+            return;
+        }
+    }
+
+    for ( sy = job->first_row; sy < job->last_row && 0 == job->result; sy++ )
+    {
+        for ( sx = 0; sx < job->cols; sx++ )
+        {
+            if ( job->encode )
+            {
+                job->body_bytes += encode_superblock(job->src, job->src_stride, layout, sx, sy, job->dst, pixels);
+            }
+            else
+            {
+                job->result = decode_superblock(job->src, layout, sx, sy, job->dst, job->dst_stride);
+                if ( job->result != 0 )
+                {
+                    break;
+                }
+            }
+        }
+    }
+
+    free(pixels);
+}
+
+static void* afbc_thread_main(void* arg)
+{
+    run_afbc_job( (afbc_job_t*)arg);
+    return NULL;
+}
+
+/*
+ * 执行 'job', 对较大的 buffer, 按 superblock 行将 'job' 分配到多个线程中.
+ * 当前线程处理最后一段, 创建线程失败的段也在当前线程中处理.
+ *
+ * @return
+ *      第一个失败的段的错误码, 或 0.
+ */
+static int run_afbc_job_parallel(const afbc_job_t* job, size_t* body_bytes)
+{
+    afbc_job_t parts[RK_AFBC_MAX_THREADS];
+    pthread_t threads[RK_AFBC_MAX_THREADS];
+    bool started[RK_AFBC_MAX_THREADS] = { false };
+    int rows = job->last_row - job->first_row;
+    int n_parts = 1;
+    int rows_per_part;
+    int result = 0;
+    int i;
+
+    if ( (int64_t)rows * job->cols >= RK_AFBC_MT_MIN_SUPERBLOCKS )
+    {
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        n_parts = (n_cpus > RK_AFBC_MAX_THREADS) ? RK_AFBC_MAX_THREADS : (int)n_cpus;
+        if ( n_parts > rows )
+        {
+            n_parts = rows;
+        }
+        if ( n_parts < 1 )
+        {
+            n_parts = 1;
+        }
+    }
+
+    rows_per_part = (rows + n_parts - 1) / n_parts;
+
+    for ( i = 0; i < n_parts; i++ )
+    {
+        int first_row = job->first_row + i * rows_per_part;
+        int last_row = first_row + rows_per_part;
+
+        parts[i] = *job;
+        parts[i].first_row = (first_row < job->last_row) ? first_row : job->last_row;
+        parts[i].last_row = (last_row < job->last_row) ? last_row : job->last_row;
+    }
+
+    for ( i = 0; i < n_parts - 1; i++ )
+    {
+        started[i] = (0 == pthread_create(&threads[i], NULL, afbc_thread_main, &parts[i]) );
+        if ( !started[i] )
+        {
+            ALOGW("failed to create afbc thread, run in current thread.");
+            run_afbc_job(&parts[i]);
+        }
+    }
+
+    run_afbc_job(&parts[n_parts - 1]);
+
+    if ( body_bytes != NULL )
+    {
+        *body_bytes = 0;
+    }
+
+    for ( i = 0; i < n_parts; i++ )
+    {
+        if ( i < n_parts - 1 && started[i] )
+        {
+            pthread_join(threads[i], NULL);
+        }
+        if ( 0 == result )
+        {
+            result = parts[i].result;
+        }
+        if ( body_bytes != NULL )
+        {
+            *body_bytes += parts[i].body_bytes;
+        }
+    }
+
+    return result;
+}
+
+/*
+ * 检查 'layout' 是否有效, 以及 header 区是否在 buffer 中.
+ */
+static bool is_layout_valid(const rk_afbc_layout_t* layout)
+{
+    size_t n_headers;
+
+    if ( layout->bytes_per_pixel < 2 || layout->bytes_per_pixel > 4
+        || !( (16 == layout->sb_width && 16 == layout->sb_height)
+              || (32 == layout->sb_width && 8 == layout->sb_height) )
+        || layout->width <= 0 || layout->height <= 0
+        || layout->sb_cols * layout->sb_width < layout->width
+        || layout->sb_rows * layout->sb_height < layout->height
+        || (layout->tiled_headers && ( (layout->sb_cols & 7) || (layout->sb_rows & 7) ) ) )
+    {
+        return false;
+    }
+
+    n_headers = (size_t)layout->sb_cols * layout->sb_rows;
+
+    return n_headers * RK_AFBC_HEADER_SIZE <= layout->buffer_size;
+}
+
+int rk_afbc_check_decodable(const uint8_t* src, const rk_afbc_layout_t* layout)
+{
+    int sb_rows;
+    int sb_cols;
+    int sx;
+    int sy;
+
+    if ( NULL == src || !is_layout_valid(layout) )
+    {
+        ALOGE("invalid afbc layout.");
+        return -EINVAL;
+    }
+
+    sb_rows = (layout->height + layout->sb_height - 1) / layout->sb_height;
+    sb_cols = (layout->width + layout->sb_width - 1) / layout->sb_width;
+
+    for ( sy = 0; sy < sb_rows; sy++ )
+    {
+        for ( sx = 0; sx < sb_cols; sx++ )
+        {
+            int ret = check_superblock(src, layout, sx, sy);
+
+            if ( ret != 0 )
+            {
+                return ret;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int rk_afbc_decode(const uint8_t* src, const rk_afbc_layout_t* layout, uint8_t* dst, int dst_stride)
+{
+    afbc_job_t job;
+    int ret;
+
+    if ( NULL == dst )
+    {
+        ALOGE("invalid afbc layout.");
+        return -EINVAL;
+    }
+
+    /* 先检查整个 buffer, 不能解码时不修改 'dst'. */
+    ret = rk_afbc_check_decodable(src, layout);
+    if ( ret != 0 )
+    {
+        return ret;
+    }
+
+    memset(&job, 0, sizeof(job) );
+    job.encode = false;
+    job.src = src;
+    job.layout = layout;
+    job.dst = dst;
+    job.dst_stride = dst_stride;
+    job.first_row = 0;
+    /* 只解码覆盖了 [0, width) x [0, height) 的 superblock. */
+    job.last_row = (layout->height + layout->sb_height - 1) / layout->sb_height;
+    job.cols = (layout->width + layout->sb_width - 1) / layout->sb_width;
+
+    return run_afbc_job_parallel(&job, NULL);
+}
+
+int rk_afbc_encode(const uint8_t* src, int src_stride, const rk_afbc_layout_t* layout, uint8_t* dst,
+                   size_t* payload_size)
+{
+    afbc_job_t job;
+    size_t n_superblocks;
+    size_t body_bytes = 0;
+    int ret;
+
+    if ( NULL == src || NULL == dst || !is_layout_valid(layout) )
+    {
+        ALOGE("invalid afbc layout.");
+        return -EINVAL;
+    }
+
+    n_superblocks = (size_t)layout->sb_cols * layout->sb_rows;
+    if ( layout->body_offset < n_superblocks * RK_AFBC_HEADER_SIZE
+        || layout->body_offset
+           + n_superblocks * layout->sb_width * layout->sb_height * layout->bytes_per_pixel > layout->buffer_size )
+    {
+        ALOGE("no room for afbc body, body_offset : %zu, buffer_size : %zu.", layout->body_offset, layout->buffer_size);
+        return -EINVAL;
+    }
+
+    memset(&job, 0, sizeof(job) );
+    job.encode = true;
+    job.src = src;
+    job.src_stride = src_stride;
+    job.layout = layout;
+    job.dst = dst;
+    job.first_row = 0;
+    /* header 区中的所有 superblock 都可能被 GPU 或 VOP 读取, 都要编码. */
+    job.last_row = layout->sb_rows;
+    job.cols = layout->sb_cols;
+
+    ret = run_afbc_job_parallel(&job, &body_bytes);
+
+    if ( payload_size != NULL )
+    {
+        *payload_size = n_superblocks * RK_AFBC_HEADER_SIZE + body_bytes;
+    }
+
+    return ret;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_drm_rockchip_afbc.h
+ *      rk_drm_gralloc 在 CPU 一侧对 AFBC (RGB 格式) buffer 的解码和编码.
+ *
+ * AFBC buffer 由 header 区和 body 区组成.
+ * 每个 superblock (16x16 或 32x8 像素) 对应 header 区中一个 16 byte 的 header :
+ *      bit [0, 32) : superblock 的数据在 buffer 中的 byte offset, 为 0 表示 superblock 是纯色的;
+ *      bit [32, 128) : 16 个 6 bit 的 size, 依次是按解码顺序的 16 个 4x4 subblock 的数据的 byte 数,
+ *                      0 : 与解码顺序中前一个 subblock 相同, 1 : 未压缩, 数据是 4x4 个像素;
+ *                      其他 : 压缩后的 byte 数.
+ *      纯色 superblock 的像素值保存在 header 的 byte [8, 8 + bytes_per_pixel) 中.
+ * superblock 中各 subblock 的数据, 按解码顺序依次存放.
+ * YTR (use_yuv_transform) 只作用于压缩的 subblock, 未压缩, 复制和纯色的数据都是原始像素, 解码与 YTR 无关.
+ *
+ * 限制 : 这里只支持 header 一级的编码, 即纯色的 superblock, 以及未压缩和复制的 subblock.
+ * 压缩的 subblock (size 为 2 ~ 63) 是 entropy coded 的, 其 bitstream 没有公开的规范, 这里不解码.
+ * Mali GPU 渲染输出的 AFBC buffer 几乎总是含有压缩的 subblock, 所以不能在 CPU 一侧解码;
+ * 可以解码的只有 : 刚 alloc 的 buffer (init_afbc() 写入的纯色 header), 由 rk_afbc_encode() 编码的 buffer,
+ * 以及其他只写入未压缩 subblock 的 producer 的 buffer.
+ */
+
+#ifndef _GRALLOC_DRM_ROCKCHIP_AFBC_H_
+#define _GRALLOC_DRM_ROCKCHIP_AFBC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* 对 superblock 总数不小于该值的 buffer, 解码和编码将被分配到多个线程中执行. 对应一个 1080p RGB buffer. */
+#define RK_AFBC_MT_MIN_SUPERBLOCKS  (1920 * 1080 / 256)
+/* 执行解码和编码的最大线程数. */
+#define RK_AFBC_MAX_THREADS         4
+
+#define RK_AFBC_HEADER_SIZE         16
+#define RK_AFBC_SUBBLOCKS_PER_SUPERBLOCK 16
+
+/*
+ * 一个 AFBC buffer 的 superblock layout.
+ */
+typedef struct rk_afbc_layout
+{
+    /* 需要解码的区域, 单位是像素. */
+    int width;
+    int height;
+    /* 2 : RGB565; 3 : RGB888; 4 : RGBA8888, RGBX8888, BGRA8888. */
+    int bytes_per_pixel;
+
+    /* superblock 的尺寸, 16x16 (basic) 或 32x8 (wideblk). */
+    int sb_width;
+    int sb_height;
+    /* header 区中 superblock 的列数和行数, 对 tiled_headers, 都是 8 的倍数. */
+    int sb_cols;
+    int sb_rows;
+    /* header 区是否以 8x8 个 superblock 为一个 tile 排列. */
+    bool tiled_headers;
+
+    /* body 区在 buffer 中的 byte offset, 即 (对齐后的) header 区的大小. 只用于编码. */
+    size_t body_offset;
+    /* buffer 的总 byte 数, 用于检查 header 中的 offset. */
+    size_t buffer_size;
+} rk_afbc_layout_t;
+
+/*
+ * 只读取 header (以及 header 中的 offset 和 size), 检查 AFBC buffer 'src' 中 [0, width) x [0, height) 的内容
+ * 是否可以被 rk_afbc_decode() 解码. 开销约为每个 superblock 读取 16 byte.
+ *
+ * @return
+ *      0 : 可以解码;
+ *      -EINVAL : layout 无效, 或者 header 中的 offset, size 越界;
+ *      -ENOTSUP : buffer 中有压缩的 subblock (比如由 GPU 渲染), 不能解码.
+ */
+int rk_afbc_check_decodable(const uint8_t* src, const rk_afbc_layout_t* layout);
+
+/*
+ * 将 AFBC buffer 'src' 解码为线性的像素数据, 写入 'dst'.
+ * 只用于 GRALLOC_DRM_LOCK_VIEW_AFBC_ENCODE_ON_UNLOCK 的副本的初始内容, 不作为通用的 AFBC 解码器提供.
+ * 先以 rk_afbc_check_decodable() 检查整个 buffer, 失败时 'dst' 不被修改.
+ *
+ * dst_stride : dst 中相邻两行之间的 byte 数.
+ *
+ * @return
+ *      0 : 成功;
+ *      -EINVAL : layout 无效, 或者 header 中的 offset, size 越界;
+ *      -ENOTSUP : buffer 中有压缩的 subblock, 见文件开头的 "限制".
+ */
+int rk_afbc_decode(const uint8_t* src, const rk_afbc_layout_t* layout, uint8_t* dst, int dst_stride);
+
+/*
+ * 将线性的像素数据 'src' 编码为 AFBC, 写入 buffer 'dst'.
+ * 只使用 rk_afbc_decode() 支持的编码 : 像素都相同的 superblock 编码为纯色,
+ * 其他 superblock 中, 与解码顺序中前一个 subblock 相同的 subblock 编码为复制, 其余不压缩.
+ * 各 superblock 的 body 按 superblock 序号存放在 body 区中的固定位置 (sparse), 不使用 YTR.
+ * 所以只有平坦或重复的内容 (UI 的背景, 纯色的区域等) 被压缩; 对照片等内容, payload 与线性数据相当 (另加 header 区).
+ * 编码的目的是使 CPU 产生的内容可以写入 AFBC buffer, 而不是减少带宽.
+ *
+ * src_stride : src 中相邻两行之间的 byte 数.
+ * payload_size : 若不是 NULL, 返回 header 区和实际使用的 body 的 byte 数之和, 用于统计压缩率.
+ *
+ * @return
+ *      0 : 成功; -EINVAL : layout 无效, 或者 buffer 中没有足够的 body 空间; -ENOMEM.
+ */
+int rk_afbc_encode(const uint8_t* src, int src_stride, const rk_afbc_layout_t* layout, uint8_t* dst,
+                   size_t* payload_size);
+
+#endif /* _GRALLOC_DRM_ROCKCHIP_AFBC_H_ */
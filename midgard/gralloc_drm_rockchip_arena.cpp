@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "GRALLOC-ROCKCHIP"
+
+#include <log/log.h>
+
+#include <errno.h>
+
+#include "gralloc_drm_rockchip_arena.h"
+
+static inline size_t align_up(size_t value, size_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+/*
+ * 将 ['offset', 'offset' + 'size') 从 'free_by_size' 中移除.
+ */
+static void erase_by_size(rk_range_arena_t* arena, size_t offset, size_t size)
+{
+    std::multimap<size_t, size_t>::iterator it;
+    std::pair<std::multimap<size_t, size_t>::iterator, std::multimap<size_t, size_t>::iterator> range;
+
+    range = arena->free_by_size.equal_range(size);
+    for ( it = range.first; it != range.second; ++it )
+    {
+        if ( it->second == offset )
+        {
+            arena->free_by_size.erase(it);
+            return;
+        }
+    }
+
+    LOG_ALWAYS_FATAL("free range at %zu (%zu bytes) is missing from size index", offset, size);
+}
+
+/*
+ * 将 ['offset', 'offset' + 'size') 加入空闲区域, 并与前后相邻的空闲区域合并.
+ */
+static void insert_free(rk_range_arena_t* arena, size_t offset, size_t size)
+{
+    std::map<size_t, size_t>::iterator next = arena->free_ranges.lower_bound(offset);
+
+    if ( next != arena->free_ranges.end() && offset + size == next->first )
+    {
+        size += next->second;
+        erase_by_size(arena, next->first, next->second);
+        next = arena->free_ranges.erase(next);
+    }
+
+    if ( next != arena->free_ranges.begin() )
+    {
+        std::map<size_t, size_t>::iterator prev = next;
+
+        --prev;
+        if ( prev->first + prev->second == offset )
+        {
+            offset = prev->first;
+            size += prev->second;
+            erase_by_size(arena, prev->first, prev->second);
+            arena->free_ranges.erase(prev);
+        }
+    }
+
+    arena->free_ranges[offset] = size;
+    arena->free_by_size.insert(std::make_pair(size, offset) );
+}
+
+void rk_range_arena_init(rk_range_arena_t* arena, size_t capacity, size_t align)
+{
+    arena->align = align;
+    arena->capacity = capacity & ~(align - 1);
+
+    arena->free_ranges.clear();
+    arena->free_by_size.clear();
+    arena->used_ranges.clear();
+
+    if ( arena->capacity > 0 )
+    {
+        insert_free(arena, 0, arena->capacity);
+    }
+
+    arena->allocs = 0;
+    arena->frees = 0;
+    arena->failures = 0;
+}
+
+int rk_range_arena_alloc(rk_range_arena_t* arena, size_t size, size_t* offset)
+{
+    std::multimap<size_t, size_t>::iterator best;
+    size_t aligned_size;
+    size_t range_offset;
+    size_t range_size;
+
+    if ( 0 == size )
+    {
+        return -EINVAL;
+    }
+    aligned_size = align_up(size, arena->align);
+
+    /* best-fit : 不小于 'aligned_size' 的最小空闲区域, 相同 size 时取 offset 最小的. */
+    best = arena->free_by_size.lower_bound(aligned_size);
+    if ( best == arena->free_by_size.end() )
+    {
+        arena->failures++;
+        return -ENOMEM;
+    }
+
+    range_size = best->first;
+    range_offset = best->second;
+    arena->free_by_size.erase(best);
+    arena->free_ranges.erase(range_offset);
+
+    /* 从区域的起始分配, 剩余部分仍是空闲区域, 其后相邻的一定不是空闲区域, 不需要合并. */
+    if ( range_size > aligned_size )
+    {
+        arena->free_ranges[range_offset + aligned_size] = range_size - aligned_size;
+        arena->free_by_size.insert(std::make_pair(range_size - aligned_size, range_offset + aligned_size) );
+    }
+
+    arena->used_ranges[range_offset] = aligned_size;
+    arena->allocs++;
+
+    *offset = range_offset;
+    return 0;
+}
+
+int rk_range_arena_free(rk_range_arena_t* arena, size_t offset)
+{
+    std::map<size_t, size_t>::iterator it = arena->used_ranges.find(offset);
+    size_t size;
+
+    if ( it == arena->used_ranges.end() )
+    {
+        ALOGE("no range is allocated at offset %zu of arena", offset);
+        return -EINVAL;
+    }
+
+    size = it->second;
+    arena->used_ranges.erase(it);
+    arena->frees++;
+
+    insert_free(arena, offset, size);
+    return 0;
+}
+
+void rk_range_arena_get_stats(const rk_range_arena_t* arena, rk_range_arena_stats_t* stats)
+{
+    std::map<size_t, size_t>::const_iterator it;
+
+    stats->capacity = arena->capacity;
+
+    stats->used_bytes = 0;
+    stats->used_count = (uint32_t)arena->used_ranges.size();
+    for ( it = arena->used_ranges.begin(); it != arena->used_ranges.end(); ++it )
+    {
+        stats->used_bytes += it->second;
+    }
+
+    stats->free_bytes = 0;
+    stats->free_count = (uint32_t)arena->free_ranges.size();
+    stats->largest_free = arena->free_by_size.empty() ? 0 : arena->free_by_size.rbegin()->first;
+    for ( it = arena->free_ranges.begin(); it != arena->free_ranges.end(); ++it )
+    {
+        stats->free_bytes += it->second;
+    }
+
+    stats->fragmentation_permille = (stats->free_bytes != 0)
+        ? (uint32_t)(1000 - (uint64_t)stats->largest_free * 1000 / stats->free_bytes)
+        : 0;
+
+    stats->allocs = arena->allocs;
+    stats->frees = arena->frees;
+    stats->failures = arena->failures;
+}
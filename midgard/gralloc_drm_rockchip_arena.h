@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_drm_rockchip_arena.h
+ *      rk_drm_gralloc 在一段预留的连续区域 (arena) 中分配子区域的 range allocator.
+ *
+ * 用于 scanout arena : 在一个物理连续的大 bo 中, 为 framebuffer 和 overlay buffer 分配 [offset, offset + size).
+ * 分配使用 best-fit, 释放时与相邻的空闲区域合并 (coalesce).
+ * 区域何时可以被释放 (所有进程都不再引用其中的 buffer) 由调用者判断, 本模块不做任何延迟.
+ *
+ * 本模块只管理 offset, 不访问内存, 也不是线程安全的, 由调用者加锁.
+ */
+
+#ifndef _GRALLOC_DRM_ROCKCHIP_ARENA_H_
+#define _GRALLOC_DRM_ROCKCHIP_ARENA_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+
+/* arena 中子区域的 offset 和 size 的默认对齐值. */
+#define RK_ARENA_DEFAULT_ALIGN  4096
+
+typedef struct rk_range_arena
+{
+    size_t capacity;
+    size_t align;
+
+    /* 空闲区域, offset -> size, 相邻的空闲区域总是已经合并. */
+    std::map<size_t, size_t> free_ranges;
+    /* 与 'free_ranges' 相同的空闲区域, size -> offset, 用于 best-fit. */
+    std::multimap<size_t, size_t> free_by_size;
+    /* 已分配的区域, offset -> size. */
+    std::map<size_t, size_t> used_ranges;
+
+    uint64_t allocs;
+    uint64_t frees;
+    /* 没有足够大的空闲区域而失败的分配的次数. */
+    uint64_t failures;
+} rk_range_arena_t;
+
+/* rk_range_arena_get_stats() 返回的统计. */
+typedef struct rk_range_arena_stats
+{
+    size_t capacity;
+    size_t used_bytes;
+    uint32_t used_count;
+    size_t free_bytes;
+    uint32_t free_count;
+    size_t largest_free;
+    /* 1 - largest_free / free_bytes, 以 1/1000 为单位, 0 表示空闲区域是连续的. */
+    uint32_t fragmentation_permille;
+
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t failures;
+} rk_range_arena_stats_t;
+
+/*
+ * 将 'arena' 初始化为 'capacity' byte 的一个空闲区域. 'align' 必须是 2 的幂.
+ */
+void rk_range_arena_init(rk_range_arena_t* arena, size_t capacity, size_t align);
+
+/*
+ * 从 'arena' 中以 best-fit 分配 'size' byte, 'size' 按 arena 的 'align' 向上对齐.
+ *
+ * @return
+ *      0 : 成功, 'offset' 返回分配的区域的起始 offset;
+ *      -EINVAL : 'size' 为 0;
+ *      -ENOMEM : 没有足够大的空闲区域.
+ */
+int rk_range_arena_alloc(rk_range_arena_t* arena, size_t size, size_t* offset);
+
+/*
+ * 释放 rk_range_arena_alloc() 在 'offset' 分配的区域, 区域立即可以被再次分配.
+ *
+ * @return
+ *      0 : 成功; -EINVAL : 'offset' 不是已分配的区域.
+ */
+int rk_range_arena_free(rk_range_arena_t* arena, size_t offset);
+
+void rk_range_arena_get_stats(const rk_range_arena_t* arena, rk_range_arena_stats_t* stats);
+
+#endif /* _GRALLOC_DRM_ROCKCHIP_ARENA_H_ */
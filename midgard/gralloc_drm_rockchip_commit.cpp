@@ -0,0 +1,483 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "GRALLOC-ROCKCHIP"
+
+#include <log/log.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <vector>
+
+#include "gralloc_drm_rockchip_commit.h"
+
+/* 请求中的 magic, 用于丢弃不是 rk_commit_request() 发送的消息. */
+#define RK_COMMIT_REQUEST_MAGIC     0x72636d74U
+
+/* 请求, 附带请求者用于接收回复的 socket (SCM_RIGHTS). */
+typedef struct
+{
+    uint32_t magic;
+} commit_request_t;
+
+/* 回复, 'status' 为 0 时附带 dma_buf 的 fd (SCM_RIGHTS). */
+typedef struct
+{
+    int32_t status;
+} commit_reply_t;
+
+struct rk_commit_server
+{
+    /* 创建 server 的进程. fork 出的子进程中没有 server 的线程. */
+    pid_t owner_pid;
+
+    rk_commit_fn commit;
+    rk_commit_release_fn release;
+
+    /* 向 'wake_fds[1]' 写入使线程重新读取 'placeholders', 或在 'quit' 为 true 时退出. */
+    int wake_fds[2];
+    pthread_t thread;
+
+    /* 保护以下成员. */
+    pthread_mutex_t lock;
+    /* placeholder 的 server 一端的 fd -> cookie. 只有线程移除其中的元素. */
+    std::map<int, void*> placeholders;
+    bool quit;
+};
+
+/*
+ * 从 'msg' 中取出 SCM_RIGHTS 附带的第一个 fd, 没有时返回 -1.
+ */
+static int get_passed_fd(struct msghdr* msg)
+{
+    struct cmsghdr* cmsg;
+
+    for ( cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg) )
+    {
+        if ( SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type
+            && cmsg->cmsg_len >= CMSG_LEN(sizeof(int) ) )
+        {
+            int fd;
+
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd) );
+            return fd;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * 通过 'socket_fd' 发送 'size' byte 的 'data', 'fd' >= 0 时一并发送 'fd'.
+ */
+static int send_with_fd(int socket_fd, const void* data, size_t size, int fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    char control[CMSG_SPACE(sizeof(int) )];
+
+    memset(&msg, 0, sizeof(msg) );
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len = size;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if ( fd >= 0 )
+    {
+        struct cmsghdr* cmsg;
+
+        memset(control, 0, sizeof(control) );
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) );
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd) );
+    }
+
+    while ( sendmsg(socket_fd, &msg, MSG_NOSIGNAL) < 0 )
+    {
+        if ( errno != EINTR )
+        {
+            return -errno;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * 通过 'socket_fd' 接收最多 'size' byte 到 'data', 附带的 fd (close-on-exec) 通过 'fd' 返回, 没有时为 -1.
+ *
+ * @return
+ *      接收的 byte 数, 0 表示对端已经关闭; 或 -errno.
+ */
+static ssize_t recv_with_fd(int socket_fd, void* data, size_t size, int* fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    char control[CMSG_SPACE(sizeof(int) )];
+    ssize_t n;
+
+    memset(&msg, 0, sizeof(msg) );
+    iov.iov_base = data;
+    iov.iov_len = size;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    *fd = -1;
+    do
+    {
+        n = recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC);
+    } while ( n < 0 && EINTR == errno );
+
+    if ( n < 0 )
+    {
+        return -errno;
+    }
+
+    *fd = get_passed_fd(&msg);
+    return n;
+}
+
+/*
+ * 处理 placeholder 的 server 一端 'fd' 上的一个请求.
+ *
+ * @return
+ *      false : 所有进程都已关闭 placeholder, 或者 'fd' 不再可用.
+ */
+static bool serve_request(rk_commit_server_t* server, int fd, void* cookie)
+{
+    commit_request_t request;
+    commit_reply_t reply;
+    int reply_fd;
+    int dma_buf_fd;
+    ssize_t n;
+
+    n = recv_with_fd(fd, &request, sizeof(request), &reply_fd);
+    if ( 0 == n )
+    {
+        return false;
+    }
+    if ( n < 0 )
+    {
+        if ( -EAGAIN == n )
+        {
+            return true;
+        }
+        ALOGE("failed to receive commit request, err : %s", strerror((int)-n) );
+        return false;
+    }
+
+    if ( n != (ssize_t)sizeof(request) || request.magic != RK_COMMIT_REQUEST_MAGIC || reply_fd < 0 )
+    {
+        ALOGW("dropped malformed commit request, size : %zd, reply_fd : %d", n, reply_fd);
+        if ( reply_fd >= 0 )
+        {
+            close(reply_fd);
+        }
+        return true;
+    }
+
+    dma_buf_fd = server->commit(cookie);
+    reply.status = (dma_buf_fd >= 0) ? 0 : dma_buf_fd;
+
+    /* 请求者可能已经超时并关闭了 'reply_fd', 此时发送失败, 不影响 placeholder. */
+    n = send_with_fd(reply_fd, &reply, sizeof(reply), dma_buf_fd);
+    if ( n < 0 )
+    {
+        ALOGW("failed to reply commit request, err : %s", strerror((int)-n) );
+    }
+    close(reply_fd);
+
+    return true;
+}
+
+static void* commit_server_main(void* arg)
+{
+    rk_commit_server_t* server = (rk_commit_server_t*)arg;
+    std::vector<struct pollfd> fds;
+    std::vector<void*> cookies;
+
+    for ( ;; )
+    {
+        std::map<int, void*>::iterator it;
+        struct pollfd wake_fd;
+        size_t i;
+
+        fds.clear();
+        cookies.clear();
+        wake_fd.fd = server->wake_fds[0];
+        wake_fd.events = POLLIN;
+        wake_fd.revents = 0;
+        fds.push_back(wake_fd);
+        cookies.push_back(NULL);
+
+        pthread_mutex_lock(&server->lock);
+        if ( server->quit )
+        {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        for ( it = server->placeholders.begin(); it != server->placeholders.end(); ++it )
+        {
+            struct pollfd pfd;
+
+            pfd.fd = it->first;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            fds.push_back(pfd);
+            cookies.push_back(it->second);
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        if ( poll(&fds[0], fds.size(), -1) < 0 )
+        {
+            if ( EINTR == errno )
+            {
+                continue;
+            }
+            ALOGE("commit server failed to poll, err : %s", strerror(errno) );
+            break;
+        }
+
+        if ( fds[0].revents & POLLIN )
+        {
+            char buf[64];
+
+            while ( read(server->wake_fds[0], buf, sizeof(buf) ) > 0 )
+            {
+            }
+        }
+
+        for ( i = 1; i < fds.size(); i++ )
+        {
+            bool open = true;
+
+            if ( fds[i].revents & POLLIN )
+            {
+                open = serve_request(server, fds[i].fd, cookies[i]);
+            }
+            else if ( fds[i].revents & (POLLHUP | POLLERR | POLLNVAL) )
+            {
+                open = false;
+            }
+
+            if ( !open )
+            {
+                pthread_mutex_lock(&server->lock);
+                server->placeholders.erase(fds[i].fd);
+                pthread_mutex_unlock(&server->lock);
+
+                close(fds[i].fd);
+                server->release(cookies[i]);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void wake_server(rk_commit_server_t* server)
+{
+    char c = 0;
+
+    if ( write(server->wake_fds[1], &c, 1) != 1 && errno != EAGAIN )
+    {
+        ALOGE("failed to wake commit server, err : %s", strerror(errno) );
+    }
+}
+
+rk_commit_server_t* rk_commit_server_create(rk_commit_fn commit, rk_commit_release_fn release)
+{
+    rk_commit_server_t* server = new rk_commit_server_t;
+    int ret;
+
+    server->owner_pid = getpid();
+    server->commit = commit;
+    server->release = release;
+    server->quit = false;
+    pthread_mutex_init(&server->lock, NULL);
+
+    if ( pipe2(server->wake_fds, O_CLOEXEC | O_NONBLOCK) != 0 )
+    {
+        ALOGE("failed to create wake pipe of commit server, err : %s", strerror(errno) );
+        pthread_mutex_destroy(&server->lock);
+        delete server;
+        return NULL;
+    }
+
+    ret = pthread_create(&server->thread, NULL, commit_server_main, server);
+    if ( ret != 0 )
+    {
+        ALOGE("failed to create commit server thread, err : %s", strerror(ret) );
+        close(server->wake_fds[0]);
+        close(server->wake_fds[1]);
+        pthread_mutex_destroy(&server->lock);
+        delete server;
+        return NULL;
+    }
+
+    return server;
+}
+
+void rk_commit_server_destroy(rk_commit_server_t* server)
+{
+    std::map<int, void*>::iterator it;
+
+    if ( NULL == server )
+    {
+        return;
+    }
+
+    /* fork 出的子进程中没有 server 的线程, 'lock' 可能停留在 fork 时被某个线程持有的状态, 只释放内存. */
+    if ( getpid() != server->owner_pid )
+    {
+        delete server;
+        return;
+    }
+
+    pthread_mutex_lock(&server->lock);
+    server->quit = true;
+    pthread_mutex_unlock(&server->lock);
+    wake_server(server);
+    pthread_join(server->thread, NULL);
+
+    close(server->wake_fds[0]);
+    close(server->wake_fds[1]);
+
+    for ( it = server->placeholders.begin(); it != server->placeholders.end(); ++it )
+    {
+        close(it->first);
+        server->release(it->second);
+    }
+    server->placeholders.clear();
+
+    pthread_mutex_destroy(&server->lock);
+    delete server;
+}
+
+int rk_commit_server_add(rk_commit_server_t* server, void* cookie)
+{
+    int fds[2];
+
+    if ( getpid() != server->owner_pid )
+    {
+        return -ECHILD;
+    }
+
+    if ( socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0 )
+    {
+        int err = errno;
+
+        ALOGE("failed to create placeholder, err : %s", strerror(err) );
+        return -err;
+    }
+
+    pthread_mutex_lock(&server->lock);
+    server->placeholders[fds[0]] = cookie;
+    pthread_mutex_unlock(&server->lock);
+    wake_server(server);
+
+    return fds[1];
+}
+
+bool rk_commit_is_placeholder(int fd)
+{
+    struct stat st;
+    int type = 0;
+    socklen_t len = sizeof(type);
+
+    if ( fd < 0 || fstat(fd, &st) != 0 || !S_ISSOCK(st.st_mode) )
+    {
+        return false;
+    }
+
+    return 0 == getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) && SOCK_SEQPACKET == type;
+}
+
+int rk_commit_request(int fd, int timeout_ms)
+{
+    commit_request_t request;
+    commit_reply_t reply;
+    struct pollfd pfd;
+    int reply_fds[2];
+    int dma_buf_fd;
+    ssize_t n;
+    int ret;
+
+    /* 每个请求使用单独的 socket 接收回复, 持有同一 placeholder 的多个请求者不会收到彼此的回复. */
+    if ( socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, reply_fds) != 0 )
+    {
+        return -errno;
+    }
+
+    request.magic = RK_COMMIT_REQUEST_MAGIC;
+    ret = send_with_fd(fd, &request, sizeof(request), reply_fds[1]);
+    close(reply_fds[1]);
+    if ( ret != 0 )
+    {
+        close(reply_fds[0]);
+        /* server 一端已经关闭. */
+        return (-ECONNRESET == ret || -ECONNREFUSED == ret) ? -EPIPE : ret;
+    }
+
+    pfd.fd = reply_fds[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    do
+    {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while ( ret < 0 && EINTR == errno );
+
+    if ( ret <= 0 )
+    {
+        ret = (0 == ret) ? -ETIMEDOUT : -errno;
+        close(reply_fds[0]);
+        return ret;
+    }
+
+    n = recv_with_fd(reply_fds[0], &reply, sizeof(reply), &dma_buf_fd);
+    close(reply_fds[0]);
+    if ( n <= 0 )
+    {
+        /* server 没有处理请求就关闭了 placeholder (比如 server 被销毁). */
+        return (0 == n) ? -EPIPE : (int)n;
+    }
+
+    if ( n != (ssize_t)sizeof(reply) || reply.status != 0 || dma_buf_fd < 0 )
+    {
+        if ( dma_buf_fd >= 0 )
+        {
+            close(dma_buf_fd);
+        }
+        return (n == (ssize_t)sizeof(reply) && reply.status < 0) ? reply.status : -EPROTO;
+    }
+
+    return dma_buf_fd;
+}
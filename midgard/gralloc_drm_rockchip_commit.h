@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_drm_rockchip_commit.h
+ *      rk_drm_gralloc lazy commit 的跨进程部分 : 尚未 commit 的 buffer 的 placeholder fd, 以及通过它请求 alloc 的进程 commit.
+ *
+ * lazy commit 的 buffer 在 alloc 时没有 dma_buf, handle 的 prime_fd 是一个 placeholder :
+ * 一对 AF_UNIX SOCK_SEQPACKET socket 中 client 的一端, server 的一端由 alloc 的进程中的 rk_commit_server_t 持有.
+ * placeholder 和其他 fd 一样随 handle 被 dup 和传递到其他进程.
+ * import 的进程发现 prime_fd 是 placeholder 时调用 rk_commit_request(), server 在 alloc 的进程中 commit 并返回 dma_buf 的 fd.
+ * 所有进程都关闭了 placeholder (server 一端收到 hang up) 之后, server 通知 alloc 的进程释放该 buffer 的 commit 状态.
+ *
+ * 本模块不访问 drm, 如何 commit 和释放由调用者通过回调提供.
+ */
+
+#ifndef _GRALLOC_DRM_ROCKCHIP_COMMIT_H_
+#define _GRALLOC_DRM_ROCKCHIP_COMMIT_H_
+
+#include <stdbool.h>
+
+/* rk_commit_request() 等待 server 回复的默认时间, 单位 ms. */
+#define RK_COMMIT_REQUEST_TIMEOUT_MS    3000
+
+/*
+ * commit 'cookie' 对应的 buffer, 在 server 的线程中调用.
+ *
+ * @return
+ *      >= 0 : buffer 的 dma_buf 的 fd, 仍由调用者持有, server 只发送其副本;
+ *      < 0 : -errno, 原样返回给请求者.
+ */
+typedef int (*rk_commit_fn)(void* cookie);
+
+/*
+ * 所有进程都已关闭 'cookie' 对应的 placeholder, 在 server 的线程中 (或 rk_commit_server_destroy() 中) 调用, 之后不再使用 'cookie'.
+ */
+typedef void (*rk_commit_release_fn)(void* cookie);
+
+/*
+ * 为当前进程的 placeholder 服务的线程及其 placeholder 的集合.
+ * 线程在 rk_commit_server_create() 中创建, 在 rk_commit_server_destroy() 中退出.
+ */
+typedef struct rk_commit_server rk_commit_server_t;
+
+/*
+ * 创建 server 及其线程, 失败返回 NULL.
+ */
+rk_commit_server_t* rk_commit_server_create(rk_commit_fn commit, rk_commit_release_fn release);
+
+/*
+ * 通知线程退出并等待, 对尚未释放的 placeholder 调用 release, 之后释放 'server'.
+ * 其他进程中的 placeholder 之后的 rk_commit_request() 返回 -EPIPE.
+ */
+void rk_commit_server_destroy(rk_commit_server_t* server);
+
+/*
+ * 为 'cookie' 创建一个 placeholder.
+ *
+ * @return
+ *      >= 0 : placeholder (client 一端) 的 fd, close-on-exec, 由调用者持有;
+ *      < 0 : -errno. 在创建 'server' 的进程 fork 出的子进程中调用时返回 -ECHILD (子进程中没有 server 的线程).
+ */
+int rk_commit_server_add(rk_commit_server_t* server, void* cookie);
+
+/*
+ * 'fd' 是否是 placeholder, 而不是 dma_buf.
+ */
+bool rk_commit_is_placeholder(int fd);
+
+/*
+ * 请求 placeholder 'fd' 所属的 server commit, 最多等待 'timeout_ms'.
+ * 可以在任何进程 (包括 alloc 的进程) 中调用, 同一个 placeholder 可以被多次请求, 返回同一个 dma_buf 的不同 fd.
+ *
+ * @return
+ *      >= 0 : dma_buf 的 fd, close-on-exec, 由调用者持有;
+ *      < 0 : -errno. -ETIMEDOUT : server 没有及时回复; -EPIPE : server 已经不存在; 其他 : commit 失败.
+ */
+int rk_commit_request(int fd, int timeout_ms);
+
+#endif /* _GRALLOC_DRM_ROCKCHIP_COMMIT_H_ */
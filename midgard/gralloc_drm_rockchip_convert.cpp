@@ -0,0 +1,462 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_drm_rockchip_convert.cpp
+ *      对 gralloc_drm_rockchip_convert.h 中接口的具体实现.
+ */
+
+#define LOG_TAG "GRALLOC-ROCKCHIP"
+
+#include <log/log.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#include "gralloc_drm_rockchip_convert.h"
+
+/*---------------------------------------------------------------------------*/
+
+/*
+ * 解包一行.
+ * 每次处理 8 个 sample (10 byte) : 先将每个 sample 所在的 2 个 byte 重排到一个 16 bit lane 中,
+ * 再左移, 使 sample 的最高 bit 对齐到 lane 的 bit 15, 最后清除低 6 bit.
+ * sample 在 lane 中的起始 bit 依次是 0, 2, 4, 6, 所以左移 6, 4, 2, 0.
+ */
+static void unpack_10bit_row(const uint8_t* src, int src_row_bytes, uint16_t* dst, int n)
+{
+    int i = 0;
+    int byte_off = 0;
+
+#if defined(__aarch64__)
+    static const uint8_t k_shuffle[16] = { 0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9 };
+    static const int16_t k_shift[8] = { 6, 4, 2, 0, 6, 4, 2, 0 };
+    const uint8x16_t shuffle = vld1q_u8(k_shuffle);
+    const int16x8_t shift = vld1q_s16(k_shift);
+    const uint16x8_t mask = vdupq_n_u16(0xFFC0);
+
+    /* 每次读入 16 byte, 不能越过当前行. */
+    for ( ; i + 8 <= n && byte_off + 16 <= src_row_bytes; i += 8, byte_off += 10 )
+    {
+        uint8x16_t in = vld1q_u8(src + byte_off);
+        uint16x8_t v = vreinterpretq_u16_u8(vqtbl1q_u8(in, shuffle) );
+
+        vst1q_u16(dst + i, vandq_u16(vshlq_u16(v, shift), mask) );
+    }
+#elif defined(__SSSE3__)
+    /* SSE 中没有按 lane 可变的 16 bit 移位, 用乘以 2^shift 代替. */
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9);
+    const __m128i mul = _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1);
+    const __m128i mask = _mm_set1_epi16((short)0xFFC0);
+
+    for ( ; i + 8 <= n && byte_off + 16 <= src_row_bytes; i += 8, byte_off += 10 )
+    {
+        __m128i in = _mm_loadu_si128((const __m128i*)(src + byte_off) );
+        __m128i v = _mm_shuffle_epi8(in, shuffle);
+
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_and_si128(_mm_mullo_epi16(v, mul), mask) );
+    }
+#else
+    (void)src_row_bytes;
+    (void)byte_off;
+#endif
+
+    for ( ; i < n; i++ )
+    {
+        int bit = i * 10;
+        const uint8_t* p = src + (bit >> 3);
+        uint16_t v = (uint16_t)(( (p[0] | (p[1] << 8) ) >> (bit & 7) ) & 0x3FF);
+
+        dst[i] = v << 6;
+    }
+}
+
+static void pack_10bit_row(const uint16_t* src, uint8_t* dst, int n)
+{
+    int i = 0;
+    int o = 0;
+
+    for ( ; i + 4 <= n; i += 4, o += 5 )
+    {
+        uint32_t s0 = src[i] >> 6;
+        uint32_t s1 = src[i + 1] >> 6;
+        uint32_t s2 = src[i + 2] >> 6;
+        uint32_t s3 = src[i + 3] >> 6;
+
+        dst[o]     = (uint8_t)s0;
+        dst[o + 1] = (uint8_t)( (s0 >> 8) | (s1 << 2) );
+        dst[o + 2] = (uint8_t)( (s1 >> 6) | (s2 << 4) );
+        dst[o + 3] = (uint8_t)( (s2 >> 4) | (s3 << 6) );
+        dst[o + 4] = (uint8_t)(s3 >> 2);
+    }
+
+    /* 末尾不足 4 个的 sample, 只修改其占用的 bit. */
+    for ( ; i < n; i++ )
+    {
+        int bit = i * 10;
+        int shift = bit & 7;
+        uint8_t* p = dst + (bit >> 3);
+        uint16_t cur = (uint16_t)(p[0] | (p[1] << 8) );
+
+        cur &= (uint16_t)~(0x3FF << shift);
+        cur |= (uint16_t)( (src[i] >> 6) << shift);
+        p[0] = (uint8_t)cur;
+        p[1] = (uint8_t)(cur >> 8);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+typedef struct
+{
+    const uint8_t* src;
+    int src_stride;
+    uint8_t* dst;
+    int dst_stride;
+    int samples_per_row;
+    int rows;
+    /* true : 10 bit packed -> P010; false : P010 -> 10 bit packed. */
+    bool unpack;
+} convert_job_t;
+
+static void run_convert_job(const convert_job_t* job)
+{
+    int r;
+
+    for ( r = 0; r < job->rows; r++ )
+    {
+        const uint8_t* src = job->src + (size_t)r * job->src_stride;
+        uint8_t* dst = job->dst + (size_t)r * job->dst_stride;
+
+        if ( job->unpack )
+        {
+            unpack_10bit_row(src, job->src_stride, (uint16_t*)dst, job->samples_per_row);
+        }
+        else
+        {
+            pack_10bit_row((const uint16_t*)src, dst, job->samples_per_row);
+        }
+    }
+}
+
+static void* convert_thread_main(void* arg)
+{
+    run_convert_job((const convert_job_t*)arg);
+    return NULL;
+}
+
+/*
+ * 执行 'job', 对较大的 plane, 按行将 'job' 分配到多个线程中.
+ * 当前线程处理最后一段, 创建线程失败的段也在当前线程中处理.
+ */
+static void run_convert_job_parallel(const convert_job_t* job)
+{
+    convert_job_t parts[RK_CONVERT_MAX_THREADS];
+    pthread_t threads[RK_CONVERT_MAX_THREADS];
+    bool started[RK_CONVERT_MAX_THREADS] = { false };
+    int n_parts = 1;
+    int rows_per_part;
+    int i;
+
+    if ( (int64_t)job->samples_per_row * job->rows >= RK_CONVERT_MT_MIN_SAMPLES )
+    {
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        n_parts = (n_cpus > RK_CONVERT_MAX_THREADS) ? RK_CONVERT_MAX_THREADS : (int)n_cpus;
+        if ( n_parts > job->rows )
+        {
+            n_parts = job->rows;
+        }
+    }
+
+    if ( n_parts <= 1 )
+    {
+        run_convert_job(job);
+        return;
+    }
+
+    rows_per_part = (job->rows + n_parts - 1) / n_parts;
+
+    for ( i = 0; i < n_parts; i++ )
+    {
+        int first_row = i * rows_per_part;
+        int rows = job->rows - first_row;
+
+        parts[i] = *job;
+        parts[i].src = job->src + (size_t)first_row * job->src_stride;
+        parts[i].dst = job->dst + (size_t)first_row * job->dst_stride;
+        parts[i].rows = (rows < rows_per_part) ? (rows > 0 ? rows : 0) : rows_per_part;
+    }
+
+    for ( i = 0; i < n_parts - 1; i++ )
+    {
+        started[i] = (0 == pthread_create(&threads[i], NULL, convert_thread_main, &parts[i]) );
+        if ( !started[i] )
+        {
+            ALOGW("failed to create convert thread, convert in current thread.");
+            run_convert_job(&parts[i]);
+        }
+    }
+
+    run_convert_job(&parts[n_parts - 1]);
+
+    for ( i = 0; i < n_parts - 1; i++ )
+    {
+        if ( started[i] )
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+void rk_unpack_10bit_to_p010(const uint8_t* src, int src_stride,
+                             uint8_t* dst, int dst_stride,
+                             int samples_per_row, int rows)
+{
+    convert_job_t job = { src, src_stride, dst, dst_stride, samples_per_row, rows, true };
+
+    run_convert_job_parallel(&job);
+}
+
+void rk_pack_p010_to_10bit(const uint8_t* src, int src_stride,
+                           uint8_t* dst, int dst_stride,
+                           int samples_per_row, int rows)
+{
+    convert_job_t job = { src, src_stride, dst, dst_stride, samples_per_row, rows, false };
+
+    run_convert_job_parallel(&job);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* rk_clear_bytes() 切分出的一段区域. */
+typedef struct clear_part
+{
+    uint8_t* dst;
+    size_t size;
+} clear_part_t;
+
+struct rk_clear_pool
+{
+    /* 创建 pool 的进程. fork 出的子进程中没有 pool 的线程. */
+    pid_t owner_pid;
+
+    /* 同一时刻只有一个 rk_clear_bytes() 使用 pool, 其他调用者不等待, 直接在当前线程中清零. */
+    pthread_mutex_t submit_lock;
+
+    /* 保护以下成员. */
+    pthread_mutex_t lock;
+    /* 'generation' 增加时 worker 开始处理新的 'parts', 或 'quit' 为 true 时退出. */
+    pthread_cond_t work_cond;
+    /* 'pending' 减为 0 时通知提交者. */
+    pthread_cond_t done_cond;
+    uint64_t generation;
+    int pending;
+    bool quit;
+    /* 'parts[i]' 由第 i 个 worker 处理, 'parts[n_threads]' 由提交者处理. */
+    clear_part_t parts[RK_CONVERT_MAX_THREADS];
+
+    int n_threads;
+    pthread_t threads[RK_CONVERT_MAX_THREADS];
+};
+
+typedef struct
+{
+    rk_clear_pool_t* pool;
+    int index;
+} clear_worker_arg_t;
+
+static void* clear_worker_main(void* arg)
+{
+    clear_worker_arg_t* worker = (clear_worker_arg_t*)arg;
+    rk_clear_pool_t* pool = worker->pool;
+    int index = worker->index;
+    uint64_t seen;
+
+    free(worker);
+
+    pthread_mutex_lock(&pool->lock);
+    seen = pool->generation;
+    for (;;)
+    {
+        clear_part_t part;
+
+        while ( !pool->quit && seen == pool->generation )
+        {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if ( pool->quit )
+        {
+            break;
+        }
+        seen = pool->generation;
+        part = pool->parts[index];
+        pthread_mutex_unlock(&pool->lock);
+
+        memset(part.dst, 0, part.size);
+
+        pthread_mutex_lock(&pool->lock);
+        if ( 0 == --pool->pending )
+        {
+            pthread_cond_signal(&pool->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+rk_clear_pool_t* rk_clear_pool_create(int n_threads)
+{
+    rk_clear_pool_t* pool;
+    int i;
+
+    if ( n_threads <= 0 )
+    {
+        return NULL;
+    }
+    if ( n_threads > RK_CONVERT_MAX_THREADS - 1 )
+    {
+        n_threads = RK_CONVERT_MAX_THREADS - 1;
+    }
+
+    pool = (rk_clear_pool_t*)calloc(1, sizeof(*pool) );
+    if ( NULL == pool )
+    {
+        return NULL;
+    }
+
+    pool->owner_pid = getpid();
+    pthread_mutex_init(&pool->submit_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    for ( i = 0; i < n_threads; i++ )
+    {
+        clear_worker_arg_t* worker = (clear_worker_arg_t*)malloc(sizeof(*worker) );
+
+        if ( NULL == worker )
+        {
+            break;
+        }
+        worker->pool = pool;
+        worker->index = i;
+
+        if ( pthread_create(&pool->threads[i], NULL, clear_worker_main, worker) != 0 )
+        {
+            free(worker);
+            break;
+        }
+        pthread_setname_np(pool->threads[i], "gralloc_clear");
+    }
+    pool->n_threads = i;
+
+    if ( 0 == pool->n_threads )
+    {
+        ALOGW("failed to create clear threads, clear in the allocating thread.");
+        rk_clear_pool_destroy(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void rk_clear_pool_destroy(rk_clear_pool_t* pool)
+{
+    int i;
+
+    if ( NULL == pool )
+    {
+        return;
+    }
+
+    /* fork 出的子进程中没有 pool 的线程, 'lock' 可能停留在 fork 时被某个线程持有的状态, 只释放内存. */
+    if ( getpid() != pool->owner_pid )
+    {
+        free(pool);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for ( i = 0; i < pool->n_threads; i++ )
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->submit_lock);
+    free(pool);
+}
+
+void rk_clear_bytes(rk_clear_pool_t* pool, uint8_t* dst, size_t size)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t bytes_per_part;
+    int n_parts;
+    int i;
+
+    if ( NULL == pool || size < RK_CLEAR_MT_MIN_BYTES || getpid() != pool->owner_pid
+        || pthread_mutex_trylock(&pool->submit_lock) != 0 )
+    {
+        memset(dst, 0, size);
+        return;
+    }
+
+    n_parts = pool->n_threads + 1;
+    /* 各段从 page 边界开始, 避免多个线程写同一个 page. */
+    bytes_per_part = (size / n_parts + page_size - 1) / page_size * page_size;
+
+    pthread_mutex_lock(&pool->lock);
+    for ( i = 0; i < n_parts; i++ )
+    {
+        size_t offset = bytes_per_part * i;
+
+        pool->parts[i].dst = dst + offset;
+        pool->parts[i].size = (offset >= size) ? 0 : ( (size - offset < bytes_per_part) ? size - offset : bytes_per_part );
+    }
+    pool->pending = pool->n_threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    memset(pool->parts[pool->n_threads].dst, 0, pool->parts[pool->n_threads].size);
+
+    pthread_mutex_lock(&pool->lock);
+    while ( pool->pending > 0 )
+    {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_mutex_unlock(&pool->submit_lock);
+}
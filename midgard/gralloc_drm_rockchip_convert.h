@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_drm_rockchip_convert.h
+ *      rk_drm_gralloc 在 CPU 一侧使用的 buffer 格式转换, 以及 buffer 的清零.
+ */
+
+#ifndef _GRALLOC_DRM_ROCKCHIP_CONVERT_H_
+#define _GRALLOC_DRM_ROCKCHIP_CONVERT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * 对 sample 总数不小于该值的 plane, 转换将被分配到多个线程中执行.
+ * 对应一个 4K 帧的 chroma plane.
+ */
+#define RK_CONVERT_MT_MIN_SAMPLES   (3840 * 1080)
+/* 执行转换的最大线程数. */
+#define RK_CONVERT_MAX_THREADS      4
+
+/* 对不小于该 byte 数的区域, 清零将被分配到 rk_clear_pool_t 的线程和当前线程中执行. */
+#define RK_CLEAR_MT_MIN_BYTES       (2 * 1024 * 1024)
+
+/*
+ * 执行清零的常驻线程池. 线程在 rk_clear_pool_create() 中创建, 在 rk_clear_pool_destroy() 中退出,
+ * rk_clear_bytes() 不创建线程.
+ */
+typedef struct rk_clear_pool rk_clear_pool_t;
+
+/*
+ * 将 10 bit packed (rk NV12_10 中的一个 plane) 的数据解包为 P010 格式 (每个 sample 16 bit, 有效数据在高 10 bit).
+ *
+ * src : 10 bit packed 数据, 行内 sample i 占用从行首起的 bit [10*i, 10*i + 10).
+ * src_stride : src 中相邻两行之间的 byte 数.
+ * dst : P010 数据.
+ * dst_stride : dst 中相邻两行之间的 byte 数.
+ * samples_per_row : 每行中的 sample 数.
+ * rows : 行数.
+ */
+void rk_unpack_10bit_to_p010(const uint8_t* src, int src_stride,
+                             uint8_t* dst, int dst_stride,
+                             int samples_per_row, int rows);
+
+/*
+ * rk_unpack_10bit_to_p010() 的逆操作, 每个 sample 低 6 bit 被丢弃.
+ */
+void rk_pack_p010_to_10bit(const uint8_t* src, int src_stride,
+                           uint8_t* dst, int dst_stride,
+                           int samples_per_row, int rows);
+
+/*
+ * 创建有 'n_threads' 个 worker 线程的清零线程池, 'n_threads' 不大于 RK_CONVERT_MAX_THREADS - 1.
+ * 失败时返回 NULL, 此时 rk_clear_bytes() 在当前线程中清零.
+ */
+rk_clear_pool_t* rk_clear_pool_create(int n_threads);
+
+/*
+ * 通知 'pool' 的线程退出, 等待其退出, 并释放 'pool'. 'pool' 可以是 NULL.
+ */
+void rk_clear_pool_destroy(rk_clear_pool_t* pool);
+
+/*
+ * 将 'dst' 开始的 'size' byte 清零.
+ * 较大的区域按 page 切分, 由 'pool' 的线程和当前线程并行写入, 返回时清零已经完成.
+ * 'pool' 是 NULL, 正被另一个线程使用, 或者是在 fork 之前的进程中创建的 (其线程不存在) 时, 在当前线程中清零.
+ */
+void rk_clear_bytes(rk_clear_pool_t* pool, uint8_t* dst, size_t size);
+
+#endif /* _GRALLOC_DRM_ROCKCHIP_CONVERT_H_ */
@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "GRALLOC-ROCKCHIP"
+
+#include <log/log.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdarg.h>
+
+#include "gralloc_drm_rockchip_ledger.h"
+
+using namespace android;
+
+static const char* const s_format_class_names[GRALLOC_DRM_LEDGER_FORMAT_COUNT] =
+{
+    "rgb", "yuv", "afbc", "other",
+};
+
+static const char* const s_usage_class_names[GRALLOC_DRM_LEDGER_USAGE_COUNT] =
+{
+    "video", "camera", "scanout", "gpu", "other",
+};
+
+static void counter_init(rk_ledger_counter_t* counter)
+{
+    counter->bytes.store(0, std::memory_order_relaxed);
+    counter->count.store(0, std::memory_order_relaxed);
+}
+
+/*
+ * 累加 'counter', 返回累加之后的 bytes.
+ */
+static inline uint64_t counter_add(rk_ledger_counter_t* counter, uint64_t size)
+{
+    counter->count.fetch_add(1, std::memory_order_relaxed);
+    return counter->bytes.fetch_add(size, std::memory_order_relaxed) + size;
+}
+
+static inline void counter_sub(rk_ledger_counter_t* counter, uint64_t size)
+{
+    counter->count.fetch_sub(1, std::memory_order_relaxed);
+    counter->bytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+static inline void counter_read(const rk_ledger_counter_t* counter, struct gralloc_drm_ledger_bucket_t* bucket)
+{
+    bucket->bytes = counter->bytes.load(std::memory_order_relaxed);
+    bucket->count = counter->count.load(std::memory_order_relaxed);
+}
+
+static inline void update_peak(std::atomic<uint64_t>* peak, uint64_t value)
+{
+    uint64_t old = peak->load(std::memory_order_relaxed);
+
+    while ( value > old && !peak->compare_exchange_weak(old, value, std::memory_order_relaxed) )
+    {
+    }
+}
+
+void rk_mem_ledger_init(rk_mem_ledger_t* ledger)
+{
+    int i;
+
+    counter_init(&ledger->allocated);
+    ledger->allocated_peak_bytes.store(0, std::memory_order_relaxed);
+    counter_init(&ledger->imported);
+    ledger->imported_peak_bytes.store(0, std::memory_order_relaxed);
+
+    for ( i = 0; i < GRALLOC_DRM_LEDGER_FORMAT_COUNT; i++ )
+    {
+        counter_init(&ledger->by_format[i]);
+    }
+    for ( i = 0; i < GRALLOC_DRM_LEDGER_USAGE_COUNT; i++ )
+    {
+        counter_init(&ledger->by_usage[i]);
+    }
+    counter_init(&ledger->cachable);
+    counter_init(&ledger->contig);
+    counter_init(&ledger->secure);
+
+    memset(&ledger->head, 0, sizeof(ledger->head) );
+    ledger->head.prev = &ledger->head;
+    ledger->head.next = &ledger->head;
+}
+
+void rk_mem_ledger_add(rk_mem_ledger_t* ledger, rk_mem_ledger_entry_t* entry)
+{
+    uint64_t size = entry->size;
+
+    {
+        Mutex::Autolock _l(ledger->list_lock);
+
+        entry->prev = ledger->head.prev;
+        entry->next = &ledger->head;
+        ledger->head.prev->next = entry;
+        ledger->head.prev = entry;
+        entry->linked = true;
+    }
+
+    if ( entry->imported )
+    {
+        update_peak(&ledger->imported_peak_bytes, counter_add(&ledger->imported, size) );
+    }
+    else
+    {
+        update_peak(&ledger->allocated_peak_bytes, counter_add(&ledger->allocated, size) );
+    }
+
+    counter_add(&ledger->by_format[entry->format_class], size);
+    counter_add(&ledger->by_usage[entry->usage_class], size);
+
+    if ( entry->attrs & RK_LEDGER_ATTR_CACHABLE )
+    {
+        counter_add(&ledger->cachable, size);
+    }
+    if ( entry->attrs & RK_LEDGER_ATTR_CONTIG )
+    {
+        counter_add(&ledger->contig, size);
+    }
+    if ( entry->attrs & RK_LEDGER_ATTR_SECURE )
+    {
+        counter_add(&ledger->secure, size);
+    }
+}
+
+void rk_mem_ledger_remove(rk_mem_ledger_t* ledger, rk_mem_ledger_entry_t* entry)
+{
+    uint64_t size = entry->size;
+
+    {
+        Mutex::Autolock _l(ledger->list_lock);
+
+        if ( !entry->linked )
+        {
+            return;
+        }
+
+        entry->prev->next = entry->next;
+        entry->next->prev = entry->prev;
+        entry->prev = NULL;
+        entry->next = NULL;
+        entry->linked = false;
+    }
+
+    counter_sub(entry->imported ? &ledger->imported : &ledger->allocated, size);
+    counter_sub(&ledger->by_format[entry->format_class], size);
+    counter_sub(&ledger->by_usage[entry->usage_class], size);
+
+    if ( entry->attrs & RK_LEDGER_ATTR_CACHABLE )
+    {
+        counter_sub(&ledger->cachable, size);
+    }
+    if ( entry->attrs & RK_LEDGER_ATTR_CONTIG )
+    {
+        counter_sub(&ledger->contig, size);
+    }
+    if ( entry->attrs & RK_LEDGER_ATTR_SECURE )
+    {
+        counter_sub(&ledger->secure, size);
+    }
+}
+
+void rk_mem_ledger_for_each(rk_mem_ledger_t* ledger, bool (*fn)(rk_mem_ledger_entry_t* entry, void* arg), void* arg)
+{
+    rk_mem_ledger_entry_t* entry;
+    Mutex::Autolock _l(ledger->list_lock);
+
+    for ( entry = ledger->head.next; entry != &ledger->head; entry = entry->next )
+    {
+        if ( !fn(entry, arg) )
+        {
+            break;
+        }
+    }
+}
+
+void rk_mem_ledger_snapshot(rk_mem_ledger_t* ledger, struct gralloc_drm_mem_ledger_t* out)
+{
+    const rk_mem_ledger_entry_t* entry;
+    uint32_t n = 0;
+    uint32_t i;
+    int j;
+
+    memset(out, 0, sizeof(*out) );
+
+    counter_read(&ledger->allocated, &out->allocated);
+    out->allocated_peak_bytes = ledger->allocated_peak_bytes.load(std::memory_order_relaxed);
+    counter_read(&ledger->imported, &out->imported);
+    out->imported_peak_bytes = ledger->imported_peak_bytes.load(std::memory_order_relaxed);
+
+    for ( j = 0; j < GRALLOC_DRM_LEDGER_FORMAT_COUNT; j++ )
+    {
+        counter_read(&ledger->by_format[j], &out->by_format[j]);
+    }
+    for ( j = 0; j < GRALLOC_DRM_LEDGER_USAGE_COUNT; j++ )
+    {
+        counter_read(&ledger->by_usage[j], &out->by_usage[j]);
+    }
+    counter_read(&ledger->cachable, &out->cachable);
+    counter_read(&ledger->contig, &out->contig);
+    counter_read(&ledger->secure, &out->secure);
+
+    /* 遍历链表, 以插入排序维护 size 最大的 GRALLOC_DRM_LEDGER_TOP_N 个 buffer. */
+    Mutex::Autolock _l(ledger->list_lock);
+
+    for ( entry = ledger->head.next; entry != &ledger->head; entry = entry->next )
+    {
+        if ( n == GRALLOC_DRM_LEDGER_TOP_N && entry->size <= out->top[n - 1].size )
+        {
+            continue;
+        }
+
+        i = (n < GRALLOC_DRM_LEDGER_TOP_N) ? n++ : n - 1;
+        while ( i > 0 && out->top[i - 1].size < entry->size )
+        {
+            out->top[i] = out->top[i - 1];
+            i--;
+        }
+
+        out->top[i].size = entry->size;
+        out->top[i].internal_format = entry->internal_format;
+        out->top[i].width = entry->width;
+        out->top[i].height = entry->height;
+        out->top[i].format = entry->format;
+        out->top[i].usage = entry->usage;
+        out->top[i].imported = entry->imported ? 1 : 0;
+    }
+
+    out->num_top = n;
+}
+
+/*
+ * 将 printf 风格的字符串追加到 'buff' 中已有的字符串之后, 'buff' 满时截断.
+ */
+static void append(char* buff, int buff_len, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+
+static void append(char* buff, int buff_len, const char* fmt, ...)
+{
+    size_t len = strlen(buff);
+    va_list args;
+
+    if ( len + 1 >= (size_t)buff_len )
+    {
+        return;
+    }
+
+    va_start(args, fmt);
+    vsnprintf(buff + len, buff_len - len, fmt, args);
+    va_end(args);
+}
+
+void rk_mem_ledger_format(const struct gralloc_drm_mem_ledger_t* snapshot, char* buff, int buff_len)
+{
+    uint32_t i;
+    int j;
+
+    append(buff, buff_len,
+           "rk gralloc mem ledger (KiB):\n"
+           "  allocated : %" PRIu64 " in %" PRIu64 " bufs, peak %" PRIu64 "\n"
+           "  imported : %" PRIu64 " in %" PRIu64 " bufs, peak %" PRIu64 "\n",
+           snapshot->allocated.bytes / 1024, snapshot->allocated.count, snapshot->allocated_peak_bytes / 1024,
+           snapshot->imported.bytes / 1024, snapshot->imported.count, snapshot->imported_peak_bytes / 1024);
+
+    append(buff, buff_len, "  format :");
+    for ( j = 0; j < GRALLOC_DRM_LEDGER_FORMAT_COUNT; j++ )
+    {
+        append(buff, buff_len, " %s %" PRIu64 "/%" PRIu64,
+               s_format_class_names[j], snapshot->by_format[j].bytes / 1024, snapshot->by_format[j].count);
+    }
+
+    append(buff, buff_len, "\n  usage :");
+    for ( j = 0; j < GRALLOC_DRM_LEDGER_USAGE_COUNT; j++ )
+    {
+        append(buff, buff_len, " %s %" PRIu64 "/%" PRIu64,
+               s_usage_class_names[j], snapshot->by_usage[j].bytes / 1024, snapshot->by_usage[j].count);
+    }
+
+    append(buff, buff_len,
+           "\n  flags : cachable %" PRIu64 "/%" PRIu64 " contig %" PRIu64 "/%" PRIu64 " secure %" PRIu64 "/%" PRIu64 "\n",
+           snapshot->cachable.bytes / 1024, snapshot->cachable.count,
+           snapshot->contig.bytes / 1024, snapshot->contig.count,
+           snapshot->secure.bytes / 1024, snapshot->secure.count);
+
+    for ( i = 0; i < snapshot->num_top; i++ )
+    {
+        append(buff, buff_len,
+               "  top[%u] : %" PRIu64 " KiB, %dx%d, format 0x%x, internal_format 0x%" PRIx64 ", usage 0x%x%s\n",
+               i,
+               snapshot->top[i].size / 1024,
+               snapshot->top[i].width,
+               snapshot->top[i].height,
+               snapshot->top[i].format,
+               snapshot->top[i].internal_format,
+               snapshot->top[i].usage,
+               snapshot->top[i].imported ? ", imported" : "");
+    }
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_drm_rockchip_ledger.h
+ *      rk_drm_gralloc 对当前进程持有的 graphic buffer 内存的统计 (ledger).
+ *
+ * 每个 alloc 或 import 的 buffer 在创建时被加入 ledger, 在 free 时被移出.
+ * 总量和各分类的统计都是原子计数, 最大的若干 buffer 在查询时遍历 ledger 中的 buffer 链表得到.
+ */
+
+#ifndef _GRALLOC_DRM_ROCKCHIP_LEDGER_H_
+#define _GRALLOC_DRM_ROCKCHIP_LEDGER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#include <utils/Mutex.h>
+
+#include "gralloc_drm.h"
+
+/* rk_mem_ledger_entry_t::attrs 中的 bit. */
+#define RK_LEDGER_ATTR_CACHABLE     (1 << 0)
+#define RK_LEDGER_ATTR_CONTIG       (1 << 1)
+#define RK_LEDGER_ATTR_SECURE       (1 << 2)
+
+/*
+ * ledger 中一个 buffer 的记录, 嵌入在 rockchip_buffer 中.
+ * 除 'prev', 'next', 'linked' 外, 在 rk_mem_ledger_add() 之前由调用者设置, 之后不再修改.
+ */
+typedef struct rk_mem_ledger_entry
+{
+    struct rk_mem_ledger_entry* prev;
+    struct rk_mem_ledger_entry* next;
+    /* 当前 entry 是否在 ledger 中. */
+    bool linked;
+
+    uint64_t size;
+    bool imported;
+    /* GRALLOC_DRM_LEDGER_FORMAT_*. */
+    int format_class;
+    /* GRALLOC_DRM_LEDGER_USAGE_*. */
+    int usage_class;
+    /* RK_LEDGER_ATTR_*. */
+    uint32_t attrs;
+
+    /* 用于在 dump 中标识 buffer. */
+    int width;
+    int height;
+    int format;
+    int usage;
+    uint64_t internal_format;
+} rk_mem_ledger_entry_t;
+
+typedef struct rk_ledger_counter
+{
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> count;
+} rk_ledger_counter_t;
+
+typedef struct rk_mem_ledger
+{
+    rk_ledger_counter_t allocated;
+    std::atomic<uint64_t> allocated_peak_bytes;
+    rk_ledger_counter_t imported;
+    std::atomic<uint64_t> imported_peak_bytes;
+
+    rk_ledger_counter_t by_format[GRALLOC_DRM_LEDGER_FORMAT_COUNT];
+    rk_ledger_counter_t by_usage[GRALLOC_DRM_LEDGER_USAGE_COUNT];
+    rk_ledger_counter_t cachable;
+    rk_ledger_counter_t contig;
+    rk_ledger_counter_t secure;
+
+    /* 当前所有 entry 组成的双向循环链表的表头. */
+    rk_mem_ledger_entry_t head;
+    /* 保护 'head' 链表. */
+    android::Mutex list_lock;
+} rk_mem_ledger_t;
+
+void rk_mem_ledger_init(rk_mem_ledger_t* ledger);
+
+/*
+ * 将 'entry' 加入 'ledger', 并累加对应的统计.
+ */
+void rk_mem_ledger_add(rk_mem_ledger_t* ledger, rk_mem_ledger_entry_t* entry);
+
+/*
+ * 将 'entry' 移出 'ledger', 并扣除对应的统计. 'entry' 不在 ledger 中时, 什么都不做.
+ */
+void rk_mem_ledger_remove(rk_mem_ledger_t* ledger, rk_mem_ledger_entry_t* entry);
+
+/*
+ * 在持有 ledger 的链表锁的情况下, 对 ledger 中的每个 entry 调用 'fn', 直到 'fn' 返回 false.
+ * 'fn' 返回之前, 对应的 buffer 不会被移出 ledger (free).
+ */
+void rk_mem_ledger_for_each(rk_mem_ledger_t* ledger, bool (*fn)(rk_mem_ledger_entry_t* entry, void* arg), void* arg);
+
+/*
+ * 将 'ledger' 的当前统计写入 'out'. 各计数分别读取, 并发 alloc/free 时彼此之间可能略有出入.
+ */
+void rk_mem_ledger_snapshot(rk_mem_ledger_t* ledger, struct gralloc_drm_mem_ledger_t* out);
+
+/*
+ * 将 'snapshot' 以文本形式追加到 'buff' 中已有的字符串之后.
+ */
+void rk_mem_ledger_format(const struct gralloc_drm_mem_ledger_t* snapshot, char* buff, int buff_len);
+
+#endif /* _GRALLOC_DRM_ROCKCHIP_LEDGER_H_ */
@@ -0,0 +1,549 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "GRALLOC-DRM"
+
+#include <log/log.h>
+#include <cutils/properties.h>
+#include <utils/CallStack.h>
+
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unwind.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "gralloc_drm_handle.h"
+#include "gralloc_drm_priv.h"
+#include "gralloc_drm_tracker.h"
+
+#ifndef RK_DRM_GRALLOC_DEBUG
+#define RK_DRM_GRALLOC_DEBUG 0
+#endif
+
+/*
+ * 一个 live bo 的记录, 'bo->track' 指向它.
+ */
+struct gralloc_drm_track_record_t
+{
+    /* 当前进程中所有 live bo 的记录组成的双向链表. */
+    struct gralloc_drm_track_record_t* prev;
+    struct gralloc_drm_track_record_t* next;
+
+    const struct gralloc_drm_bo_t* bo;
+    /* create 或 import 的时间, 单位 ns. */
+    uint64_t create_ns;
+    int imported;
+    int size;
+    int width;
+    int height;
+    int format;
+    int usage;
+
+    uint64_t locks;
+    uint64_t unlocks;
+    /* bo 没有被 lock 时的 unlock 的次数. */
+    uint64_t unmatched_unlocks;
+
+    /* 创建时的调用栈 (返回地址), 'num_frames' 为 0 表示没有被采样. */
+    uint32_t num_frames;
+    uintptr_t frames[GRALLOC_DRM_TRACK_MAX_FRAMES];
+};
+
+/* 一个分配点 (相同的调用栈) 上 live bo 的汇总. */
+struct track_site_t
+{
+    uint32_t count;
+    uint32_t imported;
+    /* 当前仍被 lock 的 bo 的个数. */
+    uint32_t locked;
+    uint64_t bytes;
+    uint64_t oldest_ns;
+    uint64_t newest_ns;
+    const struct gralloc_drm_track_record_t* sample;
+};
+
+/* dump 中存活时间的分段的上限, 单位 s, 最后一段没有上限. */
+static const uint64_t s_age_limits_s[] = { 1, 10, 60, 600 };
+#define TRACK_AGE_BUCKETS (sizeof(s_age_limits_s) / sizeof(s_age_limits_s[0]) + 1)
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static int s_enabled = 0;
+/* 每 's_sample' 个 bo 记录一次调用栈. */
+static uint32_t s_sample = GRALLOC_DRM_TRACK_DEFAULT_SAMPLE;
+
+static struct gralloc_drm_track_record_t* s_head = NULL;
+static uint64_t s_created = 0;
+static uint64_t s_destroyed = 0;
+static uint64_t s_unmatched_unlocks = 0;
+static uint64_t s_destroyed_locked = 0;
+
+static uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*---------------------------------------------------------------------------*/
+/* 调用栈 */
+
+typedef struct
+{
+    uintptr_t* frames;
+    uint32_t num_frames;
+    uint32_t max_frames;
+    /* 需要跳过的 tracker 自身的帧数. */
+    uint32_t skip;
+} unwind_state_t;
+
+static _Unwind_Reason_Code unwind_callback(struct _Unwind_Context* context, void* arg)
+{
+    unwind_state_t* state = (unwind_state_t*)arg;
+    uintptr_t pc = _Unwind_GetIP(context);
+
+    if ( 0 == pc )
+    {
+        return _URC_END_OF_STACK;
+    }
+
+    if ( state->skip > 0 )
+    {
+        state->skip--;
+        return _URC_NO_REASON;
+    }
+
+    state->frames[state->num_frames++] = pc;
+    return (state->num_frames >= state->max_frames) ? _URC_END_OF_STACK : _URC_NO_REASON;
+}
+
+/*
+ * 在 'frames' 中记录调用者的调用栈, 跳过本函数和 gralloc_drm_tracker_on_create().
+ * 只记录返回地址, 不做符号化, 开销是 unwind 若干帧.
+ */
+static uint32_t __attribute__((noinline)) capture_frames(uintptr_t* frames, uint32_t max_frames)
+{
+    unwind_state_t state;
+
+    state.frames = frames;
+    state.num_frames = 0;
+    state.max_frames = max_frames;
+    state.skip = 2;
+
+    _Unwind_Backtrace(unwind_callback, &state);
+    return state.num_frames;
+}
+
+/*
+ * 将返回地址 'pc' 格式化为 "<so> (<symbol>+<offset>)" 或 "<so>+<offset>".
+ */
+static void format_frame(uintptr_t pc, char* buff, size_t buff_len)
+{
+    Dl_info info;
+    const char* so_name;
+
+    if ( 0 == dladdr( (void*)pc, &info) || NULL == info.dli_fname )
+    {
+        snprintf(buff, buff_len, "0x%" PRIxPTR, pc);
+        return;
+    }
+
+    so_name = strrchr(info.dli_fname, '/');
+    so_name = (NULL != so_name) ? so_name + 1 : info.dli_fname;
+
+    if ( NULL != info.dli_sname )
+    {
+        snprintf(buff, buff_len, "%s (%s+%" PRIuPTR ")",
+                 so_name, info.dli_sname, pc - (uintptr_t)info.dli_saddr);
+    }
+    else
+    {
+        snprintf(buff, buff_len, "%s+0x%" PRIxPTR, so_name, pc - (uintptr_t)info.dli_fbase);
+    }
+}
+
+/*
+ * 输出 'record' 以及创建时的调用栈. 调用者持有 's_lock'.
+ */
+static void log_record_l(const struct gralloc_drm_track_record_t* record, const char* reason)
+{
+    char frame[256];
+    uint32_t i;
+
+    ALOGW("%s : bo %p, %s %dx%d, format 0x%x, usage 0x%x, size %d, age %" PRIu64 " ms, "
+          "locks %" PRIu64 ", unlocks %" PRIu64 ", unmatched unlocks %" PRIu64,
+          reason,
+          record->bo,
+          record->imported ? "imported" : "allocated",
+          record->width,
+          record->height,
+          record->format,
+          record->usage,
+          record->size,
+          (get_time_ns() - record->create_ns) / 1000000,
+          record->locks,
+          record->unlocks,
+          record->unmatched_unlocks);
+
+    if ( 0 == record->num_frames )
+    {
+        ALOGW("  creation stack not sampled, set vendor.gralloc.track_sample to 1 to record every bo");
+        return;
+    }
+
+    for ( i = 0; i < record->num_frames; i++ )
+    {
+        format_frame(record->frames[i], frame, sizeof(frame) );
+        ALOGW("  #%02u pc %s", i, frame);
+    }
+}
+
+/*
+ * 输出当前线程的调用栈, 用于 lock 和 unlock 的异常.
+ */
+static void log_current_stack(void)
+{
+    android::CallStack stack;
+
+    stack.update(2);
+    stack.log(LOG_TAG, ANDROID_LOG_WARN, "  ");
+}
+
+/*---------------------------------------------------------------------------*/
+
+void gralloc_drm_tracker_init(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+    int sample;
+
+    pthread_mutex_lock(&s_lock);
+
+    if ( RK_DRM_GRALLOC_DEBUG )
+    {
+        s_enabled = 1;
+        s_sample = 1;
+    }
+    else
+    {
+        property_get("vendor.gralloc.track", value, "false");
+        s_enabled = (0 == strcmp(value, "true") || 0 == strcmp(value, "1") );
+
+        property_get("vendor.gralloc.track_sample", value, "0");
+        sample = atoi(value);
+        s_sample = (sample > 0) ? (uint32_t)sample : GRALLOC_DRM_TRACK_DEFAULT_SAMPLE;
+    }
+
+    pthread_mutex_unlock(&s_lock);
+
+    ALOGI_IF(s_enabled, "buffer tracker enabled, recording the creation stack of 1 in %u bo", s_sample);
+}
+
+void gralloc_drm_tracker_on_create(struct gralloc_drm_bo_t* bo)
+{
+    struct gralloc_drm_track_record_t* record;
+    struct gralloc_drm_handle_t* handle = bo->handle;
+    uint64_t seq;
+
+    if ( !s_enabled )
+    {
+        return;
+    }
+
+    record = (struct gralloc_drm_track_record_t*)calloc(1, sizeof(*record) );
+    if ( NULL == record )
+    {
+        ALOGE("failed to alloc the track record of bo %p", bo);
+        return;
+    }
+
+    record->bo = bo;
+    record->create_ns = get_time_ns();
+    record->imported = bo->imported;
+    record->size = handle->size;
+    record->width = handle->width;
+    record->height = handle->height;
+    record->format = handle->format;
+    record->usage = handle->usage;
+
+    pthread_mutex_lock(&s_lock);
+    seq = s_created++;
+    pthread_mutex_unlock(&s_lock);
+
+    /* unwind 不需要持有 's_lock'. */
+    if ( 0 == seq % s_sample )
+    {
+        record->num_frames = capture_frames(record->frames, GRALLOC_DRM_TRACK_MAX_FRAMES);
+    }
+
+    pthread_mutex_lock(&s_lock);
+    record->next = s_head;
+    if ( NULL != s_head )
+    {
+        s_head->prev = record;
+    }
+    s_head = record;
+    bo->track = record;
+    pthread_mutex_unlock(&s_lock);
+}
+
+void gralloc_drm_tracker_on_destroy(struct gralloc_drm_bo_t* bo)
+{
+    struct gralloc_drm_track_record_t* record = bo->track;
+
+    if ( NULL == record )
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&s_lock);
+
+    if ( bo->lock_count > 0 )
+    {
+        s_destroyed_locked++;
+        log_record_l(record, "bo destroyed while locked");
+        log_current_stack();
+    }
+
+    if ( NULL != record->prev )
+    {
+        record->prev->next = record->next;
+    }
+    else
+    {
+        s_head = record->next;
+    }
+    if ( NULL != record->next )
+    {
+        record->next->prev = record->prev;
+    }
+    s_destroyed++;
+    bo->track = NULL;
+
+    pthread_mutex_unlock(&s_lock);
+
+    free(record);
+}
+
+void gralloc_drm_tracker_on_lock(struct gralloc_drm_bo_t* bo)
+{
+    if ( NULL == bo->track )
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&s_lock);
+    bo->track->locks++;
+    pthread_mutex_unlock(&s_lock);
+}
+
+void gralloc_drm_tracker_on_unlock(struct gralloc_drm_bo_t* bo, int was_locked)
+{
+    struct gralloc_drm_track_record_t* record = bo->track;
+
+    if ( NULL == record )
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&s_lock);
+
+    if ( was_locked )
+    {
+        record->unlocks++;
+        pthread_mutex_unlock(&s_lock);
+        return;
+    }
+
+    record->unmatched_unlocks++;
+    s_unmatched_unlocks++;
+    /* 同一个 bo 只输出第一次, 避免每帧都 unlock 的 producer 刷屏. */
+    if ( 1 == record->unmatched_unlocks )
+    {
+        log_record_l(record, "unlock of a bo which is not locked");
+        log_current_stack();
+    }
+
+    pthread_mutex_unlock(&s_lock);
+}
+
+void gralloc_drm_tracker_log_bo(const struct gralloc_drm_bo_t* bo, const char* reason)
+{
+    if ( !s_enabled )
+    {
+        return;
+    }
+
+    if ( NULL == bo->track )
+    {
+        ALOGW("%s : bo %p is not tracked", reason, bo);
+        return;
+    }
+
+    pthread_mutex_lock(&s_lock);
+    log_record_l(bo->track, reason);
+    pthread_mutex_unlock(&s_lock);
+}
+
+/*---------------------------------------------------------------------------*/
+/* dump */
+
+/*
+ * 将 printf 风格的字符串追加到 'buff' 中已有的字符串之后, 'buff' 满时截断.
+ */
+static void append(char* buff, int buff_len, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+
+static void append(char* buff, int buff_len, const char* fmt, ...)
+{
+    size_t len = strlen(buff);
+    va_list args;
+
+    if ( len + 1 >= (size_t)buff_len )
+    {
+        return;
+    }
+
+    va_start(args, fmt);
+    vsnprintf(buff + len, buff_len - len, fmt, args);
+    va_end(args);
+}
+
+typedef std::map<std::vector<uintptr_t>, track_site_t> track_site_map_t;
+
+static bool site_has_more_bytes(const track_site_map_t::const_iterator& a, const track_site_map_t::const_iterator& b)
+{
+    return a->second.bytes > b->second.bytes;
+}
+
+void gralloc_drm_tracker_dump(char* buff, int buff_len)
+{
+    track_site_map_t sites;
+    std::vector<track_site_map_t::const_iterator> sorted;
+    const struct gralloc_drm_track_record_t* record;
+    uint64_t age_count[TRACK_AGE_BUCKETS] = { 0 };
+    uint64_t age_bytes[TRACK_AGE_BUCKETS] = { 0 };
+    uint64_t now_ns;
+    uint32_t live_count = 0;
+    uint64_t live_bytes = 0;
+    char frame[256];
+    size_t i;
+    uint32_t j;
+
+    if ( !s_enabled )
+    {
+        return;
+    }
+
+    now_ns = get_time_ns();
+
+    pthread_mutex_lock(&s_lock);
+
+    for ( record = s_head; NULL != record; record = record->next )
+    {
+        std::vector<uintptr_t> key(record->frames, record->frames + record->num_frames);
+        track_site_t& site = sites[key];
+        uint64_t age_ns = now_ns - record->create_ns;
+        size_t bucket;
+
+        if ( 0 == site.count )
+        {
+            site.oldest_ns = age_ns;
+            site.newest_ns = age_ns;
+            site.sample = record;
+        }
+        site.count++;
+        site.imported += record->imported ? 1 : 0;
+        site.locked += (record->locks > record->unlocks) ? 1 : 0;
+        site.bytes += record->size;
+        site.oldest_ns = std::max(site.oldest_ns, age_ns);
+        site.newest_ns = std::min(site.newest_ns, age_ns);
+
+        for ( bucket = 0; bucket < TRACK_AGE_BUCKETS - 1; bucket++ )
+        {
+            if ( age_ns < s_age_limits_s[bucket] * 1000000000ULL )
+            {
+                break;
+            }
+        }
+        age_count[bucket]++;
+        age_bytes[bucket] += record->size;
+
+        live_count++;
+        live_bytes += record->size;
+    }
+
+    append(buff, buff_len,
+           "gralloc buffer tracker : %u live bo, %" PRIu64 " KiB, created %" PRIu64 ", destroyed %" PRIu64
+           ", unmatched unlocks %" PRIu64 ", destroyed while locked %" PRIu64 ", stack sample 1/%u\n",
+           live_count, live_bytes / 1024, s_created, s_destroyed,
+           s_unmatched_unlocks, s_destroyed_locked, s_sample);
+
+    append(buff, buff_len, "  age (bo/KiB) :");
+    for ( i = 0; i < TRACK_AGE_BUCKETS; i++ )
+    {
+        if ( i < TRACK_AGE_BUCKETS - 1 )
+        {
+            append(buff, buff_len, " <%" PRIu64 "s", s_age_limits_s[i]);
+        }
+        else
+        {
+            append(buff, buff_len, " >=%" PRIu64 "s", s_age_limits_s[i - 1]);
+        }
+        append(buff, buff_len, " %" PRIu64 "/%" PRIu64, age_count[i], age_bytes[i] / 1024);
+    }
+    append(buff, buff_len, "\n");
+
+    for ( track_site_map_t::const_iterator it = sites.begin(); it != sites.end(); ++it )
+    {
+        sorted.push_back(it);
+    }
+    std::sort(sorted.begin(), sorted.end(), site_has_more_bytes);
+
+    for ( i = 0; i < sorted.size() && i < GRALLOC_DRM_TRACK_DUMP_SITES; i++ )
+    {
+        const std::vector<uintptr_t>& frames = sorted[i]->first;
+        const track_site_t& site = sorted[i]->second;
+
+        append(buff, buff_len,
+               "  site[%zu] : %u bo (%u imported, %u locked), %" PRIu64 " KiB, age %" PRIu64 "-%" PRIu64 " s"
+               ", e.g. %dx%d format 0x%x usage 0x%x\n",
+               i, site.count, site.imported, site.locked, site.bytes / 1024,
+               site.newest_ns / 1000000000, site.oldest_ns / 1000000000,
+               site.sample->width, site.sample->height, site.sample->format, site.sample->usage);
+
+        if ( frames.empty() )
+        {
+            append(buff, buff_len, "    (creation stack not sampled)\n");
+            continue;
+        }
+
+        for ( j = 0; j < frames.size() && j < GRALLOC_DRM_TRACK_DUMP_FRAMES; j++ )
+        {
+            format_frame(frames[j], frame, sizeof(frame) );
+            append(buff, buff_len, "    #%02u %s\n", j, frame);
+        }
+    }
+
+    pthread_mutex_unlock(&s_lock);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_drm_tracker.h
+ *      当前进程中 bo 的生命周期和泄漏的跟踪 (tracker).
+ *
+ * 开启时, 每个 create 或 import 的 bo 都被记录 : 创建时间, size, geometry, lock 和 unlock 的次数;
+ * 按 'vendor.gralloc.track_sample' 采样的 bo 还记录创建时的调用栈 (若干个返回地址, 在 dump 时才符号化).
+ * dump 按创建时的调用栈 (分配点) 汇总 live bo 的个数, byte 数和存活时间, 用于在没有调试器时找到泄漏 buffer 的 producer.
+ *
+ * property "vendor.gralloc.track" 为 true 时开启, 默认关闭; RK_DRM_GRALLOC_DEBUG 的版本总是开启, 并记录每个 bo 的调用栈.
+ */
+
+#ifndef _GRALLOC_DRM_TRACKER_H_
+#define _GRALLOC_DRM_TRACKER_H_
+
+struct gralloc_drm_bo_t;
+
+/* 每个 bo 记录的调用栈的最大帧数. */
+#define GRALLOC_DRM_TRACK_MAX_FRAMES        12
+/* 默认每 create 或 import 多少个 bo 记录一次调用栈. */
+#define GRALLOC_DRM_TRACK_DEFAULT_SAMPLE    8
+/* dump 中列出的分配点的最大个数, 按 live byte 数降序. */
+#define GRALLOC_DRM_TRACK_DUMP_SITES        8
+/* dump 中每个分配点输出的调用栈的最大帧数. */
+#define GRALLOC_DRM_TRACK_DUMP_FRAMES       6
+
+/*
+ * 根据 property 确定当前进程中 tracker 是否开启, 以及采样的间隔. 在 gralloc_drm_create() 中调用.
+ */
+void gralloc_drm_tracker_init(void);
+
+/*
+ * 'bo' 被 create ('bo->imported' 为 0) 或 import 之后调用, 在调用者的栈上记录调用栈.
+ */
+void gralloc_drm_tracker_on_create(struct gralloc_drm_bo_t *bo);
+
+/*
+ * 'bo' 被 destroy 之前调用. 'bo' 仍被 lock 时, 输出警告和当前调用栈.
+ */
+void gralloc_drm_tracker_on_destroy(struct gralloc_drm_bo_t *bo);
+
+/*
+ * 'bo' 被成功 lock 之后调用.
+ */
+void gralloc_drm_tracker_on_lock(struct gralloc_drm_bo_t *bo);
+
+/*
+ * 'bo' 被 unlock 时调用. 'was_locked' 为 false 表示 unlock 时 'bo' 并没有被 lock, 输出警告和当前调用栈.
+ */
+void gralloc_drm_tracker_on_unlock(struct gralloc_drm_bo_t *bo, int was_locked);
+
+/*
+ * 输出 'bo' 的记录和创建时的调用栈, 用于 bo 的异常 (比如 destroy 时 handle 仍被引用).
+ */
+void gralloc_drm_tracker_log_bo(const struct gralloc_drm_bo_t *bo, const char *reason);
+
+/*
+ * 将 live bo 按分配点和存活时间的汇总, 以文本形式追加到 'buff' 中已有的字符串之后. tracker 没有开启时什么都不做.
+ */
+void gralloc_drm_tracker_dump(char *buff, int buff_len);
+
+#endif /* _GRALLOC_DRM_TRACKER_H_ */
@@ -19,6 +19,7 @@
 /**
  * @file mali_gralloc_formats.cpp
  *      实现 mali_gralloc_select_format, 从 arm_gralloc 中的版本精简得到.
+ *      未定义 GRALLOC_ARM_FORMAT_SELECTION_DISABLE 时, 由 formatdef_files/ 中各 IP block 的 weight 选择 AFBC 等 internal_format.
  */
 
 #define LOG_TAG "gralloc"
@@ -26,7 +27,9 @@
 
 #include <string.h>
 #include <dlfcn.h>
+#include <errno.h>
 #include <inttypes.h>
+#include <drm_fourcc.h>
 
 #if GRALLOC_USE_GRALLOC1_API == 1
 #include <hardware/gralloc1.h>
@@ -37,10 +40,365 @@
 // #include "mali_gralloc_module.h"
 
 #include "gralloc_drm.h"
+#include "gralloc_drm_handle.h"
 #include "gralloc_helper.h"
 #include "mali_gralloc_formats.h"
 #include "mali_gralloc_usages.h"
 
+#if !defined(GRALLOC_ARM_FORMAT_SELECTION_DISABLE)
+
+#include <pthread.h>
+#include <cutils/memory.h>
+
+/*---------------------------------------------------------------------------*/
+// .DP : format_selection
+
+#include "formatdef_files/gpu_default.defs"
+
+#if MALI_AFBC_GRALLOC == 1
+#if MALI_SUPPORT_AFBC_WIDEBLK == 1
+#include "formatdef_files/gpu_afbc_wideblk.defs"
+#else
+#include "formatdef_files/gpu_afbc.defs"
+#endif
+#endif
+
+#include "formatdef_files/display_rk_vop.defs"
+
+typedef void (*blkinit_func_t)(struct hwblk *blk, int16_t **array);
+
+/* 参与 format 选择的 IP blocks. */
+static const blkinit_func_t s_blkinits[] =
+{
+#if MALI_AFBC_GRALLOC == 1
+	gpu_afbc_write_blkinit,
+	gpu_afbc_read_blkinit,
+#else
+	gpu_write_blkinit,
+	gpu_read_blkinit,
+#endif
+	display_rk_vop_blkinit,
+};
+
+#define NUM_HWBLKS (sizeof(s_blkinits) / sizeof(s_blkinits[0]))
+
+static struct hwblk s_hwblks[NUM_HWBLKS];
+static pthread_once_t s_hwblks_once = PTHREAD_ONCE_INIT;
+
+/*
+ * 候选 internal_format.
+ * 'req_format' 是该候选可以满足的 (map_flex_formats() 之后的) request format.
+ */
+typedef struct
+{
+	gralloc_arm_internal_index_format index;
+	uint64_t req_format;
+	uint64_t internal_format;
+} indexed_format_t;
+
+static const indexed_format_t s_indexed_formats[] =
+{
+	/* 同一 request format 的候选中, 分数相同时先列出的优先, 所以线性格式列在最前. */
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBA_8888, HAL_PIXEL_FORMAT_RGBA_8888, MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBX_8888, HAL_PIXEL_FORMAT_RGBX_8888, MALI_GRALLOC_FORMAT_INTERNAL_RGBX_8888 },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGB_888, HAL_PIXEL_FORMAT_RGB_888, MALI_GRALLOC_FORMAT_INTERNAL_RGB_888 },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGB_565, HAL_PIXEL_FORMAT_RGB_565, MALI_GRALLOC_FORMAT_INTERNAL_RGB_565 },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_BGRA_8888, HAL_PIXEL_FORMAT_BGRA_8888, MALI_GRALLOC_FORMAT_INTERNAL_BGRA_8888 },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_YV12, HAL_PIXEL_FORMAT_YV12, MALI_GRALLOC_FORMAT_INTERNAL_YV12 },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_NV12, MALI_GRALLOC_FORMAT_INTERNAL_NV12, MALI_GRALLOC_FORMAT_INTERNAL_NV12 },
+
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBA_8888_AFBC, HAL_PIXEL_FORMAT_RGBA_8888,
+	  MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBX_8888_AFBC, HAL_PIXEL_FORMAT_RGBX_8888,
+	  MALI_GRALLOC_FORMAT_INTERNAL_RGBX_8888 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGB_888_AFBC, HAL_PIXEL_FORMAT_RGB_888,
+	  MALI_GRALLOC_FORMAT_INTERNAL_RGB_888 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGB_565_AFBC, HAL_PIXEL_FORMAT_RGB_565,
+	  MALI_GRALLOC_FORMAT_INTERNAL_RGB_565 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_BGRA_8888_AFBC, HAL_PIXEL_FORMAT_BGRA_8888,
+	  MALI_GRALLOC_FORMAT_INTERNAL_BGRA_8888 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_YUV420_8BIT_AFBC, HAL_PIXEL_FORMAT_YV12,
+	  MALI_GRALLOC_FORMAT_INTERNAL_YV12 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+	/* 视频解码器输出的 AFBC YUV, 由 rk 的 request format 请求. */
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_YUV420_8BIT_AFBC, HAL_PIXEL_FORMAT_YCrCb_NV12,
+	  MALI_GRALLOC_FORMAT_INTERNAL_YV12 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_YUV420_10BIT_AFBC, HAL_PIXEL_FORMAT_YCrCb_NV12_10,
+	  MALI_GRALLOC_FORMAT_INTERNAL_Y0L2 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_YUV422_10BIT_AFBC, HAL_PIXEL_FORMAT_YCbCr_422_SP_10,
+	  MALI_GRALLOC_FORMAT_INTERNAL_Y210 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBA_8888_AFBC_SPLITBLK, HAL_PIXEL_FORMAT_RGBA_8888,
+	  MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 | MALI_GRALLOC_INTFMT_AFBC_SPLITBLK },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBX_8888_AFBC_SPLITBLK, HAL_PIXEL_FORMAT_RGBX_8888,
+	  MALI_GRALLOC_FORMAT_INTERNAL_RGBX_8888 | MALI_GRALLOC_INTFMT_AFBC_SPLITBLK },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGB_888_AFBC_SPLITBLK, HAL_PIXEL_FORMAT_RGB_888,
+	  MALI_GRALLOC_FORMAT_INTERNAL_RGB_888 | MALI_GRALLOC_INTFMT_AFBC_SPLITBLK },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGB_565_AFBC_SPLITBLK, HAL_PIXEL_FORMAT_RGB_565,
+	  MALI_GRALLOC_FORMAT_INTERNAL_RGB_565 | MALI_GRALLOC_INTFMT_AFBC_SPLITBLK },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_BGRA_8888_AFBC_SPLITBLK, HAL_PIXEL_FORMAT_BGRA_8888,
+	  MALI_GRALLOC_FORMAT_INTERNAL_BGRA_8888 | MALI_GRALLOC_INTFMT_AFBC_SPLITBLK },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_YUV420_8BIT_AFBC_SPLITBLK, HAL_PIXEL_FORMAT_YV12,
+	  MALI_GRALLOC_FORMAT_INTERNAL_YV12 | MALI_GRALLOC_INTFMT_AFBC_SPLITBLK },
+
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBA_8888_AFBC_SPLITBLK_WIDEBLK, HAL_PIXEL_FORMAT_RGBA_8888,
+	  MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 | MALI_GRALLOC_INTFMT_AFBC_SPLITBLK | MALI_GRALLOC_INTFMT_AFBC_WIDEBLK },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBX_8888_AFBC_SPLITBLK_WIDEBLK, HAL_PIXEL_FORMAT_RGBX_8888,
+	  MALI_GRALLOC_FORMAT_INTERNAL_RGBX_8888 | MALI_GRALLOC_INTFMT_AFBC_SPLITBLK | MALI_GRALLOC_INTFMT_AFBC_WIDEBLK },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGB_888_AFBC_SPLITBLK_WIDEBLK, HAL_PIXEL_FORMAT_RGB_888,
+	  MALI_GRALLOC_FORMAT_INTERNAL_RGB_888 | MALI_GRALLOC_INTFMT_AFBC_SPLITBLK | MALI_GRALLOC_INTFMT_AFBC_WIDEBLK },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_BGRA_8888_AFBC_SPLITBLK_WIDEBLK, HAL_PIXEL_FORMAT_BGRA_8888,
+	  MALI_GRALLOC_FORMAT_INTERNAL_BGRA_8888 | MALI_GRALLOC_INTFMT_AFBC_SPLITBLK | MALI_GRALLOC_INTFMT_AFBC_WIDEBLK },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGB_565_AFBC_WIDEBLK, HAL_PIXEL_FORMAT_RGB_565,
+	  MALI_GRALLOC_FORMAT_INTERNAL_RGB_565 | MALI_GRALLOC_INTFMT_AFBC_WIDEBLK },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_YUV420_8BIT_AFBC_WIDEBLK, HAL_PIXEL_FORMAT_YV12,
+	  MALI_GRALLOC_FORMAT_INTERNAL_YV12 | MALI_GRALLOC_INTFMT_AFBC_WIDEBLK },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_YUV420_8BIT_AFBC_WIDEBLK, HAL_PIXEL_FORMAT_YCrCb_NV12,
+	  MALI_GRALLOC_FORMAT_INTERNAL_YV12 | MALI_GRALLOC_INTFMT_AFBC_WIDEBLK },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_YUV420_10BIT_AFBC_WIDEBLK, HAL_PIXEL_FORMAT_YCrCb_NV12_10,
+	  MALI_GRALLOC_FORMAT_INTERNAL_Y0L2 | MALI_GRALLOC_INTFMT_AFBC_WIDEBLK },
+
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBA_8888_AFBC_TILED_HEADERS, HAL_PIXEL_FORMAT_RGBA_8888,
+	  MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 | MALI_GRALLOC_INTFMT_AFBC_BASIC | MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBX_8888_AFBC_TILED_HEADERS, HAL_PIXEL_FORMAT_RGBX_8888,
+	  MALI_GRALLOC_FORMAT_INTERNAL_RGBX_8888 | MALI_GRALLOC_INTFMT_AFBC_BASIC | MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS },
+	{ GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_BGRA_8888_AFBC_TILED_HEADERS, HAL_PIXEL_FORMAT_BGRA_8888,
+	  MALI_GRALLOC_FORMAT_INTERNAL_BGRA_8888 | MALI_GRALLOC_INTFMT_AFBC_BASIC | MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS },
+};
+
+#define NUM_INDEXED_FORMATS (sizeof(s_indexed_formats) / sizeof(s_indexed_formats[0]))
+
+/*
+ * 初始化 s_hwblks.
+ * gpu_default.defs 中的 read 和 write blkinit 共用同一个 'pref_formats' 数组,
+ * 所以每次调用 blkinit 之前将其重置为 unsupported, 调用之后将结果复制到 hwblk 自己的 weights 中.
+ */
+static void init_hwblks(void)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_HWBLKS; i++)
+	{
+		int16_t *array = NULL;
+
+		android_memset16((uint16_t *)pref_formats, (uint16_t)DEFAULT_WEIGHT_UNSUPPORTED, sizeof(pref_formats));
+
+		s_hwblks[i].usage = 0;
+		s_hwblks[i].afbc_max_size = 0;
+		s_hwblks[i].dpu = false;
+		s_blkinits[i](&s_hwblks[i], &array);
+		memcpy(s_hwblks[i].weights, array, sizeof(s_hwblks[i].weights));
+	}
+}
+
+/*
+ * 返回 'base_format' 是否是 (可以 AFBC 压缩的) YUV 格式.
+ */
+static bool is_afbc_yuv_base_format(uint64_t base_format)
+{
+	switch (base_format)
+	{
+	case MALI_GRALLOC_FORMAT_INTERNAL_YV12:
+	case MALI_GRALLOC_FORMAT_INTERNAL_Y0L2:
+	case MALI_GRALLOC_FORMAT_INTERNAL_Y210:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/*
+ * 返回 'blk' 是否支持 AFBC 候选 'internal_format', 由 blk 对应的 IP 的 runtime caps 判断.
+ */
+static bool is_afbc_supported_by_caps(const struct hwblk *blk, uint64_t internal_format,
+                                      const mali_gralloc_runtime_caps *caps)
+{
+	uint64_t caps_mask = blk->dpu ? caps->dpu.caps_mask : caps->gpu.caps_mask;
+	uint64_t base_format = internal_format & MALI_GRALLOC_INTFMT_FMT_MASK;
+	bool is_yuv = is_afbc_yuv_base_format(base_format);
+	uint64_t required = MALI_GRALLOC_FORMAT_CAPABILITY_OPTIONS_PRESENT;
+
+	if (internal_format & MALI_GRALLOC_INTFMT_AFBC_BASIC)
+	{
+		required |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_BASIC;
+	}
+	if (internal_format & MALI_GRALLOC_INTFMT_AFBC_SPLITBLK)
+	{
+		required |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_SPLITBLK;
+	}
+	if (internal_format & MALI_GRALLOC_INTFMT_AFBC_WIDEBLK)
+	{
+		required |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_WIDEBLK;
+
+		if (is_yuv && (caps_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_WIDEBLK_YUV_DISABLE))
+		{
+			return false;
+		}
+	}
+	if (internal_format & MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS)
+	{
+		required |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_TILED_HEADERS;
+	}
+
+	if (is_yuv)
+	{
+		/* display processor 只读取 buffer. */
+		if ((blk->dpu || (blk->usage & GRALLOC_USAGE_HW_TEXTURE))
+		    && (caps_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_YUV_NOREAD))
+		{
+			return false;
+		}
+		if ((blk->usage & GRALLOC_USAGE_HW_RENDER) && (caps_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_YUV_NOWRITE))
+		{
+			return false;
+		}
+	}
+
+	return (caps_mask & required) == required;
+}
+
+/*
+ * 在 s_indexed_formats 中 可以满足 'req_format' 的候选中,
+ * 选择 被 'usage' 涉及的所有 hwblk 都支持, 且 weight 之和最大的一个.
+ * AFBC 候选还必须被各 hwblk 对应 IP 的 runtime caps ('caps') 支持.
+ *
+ * @return
+ *      若成功选出, 返回 true, 结果存储在 '*internal_format' 中;
+ *      若 'usage' 没有涉及任何 hwblk, 或者涉及了不参与 format 选择的 IP, 或者没有候选被所有 hwblk 支持, 返回 false.
+ */
+static bool select_format_by_weights(uint64_t req_format, uint64_t usage, int buffer_size,
+                                     const mali_gralloc_runtime_caps *caps, uint64_t *internal_format)
+{
+	uint64_t hw_usage = usage & GRALLOC_USAGE_HW_MASK;
+	uint64_t covered_usage = 0;
+	bool afbc_allowed;
+	bool afbc_yuv_allowed;
+	int best_score = -1;
+	size_t i, j;
+
+	pthread_once(&s_hwblks_once, init_hwblks);
+
+	for (j = 0; j < NUM_HWBLKS; j++)
+	{
+		covered_usage |= s_hwblks[j].usage;
+	}
+
+	/* 未知的 IP (比如 video_encoder, camera) 只能使用线性格式, 仍由原有的逻辑选择. */
+	if (0 == hw_usage || (hw_usage & ~covered_usage) != 0)
+	{
+		return false;
+	}
+
+	/* CPU 不能访问 AFBC buffer. */
+	afbc_allowed = !(usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK))
+	               && (usage & GRALLOC_ARM_USAGE_NO_AFBC) != GRALLOC_ARM_USAGE_NO_AFBC;
+	/*
+	 * AFBC YUV buffer 只能由视频解码器写入 (GPU 通常不能写 AFBC YUV), 而 gralloc 0.3 中没有表示解码器的 usage,
+	 * 所以只在 producer 通过 GRALLOC_USAGE_TO_USE_FBDC_FMT 显式请求时 选择 AFBC YUV.
+	 */
+	afbc_yuv_allowed = afbc_allowed && USAGE_CONTAIN_VALUE(GRALLOC_USAGE_TO_USE_FBDC_FMT, GRALLOC_USAGE_ROT_MASK);
+
+	for (i = 0; i < NUM_INDEXED_FORMATS; i++)
+	{
+		const indexed_format_t *candidate = &s_indexed_formats[i];
+		bool is_afbc = (candidate->internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK) != 0;
+		bool supported = true;
+		int score = 0;
+
+		if (candidate->req_format != req_format || (is_afbc && !afbc_allowed))
+		{
+			continue;
+		}
+		if (is_afbc && !afbc_yuv_allowed
+		    && is_afbc_yuv_base_format(candidate->internal_format & MALI_GRALLOC_INTFMT_FMT_MASK))
+		{
+			continue;
+		}
+
+		for (j = 0; j < NUM_HWBLKS && supported; j++)
+		{
+			const struct hwblk *blk = &s_hwblks[j];
+			int16_t weight;
+
+			if (0 == (blk->usage & usage))
+			{
+				continue;
+			}
+
+			weight = blk->weights[candidate->index];
+			if (weight <= DEFAULT_WEIGHT_UNSUPPORTED
+			    || (is_afbc && blk->afbc_max_size > 0 && buffer_size > blk->afbc_max_size)
+			    || (is_afbc && !is_afbc_supported_by_caps(blk, candidate->internal_format, caps)))
+			{
+				supported = false;
+			}
+			else
+			{
+				score += weight;
+			}
+		}
+
+		if (supported && score > best_score)
+		{
+			best_score = score;
+			*internal_format = candidate->internal_format;
+		}
+	}
+
+	if (best_score < 0)
+	{
+		return false;
+	}
+
+	ALOGD_IF(RK_DRM_GRALLOC_DEBUG, "selected internal_format 0x%" PRIx64 " (score %d) for req_format 0x%" PRIx64 ", usage 0x%" PRIx64,
+	         *internal_format, best_score, req_format, usage);
+	return true;
+}
+
+#endif /* !GRALLOC_ARM_FORMAT_SELECTION_DISABLE */
+
+#if defined(__LP64__)
+#define MALI_GRALLOC_GPU_LIBRARY_PATH "/vendor/lib64/egl/"
+#else
+#define MALI_GRALLOC_GPU_LIBRARY_PATH "/vendor/lib/egl/"
+#endif
+
+/*
+ * 从 GPU 驱动 (libGLES_mali.so) 导出的 MALI_GRALLOC_FORMATCAPS_SYM_NAME 获取 GPU 的 format caps.
+ * 若获取失败, '*gpu_caps' 中的 caps_mask 为 0, 不含 MALI_GRALLOC_FORMAT_CAPABILITY_OPTIONS_PRESENT.
+ */
+void mali_gralloc_get_gpu_caps(struct mali_gralloc_format_caps *gpu_caps)
+{
+	void *dso_handle;
+	void *gpu_caps_sym;
+
+	if (gpu_caps == NULL)
+	{
+		return;
+	}
+
+	memset(gpu_caps, 0, sizeof(*gpu_caps));
+
+	dso_handle = dlopen(MALI_GRALLOC_GPU_LIBRARY_PATH "libGLES_mali.so", RTLD_LAZY);
+	if (dso_handle == NULL)
+	{
+		ALOGW("failed to dlopen libGLES_mali.so : %s", dlerror());
+		return;
+	}
+
+	gpu_caps_sym = dlsym(dso_handle, MALI_GRALLOC_FORMATCAPS_SYM_NAME_STR);
+	if (gpu_caps_sym != NULL)
+	{
+		memcpy(gpu_caps, gpu_caps_sym, sizeof(*gpu_caps));
+	}
+	else
+	{
+		ALOGI("no '%s' in libGLES_mali.so", MALI_GRALLOC_FORMATCAPS_SYM_NAME_STR);
+	}
+
+	dlclose(dso_handle);
+}
+
 static int map_flex_formats(uint64_t req_format)
 {
 	/* Map Android flexible formats to internal base formats */
@@ -55,18 +413,20 @@ static int map_flex_formats(uint64_t req_format)
 	}
 	else if (req_format == HAL_PIXEL_FORMAT_YCbCr_444_888)
 	{
-		/* To be determined */
+		/* Allocated as NV24, the format value is kept as the base format. */
 	}
 
 	return req_format;
 }
 
-uint64_t mali_gralloc_select_format(uint64_t req_format, mali_gralloc_format_type type, uint64_t usage, int buffer_size)
+uint64_t mali_gralloc_select_format(uint64_t req_format, mali_gralloc_format_type type, uint64_t usage, int buffer_size,
+                                    const mali_gralloc_runtime_caps *caps)
 {
     uint64_t internal_format;
     GRALLOC_UNUSED(type);
     GRALLOC_UNUSED(usage);
     GRALLOC_UNUSED(buffer_size);
+    GRALLOC_UNUSED(caps);
 
     if ( req_format == HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED )
     {
@@ -91,8 +451,211 @@ uint64_t mali_gralloc_select_format(uint64_t req_format, mali_gralloc_format_typ
     else
     {
         internal_format = map_flex_formats(req_format);
+
+#if !defined(GRALLOC_ARM_FORMAT_SELECTION_DISABLE)
+        if ( MALI_GRALLOC_FORMAT_TYPE_USAGE == type && caps != NULL )
+        {
+            /* 若不能按 weight 选出, 'internal_format' 保持不变. */
+            select_format_by_weights(internal_format, usage, buffer_size, caps, &internal_format);
+        }
+#endif
     }
 
     return internal_format;
 }
 
+/*---------------------------------------------------------------------------*/
+// .DP : drm_format : internal_format 到 DRM fourcc 和 format modifier 的映射, 供 KMS import (drmModeAddFB2WithModifiers) 使用.
+
+/* 较旧的 drm_fourcc.h 中可能没有的定义, 取值与 linux uapi 一致. */
+#ifndef DRM_FORMAT_ABGR16161616F
+#define DRM_FORMAT_ABGR16161616F fourcc_code('A', 'B', '4', 'H')
+#endif
+#ifndef DRM_FORMAT_R16
+#define DRM_FORMAT_R16 fourcc_code('R', '1', '6', ' ')
+#endif
+#ifndef DRM_FORMAT_Y210
+#define DRM_FORMAT_Y210 fourcc_code('Y', '2', '1', '0')
+#endif
+#ifndef DRM_FORMAT_Y410
+#define DRM_FORMAT_Y410 fourcc_code('Y', '4', '1', '0')
+#endif
+#ifndef DRM_FORMAT_Y0L2
+#define DRM_FORMAT_Y0L2 fourcc_code('Y', '0', 'L', '2')
+#endif
+#ifndef DRM_FORMAT_P010
+#define DRM_FORMAT_P010 fourcc_code('P', '0', '1', '0')
+#endif
+#ifndef DRM_FORMAT_P210
+#define DRM_FORMAT_P210 fourcc_code('P', '2', '1', '0')
+#endif
+#ifndef DRM_FORMAT_NV15
+#define DRM_FORMAT_NV15 fourcc_code('N', 'V', '1', '5')
+#endif
+#ifndef DRM_FORMAT_NV20
+#define DRM_FORMAT_NV20 fourcc_code('N', 'V', '2', '0')
+#endif
+#ifndef DRM_FORMAT_NV24
+#define DRM_FORMAT_NV24 fourcc_code('N', 'V', '2', '4')
+#endif
+#ifndef DRM_FORMAT_YUV420_8BIT
+#define DRM_FORMAT_YUV420_8BIT fourcc_code('Y', 'U', '0', '8')
+#endif
+#ifndef DRM_FORMAT_YUV420_10BIT
+#define DRM_FORMAT_YUV420_10BIT fourcc_code('Y', 'U', '1', '0')
+#endif
+
+#ifndef DRM_FORMAT_MOD_LINEAR
+#define DRM_FORMAT_MOD_LINEAR 0ULL
+#endif
+#ifndef DRM_FORMAT_MOD_ARM_AFBC
+#define DRM_FORMAT_MOD_ARM_AFBC(__afbc_mode) ((0x08ULL << 56) | ((__afbc_mode) & 0x00ffffffffffffffULL))
+#endif
+#ifndef AFBC_FORMAT_MOD_BLOCK_SIZE_16x16
+#define AFBC_FORMAT_MOD_BLOCK_SIZE_16x16 (1ULL)
+#endif
+#ifndef AFBC_FORMAT_MOD_BLOCK_SIZE_32x8
+#define AFBC_FORMAT_MOD_BLOCK_SIZE_32x8 (2ULL)
+#endif
+#ifndef AFBC_FORMAT_MOD_YTR
+#define AFBC_FORMAT_MOD_YTR (1ULL << 4)
+#endif
+#ifndef AFBC_FORMAT_MOD_SPLIT
+#define AFBC_FORMAT_MOD_SPLIT (1ULL << 5)
+#endif
+#ifndef AFBC_FORMAT_MOD_SPARSE
+#define AFBC_FORMAT_MOD_SPARSE (1ULL << 6)
+#endif
+#ifndef AFBC_FORMAT_MOD_TILED
+#define AFBC_FORMAT_MOD_TILED (1ULL << 8)
+#endif
+
+typedef struct
+{
+	uint64_t base_format;
+	/* 未压缩 buffer 的 fourcc. */
+	uint32_t fourcc;
+	/* AFBC buffer 的 fourcc, 0 表示该格式不能是 AFBC. */
+	uint32_t afbc_fourcc;
+	/* 未压缩 buffer 的 plane 数; AFBC buffer 总是只有 1 个 plane. */
+	uint32_t num_planes;
+	/* AFBC 时是否使用 YTR, 与 init_afbc_attrs() 在 alloc 时的设置一致. */
+	bool afbc_ytr;
+} drm_format_entry;
+
+/*
+ * Android 的 RGBA_8888 等格式按 byte 顺序命名, DRM 的 fourcc 按 little endian 的 32 bit 值命名, 分量顺序相反.
+ */
+static const drm_format_entry s_drm_formats[] =
+{
+	/* base_format                                  fourcc                  afbc_fourcc               planes ytr */
+	{ MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888,       DRM_FORMAT_ABGR8888,    DRM_FORMAT_ABGR8888,      1,     true },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_RGBX_8888,       DRM_FORMAT_XBGR8888,    DRM_FORMAT_XBGR8888,      1,     true },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_RGB_888,         DRM_FORMAT_BGR888,      DRM_FORMAT_BGR888,        1,     true },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_RGB_565,         DRM_FORMAT_RGB565,      DRM_FORMAT_RGB565,        1,     true },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_BGRA_8888,       DRM_FORMAT_ARGB8888,    DRM_FORMAT_ARGB8888,      1,     true },
+#if PLATFORM_SDK_VERSION >= 26
+	{ MALI_GRALLOC_FORMAT_INTERNAL_RGBA_1010102,    DRM_FORMAT_ABGR2101010, DRM_FORMAT_ABGR2101010,   1,     true },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_RGBA_16161616,   DRM_FORMAT_ABGR16161616F, 0,                      1,     false },
+#endif
+	{ MALI_GRALLOC_FORMAT_INTERNAL_Y8,              DRM_FORMAT_R8,          0,                        1,     false },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_Y16,             DRM_FORMAT_R16,         0,                        1,     false },
+	/* Y plane, V plane, U plane. AFBC 的 YV12 是 YUV420 8 bit. */
+	{ MALI_GRALLOC_FORMAT_INTERNAL_YV12,            DRM_FORMAT_YVU420,      DRM_FORMAT_YUV420_8BIT,   3,     false },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_NV12,            DRM_FORMAT_NV12,        DRM_FORMAT_YUV420_8BIT,   2,     false },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_NV21,            DRM_FORMAT_NV21,        0,                        2,     false },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_YUV422_8BIT,     DRM_FORMAT_YUYV,        DRM_FORMAT_YUYV,          1,     false },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_Y0L2,            DRM_FORMAT_Y0L2,        DRM_FORMAT_YUV420_10BIT,  1,     false },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_P010,            DRM_FORMAT_P010,        0,                        2,     false },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_P210,            DRM_FORMAT_P210,        0,                        2,     false },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_Y210,            DRM_FORMAT_Y210,        DRM_FORMAT_Y210,          1,     false },
+	{ MALI_GRALLOC_FORMAT_INTERNAL_Y410,            DRM_FORMAT_Y410,        0,                        1,     false },
+	{ HAL_PIXEL_FORMAT_YCrCb_420_SP,                DRM_FORMAT_NV21,        0,                        2,     false },
+	{ HAL_PIXEL_FORMAT_YCbCr_422_SP,                DRM_FORMAT_NV16,        0,                        2,     false },
+	{ HAL_PIXEL_FORMAT_YCbCr_444_888,               DRM_FORMAT_NV24,        0,                        2,     false },
+	{ HAL_PIXEL_FORMAT_YCbCr_422_I,                 DRM_FORMAT_YUYV,        0,                        1,     false },
+	{ HAL_PIXEL_FORMAT_YCrCb_NV12,                  DRM_FORMAT_NV12,        0,                        2,     false },
+	/* rk 的 10 bit packed Y plane, UV plane. */
+	{ HAL_PIXEL_FORMAT_YCrCb_NV12_10,               DRM_FORMAT_NV15,        0,                        2,     false },
+	{ HAL_PIXEL_FORMAT_YCrCb_420_SP_10,             DRM_FORMAT_NV15,        0,                        2,     false },
+	{ HAL_PIXEL_FORMAT_YCbCr_422_SP_10,             DRM_FORMAT_NV20,        0,                        2,     false },
+};
+
+int mali_gralloc_get_drm_format(uint64_t internal_format, mali_gralloc_drm_format *drm_format)
+{
+	uint64_t base_format = internal_format & MALI_GRALLOC_INTFMT_FMT_MASK;
+	uint64_t afbc_bits = internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK;
+	const drm_format_entry *entry = NULL;
+	size_t i;
+
+	if (drm_format == NULL)
+	{
+		return -EINVAL;
+	}
+
+	for (i = 0; i < sizeof(s_drm_formats) / sizeof(s_drm_formats[0]); i++)
+	{
+		if (s_drm_formats[i].base_format == base_format)
+		{
+			entry = &s_drm_formats[i];
+			break;
+		}
+	}
+
+	if (entry == NULL)
+	{
+		ALOGW("no drm format for internal_format : 0x%" PRIx64, internal_format);
+		return -EINVAL;
+	}
+
+	if (afbc_bits == 0)
+	{
+		if (internal_format & MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS)
+		{
+			ALOGW("tiled headers without afbc, internal_format : 0x%" PRIx64, internal_format);
+			return -EINVAL;
+		}
+
+		drm_format->fourcc = entry->fourcc;
+		drm_format->modifier = DRM_FORMAT_MOD_LINEAR;
+		drm_format->num_planes = entry->num_planes;
+		return 0;
+	}
+
+	if (entry->afbc_fourcc == 0)
+	{
+		ALOGW("no afbc drm format for internal_format : 0x%" PRIx64, internal_format);
+		return -EINVAL;
+	}
+
+	drm_format->fourcc = entry->afbc_fourcc;
+	drm_format->modifier = DRM_FORMAT_MOD_ARM_AFBC(
+	        ((internal_format & MALI_GRALLOC_INTFMT_AFBC_WIDEBLK) ? AFBC_FORMAT_MOD_BLOCK_SIZE_32x8
+	                                                               : AFBC_FORMAT_MOD_BLOCK_SIZE_16x16)
+	        | ((internal_format & MALI_GRALLOC_INTFMT_AFBC_SPLITBLK) ? AFBC_FORMAT_MOD_SPLIT : 0)
+	        | ((internal_format & MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS) ? AFBC_FORMAT_MOD_TILED : 0)
+	        | (entry->afbc_ytr ? AFBC_FORMAT_MOD_YTR : 0));
+	drm_format->num_planes = 1;
+
+	return 0;
+}
+
+uint64_t mali_gralloc_drm_modifier_set_afbc_attrs(uint64_t modifier, int use_yuv_transform, int use_sparse_alloc)
+{
+	if ((modifier >> 56) != (DRM_FORMAT_MOD_ARM_AFBC(0) >> 56))
+	{
+		return modifier;
+	}
+
+	modifier &= ~(AFBC_FORMAT_MOD_YTR | AFBC_FORMAT_MOD_SPARSE);
+	if (use_yuv_transform)
+	{
+		modifier |= AFBC_FORMAT_MOD_YTR;
+	}
+	if (use_sparse_alloc)
+	{
+		modifier |= AFBC_FORMAT_MOD_SPARSE;
+	}
+
+	return modifier;
+}
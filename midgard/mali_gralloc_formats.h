@@ -224,6 +224,16 @@ struct mali_gralloc_format_caps
 };
 typedef struct mali_gralloc_format_caps mali_gralloc_format_caps;
 
+/*
+ * Runtime format capabilities of the IP blocks taking part in format selection.
+ * Discovered once by the driver, see rk_discover_format_caps().
+ */
+typedef struct
+{
+	mali_gralloc_format_caps gpu;
+	mali_gralloc_format_caps dpu;
+} mali_gralloc_runtime_caps;
+
 #define MALI_GRALLOC_FORMATCAPS_SYM_NAME mali_gralloc_format_capabilities
 #define MALI_GRALLOC_FORMATCAPS_SYM_NAME_STR "mali_gralloc_format_capabilities"
 
@@ -254,13 +264,108 @@ typedef enum
 	MALI_GRALLOC_CONSUMER_GPU_EXCL,
 } mali_gralloc_consumer_type;
 
+/*
+ * .DP : format_selection : 由各 IP block (hwblk) 对候选 internal_format 的 weight 选择 internal_format.
+ * 各 hwblk 的 weight 表定义在 formatdef_files/ 下的 .defs 文件中.
+ */
+
+/* Weight of a candidate format for one IP block. */
+#define DEFAULT_WEIGHT_SUPPORTED 50
+#define DEFAULT_WEIGHT_MOST_PREFERRED 100
+#define DEFAULT_WEIGHT_UNSUPPORTED -1
+
+/* Indexes of the candidate internal formats in the weight tables. */
+typedef enum
+{
+	/* Linear formats */
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBA_8888 = 0,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBX_8888,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGB_888,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGB_565,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_BGRA_8888,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_YV12,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_NV12,
+
+	/* AFBC basic */
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBA_8888_AFBC,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBX_8888_AFBC,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGB_888_AFBC,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGB_565_AFBC,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_BGRA_8888_AFBC,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_YUV420_8BIT_AFBC,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_YUV420_10BIT_AFBC,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_YUV422_10BIT_AFBC,
+
+	/* AFBC split block */
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBA_8888_AFBC_SPLITBLK,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBX_8888_AFBC_SPLITBLK,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGB_888_AFBC_SPLITBLK,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGB_565_AFBC_SPLITBLK,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_BGRA_8888_AFBC_SPLITBLK,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_YUV420_8BIT_AFBC_SPLITBLK,
+
+	/* AFBC wide block (split block for 32 bit formats) */
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBA_8888_AFBC_SPLITBLK_WIDEBLK,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBX_8888_AFBC_SPLITBLK_WIDEBLK,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGB_888_AFBC_SPLITBLK_WIDEBLK,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_BGRA_8888_AFBC_SPLITBLK_WIDEBLK,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGB_565_AFBC_WIDEBLK,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_YUV420_8BIT_AFBC_WIDEBLK,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_YUV420_10BIT_AFBC_WIDEBLK,
+
+	/* AFBC basic with tiled headers */
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBA_8888_AFBC_TILED_HEADERS,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_RGBX_8888_AFBC_TILED_HEADERS,
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_BGRA_8888_AFBC_TILED_HEADERS,
+
+	GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_LAST
+} gralloc_arm_internal_index_format;
+
+/*
+ * One IP block taking part in format selection.
+ * The block's weights apply when any of its usage bits is requested.
+ */
+struct hwblk
+{
+	uint64_t usage;
+	/* AFBC candidates are unsupported for buffers larger than this many pixels, 0 : no limit. */
+	int afbc_max_size;
+	/* The block is a display processor, AFBC candidates are gated by the dpu caps instead of the gpu caps. */
+	bool dpu;
+	int16_t weights[GRALLOC_ARM_FORMAT_INTERNAL_INDEXED_LAST];
+};
+
+/*
+ * The DRM description of a buffer of some internal_format, to import it into KMS by drmModeAddFB2WithModifiers().
+ */
+typedef struct
+{
+	uint32_t fourcc;
+	uint64_t modifier;
+	/* Number of planes (pitch/offset pairs), always 1 for AFBC. */
+	uint32_t num_planes;
+} mali_gralloc_drm_format;
+
 /* Internal prototypes */
 #if defined(GRALLOC_LIBRARY_BUILD)
 uint64_t mali_gralloc_select_format(uint64_t req_format, mali_gralloc_format_type type, uint64_t usage,
-                                    int buffer_size);
+                                    int buffer_size, const mali_gralloc_runtime_caps *caps);
+
+/*
+ * Map 'internal_format' to its DRM fourcc, format modifier and plane count.
+ * The AFBC YTR bit follows the alloc time default of the base format,
+ * see mali_gralloc_drm_modifier_set_afbc_attrs() to apply the attributes actually recorded for a buffer.
+ * Return 0 on success, -EINVAL if the format has no DRM description.
+ */
+int mali_gralloc_get_drm_format(uint64_t internal_format, mali_gralloc_drm_format *drm_format);
+
+/*
+ * Return AFBC 'modifier' with its YTR and SPARSE bits replaced by the buffer attributes.
+ * Non AFBC modifiers are returned unchanged.
+ */
+uint64_t mali_gralloc_drm_modifier_set_afbc_attrs(uint64_t modifier, int use_yuv_transform, int use_sparse_alloc);
 #endif
 
-#if 0
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -270,6 +375,5 @@ void mali_gralloc_get_gpu_caps(struct mali_gralloc_format_caps *gpu_caps);
 #ifdef __cplusplus
 }
 #endif
-#endif
 
 #endif /* MALI_GRALLOC_FORMATS_H_ */
@@ -0,0 +1,243 @@
+# Tests and benchmarks of drm_gralloc.
+#
+# Device benchmarks load gralloc.$(TARGET_BOARD_PLATFORM) and must run on the target.
+# Unit tests of code without drm dependencies build gralloc sources directly, for the target
+# and, where noted, for the host.
+
+LOCAL_PATH := $(call my-dir)
+
+# same handle layout as gralloc.$(TARGET_BOARD_PLATFORM)
+gralloc_test_cflags := \
+	-DRK_DRM_GRALLOC=1 \
+	-DRK_DRM_GRALLOC_DEBUG=0 \
+	-DMALI_AFBC_GRALLOC=1 \
+	-DPLATFORM_SDK_VERSION=$(PLATFORM_SDK_VERSION)
+
+ifeq ($(TARGET_USES_HWC2),true)
+gralloc_test_cflags += -DUSE_HWC2
+endif
+
+gralloc_test_c_includes := \
+	$(LOCAL_PATH)/.. \
+	external/libdrm \
+	external/libdrm/include/drm
+
+# ------------ #
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_drm_import_benchmark
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_SRC_FILES := gralloc_import_benchmark.cpp
+LOCAL_C_INCLUDES := $(gralloc_test_c_includes)
+LOCAL_HEADER_LIBRARIES := \
+	libhardware_headers \
+	liblog_headers \
+	libutils_headers \
+	libcutils_headers
+LOCAL_SHARED_LIBRARIES := \
+	libhardware \
+	libcutils \
+	liblog
+LOCAL_CFLAGS := $(gralloc_test_cflags)
+include $(BUILD_NATIVE_BENCHMARK)
+
+# ------------ #
+
+# 10 bit packed <-> P010 conversion. The target build tests the NEON path (arm64),
+# the host build the SSSE3 path; both are checked against a bit-by-bit reference.
+gralloc_convert_test_src_files := \
+	gralloc_convert_test.cpp \
+	../gralloc_drm_rockchip_convert.cpp
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_drm_convert_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_SRC_FILES := $(gralloc_convert_test_src_files)
+LOCAL_C_INCLUDES := $(gralloc_test_c_includes)
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_CFLAGS := $(gralloc_test_cflags)
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_drm_convert_test
+LOCAL_SRC_FILES := $(gralloc_convert_test_src_files)
+LOCAL_C_INCLUDES := $(gralloc_test_c_includes)
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_CFLAGS := $(gralloc_test_cflags)
+LOCAL_CFLAGS_x86 := -mssse3
+LOCAL_CFLAGS_x86_64 := -mssse3
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_drm_convert_benchmark
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_SRC_FILES := \
+	gralloc_convert_benchmark.cpp \
+	../gralloc_drm_rockchip_convert.cpp
+LOCAL_C_INCLUDES := $(gralloc_test_c_includes)
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_CFLAGS := $(gralloc_test_cflags)
+include $(BUILD_NATIVE_BENCHMARK)
+
+# ------------ #
+
+# Weight based internal_format selection (formatdef_files/), built with
+# format selection enabled whatever RK_GRALLOC_FORMAT_SELECTION is.
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_drm_format_selection_test
+LOCAL_SRC_FILES := \
+	gralloc_format_selection_test.cpp \
+	../mali_gralloc_formats.cpp
+LOCAL_C_INCLUDES := $(gralloc_test_c_includes)
+LOCAL_HEADER_LIBRARIES := \
+	libhardware_headers \
+	libsystem_headers
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	liblog
+# mali_gralloc_select_format() is declared for GRALLOC_LIBRARY_BUILD only; glibc has no PAGE_SIZE.
+LOCAL_CFLAGS := \
+	$(gralloc_test_cflags) \
+	-DGRALLOC_LIBRARY_BUILD=1 \
+	-DMALI_SUPPORT_AFBC_WIDEBLK=0 \
+	-DPAGE_SIZE=4096
+include $(BUILD_HOST_NATIVE_TEST)
+
+# ------------ #
+
+# DRM fourcc and format modifier export of internal formats.
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_drm_fourcc_test
+LOCAL_SRC_FILES := \
+	gralloc_drm_fourcc_test.cpp \
+	../mali_gralloc_formats.cpp
+LOCAL_C_INCLUDES := $(gralloc_test_c_includes)
+LOCAL_HEADER_LIBRARIES := \
+	libhardware_headers \
+	libsystem_headers
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	liblog
+LOCAL_CFLAGS := \
+	$(gralloc_test_cflags) \
+	-DGRALLOC_LIBRARY_BUILD=1 \
+	-DPAGE_SIZE=4096
+include $(BUILD_HOST_NATIVE_TEST)
+
+# ------------ #
+
+# CPU side AFBC decode (and encode) of RGB AFBC buffers.
+gralloc_afbc_test_src_files := \
+	gralloc_afbc_test.cpp \
+	../gralloc_drm_rockchip_afbc.cpp
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_drm_afbc_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_SRC_FILES := $(gralloc_afbc_test_src_files)
+LOCAL_C_INCLUDES := $(gralloc_test_c_includes)
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_CFLAGS := $(gralloc_test_cflags)
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_drm_afbc_test
+LOCAL_SRC_FILES := $(gralloc_afbc_test_src_files)
+LOCAL_C_INCLUDES := $(gralloc_test_c_includes)
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_CFLAGS := $(gralloc_test_cflags)
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_drm_afbc_benchmark
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_SRC_FILES := \
+	gralloc_afbc_benchmark.cpp \
+	../gralloc_drm_rockchip_afbc.cpp
+LOCAL_C_INCLUDES := $(gralloc_test_c_includes)
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_CFLAGS := $(gralloc_test_cflags)
+include $(BUILD_NATIVE_BENCHMARK)
+
+# ------------ #
+
+# Scanout arena : the range allocator, and the memfd + inotify release tracking of its ranges.
+gralloc_arena_test_src_files := \
+	gralloc_arena_test.cpp \
+	../gralloc_drm_rockchip_arena.cpp \
+	../gralloc_buffer_priv.cpp
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_drm_arena_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_SRC_FILES := $(gralloc_arena_test_src_files)
+LOCAL_C_INCLUDES := $(gralloc_test_c_includes)
+LOCAL_HEADER_LIBRARIES := \
+	libhardware_headers \
+	libsystem_headers
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	liblog
+LOCAL_CFLAGS := $(gralloc_test_cflags)
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_drm_arena_test
+LOCAL_SRC_FILES := $(gralloc_arena_test_src_files)
+LOCAL_C_INCLUDES := $(gralloc_test_c_includes)
+LOCAL_HEADER_LIBRARIES := \
+	libhardware_headers \
+	libsystem_headers
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	liblog
+# glibc has no PAGE_SIZE.
+LOCAL_CFLAGS := \
+	$(gralloc_test_cflags) \
+	-DPAGE_SIZE=4096
+include $(BUILD_HOST_NATIVE_TEST)
+
+# ------------ #
+
+# Lazy commit : the placeholder fds of uncommitted buffers and the cross-process commit requests.
+gralloc_commit_test_src_files := \
+	gralloc_commit_test.cpp \
+	../gralloc_drm_rockchip_commit.cpp
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_drm_commit_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_SRC_FILES := $(gralloc_commit_test_src_files)
+LOCAL_C_INCLUDES := $(gralloc_test_c_includes)
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_CFLAGS := $(gralloc_test_cflags)
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_drm_commit_test
+LOCAL_SRC_FILES := $(gralloc_commit_test_src_files)
+LOCAL_C_INCLUDES := $(gralloc_test_c_includes)
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_CFLAGS := $(gralloc_test_cflags)
+include $(BUILD_HOST_NATIVE_TEST)
+
+# ------------ #
+
+# Lazy commit through gralloc.$(TARGET_BOARD_PLATFORM) : a consumer process registers a buffer before
+# the allocating process commits it. The test execs itself as the consumer.
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_drm_lazy_commit_test
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_SRC_FILES := gralloc_lazy_commit_test.cpp
+LOCAL_C_INCLUDES := $(gralloc_test_c_includes)
+LOCAL_HEADER_LIBRARIES := \
+	libhardware_headers \
+	liblog_headers \
+	libutils_headers \
+	libcutils_headers
+LOCAL_SHARED_LIBRARIES := \
+	libhardware \
+	libcutils \
+	liblog
+LOCAL_CFLAGS := $(gralloc_test_cflags)
+include $(BUILD_NATIVE_TEST)
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_afbc_benchmark.cpp
+ *      CPU 一侧 AFBC 编码和解码 (RGBA8888, 16x16 superblock) 的吞吐量, 以及编码的压缩率.
+ *
+ * 参数 : width, height, content.
+ * content : 0 随机的像素 (照片等, 没有可压缩的部分); 1 纯色; 2 类似 UI 的内容 (纯色的区域, 约 1/8 是随机的像素).
+ * bytes_per_second 按线性数据的 byte 数计算; 计数器 payload_ratio 是 payload (header 区和实际使用的 body) 与线性数据的 byte 数之比.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <string.h>
+#include <vector>
+
+#include "gralloc_drm_rockchip_afbc.h"
+
+static const int k_bpp = 4;
+
+static rk_afbc_layout_t make_layout(int width, int height)
+{
+    rk_afbc_layout_t layout;
+    size_t n_headers;
+
+    memset(&layout, 0, sizeof(layout) );
+    layout.width = width;
+    layout.height = height;
+    layout.bytes_per_pixel = k_bpp;
+    layout.sb_width = 16;
+    layout.sb_height = 16;
+    layout.sb_cols = (width + 15) / 16;
+    layout.sb_rows = (height + 15) / 16;
+    n_headers = (size_t)layout.sb_cols * layout.sb_rows;
+    layout.body_offset = (n_headers * RK_AFBC_HEADER_SIZE + 4095) / 4096 * 4096;
+    layout.buffer_size = layout.body_offset + n_headers * 16 * 16 * k_bpp;
+
+    return layout;
+}
+
+static void fill_content(int content, int width, int height, std::vector<uint8_t>* pixels)
+{
+    std::mt19937 rng(1);
+
+    pixels->resize( (size_t)width * height * k_bpp);
+
+    for ( int y = 0; y < height; y++ )
+    {
+        for ( int x = 0; x < width; x++ )
+        {
+            uint8_t* p = pixels->data() + ( (size_t)y * width + x) * k_bpp;
+
+            for ( int b = 0; b < k_bpp; b++ )
+            {
+                if ( 0 == content || (2 == content && (x / 64 + y / 64) % 8 == 3) )
+                {
+                    p[b] = (uint8_t)rng();
+                }
+                else if ( 1 == content )
+                {
+                    p[b] = 0x80;
+                }
+                else
+                {
+                    p[b] = (uint8_t)( ( (x / 160) * 3 + (y / 96) ) * 29 + b);
+                }
+            }
+        }
+    }
+}
+
+static void BM_AfbcEncode(benchmark::State& state)
+{
+    const int width = (int)state.range(0);
+    const int height = (int)state.range(1);
+    rk_afbc_layout_t layout = make_layout(width, height);
+    std::vector<uint8_t> src;
+    std::vector<uint8_t> afbc(layout.buffer_size);
+    size_t payload = 0;
+
+    fill_content( (int)state.range(2), width, height, &src);
+
+    for ( auto _ : state )
+    {
+        if ( rk_afbc_encode(src.data(), width * k_bpp, &layout, afbc.data(), &payload) != 0 )
+        {
+            state.SkipWithError("failed to encode");
+            break;
+        }
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed( (int64_t)state.iterations() * src.size() );
+    state.counters["payload_ratio"] = (double)payload / src.size();
+}
+
+static void BM_AfbcDecode(benchmark::State& state)
+{
+    const int width = (int)state.range(0);
+    const int height = (int)state.range(1);
+    rk_afbc_layout_t layout = make_layout(width, height);
+    std::vector<uint8_t> src;
+    std::vector<uint8_t> afbc(layout.buffer_size);
+    std::vector<uint8_t> dst;
+
+    fill_content( (int)state.range(2), width, height, &src);
+    dst.resize(src.size() );
+    if ( rk_afbc_encode(src.data(), width * k_bpp, &layout, afbc.data(), NULL) != 0 )
+    {
+        state.SkipWithError("failed to encode");
+        return;
+    }
+
+    for ( auto _ : state )
+    {
+        if ( rk_afbc_decode(afbc.data(), &layout, dst.data(), width * k_bpp) != 0 )
+        {
+            state.SkipWithError("failed to decode");
+            break;
+        }
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed( (int64_t)state.iterations() * dst.size() );
+}
+
+#define AFBC_BENCHMARK(name) \
+    BENCHMARK(name) \
+        ->ArgNames({"width", "height", "content"}) \
+        ->Args({1920, 1080, 0}) \
+        ->Args({1920, 1080, 1}) \
+        ->Args({1920, 1080, 2}) \
+        ->Args({3840, 2160, 2}) \
+        ->Unit(benchmark::kMicrosecond) \
+        ->UseRealTime()
+
+AFBC_BENCHMARK(BM_AfbcEncode);
+AFBC_BENCHMARK(BM_AfbcDecode);
+
+BENCHMARK_MAIN();
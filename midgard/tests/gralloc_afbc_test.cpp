@@ -0,0 +1,478 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_afbc_test.cpp
+ *      gralloc_drm_rockchip_afbc 中 AFBC 解码和编码的 test.
+ *
+ * AfbcDecodeTest : AFBC buffer 由这里独立构造, 按 superblock 随机选择 纯色, 未压缩, 或未压缩与复制混合的编码,
+ *                  解码结果与构造时使用的线性图像比较.
+ * AfbcRoundTripTest : 对不同的内容 (随机, 纯色, 重复的 subblock, 类似 UI 的混合内容), 编码再解码应得到原图像,
+ *                     并检查 payload 的大小.
+ * 覆盖 bytes_per_pixel, basic / wideblk, linear / tiled headers 的所有组合.
+ */
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <random>
+#include <string.h>
+#include <vector>
+
+#include "gralloc_drm_rockchip_afbc.h"
+
+namespace {
+
+/* 与 gralloc_drm_rockchip_afbc.cpp 中的解码顺序相同, 按 AFBC 的定义. */
+const uint8_t k_sb16_pos[16][2] =
+{
+    { 1, 1 }, { 1, 0 }, { 0, 0 }, { 0, 1 },
+    { 0, 2 }, { 0, 3 }, { 1, 3 }, { 1, 2 },
+    { 2, 2 }, { 2, 3 }, { 3, 3 }, { 3, 2 },
+    { 3, 1 }, { 3, 0 }, { 2, 0 }, { 2, 1 },
+};
+
+void subblock_pos(const rk_afbc_layout_t& layout, int i, int* x, int* y)
+{
+    if ( 16 == layout.sb_width )
+    {
+        *x = k_sb16_pos[i][0] * 4;
+        *y = k_sb16_pos[i][1] * 4;
+    }
+    else
+    {
+        *x = (i / 2) * 4;
+        *y = (i % 2) * 4;
+    }
+}
+
+size_t header_index(const rk_afbc_layout_t& layout, int sx, int sy)
+{
+    if ( layout.tiled_headers )
+    {
+        return ( (size_t)(sy / 8) * (layout.sb_cols / 8) + sx / 8) * 64 + (sy % 8) * 8 + sx % 8;
+    }
+    return (size_t)sy * layout.sb_cols + sx;
+}
+
+void set_size(uint8_t* header, int i, uint32_t size)
+{
+    for ( int b = 0; b < 6; b++ )
+    {
+        int bit = 32 + 6 * i + b;
+
+        if ( (size >> b) & 1 )
+        {
+            header[bit / 8] |= (uint8_t)(1 << (bit % 8) );
+        }
+        else
+        {
+            header[bit / 8] &= (uint8_t)~(1 << (bit % 8) );
+        }
+    }
+}
+
+rk_afbc_layout_t make_layout(int width, int height, int bpp, bool wideblk, bool tiled)
+{
+    rk_afbc_layout_t layout;
+    size_t n_headers;
+
+    memset(&layout, 0, sizeof(layout) );
+    layout.width = width;
+    layout.height = height;
+    layout.bytes_per_pixel = bpp;
+    layout.sb_width = wideblk ? 32 : 16;
+    layout.sb_height = wideblk ? 8 : 16;
+    layout.sb_cols = (width + layout.sb_width - 1) / layout.sb_width;
+    layout.sb_rows = (height + layout.sb_height - 1) / layout.sb_height;
+    layout.tiled_headers = tiled;
+    if ( tiled )
+    {
+        layout.sb_cols = (layout.sb_cols + 7) / 8 * 8;
+        layout.sb_rows = (layout.sb_rows + 7) / 8 * 8;
+    }
+    n_headers = (size_t)layout.sb_cols * layout.sb_rows;
+    layout.body_offset = (n_headers * RK_AFBC_HEADER_SIZE + 1023) / 1024 * 1024;
+    layout.buffer_size = layout.body_offset + n_headers * layout.sb_width * layout.sb_height * bpp;
+
+    return layout;
+}
+
+/*
+ * 构造的 AFBC buffer 和对应的线性图像 (sb_cols * sb_width x sb_rows * sb_height).
+ */
+struct AfbcImage
+{
+    rk_afbc_layout_t layout;
+    std::vector<uint8_t> afbc;
+    std::vector<uint8_t> linear;
+    int linear_stride;
+};
+
+AfbcImage build_image(int width, int height, int bpp, bool wideblk, bool tiled, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    AfbcImage img;
+    size_t body_pos;
+
+    img.layout = make_layout(width, height, bpp, wideblk, tiled);
+    const rk_afbc_layout_t& l = img.layout;
+
+    img.afbc.assign(l.buffer_size, 0);
+    img.linear_stride = l.sb_cols * l.sb_width * bpp;
+    img.linear.assign( (size_t)img.linear_stride * l.sb_rows * l.sb_height, 0);
+    body_pos = l.body_offset;
+
+    for ( int sy = 0; sy < l.sb_rows; sy++ )
+    {
+        for ( int sx = 0; sx < l.sb_cols; sx++ )
+        {
+            uint8_t* header = img.afbc.data() + header_index(l, sx, sy) * RK_AFBC_HEADER_SIZE;
+            uint8_t* sb = img.linear.data() + (size_t)sy * l.sb_height * img.linear_stride + (size_t)sx * l.sb_width * bpp;
+            int kind = rng() % 3;
+
+            if ( 0 == kind )
+            {
+                /* 纯色. */
+                uint8_t color[4];
+
+                for ( int b = 0; b < bpp; b++ )
+                {
+                    color[b] = (uint8_t)rng();
+                    header[8 + b] = color[b];
+                }
+                for ( int y = 0; y < l.sb_height; y++ )
+                {
+                    for ( int x = 0; x < l.sb_width; x++ )
+                    {
+                        memcpy(sb + (size_t)y * img.linear_stride + x * bpp, color, bpp);
+                    }
+                }
+                continue;
+            }
+
+            header[0] = (uint8_t)body_pos;
+            header[1] = (uint8_t)(body_pos >> 8);
+            header[2] = (uint8_t)(body_pos >> 16);
+            header[3] = (uint8_t)(body_pos >> 24);
+
+            const uint8_t* prev = NULL;
+
+            for ( int i = 0; i < 16; i++ )
+            {
+                int x, y;
+                /* kind 2 : 约一半的 subblock 复制前一个. */
+                bool copy = (2 == kind) && i > 0 && (rng() & 1);
+                const uint8_t* data;
+
+                subblock_pos(l, i, &x, &y);
+                if ( copy )
+                {
+                    set_size(header, i, 0);
+                    data = prev;
+                }
+                else
+                {
+                    set_size(header, i, 1);
+                    for ( int b = 0; b < 16 * bpp; b++ )
+                    {
+                        img.afbc[body_pos + b] = (uint8_t)rng();
+                    }
+                    data = img.afbc.data() + body_pos;
+                    body_pos += 16 * bpp;
+                }
+                for ( int r = 0; r < 4; r++ )
+                {
+                    memcpy(sb + (size_t)(y + r) * img.linear_stride + x * bpp, data + r * 4 * bpp, 4 * bpp);
+                }
+                prev = data;
+            }
+        }
+    }
+
+    return img;
+}
+
+struct DecodeParam
+{
+    int bpp;
+    bool wideblk;
+    bool tiled;
+};
+
+class AfbcDecodeTest : public ::testing::TestWithParam<DecodeParam>
+{
+};
+
+TEST_P(AfbcDecodeTest, MatchesConstructedImage)
+{
+    const DecodeParam& p = GetParam();
+    /* 宽高不是 superblock 的整数倍; 大尺寸使用多线程. */
+    const int sizes[][2] = { { 1, 1 }, { 17, 9 }, { 100, 37 }, { 1920, 1080 } };
+
+    for ( const auto& size : sizes )
+    {
+        AfbcImage img = build_image(size[0], size[1], p.bpp, p.wideblk, p.tiled, size[0] * 31 + p.bpp);
+        int dst_stride = size[0] * p.bpp + 12;
+        std::vector<uint8_t> dst( (size_t)dst_stride * size[1], 0xEE);
+
+        ASSERT_EQ(0, rk_afbc_check_decodable(img.afbc.data(), &img.layout) );
+        ASSERT_EQ(0, rk_afbc_decode(img.afbc.data(), &img.layout, dst.data(), dst_stride) );
+
+        for ( int y = 0; y < size[1]; y++ )
+        {
+            const uint8_t* d = dst.data() + (size_t)y * dst_stride;
+
+            ASSERT_EQ(0, memcmp(img.linear.data() + (size_t)y * img.linear_stride, d, (size_t)size[0] * p.bpp) )
+                << size[0] << "x" << size[1] << ", row " << y;
+            /* 行尾的 padding 不被修改. */
+            for ( int b = size[0] * p.bpp; b < dst_stride; b++ )
+            {
+                ASSERT_EQ(0xEE, d[b]);
+            }
+        }
+    }
+}
+
+/*
+ * 含有压缩的 subblock 时, 解码失败且不修改 'dst'.
+ */
+TEST_P(AfbcDecodeTest, CompressedSubblockIsNotSupported)
+{
+    const DecodeParam& p = GetParam();
+    AfbcImage img = build_image(64, 64, p.bpp, p.wideblk, p.tiled, 7);
+    int dst_stride = 64 * p.bpp;
+    std::vector<uint8_t> dst( (size_t)dst_stride * 64, 0xEE);
+    uint8_t* last_header = img.afbc.data() + header_index(img.layout, 64 / img.layout.sb_width - 1,
+                                                            64 / img.layout.sb_height - 1) * RK_AFBC_HEADER_SIZE;
+
+    /* 最后一个 superblock 改为 : 有 body, 第 3 个 subblock 是压缩的 (size 20). */
+    memset(last_header, 0, RK_AFBC_HEADER_SIZE);
+    last_header[0] = (uint8_t)img.layout.body_offset;
+    last_header[1] = (uint8_t)(img.layout.body_offset >> 8);
+    last_header[2] = (uint8_t)(img.layout.body_offset >> 16);
+    set_size(last_header, 0, 1);
+    set_size(last_header, 1, 1);
+    set_size(last_header, 2, 20);
+
+    EXPECT_EQ(-ENOTSUP, rk_afbc_check_decodable(img.afbc.data(), &img.layout) );
+    EXPECT_EQ(-ENOTSUP, rk_afbc_decode(img.afbc.data(), &img.layout, dst.data(), dst_stride) );
+    for ( uint8_t v : dst )
+    {
+        ASSERT_EQ(0xEE, v);
+    }
+}
+
+TEST_P(AfbcDecodeTest, InvalidHeaders)
+{
+    const DecodeParam& p = GetParam();
+    AfbcImage img = build_image(32, 32, p.bpp, p.wideblk, p.tiled, 9);
+    std::vector<uint8_t> dst( (size_t)32 * p.bpp * 32);
+    uint8_t* header = img.afbc.data();
+
+    /* 第一个 subblock 是复制. */
+    memset(header, 0, RK_AFBC_HEADER_SIZE);
+    header[0] = (uint8_t)img.layout.body_offset;
+    header[1] = (uint8_t)(img.layout.body_offset >> 8);
+    EXPECT_EQ(-EINVAL, rk_afbc_decode(img.afbc.data(), &img.layout, dst.data(), 32 * p.bpp) );
+
+    /* body 越过 buffer 的末尾. */
+    memset(header, 0, RK_AFBC_HEADER_SIZE);
+    header[0] = header[1] = header[2] = 0xFF;
+    header[3] = 0x0F;
+    set_size(header, 0, 1);
+    EXPECT_EQ(-EINVAL, rk_afbc_decode(img.afbc.data(), &img.layout, dst.data(), 32 * p.bpp) );
+}
+
+/*---------------------------------------------------------------------------*/
+
+enum Content
+{
+    CONTENT_RANDOM,
+    CONTENT_FLAT,
+    /* 每 4 列一个颜色 : 竖直方向相邻的 subblock 相同. */
+    CONTENT_STRIPES,
+    /* 纯色背景上的矩形, 约 1/8 的区域是随机的像素. */
+    CONTENT_UI,
+};
+
+void fill_content(Content content, int width, int height, int bpp, uint8_t* dst, int stride, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+
+    for ( int y = 0; y < height; y++ )
+    {
+        uint8_t* row = dst + (size_t)y * stride;
+
+        for ( int x = 0; x < width; x++ )
+        {
+            uint8_t* p = row + (size_t)x * bpp;
+
+            for ( int b = 0; b < bpp; b++ )
+            {
+                switch ( content )
+                {
+                    case CONTENT_RANDOM:
+                        p[b] = (uint8_t)rng();
+                        break;
+                    case CONTENT_FLAT:
+                        p[b] = (uint8_t)(0x40 + b);
+                        break;
+                    case CONTENT_STRIPES:
+                        p[b] = (uint8_t)( (x / 4) * 37 + b);
+                        break;
+                    case CONTENT_UI:
+                        if ( (x / 64 + y / 64) % 8 == 3 )
+                        {
+                            p[b] = (uint8_t)rng();
+                        }
+                        else
+                        {
+                            p[b] = (uint8_t)( ( (x / 160) * 3 + (y / 96) ) * 29 + b);
+                        }
+                        break;
+                }
+            }
+        }
+    }
+}
+
+struct RoundTripParam
+{
+    DecodeParam layout;
+    Content content;
+};
+
+class AfbcRoundTripTest : public ::testing::TestWithParam<RoundTripParam>
+{
+};
+
+TEST_P(AfbcRoundTripTest, EncodeThenDecodeIsLossless)
+{
+    const RoundTripParam& p = GetParam();
+    const int bpp = p.layout.bpp;
+    const int sizes[][2] = { { 1, 1 }, { 33, 17 }, { 1920, 1080 } };
+
+    for ( const auto& size : sizes )
+    {
+        const int width = size[0];
+        const int height = size[1];
+        const int stride = width * bpp + 8;
+        rk_afbc_layout_t layout = make_layout(width, height, bpp, p.layout.wideblk, p.layout.tiled);
+        const size_t n_superblocks = (size_t)layout.sb_cols * layout.sb_rows;
+        const size_t headers_size = n_superblocks * RK_AFBC_HEADER_SIZE;
+        std::vector<uint8_t> src( (size_t)stride * height);
+        std::vector<uint8_t> afbc(layout.buffer_size, 0xA5);
+        std::vector<uint8_t> decoded( (size_t)stride * height, 0);
+        size_t payload = 0;
+
+        fill_content(p.content, width, height, bpp, src.data(), stride, width + height);
+
+        ASSERT_EQ(0, rk_afbc_encode(src.data(), stride, &layout, afbc.data(), &payload) );
+        ASSERT_EQ(0, rk_afbc_check_decodable(afbc.data(), &layout) );
+        ASSERT_EQ(0, rk_afbc_decode(afbc.data(), &layout, decoded.data(), stride) );
+
+        for ( int y = 0; y < height; y++ )
+        {
+            ASSERT_EQ(0, memcmp(src.data() + (size_t)y * stride, decoded.data() + (size_t)y * stride, (size_t)width * bpp) )
+                << width << "x" << height << ", row " << y;
+        }
+
+        ASSERT_GE(payload, headers_size);
+        ASSERT_LE(payload, headers_size + n_superblocks * layout.sb_width * layout.sb_height * bpp);
+        if ( CONTENT_FLAT == p.content )
+        {
+            /* 都是纯色的 superblock, 没有 body. */
+            EXPECT_EQ(headers_size, payload);
+        }
+        else if ( CONTENT_STRIPES == p.content && width >= 1920 )
+        {
+            /*
+             * 解码顺序中, 与前一个 subblock 在同一列的 subblock 被编码为复制.
+             * 16x16 : 16 个中只有 6 个换列 (见 k_sb16_pos); 32x8 : 每列 2 个, 8 个换列.
+             * 超出图像的 superblock 是边缘像素的复制, 只会更少.
+             */
+            size_t body = payload - headers_size;
+            size_t full = n_superblocks * layout.sb_width * layout.sb_height * bpp;
+
+            EXPECT_LE(body, full * (p.layout.wideblk ? 8 : 6) / 16);
+        }
+    }
+}
+
+TEST(AfbcEncodeTest, RejectsBufferWithoutRoomForBody)
+{
+    rk_afbc_layout_t layout = make_layout(64, 64, 4, false, false);
+    std::vector<uint8_t> src(64 * 64 * 4);
+    std::vector<uint8_t> afbc(layout.buffer_size);
+
+    layout.buffer_size -= 1;
+    EXPECT_EQ(-EINVAL, rk_afbc_encode(src.data(), 64 * 4, &layout, afbc.data(), NULL) );
+}
+
+std::vector<RoundTripParam> round_trip_params();
+
+std::vector<DecodeParam> decode_params()
+{
+    std::vector<DecodeParam> v;
+
+    for ( int bpp = 2; bpp <= 4; bpp++ )
+    {
+        for ( int wideblk = 0; wideblk < 2; wideblk++ )
+        {
+            for ( int tiled = 0; tiled < 2; tiled++ )
+            {
+                v.push_back({ bpp, wideblk != 0, tiled != 0 });
+            }
+        }
+    }
+    return v;
+}
+
+INSTANTIATE_TEST_CASE_P(Layouts, AfbcDecodeTest, ::testing::ValuesIn(decode_params() ),
+                        [](const ::testing::TestParamInfo<DecodeParam>& info)
+                        {
+                            return std::to_string(info.param.bpp) + "bpp"
+                                   + (info.param.wideblk ? "_wideblk" : "_basic")
+                                   + (info.param.tiled ? "_tiled" : "_linear");
+                        });
+
+std::vector<RoundTripParam> round_trip_params()
+{
+    std::vector<RoundTripParam> v;
+
+    for ( const DecodeParam& layout : decode_params() )
+    {
+        for ( Content content : { CONTENT_RANDOM, CONTENT_FLAT, CONTENT_STRIPES, CONTENT_UI } )
+        {
+            v.push_back({ layout, content });
+        }
+    }
+    return v;
+}
+
+const char* const k_content_names[] = { "random", "flat", "stripes", "ui" };
+
+INSTANTIATE_TEST_CASE_P(LayoutsAndContents, AfbcRoundTripTest, ::testing::ValuesIn(round_trip_params() ),
+                        [](const ::testing::TestParamInfo<RoundTripParam>& info)
+                        {
+                            return std::to_string(info.param.layout.bpp) + "bpp"
+                                   + (info.param.layout.wideblk ? "_wideblk" : "_basic")
+                                   + (info.param.layout.tiled ? "_tiled_" : "_linear_")
+                                   + k_content_names[info.param.content];
+                        });
+
+} // namespace
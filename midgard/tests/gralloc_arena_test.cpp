@@ -0,0 +1,385 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_arena_test.cpp
+ *      scanout arena 的 test.
+ *
+ * RangeArenaTest : gralloc_drm_rockchip_arena 的 best-fit 分配, 释放时的合并, 碎片化统计,
+ *                  以及随机 alloc / free 与逐页的参考模型的比较.
+ * ArenaReleaseTest : arena 中的区域在所有进程都关闭了 handle 之后才被释放,
+ *                    依赖 memfd 的 attr region 在最后一个引用 (fd, dup, mmap, 子进程) 被释放时才收到 IN_DELETE_SELF.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <errno.h>
+#include <poll.h>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include <log/log.h>
+
+#include "gralloc_drm.h"
+#include "gralloc_drm_handle.h"
+#include "gralloc_buffer_priv.h"
+#include "gralloc_drm_rockchip_arena.h"
+
+namespace {
+
+const size_t k_page = RK_ARENA_DEFAULT_ALIGN;
+
+class RangeArenaTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        rk_range_arena_init(&m_arena, 64 * k_page, k_page);
+    }
+
+    size_t alloc(size_t pages)
+    {
+        size_t offset = 0;
+
+        EXPECT_EQ(0, rk_range_arena_alloc(&m_arena, pages * k_page, &offset) );
+        return offset;
+    }
+
+    rk_range_arena_stats_t stats() const
+    {
+        rk_range_arena_stats_t s;
+
+        rk_range_arena_get_stats(&m_arena, &s);
+        return s;
+    }
+
+    rk_range_arena_t m_arena;
+};
+
+TEST_F(RangeArenaTest, AlignsSizeAndRejectsEmpty)
+{
+    size_t offset;
+
+    EXPECT_EQ(-EINVAL, rk_range_arena_alloc(&m_arena, 0, &offset) );
+
+    ASSERT_EQ(0, rk_range_arena_alloc(&m_arena, 1, &offset) );
+    EXPECT_EQ(0u, offset);
+    ASSERT_EQ(0, rk_range_arena_alloc(&m_arena, k_page + 1, &offset) );
+    EXPECT_EQ(k_page, offset);
+
+    EXPECT_EQ(3 * k_page, stats().used_bytes);
+    EXPECT_EQ(2u, stats().used_count);
+}
+
+TEST_F(RangeArenaTest, PicksSmallestFreeRangeThatFits)
+{
+    /* 释放之后的空闲区域 : 4 页, 1 页, 2 页, 以及末尾的 48 页. */
+    size_t a = alloc(4);
+    alloc(1);
+    size_t c = alloc(1);
+    alloc(1);
+    size_t e = alloc(2);
+    alloc(1);
+
+    ASSERT_EQ(0, rk_range_arena_free(&m_arena, a) );
+    ASSERT_EQ(0, rk_range_arena_free(&m_arena, c) );
+    ASSERT_EQ(0, rk_range_arena_free(&m_arena, e) );
+    EXPECT_EQ(4u, stats().free_count);
+
+    EXPECT_EQ(c, alloc(1) );
+    EXPECT_EQ(e, alloc(2) );
+    EXPECT_EQ(a, alloc(3) );
+    EXPECT_EQ(a + 3 * k_page, alloc(1) );
+    EXPECT_EQ(1u, stats().free_count);
+}
+
+TEST_F(RangeArenaTest, CoalescesWithBothNeighbours)
+{
+    size_t a = alloc(2);
+    size_t b = alloc(2);
+    size_t c = alloc(2);
+    size_t d = alloc(58);
+
+    EXPECT_EQ(0u, stats().free_count);
+
+    ASSERT_EQ(0, rk_range_arena_free(&m_arena, a) );
+    ASSERT_EQ(0, rk_range_arena_free(&m_arena, c) );
+    EXPECT_EQ(2u, stats().free_count);
+
+    /* 'b' 与前后的空闲区域合并为一个 6 页的区域. */
+    ASSERT_EQ(0, rk_range_arena_free(&m_arena, b) );
+    EXPECT_EQ(1u, stats().free_count);
+    EXPECT_EQ(6 * k_page, stats().largest_free);
+    EXPECT_EQ(a, alloc(6) );
+
+    ASSERT_EQ(0, rk_range_arena_free(&m_arena, a) );
+    ASSERT_EQ(0, rk_range_arena_free(&m_arena, d) );
+    EXPECT_EQ(1u, stats().free_count);
+    EXPECT_EQ(64 * k_page, stats().largest_free);
+}
+
+TEST_F(RangeArenaTest, ReportsFragmentation)
+{
+    std::vector<size_t> offsets;
+
+    EXPECT_EQ(0u, stats().fragmentation_permille);
+
+    for ( int i = 0; i < 16; i++ )
+    {
+        offsets.push_back(alloc(4) );
+    }
+
+    /* 每隔一个释放 : 8 个 4 页的空闲区域, 最大的是空闲总量的 1/8. */
+    for ( int i = 0; i < 16; i += 2 )
+    {
+        ASSERT_EQ(0, rk_range_arena_free(&m_arena, offsets[i]) );
+    }
+
+    rk_range_arena_stats_t s = stats();
+    EXPECT_EQ(32 * k_page, s.free_bytes);
+    EXPECT_EQ(8u, s.free_count);
+    EXPECT_EQ(4 * k_page, s.largest_free);
+    EXPECT_EQ(875u, s.fragmentation_permille);
+
+    /* 空闲总量足够, 但没有足够大的连续区域. */
+    size_t offset;
+    EXPECT_EQ(-ENOMEM, rk_range_arena_alloc(&m_arena, 5 * k_page, &offset) );
+    EXPECT_EQ(1u, stats().failures);
+}
+
+TEST_F(RangeArenaTest, RejectsUnknownOffset)
+{
+    size_t a = alloc(1);
+
+    EXPECT_EQ(-EINVAL, rk_range_arena_free(&m_arena, a + k_page) );
+    EXPECT_EQ(0, rk_range_arena_free(&m_arena, a) );
+    EXPECT_EQ(-EINVAL, rk_range_arena_free(&m_arena, a) );
+}
+
+TEST_F(RangeArenaTest, RandomAllocFreeMatchesPageModel)
+{
+    const size_t pages = 64;
+    std::vector<bool> used(pages, false);
+    std::vector<std::pair<size_t, size_t> > live;
+    std::mt19937 rng(48);
+
+    for ( int step = 0; step < 20000; step++ )
+    {
+        if ( !live.empty() && (rng() % 2 || live.size() > 24) )
+        {
+            size_t i = rng() % live.size();
+
+            ASSERT_EQ(0, rk_range_arena_free(&m_arena, live[i].first) );
+            for ( size_t p = 0; p < live[i].second; p++ )
+            {
+                used[live[i].first / k_page + p] = false;
+            }
+            live.erase(live.begin() + i);
+        }
+        else
+        {
+            size_t n = 1 + rng() % 8;
+            size_t offset;
+            bool fits = false;
+
+            /* 模型中是否存在 'n' 页的连续空闲区域. */
+            for ( size_t start = 0, run = 0; start < pages; start++ )
+            {
+                run = used[start] ? 0 : run + 1;
+                fits = fits || run >= n;
+            }
+
+            int ret = rk_range_arena_alloc(&m_arena, n * k_page - rng() % k_page, &offset);
+            ASSERT_EQ(fits ? 0 : -ENOMEM, ret);
+            if ( ret != 0 )
+            {
+                continue;
+            }
+
+            ASSERT_EQ(0u, offset % k_page);
+            ASSERT_LE(offset / k_page + n, pages);
+            for ( size_t p = 0; p < n; p++ )
+            {
+                ASSERT_FALSE(used[offset / k_page + p]) << "overlap at page " << offset / k_page + p;
+                used[offset / k_page + p] = true;
+            }
+            live.push_back(std::make_pair(offset, n) );
+        }
+
+        /* 统计与模型一致, 且相邻的空闲区域总是已经合并. */
+        rk_range_arena_stats_t s = stats();
+        size_t free_pages = 0;
+        uint32_t free_runs = 0;
+        size_t largest = 0;
+        size_t run = 0;
+
+        for ( size_t p = 0; p <= pages; p++ )
+        {
+            if ( p < pages && !used[p] )
+            {
+                free_pages++;
+                run++;
+                continue;
+            }
+            if ( run != 0 )
+            {
+                free_runs++;
+                largest = std::max(largest, run);
+            }
+            run = 0;
+        }
+        ASSERT_EQ(free_pages * k_page, s.free_bytes);
+        ASSERT_EQ(free_runs, s.free_count);
+        ASSERT_EQ(largest * k_page, s.largest_free);
+        ASSERT_EQ(live.size(), s.used_count);
+    }
+
+    for ( size_t i = 0; i < live.size(); i++ )
+    {
+        ASSERT_EQ(0, rk_range_arena_free(&m_arena, live[i].first) );
+    }
+    EXPECT_EQ(1u, stats().free_count);
+    EXPECT_EQ(pages * k_page, stats().largest_free);
+}
+
+class ArenaReleaseTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        memset(&m_handle, 0, sizeof(m_handle) );
+        m_handle.share_attr_fd = -1;
+        m_handle.attr_base = MAP_FAILED;
+        ASSERT_EQ(0, gralloc_buffer_attr_allocate_memfd(&m_handle) );
+
+        /* 与 rk_scanout_arena_take_range() 相同的 watch. */
+        char path[64];
+        m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        ASSERT_GE(m_inotify_fd, 0);
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", m_handle.share_attr_fd);
+        m_wd = inotify_add_watch(m_inotify_fd, path, IN_DELETE_SELF);
+        ASSERT_GE(m_wd, 0);
+    }
+
+    void TearDown() override
+    {
+        if ( m_handle.share_attr_fd >= 0 )
+        {
+            close(m_handle.share_attr_fd);
+        }
+        if ( m_inotify_fd >= 0 )
+        {
+            close(m_inotify_fd);
+        }
+    }
+
+    /* 在 'timeout_ms' 内是否收到了 'm_wd' 的 IN_DELETE_SELF. */
+    bool released(int timeout_ms)
+    {
+        char events[4096] __attribute__((aligned(__alignof__(struct inotify_event) ) ) );
+        struct pollfd pfd = { m_inotify_fd, POLLIN, 0 };
+        ssize_t len;
+
+        if ( poll(&pfd, 1, timeout_ms) <= 0 )
+        {
+            return false;
+        }
+
+        len = read(m_inotify_fd, events, sizeof(events) );
+        for ( char* ptr = events; ptr < events + len; )
+        {
+            const struct inotify_event* event = (const struct inotify_event*)ptr;
+
+            if ( event->wd == m_wd && (event->mask & IN_DELETE_SELF) )
+            {
+                return true;
+            }
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+        return false;
+    }
+
+    void close_handle()
+    {
+        close(m_handle.share_attr_fd);
+        m_handle.share_attr_fd = -1;
+    }
+
+    struct gralloc_drm_handle_t m_handle;
+    int m_inotify_fd = -1;
+    int m_wd = -1;
+};
+
+TEST_F(ArenaReleaseTest, ReleasedWhenOwnerCloses)
+{
+    EXPECT_FALSE(released(0) );
+    close_handle();
+    EXPECT_TRUE(released(1000) );
+}
+
+TEST_F(ArenaReleaseTest, HeldByDupAndMapping)
+{
+    int dup_fd = dup(m_handle.share_attr_fd);
+    ASSERT_GE(dup_fd, 0);
+    ASSERT_EQ(0, gralloc_buffer_attr_map(&m_handle, 0) );
+
+    close_handle();
+    EXPECT_FALSE(released(100) );
+
+    close(dup_fd);
+    EXPECT_FALSE(released(100) );
+
+    gralloc_buffer_attr_unmap(&m_handle);
+    EXPECT_TRUE(released(1000) );
+}
+
+TEST_F(ArenaReleaseTest, HeldByAnotherProcess)
+{
+    int pipe_fds[2];
+    pid_t pid;
+    char c;
+
+    ASSERT_EQ(0, pipe(pipe_fds) );
+    pid = fork();
+    ASSERT_GE(pid, 0);
+    if ( 0 == pid )
+    {
+        /* 子进程 (与 import 了 handle 的 consumer 一样) 持有 attr region, 直到 pipe 被关闭. */
+        close(pipe_fds[1]);
+        if ( read(pipe_fds[0], &c, 1) < 0 )
+        {
+            _exit(1);
+        }
+        _exit(0);
+    }
+    close(pipe_fds[0]);
+
+    close_handle();
+    EXPECT_FALSE(released(100) );
+
+    close(pipe_fds[1]);
+    ASSERT_EQ(pid, waitpid(pid, NULL, 0) );
+    EXPECT_TRUE(released(1000) );
+}
+
+} // namespace
@@ -0,0 +1,438 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_commit_test.cpp
+ *      lazy commit 的 placeholder 和跨进程 commit 请求 (gralloc_drm_rockchip_commit) 的 test.
+ *
+ * commit 回调以 memfd 代替 dma_buf. 其他进程通过 unix socket 收到 placeholder, 与 handle 在进程间传递的方式相同.
+ * 对实际的 gralloc module 的 test 见 gralloc_lazy_commit_test.cpp.
+ */
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <log/log.h>
+
+#include "gralloc_drm_rockchip_commit.h"
+
+namespace {
+
+const size_t k_size = 4096;
+const uint8_t k_pattern = 0x5a;
+
+/* 以 memfd 为 backing 的 buffer, 第一次 commit 时分配. */
+struct fake_buffer_t
+{
+    std::mutex lock;
+    int memfd = -1;
+    int commits = 0;
+    /* 非 0 时 commit 返回该错误. */
+    int commit_error = 0;
+    std::atomic<int> releases{0};
+};
+
+int fake_commit(void* cookie)
+{
+    fake_buffer_t* buffer = (fake_buffer_t*)cookie;
+    std::lock_guard<std::mutex> _l(buffer->lock);
+
+    if ( buffer->commit_error != 0 )
+    {
+        return buffer->commit_error;
+    }
+    if ( buffer->memfd < 0 )
+    {
+        buffer->memfd = (int)syscall(__NR_memfd_create, "fake_dma_buf", 1U /* MFD_CLOEXEC */);
+        if ( buffer->memfd < 0 || ftruncate(buffer->memfd, k_size) != 0 )
+        {
+            return -ENOMEM;
+        }
+    }
+    buffer->commits++;
+    return buffer->memfd;
+}
+
+void fake_release(void* cookie)
+{
+    fake_buffer_t* buffer = (fake_buffer_t*)cookie;
+    std::lock_guard<std::mutex> _l(buffer->lock);
+
+    if ( buffer->memfd >= 0 )
+    {
+        close(buffer->memfd);
+        buffer->memfd = -1;
+    }
+    buffer->releases++;
+}
+
+/* 通过 'socket_fd' 发送 'fd'. */
+bool send_fd(int socket_fd, int fd)
+{
+    char byte = 0;
+    struct iovec iov = { &byte, 1 };
+    char control[CMSG_SPACE(sizeof(int) )];
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+
+    memset(&msg, 0, sizeof(msg) );
+    memset(control, 0, sizeof(control) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) );
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd) );
+
+    return sendmsg(socket_fd, &msg, 0) == 1;
+}
+
+/* 从 'socket_fd' 接收一个 fd, 失败返回 -1. */
+int recv_fd(int socket_fd)
+{
+    char byte;
+    struct iovec iov = { &byte, 1 };
+    char control[CMSG_SPACE(sizeof(int) )];
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    int fd = -1;
+
+    memset(&msg, 0, sizeof(msg) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if ( recvmsg(socket_fd, &msg, 0) != 1 )
+    {
+        return -1;
+    }
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if ( cmsg != NULL && SCM_RIGHTS == cmsg->cmsg_type )
+    {
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd) );
+    }
+    return fd;
+}
+
+bool same_file(int a, int b)
+{
+    struct stat sa;
+    struct stat sb;
+
+    return 0 == fstat(a, &sa) && 0 == fstat(b, &sb) && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+/* 读取 'fd' 的第一个 byte, 失败返回 -1. */
+int read_first_byte(int fd)
+{
+    void* addr = mmap(NULL, k_size, PROT_READ, MAP_SHARED, fd, 0);
+    int value;
+
+    if ( MAP_FAILED == addr )
+    {
+        return -1;
+    }
+    value = ((const uint8_t*)addr)[0];
+    munmap(addr, k_size);
+    return value;
+}
+
+/*
+ * 在子进程中通过 'socket_fd' 接收 placeholder, 请求 commit, 写入 k_pattern.
+ * 子进程的退出码 : 0 成功; 1 没有收到 placeholder; 2 commit 失败; 3 写入失败.
+ */
+pid_t fork_importer(int socket_fd)
+{
+    pid_t pid = fork();
+
+    if ( 0 == pid )
+    {
+        int placeholder = recv_fd(socket_fd);
+        int dma_buf_fd;
+        void* addr;
+
+        if ( !rk_commit_is_placeholder(placeholder) )
+        {
+            _exit(1);
+        }
+        dma_buf_fd = rk_commit_request(placeholder, RK_COMMIT_REQUEST_TIMEOUT_MS);
+        if ( dma_buf_fd < 0 )
+        {
+            _exit(2);
+        }
+        /* 与 import 相同, 以 dma_buf 替换 handle 中的 placeholder. */
+        if ( dup2(dma_buf_fd, placeholder) < 0 )
+        {
+            _exit(3);
+        }
+        close(dma_buf_fd);
+        addr = mmap(NULL, k_size, PROT_READ | PROT_WRITE, MAP_SHARED, placeholder, 0);
+        if ( MAP_FAILED == addr )
+        {
+            _exit(3);
+        }
+        memset(addr, k_pattern, k_size);
+        munmap(addr, k_size);
+        close(placeholder);
+        _exit(0);
+    }
+
+    return pid;
+}
+
+int wait_exit_code(pid_t pid)
+{
+    int status = 0;
+
+    if ( waitpid(pid, &status, 0) != pid || !WIFEXITED(status) )
+    {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+class CommitServerTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        m_server = rk_commit_server_create(fake_commit, fake_release);
+        ASSERT_NE(nullptr, m_server);
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, m_channel) );
+    }
+
+    void TearDown() override
+    {
+        rk_commit_server_destroy(m_server);
+        close(m_channel[0]);
+        close(m_channel[1]);
+    }
+
+    /* 等待 'buffer' 被 release, 最多 2 秒. release 在 server 的线程中调用, 各 test 在返回之前等待, 'buffer' 才能被销毁. */
+    bool wait_released(const fake_buffer_t& buffer)
+    {
+        for ( int i = 0; i < 200 && 0 == buffer.releases.load(); i++ )
+        {
+            usleep(10 * 1000);
+        }
+        return 1 == buffer.releases.load();
+    }
+
+    rk_commit_server_t* m_server = nullptr;
+    /* 与子进程之间传递 placeholder 的 channel, [0] 由当前进程使用. */
+    int m_channel[2];
+};
+
+} // namespace
+
+TEST_F(CommitServerTest, PlaceholderIsNotADmaBuf)
+{
+    fake_buffer_t buffer;
+    int placeholder = rk_commit_server_add(m_server, &buffer);
+    ASSERT_GE(placeholder, 0);
+
+    EXPECT_TRUE(rk_commit_is_placeholder(placeholder) );
+    EXPECT_FALSE(rk_commit_is_placeholder(m_channel[0]) );
+    EXPECT_FALSE(rk_commit_is_placeholder(-1) );
+
+    int dma_buf_fd = rk_commit_request(placeholder, RK_COMMIT_REQUEST_TIMEOUT_MS);
+    ASSERT_GE(dma_buf_fd, 0);
+    EXPECT_FALSE(rk_commit_is_placeholder(dma_buf_fd) );
+    EXPECT_TRUE(fcntl(dma_buf_fd, F_GETFD) & FD_CLOEXEC);
+
+    close(dma_buf_fd);
+    close(placeholder);
+    EXPECT_TRUE(wait_released(buffer) );
+}
+
+TEST_F(CommitServerTest, RepeatedRequestsShareOneBacking)
+{
+    fake_buffer_t buffer;
+    int placeholder = rk_commit_server_add(m_server, &buffer);
+    ASSERT_GE(placeholder, 0);
+
+    int first = rk_commit_request(placeholder, RK_COMMIT_REQUEST_TIMEOUT_MS);
+    int second = rk_commit_request(placeholder, RK_COMMIT_REQUEST_TIMEOUT_MS);
+    ASSERT_GE(first, 0);
+    ASSERT_GE(second, 0);
+    EXPECT_NE(first, second);
+    EXPECT_TRUE(same_file(first, second) );
+    EXPECT_EQ(2, buffer.commits);
+
+    close(first);
+    close(second);
+    close(placeholder);
+    EXPECT_TRUE(wait_released(buffer) );
+}
+
+TEST_F(CommitServerTest, ConcurrentRequestersEachGetAReply)
+{
+    const int k_threads = 8;
+    fake_buffer_t buffer;
+    int placeholder = rk_commit_server_add(m_server, &buffer);
+    std::vector<std::thread> threads;
+    int fds[k_threads];
+    ASSERT_GE(placeholder, 0);
+
+    for ( int i = 0; i < k_threads; i++ )
+    {
+        threads.emplace_back([&fds, i, placeholder]() {
+            fds[i] = rk_commit_request(placeholder, RK_COMMIT_REQUEST_TIMEOUT_MS);
+        });
+    }
+    for ( auto& thread : threads )
+    {
+        thread.join();
+    }
+
+    for ( int i = 0; i < k_threads; i++ )
+    {
+        ASSERT_GE(fds[i], 0) << "requester " << i;
+        EXPECT_TRUE(same_file(fds[0], fds[i]) );
+    }
+    for ( int i = 0; i < k_threads; i++ )
+    {
+        close(fds[i]);
+    }
+    close(placeholder);
+    EXPECT_TRUE(wait_released(buffer) );
+}
+
+TEST_F(CommitServerTest, ImporterCommitsBeforeOwner)
+{
+    fake_buffer_t buffer;
+    int placeholder = rk_commit_server_add(m_server, &buffer);
+    ASSERT_GE(placeholder, 0);
+
+    pid_t pid = fork_importer(m_channel[1]);
+    ASSERT_GE(pid, 0);
+    ASSERT_TRUE(send_fd(m_channel[0], placeholder) );
+    ASSERT_EQ(0, wait_exit_code(pid) );
+    EXPECT_EQ(1, buffer.commits);
+    EXPECT_EQ(0, buffer.releases.load() );
+
+    /* owner 之后 commit, 得到同一个 backing, 其中是 importer 写入的内容. */
+    int dma_buf_fd = rk_commit_request(placeholder, RK_COMMIT_REQUEST_TIMEOUT_MS);
+    ASSERT_GE(dma_buf_fd, 0);
+    EXPECT_EQ(k_pattern, read_first_byte(dma_buf_fd) );
+    EXPECT_EQ(2, buffer.commits);
+
+    close(dma_buf_fd);
+    close(placeholder);
+    EXPECT_TRUE(wait_released(buffer) );
+}
+
+TEST_F(CommitServerTest, OwnerClosesBeforeImport)
+{
+    fake_buffer_t buffer;
+    int placeholder = rk_commit_server_add(m_server, &buffer);
+    ASSERT_GE(placeholder, 0);
+
+    /* handle 已经发送, 之后 owner 在 importer 收到之前 free. */
+    ASSERT_TRUE(send_fd(m_channel[0], placeholder) );
+    close(placeholder);
+    usleep(50 * 1000);
+    EXPECT_EQ(0, buffer.releases.load() ) << "released while the importer still holds the placeholder";
+
+    pid_t pid = fork_importer(m_channel[1]);
+    ASSERT_GE(pid, 0);
+    ASSERT_EQ(0, wait_exit_code(pid) );
+    EXPECT_EQ(1, buffer.commits);
+
+    /* 子进程退出时关闭了最后一个 placeholder. */
+    EXPECT_TRUE(wait_released(buffer) );
+}
+
+TEST_F(CommitServerTest, ReleasedWithoutCommit)
+{
+    fake_buffer_t buffer;
+    int placeholder = rk_commit_server_add(m_server, &buffer);
+    ASSERT_GE(placeholder, 0);
+
+    int copy = dup(placeholder);
+    close(placeholder);
+    usleep(50 * 1000);
+    EXPECT_EQ(0, buffer.releases.load() );
+
+    close(copy);
+    EXPECT_TRUE(wait_released(buffer) );
+    EXPECT_EQ(0, buffer.commits);
+}
+
+TEST_F(CommitServerTest, CommitErrorIsReturnedToRequester)
+{
+    fake_buffer_t buffer;
+    buffer.commit_error = -ENOMEM;
+    int placeholder = rk_commit_server_add(m_server, &buffer);
+    ASSERT_GE(placeholder, 0);
+
+    EXPECT_EQ(-ENOMEM, rk_commit_request(placeholder, RK_COMMIT_REQUEST_TIMEOUT_MS) );
+
+    /* 失败不影响之后的请求. */
+    buffer.commit_error = 0;
+    int dma_buf_fd = rk_commit_request(placeholder, RK_COMMIT_REQUEST_TIMEOUT_MS);
+    EXPECT_GE(dma_buf_fd, 0);
+
+    close(dma_buf_fd);
+    close(placeholder);
+    EXPECT_TRUE(wait_released(buffer) );
+}
+
+TEST_F(CommitServerTest, DestroyedServerFailsRequests)
+{
+    fake_buffer_t buffer;
+    int placeholder = rk_commit_server_add(m_server, &buffer);
+    ASSERT_GE(placeholder, 0);
+
+    rk_commit_server_destroy(m_server);
+    m_server = nullptr;
+    EXPECT_EQ(1, buffer.releases.load() );
+
+    EXPECT_EQ(-EPIPE, rk_commit_request(placeholder, RK_COMMIT_REQUEST_TIMEOUT_MS) );
+    close(placeholder);
+}
+
+TEST_F(CommitServerTest, ForkedChildCannotAddPlaceholders)
+{
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+
+    if ( 0 == pid )
+    {
+        fake_buffer_t buffer;
+
+        _exit(-ECHILD == rk_commit_server_add(m_server, &buffer) ? 0 : 1);
+    }
+    EXPECT_EQ(0, wait_exit_code(pid) );
+}
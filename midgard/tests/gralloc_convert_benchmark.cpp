@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_convert_benchmark.cpp
+ *      10 bit packed <-> P010 转换的吞吐量 : NEON / SSSE3 (并对大的 plane 使用多线程) 的实现, 与单线程的标量实现比较.
+ *
+ * 参数是 NV12_10 buffer 的宽和高, 转换整个 buffer (luma 和 chroma plane, 共 width * height * 3 / 2 个 sample).
+ * bytes_per_second 按 P010 一侧的 byte 数计算.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <string.h>
+#include <vector>
+
+#include "gralloc_drm_rockchip_convert.h"
+
+typedef void (*convert_func_t)(const uint8_t* src, int src_stride,
+                               uint8_t* dst, int dst_stride,
+                               int samples_per_row, int rows);
+
+/*
+ * 单线程的标量实现, 每个 sample 读写其所在的 2 个 byte, 与 SIMD 代码引入之前的转换相同.
+ */
+static void scalar_unpack_10bit_to_p010(const uint8_t* src, int src_stride,
+                                        uint8_t* dst, int dst_stride,
+                                        int samples_per_row, int rows)
+{
+    for ( int r = 0; r < rows; r++ )
+    {
+        const uint8_t* s = src + (size_t)r * src_stride;
+        uint16_t* d = (uint16_t*)(dst + (size_t)r * dst_stride);
+
+        for ( int i = 0; i < samples_per_row; i++ )
+        {
+            int bit = i * 10;
+            const uint8_t* p = s + (bit >> 3);
+
+            d[i] = (uint16_t)( ( ( (p[0] | (p[1] << 8) ) >> (bit & 7) ) & 0x3FF) << 6);
+        }
+    }
+}
+
+static void scalar_pack_p010_to_10bit(const uint8_t* src, int src_stride,
+                                      uint8_t* dst, int dst_stride,
+                                      int samples_per_row, int rows)
+{
+    for ( int r = 0; r < rows; r++ )
+    {
+        const uint16_t* s = (const uint16_t*)(src + (size_t)r * src_stride);
+        uint8_t* d = dst + (size_t)r * dst_stride;
+
+        for ( int i = 0; i < samples_per_row; i++ )
+        {
+            int bit = i * 10;
+            int shift = bit & 7;
+            uint8_t* p = d + (bit >> 3);
+            uint16_t cur = (uint16_t)(p[0] | (p[1] << 8) );
+
+            cur &= (uint16_t)~(0x3FF << shift);
+            cur |= (uint16_t)( (s[i] >> 6) << shift);
+            p[0] = (uint8_t)cur;
+            p[1] = (uint8_t)(cur >> 8);
+        }
+    }
+}
+
+static void run_convert(benchmark::State& state, convert_func_t func, bool unpack)
+{
+    const int width = (int)state.range(0);
+    const int rows = (int)state.range(1) * 3 / 2;
+    const int packed_stride = (width * 10 + 7) / 8;
+    const int p010_stride = width * 2;
+    std::vector<uint8_t> packed((size_t)packed_stride * rows, 0x5A);
+    std::vector<uint8_t> p010((size_t)p010_stride * rows, 0xA5);
+
+    for ( auto _ : state )
+    {
+        if ( unpack )
+        {
+            func(packed.data(), packed_stride, p010.data(), p010_stride, width, rows);
+        }
+        else
+        {
+            func(p010.data(), p010_stride, packed.data(), packed_stride, width, rows);
+        }
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed( (int64_t)state.iterations() * p010.size() );
+}
+
+static void BM_Unpack10bitToP010(benchmark::State& state)
+{
+    run_convert(state, rk_unpack_10bit_to_p010, true);
+}
+
+static void BM_Unpack10bitToP010Scalar(benchmark::State& state)
+{
+    run_convert(state, scalar_unpack_10bit_to_p010, true);
+}
+
+static void BM_PackP010To10bit(benchmark::State& state)
+{
+    run_convert(state, rk_pack_p010_to_10bit, false);
+}
+
+static void BM_PackP010To10bitScalar(benchmark::State& state)
+{
+    run_convert(state, scalar_pack_p010_to_10bit, false);
+}
+
+#define CONVERT_BENCHMARK(name) \
+    BENCHMARK(name) \
+        ->ArgNames({"width", "height"}) \
+        ->Args({1920, 1080}) \
+        ->Args({3840, 2160}) \
+        ->Unit(benchmark::kMicrosecond) \
+        ->UseRealTime()
+
+CONVERT_BENCHMARK(BM_Unpack10bitToP010);
+CONVERT_BENCHMARK(BM_Unpack10bitToP010Scalar);
+CONVERT_BENCHMARK(BM_PackP010To10bit);
+CONVERT_BENCHMARK(BM_PackP010To10bitScalar);
+
+BENCHMARK_MAIN();
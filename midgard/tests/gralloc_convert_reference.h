@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_convert_reference.h
+ *      gralloc_drm_rockchip_convert 的逐 bit 实现的参考版本, 供 test 和 benchmark 与 NEON / SSSE3 的实现比较.
+ *
+ * 这里有意不使用 gralloc_drm_rockchip_convert.cpp 中的标量尾部处理, 而是按定义逐 bit 读写, 与被测的代码不共享任何逻辑.
+ */
+
+#ifndef _GRALLOC_CONVERT_REFERENCE_H_
+#define _GRALLOC_CONVERT_REFERENCE_H_
+
+#include <stdint.h>
+
+/* 读取行内第 'i' 个 10 bit sample : bit [10*i, 10*i + 10), 低位在前. */
+static inline uint16_t ref_get_10bit_sample(const uint8_t* row, int i)
+{
+    uint16_t v = 0;
+    int b;
+
+    for ( b = 0; b < 10; b++ )
+    {
+        int bit = i * 10 + b;
+
+        v |= (uint16_t)( ( (row[bit >> 3] >> (bit & 7) ) & 1) << b);
+    }
+
+    return v;
+}
+
+static inline void ref_set_10bit_sample(uint8_t* row, int i, uint16_t v)
+{
+    int b;
+
+    for ( b = 0; b < 10; b++ )
+    {
+        int bit = i * 10 + b;
+        uint8_t m = (uint8_t)(1 << (bit & 7) );
+
+        if ( (v >> b) & 1 )
+        {
+            row[bit >> 3] |= m;
+        }
+        else
+        {
+            row[bit >> 3] &= (uint8_t)~m;
+        }
+    }
+}
+
+static inline void ref_unpack_10bit_to_p010(const uint8_t* src, int src_stride,
+                                            uint8_t* dst, int dst_stride,
+                                            int samples_per_row, int rows)
+{
+    for ( int r = 0; r < rows; r++ )
+    {
+        const uint8_t* s = src + (size_t)r * src_stride;
+        uint16_t* d = (uint16_t*)(dst + (size_t)r * dst_stride);
+
+        for ( int i = 0; i < samples_per_row; i++ )
+        {
+            d[i] = (uint16_t)(ref_get_10bit_sample(s, i) << 6);
+        }
+    }
+}
+
+static inline void ref_pack_p010_to_10bit(const uint8_t* src, int src_stride,
+                                          uint8_t* dst, int dst_stride,
+                                          int samples_per_row, int rows)
+{
+    for ( int r = 0; r < rows; r++ )
+    {
+        const uint16_t* s = (const uint16_t*)(src + (size_t)r * src_stride);
+        uint8_t* d = dst + (size_t)r * dst_stride;
+
+        for ( int i = 0; i < samples_per_row; i++ )
+        {
+            ref_set_10bit_sample(d, i, (uint16_t)(s[i] >> 6) );
+        }
+    }
+}
+
+#endif /* _GRALLOC_CONVERT_REFERENCE_H_ */
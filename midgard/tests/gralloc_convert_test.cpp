@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_convert_test.cpp
+ *      10 bit packed <-> P010 转换 : NEON (aarch64) 或 SSSE3 (x86) 实现与逐 bit 的参考实现的比较.
+ *
+ * 每行的宽度覆盖 SIMD 主循环的各种余数, 以及 "最后一组 8 个 sample 不足 16 byte 可读, 由标量代码处理" 的情况.
+ * src 的最后一行紧贴一个不可访问的 guard page, 越过行尾的读取会导致 test 崩溃.
+ * 另有 rk_clear_bytes() 经由 rk_clear_pool_t 清零的 test.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <string.h>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "gralloc_drm_rockchip_convert.h"
+#include "gralloc_convert_reference.h"
+
+namespace {
+
+/*
+ * 大小为 'size' 的区域, 其后紧跟一个 PROT_NONE 的 page.
+ */
+class GuardedBuffer
+{
+public:
+    explicit GuardedBuffer(size_t size)
+        : m_size(size)
+    {
+        size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+        m_map_size = (size + page_size - 1) / page_size * page_size + page_size;
+        m_map = (uint8_t*)mmap(NULL, m_map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if ( MAP_FAILED == m_map )
+        {
+            m_map = NULL;
+            return;
+        }
+        mprotect(m_map + m_map_size - page_size, page_size, PROT_NONE);
+    }
+
+    ~GuardedBuffer()
+    {
+        if ( NULL != m_map )
+        {
+            munmap(m_map, m_map_size);
+        }
+    }
+
+    uint8_t* data() const { return (NULL != m_map) ? m_map + m_map_size - sysconf(_SC_PAGESIZE) - m_size : NULL; }
+    size_t size() const { return m_size; }
+
+private:
+    uint8_t* m_map = NULL;
+    size_t m_map_size = 0;
+    size_t m_size;
+};
+
+static void fill_random(uint8_t* p, size_t size, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+
+    for ( size_t i = 0; i < size; i++ )
+    {
+        p[i] = (uint8_t)rng();
+    }
+}
+
+static int packed_row_bytes(int samples)
+{
+    return (samples * 10 + 7) / 8;
+}
+
+struct Geometry
+{
+    int samples_per_row;
+    int rows;
+    /* src (10 bit packed) 中每行在有效数据之后的 padding byte 数. */
+    int src_padding;
+};
+
+class ConvertTest : public ::testing::TestWithParam<Geometry>
+{
+};
+
+/*
+ * 1 ~ 33 : 没有或有 1 ~ 3 组完整的 8 个 sample, 以及各种余数.
+ * 1920 / 1922 / 4096 : 实际使用的宽度 (NV12_10 的 chroma plane 的宽度与 luma 相同).
+ */
+static std::vector<Geometry> geometries()
+{
+    std::vector<Geometry> g;
+
+    for ( int w = 1; w <= 33; w++ )
+    {
+        g.push_back({ w, 3, 0 });
+        g.push_back({ w, 3, 16 });
+    }
+    g.push_back({ 1920, 4, 0 });
+    g.push_back({ 1922, 4, 0 });
+    g.push_back({ 1922, 4, 6 });
+    g.push_back({ 4096, 2, 64 });
+
+    return g;
+}
+
+TEST_P(ConvertTest, UnpackMatchesReference)
+{
+    const Geometry& g = GetParam();
+    const int src_stride = packed_row_bytes(g.samples_per_row) + g.src_padding;
+    const int dst_stride = g.samples_per_row * 2;
+    GuardedBuffer src((size_t)src_stride * g.rows);
+    std::vector<uint8_t> dst((size_t)dst_stride * g.rows, 0xCD);
+    std::vector<uint8_t> expected((size_t)dst_stride * g.rows, 0xCD);
+
+    ASSERT_NE(nullptr, src.data() );
+    fill_random(src.data(), src.size(), g.samples_per_row);
+
+    rk_unpack_10bit_to_p010(src.data(), src_stride, dst.data(), dst_stride, g.samples_per_row, g.rows);
+    ref_unpack_10bit_to_p010(src.data(), src_stride, expected.data(), dst_stride, g.samples_per_row, g.rows);
+
+    for ( int r = 0; r < g.rows; r++ )
+    {
+        const uint16_t* d = (const uint16_t*)(dst.data() + (size_t)r * dst_stride);
+        const uint16_t* e = (const uint16_t*)(expected.data() + (size_t)r * dst_stride);
+
+        for ( int i = 0; i < g.samples_per_row; i++ )
+        {
+            ASSERT_EQ(e[i], d[i]) << "row " << r << ", sample " << i;
+        }
+    }
+}
+
+TEST_P(ConvertTest, PackMatchesReference)
+{
+    const Geometry& g = GetParam();
+    const int src_stride = g.samples_per_row * 2;
+    const int dst_stride = packed_row_bytes(g.samples_per_row) + g.src_padding;
+    GuardedBuffer src((size_t)src_stride * g.rows);
+    std::vector<uint8_t> dst((size_t)dst_stride * g.rows);
+    std::vector<uint8_t> expected;
+
+    ASSERT_NE(nullptr, src.data() );
+    /* 每个 sample 的低 6 bit 也是随机的, pack 应将其丢弃. */
+    fill_random(src.data(), src.size(), g.samples_per_row + 1);
+    /* 行尾最后一个 byte 中不属于 sample 的 bit, 以及 padding, 不能被修改. */
+    fill_random(dst.data(), dst.size(), g.samples_per_row + 2);
+    expected = dst;
+
+    rk_pack_p010_to_10bit(src.data(), src_stride, dst.data(), dst_stride, g.samples_per_row, g.rows);
+    ref_pack_p010_to_10bit(src.data(), src_stride, expected.data(), dst_stride, g.samples_per_row, g.rows);
+
+    ASSERT_EQ(0, memcmp(expected.data(), dst.data(), dst.size() ) );
+}
+
+TEST_P(ConvertTest, RoundTrip)
+{
+    const Geometry& g = GetParam();
+    const int packed_stride = packed_row_bytes(g.samples_per_row) + g.src_padding;
+    const int p010_stride = g.samples_per_row * 2;
+    GuardedBuffer packed((size_t)packed_stride * g.rows);
+    std::vector<uint8_t> p010((size_t)p010_stride * g.rows);
+    std::vector<uint8_t> repacked;
+
+    ASSERT_NE(nullptr, packed.data() );
+    fill_random(packed.data(), packed.size(), g.samples_per_row + 3);
+    repacked.assign(packed.data(), packed.data() + packed.size() );
+
+    rk_unpack_10bit_to_p010(packed.data(), packed_stride, p010.data(), p010_stride, g.samples_per_row, g.rows);
+    memset(repacked.data(), 0, repacked.size() );
+    rk_pack_p010_to_10bit(p010.data(), p010_stride, repacked.data(), packed_stride, g.samples_per_row, g.rows);
+
+    for ( int r = 0; r < g.rows; r++ )
+    {
+        const uint8_t* a = packed.data() + (size_t)r * packed_stride;
+        const uint8_t* b = repacked.data() + (size_t)r * packed_stride;
+
+        for ( int i = 0; i < g.samples_per_row; i++ )
+        {
+            ASSERT_EQ(ref_get_10bit_sample(a, i), ref_get_10bit_sample(b, i) ) << "row " << r << ", sample " << i;
+        }
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(Geometries, ConvertTest, ::testing::ValuesIn(geometries() ) );
+
+/*
+ * 4K NV12_10 的 chroma plane, 达到 RK_CONVERT_MT_MIN_SAMPLES, 由多个线程转换; 行数不能被线程数整除.
+ */
+TEST(ConvertMultiThreadTest, UnpackAndPackMatchReference)
+{
+    const int samples_per_row = 3840;
+    const int rows = RK_CONVERT_MT_MIN_SAMPLES / samples_per_row + 3;
+    const int packed_stride = packed_row_bytes(samples_per_row);
+    const int p010_stride = samples_per_row * 2;
+    GuardedBuffer packed((size_t)packed_stride * rows);
+    std::vector<uint8_t> p010((size_t)p010_stride * rows);
+    std::vector<uint8_t> expected((size_t)p010_stride * rows);
+    std::vector<uint8_t> repacked((size_t)packed_stride * rows);
+
+    ASSERT_NE(nullptr, packed.data() );
+    fill_random(packed.data(), packed.size(), 4);
+
+    rk_unpack_10bit_to_p010(packed.data(), packed_stride, p010.data(), p010_stride, samples_per_row, rows);
+    ref_unpack_10bit_to_p010(packed.data(), packed_stride, expected.data(), p010_stride, samples_per_row, rows);
+    ASSERT_EQ(0, memcmp(expected.data(), p010.data(), p010.size() ) );
+
+    rk_pack_p010_to_10bit(p010.data(), p010_stride, repacked.data(), packed_stride, samples_per_row, rows);
+    /* 3840 个 sample 正好是 4800 byte, 没有行尾的剩余 bit. */
+    ASSERT_EQ(0, memcmp(packed.data(), repacked.data(), repacked.size() ) );
+}
+
+TEST(ClearBytesTest, ClearsExactlyTheRange)
+{
+    const size_t sizes[] = { 0, 1, 4095, 4097, RK_CLEAR_MT_MIN_BYTES - 1, RK_CLEAR_MT_MIN_BYTES + 4096 + 7 };
+    rk_clear_pool_t* pool = rk_clear_pool_create(RK_CONVERT_MAX_THREADS - 1);
+
+    ASSERT_TRUE(pool != NULL);
+
+    /* 同一个 pool 被多次使用, 另以 NULL (当前线程中清零) 对照. */
+    for ( rk_clear_pool_t* p : { pool, (rk_clear_pool_t*)NULL } )
+    {
+        for ( size_t size : sizes )
+        {
+            std::vector<uint8_t> buf(size + 2, 0xFF);
+
+            rk_clear_bytes(p, buf.data() + 1, size);
+
+            ASSERT_EQ(0xFF, buf[0]) << size;
+            ASSERT_EQ(0xFF, buf[size + 1]) << size;
+            for ( size_t i = 1; i <= size; i++ )
+            {
+                ASSERT_EQ(0, buf[i]) << "size " << size << ", offset " << i - 1;
+            }
+        }
+    }
+
+    rk_clear_pool_destroy(pool);
+}
+
+TEST(ClearBytesTest, ConcurrentCallersShareOnePool)
+{
+    const size_t size = RK_CLEAR_MT_MIN_BYTES * 2 + 123;
+    rk_clear_pool_t* pool = rk_clear_pool_create(RK_CONVERT_MAX_THREADS - 1);
+    std::vector<std::thread> callers;
+    std::vector<std::vector<uint8_t> > bufs(4);
+
+    ASSERT_TRUE(pool != NULL);
+
+    for ( size_t i = 0; i < bufs.size(); i++ )
+    {
+        bufs[i].assign(size, 0xA5);
+        callers.emplace_back([pool, &bufs, i]() {
+            for ( int round = 0; round < 8; round++ )
+            {
+                memset(bufs[i].data(), 0xA5, bufs[i].size() );
+                rk_clear_bytes(pool, bufs[i].data(), bufs[i].size() );
+            }
+        });
+    }
+    for ( std::thread& t : callers )
+    {
+        t.join();
+    }
+
+    for ( size_t i = 0; i < bufs.size(); i++ )
+    {
+        ASSERT_EQ(bufs[i].end(), std::find_if(bufs[i].begin(), bufs[i].end(), [](uint8_t v) { return v != 0; }) ) << i;
+    }
+
+    rk_clear_pool_destroy(pool);
+}
+
+} // namespace
@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_drm_fourcc_test.cpp
+ *      mali_gralloc_get_drm_format() 和 mali_gralloc_drm_modifier_set_afbc_attrs() 的 test.
+ *
+ * DrmFormatTest : 对 s_drm_formats 中的每个 base format, 检查线性时的 fourcc 和 plane 数,
+ *                 以及 AFBC 各 attribute (basic, split block, wide block, tiled headers) 的每种组合下的 fourcc 和 modifier.
+ * 期望的 fourcc 和 modifier 按 linux uapi drm_fourcc.h 的定义在这里独立写出, 不使用被测代码中的宏.
+ * 另外遍历 base format 的取值范围, 确认表外的 format 都被拒绝, 即被测的表和这里的表一致.
+ */
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <hardware/gralloc.h>
+#include <inttypes.h>
+#include <log/log.h>
+#include <string>
+#include <vector>
+
+#include "gralloc_drm.h"
+#include "gralloc_drm_handle.h"
+#include "mali_gralloc_formats.h"
+
+namespace {
+
+constexpr uint32_t fourcc(char a, char b, char c, char d)
+{
+    return (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24);
+}
+
+/* drm_fourcc.h 中 ARM AFBC modifier 的编码. */
+const uint64_t k_mod_linear = 0;
+const uint64_t k_mod_afbc_vendor = 0x08ULL << 56;
+const uint64_t k_mod_block_16x16 = 1;
+const uint64_t k_mod_block_32x8 = 2;
+const uint64_t k_mod_ytr = 1ULL << 4;
+const uint64_t k_mod_split = 1ULL << 5;
+const uint64_t k_mod_sparse = 1ULL << 6;
+const uint64_t k_mod_tiled = 1ULL << 8;
+
+struct DrmFormatCase
+{
+    const char* name;
+    uint64_t base_format;
+    uint32_t fourcc;
+    /* 0 : 没有 AFBC 的 DRM 描述. */
+    uint32_t afbc_fourcc;
+    uint32_t num_planes;
+    bool afbc_ytr;
+};
+
+const DrmFormatCase k_formats[] =
+{
+    { "rgba_8888", MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888, fourcc('A', 'B', '2', '4'), fourcc('A', 'B', '2', '4'), 1, true },
+    { "rgbx_8888", MALI_GRALLOC_FORMAT_INTERNAL_RGBX_8888, fourcc('X', 'B', '2', '4'), fourcc('X', 'B', '2', '4'), 1, true },
+    { "rgb_888", MALI_GRALLOC_FORMAT_INTERNAL_RGB_888, fourcc('B', 'G', '2', '4'), fourcc('B', 'G', '2', '4'), 1, true },
+    { "rgb_565", MALI_GRALLOC_FORMAT_INTERNAL_RGB_565, fourcc('R', 'G', '1', '6'), fourcc('R', 'G', '1', '6'), 1, true },
+    { "bgra_8888", MALI_GRALLOC_FORMAT_INTERNAL_BGRA_8888, fourcc('A', 'R', '2', '4'), fourcc('A', 'R', '2', '4'), 1, true },
+#if PLATFORM_SDK_VERSION >= 26
+    { "rgba_1010102", MALI_GRALLOC_FORMAT_INTERNAL_RGBA_1010102, fourcc('A', 'B', '3', '0'), fourcc('A', 'B', '3', '0'), 1, true },
+    { "rgba_16161616", MALI_GRALLOC_FORMAT_INTERNAL_RGBA_16161616, fourcc('A', 'B', '4', 'H'), 0, 1, false },
+#endif
+    { "y8", MALI_GRALLOC_FORMAT_INTERNAL_Y8, fourcc('R', '8', ' ', ' '), 0, 1, false },
+    { "y16", MALI_GRALLOC_FORMAT_INTERNAL_Y16, fourcc('R', '1', '6', ' '), 0, 1, false },
+    { "yv12", MALI_GRALLOC_FORMAT_INTERNAL_YV12, fourcc('Y', 'V', '1', '2'), fourcc('Y', 'U', '0', '8'), 3, false },
+    { "internal_nv12", MALI_GRALLOC_FORMAT_INTERNAL_NV12, fourcc('N', 'V', '1', '2'), fourcc('Y', 'U', '0', '8'), 2, false },
+    { "internal_nv21", MALI_GRALLOC_FORMAT_INTERNAL_NV21, fourcc('N', 'V', '2', '1'), 0, 2, false },
+    { "yuv422_8bit", MALI_GRALLOC_FORMAT_INTERNAL_YUV422_8BIT, fourcc('Y', 'U', 'Y', 'V'), fourcc('Y', 'U', 'Y', 'V'), 1, false },
+    { "y0l2", MALI_GRALLOC_FORMAT_INTERNAL_Y0L2, fourcc('Y', '0', 'L', '2'), fourcc('Y', 'U', '1', '0'), 1, false },
+    { "p010", MALI_GRALLOC_FORMAT_INTERNAL_P010, fourcc('P', '0', '1', '0'), 0, 2, false },
+    { "p210", MALI_GRALLOC_FORMAT_INTERNAL_P210, fourcc('P', '2', '1', '0'), 0, 2, false },
+    { "y210", MALI_GRALLOC_FORMAT_INTERNAL_Y210, fourcc('Y', '2', '1', '0'), fourcc('Y', '2', '1', '0'), 1, false },
+    { "y410", MALI_GRALLOC_FORMAT_INTERNAL_Y410, fourcc('Y', '4', '1', '0'), 0, 1, false },
+    { "ycrcb_420_sp", HAL_PIXEL_FORMAT_YCrCb_420_SP, fourcc('N', 'V', '2', '1'), 0, 2, false },
+    { "ycbcr_422_sp", HAL_PIXEL_FORMAT_YCbCr_422_SP, fourcc('N', 'V', '1', '6'), 0, 2, false },
+    { "ycbcr_444_888", HAL_PIXEL_FORMAT_YCbCr_444_888, fourcc('N', 'V', '2', '4'), 0, 2, false },
+    { "ycbcr_422_i", HAL_PIXEL_FORMAT_YCbCr_422_I, fourcc('Y', 'U', 'Y', 'V'), 0, 1, false },
+    { "ycrcb_nv12", HAL_PIXEL_FORMAT_YCrCb_NV12, fourcc('N', 'V', '1', '2'), 0, 2, false },
+    { "ycrcb_nv12_10", HAL_PIXEL_FORMAT_YCrCb_NV12_10, fourcc('N', 'V', '1', '5'), 0, 2, false },
+    { "ycrcb_420_sp_10", HAL_PIXEL_FORMAT_YCrCb_420_SP_10, fourcc('N', 'V', '1', '5'), 0, 2, false },
+    { "ycbcr_422_sp_10", HAL_PIXEL_FORMAT_YCbCr_422_SP_10, fourcc('N', 'V', '2', '0'), 0, 2, false },
+};
+
+const DrmFormatCase* find_case(uint64_t base_format)
+{
+    for ( const DrmFormatCase& c : k_formats )
+    {
+        if ( c.base_format == base_format )
+        {
+            return &c;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * AFBC attribute 的每种组合 : basic, split block, wide block 的非空子集, 各自带或不带 tiled headers.
+ */
+std::vector<uint64_t> afbc_attr_combinations()
+{
+    const uint64_t afbc_bits[] =
+    {
+        MALI_GRALLOC_INTFMT_AFBC_BASIC,
+        MALI_GRALLOC_INTFMT_AFBC_SPLITBLK,
+        MALI_GRALLOC_INTFMT_AFBC_WIDEBLK,
+    };
+    std::vector<uint64_t> combinations;
+
+    for ( unsigned subset = 1; subset < (1u << 3); subset++ )
+    {
+        uint64_t attrs = 0;
+
+        for ( unsigned i = 0; i < 3; i++ )
+        {
+            if ( subset & (1u << i) )
+            {
+                attrs |= afbc_bits[i];
+            }
+        }
+        combinations.push_back(attrs);
+        combinations.push_back(attrs | MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS);
+    }
+
+    return combinations;
+}
+
+uint64_t expected_afbc_modifier(uint64_t attrs, bool ytr)
+{
+    uint64_t modifier = k_mod_afbc_vendor;
+
+    modifier |= (attrs & MALI_GRALLOC_INTFMT_AFBC_WIDEBLK) ? k_mod_block_32x8 : k_mod_block_16x16;
+    if ( attrs & MALI_GRALLOC_INTFMT_AFBC_SPLITBLK )
+    {
+        modifier |= k_mod_split;
+    }
+    if ( attrs & MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS )
+    {
+        modifier |= k_mod_tiled;
+    }
+    if ( ytr )
+    {
+        modifier |= k_mod_ytr;
+    }
+
+    return modifier;
+}
+
+/*---------------------------------------------------------------------------*/
+
+class DrmFormatTest : public ::testing::TestWithParam<DrmFormatCase>
+{
+};
+
+TEST_P(DrmFormatTest, Linear)
+{
+    const DrmFormatCase& c = GetParam();
+    mali_gralloc_drm_format drm_format;
+
+    ASSERT_EQ(0, mali_gralloc_get_drm_format(c.base_format, &drm_format));
+    EXPECT_EQ(c.fourcc, drm_format.fourcc);
+    EXPECT_EQ(k_mod_linear, drm_format.modifier);
+    EXPECT_EQ(c.num_planes, drm_format.num_planes);
+}
+
+TEST_P(DrmFormatTest, TiledHeadersWithoutAfbcAreRejected)
+{
+    const DrmFormatCase& c = GetParam();
+    mali_gralloc_drm_format drm_format;
+
+    EXPECT_EQ(-EINVAL, mali_gralloc_get_drm_format(c.base_format | MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS, &drm_format));
+}
+
+TEST_P(DrmFormatTest, EachAfbcAttributeCombination)
+{
+    const DrmFormatCase& c = GetParam();
+
+    for ( uint64_t attrs : afbc_attr_combinations() )
+    {
+        mali_gralloc_drm_format drm_format;
+        int ret = mali_gralloc_get_drm_format(c.base_format | attrs, &drm_format);
+
+        SCOPED_TRACE(::testing::Message() << std::hex << "afbc attrs 0x" << attrs);
+
+        if ( 0 == c.afbc_fourcc )
+        {
+            EXPECT_EQ(-EINVAL, ret);
+            continue;
+        }
+
+        ASSERT_EQ(0, ret);
+        EXPECT_EQ(c.afbc_fourcc, drm_format.fourcc);
+        EXPECT_EQ(expected_afbc_modifier(attrs, c.afbc_ytr), drm_format.modifier)
+            << std::hex << "got 0x" << drm_format.modifier;
+        EXPECT_EQ(1u, drm_format.num_planes);
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(DrmFormats, DrmFormatTest, ::testing::ValuesIn(k_formats),
+                        [](const ::testing::TestParamInfo<DrmFormatCase>& info) { return std::string(info.param.name); });
+
+/*
+ * 遍历 HAL format 和 internal format 的取值范围 (以及超出范围的值) : 不在 k_formats 中的 base format, 线性和 AFBC 都被拒绝;
+ * 在 k_formats 中的都被接受. 两者合起来保证 s_drm_formats 与 k_formats 中的 base format 完全相同.
+ */
+TEST(DrmFormatSweepTest, OnlyListedBaseFormatsHaveDrmFormat)
+{
+    std::vector<uint64_t> base_formats;
+
+    for ( uint64_t base_format = 0; base_format < MALI_GRALLOC_FORMAT_INTERNAL_RANGE_LAST + 0x100; base_format++ )
+    {
+        base_formats.push_back(base_format);
+    }
+    base_formats.push_back(0x7fffffff);
+    base_formats.push_back(MALI_GRALLOC_INTFMT_FMT_MASK);
+
+    for ( uint64_t base_format : base_formats )
+    {
+        const DrmFormatCase* c = find_case(base_format);
+        mali_gralloc_drm_format drm_format;
+
+        SCOPED_TRACE(::testing::Message() << std::hex << "base format 0x" << base_format);
+
+        EXPECT_EQ(c ? 0 : -EINVAL, mali_gralloc_get_drm_format(base_format, &drm_format));
+        if ( NULL == c || 0 == c->afbc_fourcc )
+        {
+            EXPECT_EQ(-EINVAL, mali_gralloc_get_drm_format(base_format | MALI_GRALLOC_INTFMT_AFBC_BASIC, &drm_format));
+        }
+    }
+}
+
+TEST(DrmFormatSweepTest, NullOutputIsRejected)
+{
+    EXPECT_EQ(-EINVAL, mali_gralloc_get_drm_format(MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888, NULL));
+}
+
+/*---------------------------------------------------------------------------*/
+
+TEST(DrmModifierAttrsTest, ReplacesYtrAndSparseOfAfbcModifiers)
+{
+    /* alloc 时的各种 AFBC modifier, 以及已经带有 YTR / SPARSE 的. */
+    std::vector<uint64_t> modifiers;
+
+    for ( uint64_t attrs : afbc_attr_combinations() )
+    {
+        modifiers.push_back(expected_afbc_modifier(attrs, false));
+        modifiers.push_back(expected_afbc_modifier(attrs, true));
+        modifiers.push_back(expected_afbc_modifier(attrs, true) | k_mod_sparse);
+    }
+
+    for ( uint64_t modifier : modifiers )
+    {
+        for ( int ytr = 0; ytr <= 1; ytr++ )
+        {
+            for ( int sparse = 0; sparse <= 1; sparse++ )
+            {
+                uint64_t expected = (modifier & ~(k_mod_ytr | k_mod_sparse))
+                                    | (ytr ? k_mod_ytr : 0)
+                                    | (sparse ? k_mod_sparse : 0);
+
+                EXPECT_EQ(expected, mali_gralloc_drm_modifier_set_afbc_attrs(modifier, ytr, sparse))
+                    << std::hex << "modifier 0x" << modifier << ", ytr " << ytr << ", sparse " << sparse;
+            }
+        }
+    }
+}
+
+TEST(DrmModifierAttrsTest, LeavesOtherModifiersUnchanged)
+{
+    /* 线性, 以及其他 vendor 的 modifier (即使低位与 YTR / SPARSE 重叠). */
+    const uint64_t modifiers[] =
+    {
+        k_mod_linear,
+        (0x01ULL << 56) | k_mod_ytr | k_mod_sparse,
+        (0x09ULL << 56) | 1,
+        0x00ffffffffffffffULL,
+    };
+
+    for ( uint64_t modifier : modifiers )
+    {
+        for ( int ytr = 0; ytr <= 1; ytr++ )
+        {
+            for ( int sparse = 0; sparse <= 1; sparse++ )
+            {
+                EXPECT_EQ(modifier, mali_gralloc_drm_modifier_set_afbc_attrs(modifier, ytr, sparse))
+                    << std::hex << "modifier 0x" << modifier;
+            }
+        }
+    }
+}
+
+} // namespace
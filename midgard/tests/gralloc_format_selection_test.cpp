@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_format_selection_test.cpp
+ *      mali_gralloc_select_format() 按 formatdef_files/ 中的 weight 选择 internal_format 的 test.
+ *
+ * SelectionCases : 典型 usage 和 caps 下期望的 internal_format, 由 gpu_afbc.defs 和 display_rk_vop.defs 中的 weight 手工算出.
+ * Exhaustive : 遍历 request format, hw usage 的所有组合, sw usage, AFBC 相关的 usage, 一组 gpu / dpu caps 和 buffer 大小,
+ *              检查每个结果都满足 AFBC 的约束 (只在所有涉及的 IP 都支持时选择 AFBC).
+ *
+ * 被测的代码须以未定义 GRALLOC_ARM_FORMAT_SELECTION_DISABLE 的方式编译.
+ */
+
+#include <gtest/gtest.h>
+
+#include <hardware/gralloc.h>
+#include <inttypes.h>
+#include <log/log.h>
+#include <vector>
+
+#include "gralloc_drm.h"
+#include "gralloc_drm_handle.h"
+#include "mali_gralloc_formats.h"
+
+namespace {
+
+/* 与 formatdef_files/display_rk_vop.defs 中的 RK_VOP_AFBC_MAX_SIZE 相同. */
+const int k_vop_afbc_max_size = 3840 * 2160 - 1;
+const int k_size_1080p = 1920 * 1080;
+const int k_size_4k = 3840 * 2160;
+
+const uint64_t k_caps_none = 0;
+const uint64_t k_caps_basic = MALI_GRALLOC_FORMAT_CAPABILITY_OPTIONS_PRESENT
+                              | MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_BASIC;
+const uint64_t k_caps_all = k_caps_basic
+                            | MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_SPLITBLK
+                            | MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_WIDEBLK
+                            | MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_TILED_HEADERS;
+
+const uint64_t k_afbc_mask = MALI_GRALLOC_INTFMT_AFBCENABLE_MASK;
+
+uint64_t select(uint64_t req_format, uint64_t usage, int buffer_size, uint64_t gpu_caps, uint64_t dpu_caps)
+{
+    mali_gralloc_runtime_caps caps;
+
+    caps.gpu.caps_mask = gpu_caps;
+    caps.dpu.caps_mask = dpu_caps;
+
+    return mali_gralloc_select_format(req_format, MALI_GRALLOC_FORMAT_TYPE_USAGE, usage, buffer_size, &caps);
+}
+
+bool is_yuv_base(uint64_t base_format)
+{
+    return MALI_GRALLOC_FORMAT_INTERNAL_YV12 == base_format
+           || MALI_GRALLOC_FORMAT_INTERNAL_Y0L2 == base_format
+           || MALI_GRALLOC_FORMAT_INTERNAL_Y210 == base_format;
+}
+
+/*
+ * 'internal_format' 要求 IP 具有的 caps, 以及 'caps_mask' 是否满足.
+ */
+bool caps_allow(uint64_t internal_format, uint64_t caps_mask, bool reads, bool writes)
+{
+    uint64_t required = MALI_GRALLOC_FORMAT_CAPABILITY_OPTIONS_PRESENT;
+    bool yuv = is_yuv_base(internal_format & MALI_GRALLOC_INTFMT_FMT_MASK);
+
+    if ( internal_format & MALI_GRALLOC_INTFMT_AFBC_BASIC )
+    {
+        required |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_BASIC;
+    }
+    if ( internal_format & MALI_GRALLOC_INTFMT_AFBC_SPLITBLK )
+    {
+        required |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_SPLITBLK;
+    }
+    if ( internal_format & MALI_GRALLOC_INTFMT_AFBC_WIDEBLK )
+    {
+        required |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_WIDEBLK;
+        if ( yuv && (caps_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_WIDEBLK_YUV_DISABLE) )
+        {
+            return false;
+        }
+    }
+    if ( internal_format & MALI_GRALLOC_INTFMT_AFBC_TILED_HEADERS )
+    {
+        required |= MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_TILED_HEADERS;
+    }
+    if ( yuv && reads && (caps_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_YUV_NOREAD) )
+    {
+        return false;
+    }
+    if ( yuv && writes && (caps_mask & MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_YUV_NOWRITE) )
+    {
+        return false;
+    }
+
+    return (caps_mask & required) == required;
+}
+
+/*---------------------------------------------------------------------------*/
+
+struct SelectionCase
+{
+    const char* name;
+    uint64_t req_format;
+    uint64_t usage;
+    int buffer_size;
+    uint64_t gpu_caps;
+    uint64_t dpu_caps;
+    uint64_t expected;
+};
+
+const uint64_t k_fbdc = GRALLOC_USAGE_TO_USE_FBDC_FMT;
+const uint64_t k_tex = GRALLOC_USAGE_HW_TEXTURE;
+const uint64_t k_render = GRALLOC_USAGE_HW_RENDER;
+const uint64_t k_hwc = GRALLOC_USAGE_HW_COMPOSER;
+
+const SelectionCase k_cases[] =
+{
+    /* AFBC basic : gpu 100, 高于线性 (60) 和 split block (70). */
+    { "rgba_texture", HAL_PIXEL_FORMAT_RGBA_8888, k_tex, k_size_1080p, k_caps_all, k_caps_basic,
+      MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+    { "rgba_gpu_and_vop", HAL_PIXEL_FORMAT_RGBA_8888, k_tex | k_render | k_hwc, k_size_1080p, k_caps_all, k_caps_basic,
+      MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+    { "rgb565_gpu", HAL_PIXEL_FORMAT_RGB_565, k_tex | k_render, k_size_1080p, k_caps_all, k_caps_none,
+      MALI_GRALLOC_FORMAT_INTERNAL_RGB_565 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+    /* gpu 只支持 split block : AFBC basic 不可用, split block (70) 高于线性. */
+    { "rgba_gpu_splitblk_only", HAL_PIXEL_FORMAT_RGBA_8888, k_tex,
+      k_size_1080p, MALI_GRALLOC_FORMAT_CAPABILITY_OPTIONS_PRESENT | MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_SPLITBLK, k_caps_none,
+      MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 | MALI_GRALLOC_INTFMT_AFBC_SPLITBLK },
+    /* VOP 不支持 split block, 且没有 AFBDC. */
+    { "rgba_vop_without_afbdc", HAL_PIXEL_FORMAT_RGBA_8888, k_tex | k_hwc, k_size_1080p, k_caps_all, k_caps_none,
+      MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 },
+    { "rgba_vop_4k", HAL_PIXEL_FORMAT_RGBA_8888, k_tex | k_hwc, k_size_4k, k_caps_all, k_caps_basic,
+      MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 },
+    { "rgba_gpu_only_4k", HAL_PIXEL_FORMAT_RGBA_8888, k_tex, k_size_4k, k_caps_all, k_caps_none,
+      MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+    { "rgba_gpu_without_caps", HAL_PIXEL_FORMAT_RGBA_8888, k_tex, k_size_1080p, k_caps_none, k_caps_none,
+      MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 },
+    { "rgba_sw_read", HAL_PIXEL_FORMAT_RGBA_8888, k_tex | GRALLOC_USAGE_SW_READ_OFTEN, k_size_1080p, k_caps_all, k_caps_basic,
+      MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 },
+    { "rgba_no_afbc", HAL_PIXEL_FORMAT_RGBA_8888, k_tex | GRALLOC_ARM_USAGE_NO_AFBC, k_size_1080p, k_caps_all, k_caps_basic,
+      MALI_GRALLOC_FORMAT_INTERNAL_RGBA_8888 },
+    /* video encoder 不参与 format 选择, 保持线性. */
+    { "rgba_video_encoder", HAL_PIXEL_FORMAT_RGBA_8888, k_tex | GRALLOC_USAGE_HW_VIDEO_ENCODER, k_size_1080p, k_caps_all, k_caps_basic,
+      HAL_PIXEL_FORMAT_RGBA_8888 },
+    { "rgba_no_hw_usage", HAL_PIXEL_FORMAT_RGBA_8888, GRALLOC_USAGE_SW_WRITE_OFTEN, k_size_1080p, k_caps_all, k_caps_basic,
+      HAL_PIXEL_FORMAT_RGBA_8888 },
+
+    /* AFBC YUV 只在 GRALLOC_USAGE_TO_USE_FBDC_FMT 时选择. */
+    { "nv12_fbdc", HAL_PIXEL_FORMAT_YCrCb_NV12, k_fbdc | k_tex | k_hwc, k_size_1080p, k_caps_all, k_caps_basic,
+      MALI_GRALLOC_FORMAT_INTERNAL_YV12 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+    { "nv12_without_fbdc", HAL_PIXEL_FORMAT_YCrCb_NV12, k_tex | k_hwc, k_size_1080p, k_caps_all, k_caps_basic,
+      HAL_PIXEL_FORMAT_YCrCb_NV12 },
+    { "nv12_fbdc_vop_yuv_noread", HAL_PIXEL_FORMAT_YCrCb_NV12, k_fbdc | k_tex | k_hwc, k_size_1080p, k_caps_all,
+      k_caps_basic | MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_YUV_NOREAD,
+      HAL_PIXEL_FORMAT_YCrCb_NV12 },
+    { "nv12_fbdc_gpu_yuv_noread", HAL_PIXEL_FORMAT_YCrCb_NV12, k_fbdc | k_tex, k_size_1080p,
+      k_caps_all | MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_YUV_NOREAD, k_caps_basic,
+      HAL_PIXEL_FORMAT_YCrCb_NV12 },
+    /* gpu_afbc.defs 的 write blkinit 不支持 AFBC YUV. */
+    { "nv12_fbdc_render", HAL_PIXEL_FORMAT_YCrCb_NV12, k_fbdc | k_render, k_size_1080p, k_caps_all, k_caps_basic,
+      HAL_PIXEL_FORMAT_YCrCb_NV12 },
+    { "nv12_10_fbdc", HAL_PIXEL_FORMAT_YCrCb_NV12_10, k_fbdc | k_tex | k_hwc, k_size_1080p, k_caps_all, k_caps_basic,
+      MALI_GRALLOC_FORMAT_INTERNAL_Y0L2 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+    { "nv16_10_fbdc", HAL_PIXEL_FORMAT_YCbCr_422_SP_10, k_fbdc | k_tex | k_hwc, k_size_1080p, k_caps_all, k_caps_basic,
+      MALI_GRALLOC_FORMAT_INTERNAL_Y210 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+    { "nv12_fbdc_vop_4k", HAL_PIXEL_FORMAT_YCrCb_NV12, k_fbdc | k_tex | k_hwc, k_size_4k, k_caps_all, k_caps_basic,
+      HAL_PIXEL_FORMAT_YCrCb_NV12 },
+    /* YV12 : gpu 读取 AFBC (100) 高于 split block (70). VOP 不支持 YV12. */
+    { "yv12_fbdc_texture", HAL_PIXEL_FORMAT_YV12, k_fbdc | k_tex, k_size_1080p, k_caps_all, k_caps_none,
+      MALI_GRALLOC_FORMAT_INTERNAL_YV12 | MALI_GRALLOC_INTFMT_AFBC_BASIC },
+    { "yv12_composer", HAL_PIXEL_FORMAT_YV12, k_tex | k_hwc, k_size_1080p, k_caps_all, k_caps_basic,
+      HAL_PIXEL_FORMAT_YV12 },
+
+    /* 不经过 weight 的分支. */
+    { "implementation_defined", HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED, k_tex | k_hwc, k_size_1080p, k_caps_all, k_caps_basic,
+      HAL_PIXEL_FORMAT_RGBX_8888 },
+    { "implementation_defined_encoder", HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED, k_tex | GRALLOC_USAGE_HW_VIDEO_ENCODER,
+      k_size_1080p, k_caps_all, k_caps_basic,
+      HAL_PIXEL_FORMAT_YCrCb_NV12 },
+    { "ycbcr_420_888", HAL_PIXEL_FORMAT_YCbCr_420_888, GRALLOC_USAGE_SW_READ_OFTEN | k_tex, k_size_1080p, k_caps_all, k_caps_basic,
+      HAL_PIXEL_FORMAT_YCrCb_NV12 },
+    { "arm_p010", HAL_PIXEL_FORMAT_YCrCb_NV12_10, GRALLOC_USAGE_TO_USE_ARM_P010 | k_tex, k_size_1080p, k_caps_all, k_caps_basic,
+      MALI_GRALLOC_FORMAT_INTERNAL_P010 },
+};
+
+class SelectionCaseTest : public ::testing::TestWithParam<SelectionCase>
+{
+};
+
+TEST_P(SelectionCaseTest, SelectsExpectedFormat)
+{
+    const SelectionCase& c = GetParam();
+    uint64_t result = select(c.req_format, c.usage, c.buffer_size, c.gpu_caps, c.dpu_caps);
+
+    EXPECT_EQ(c.expected, result) << std::hex << "got 0x" << result << ", expected 0x" << c.expected;
+}
+
+INSTANTIATE_TEST_CASE_P(SelectionCases, SelectionCaseTest, ::testing::ValuesIn(k_cases),
+                        [](const ::testing::TestParamInfo<SelectionCase>& info) { return std::string(info.param.name); });
+
+TEST(FormatSelectionTest, NoSelectionWithoutCapsOrForInternalType)
+{
+    mali_gralloc_runtime_caps caps;
+
+    caps.gpu.caps_mask = k_caps_all;
+    caps.dpu.caps_mask = k_caps_basic;
+
+    EXPECT_EQ( (uint64_t)HAL_PIXEL_FORMAT_RGBA_8888,
+               mali_gralloc_select_format(HAL_PIXEL_FORMAT_RGBA_8888, MALI_GRALLOC_FORMAT_TYPE_USAGE, k_tex, k_size_1080p, NULL) );
+    EXPECT_EQ( (uint64_t)HAL_PIXEL_FORMAT_RGBA_8888,
+               mali_gralloc_select_format(HAL_PIXEL_FORMAT_RGBA_8888, MALI_GRALLOC_FORMAT_TYPE_INTERNAL, k_tex, k_size_1080p, &caps) );
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* 遍历的 request format : s_indexed_formats 中出现的全部, 以及不参与选择的格式. */
+const uint64_t k_req_formats[] =
+{
+    HAL_PIXEL_FORMAT_RGBA_8888,
+    HAL_PIXEL_FORMAT_RGBX_8888,
+    HAL_PIXEL_FORMAT_RGB_888,
+    HAL_PIXEL_FORMAT_RGB_565,
+    HAL_PIXEL_FORMAT_BGRA_8888,
+    HAL_PIXEL_FORMAT_YV12,
+    HAL_PIXEL_FORMAT_YCrCb_NV12,
+    HAL_PIXEL_FORMAT_YCrCb_NV12_10,
+    HAL_PIXEL_FORMAT_YCbCr_422_SP_10,
+    HAL_PIXEL_FORMAT_YCbCr_420_888,
+    HAL_PIXEL_FORMAT_BLOB,
+    HAL_PIXEL_FORMAT_RAW16,
+};
+
+/* 基本格式 (去掉 AFBC 修饰) 与 request format 的对应. */
+uint64_t expected_base_format(uint64_t req_format, bool afbc)
+{
+    switch ( req_format )
+    {
+        case HAL_PIXEL_FORMAT_YCbCr_420_888:
+            return afbc ? (uint64_t)MALI_GRALLOC_FORMAT_INTERNAL_YV12 : (uint64_t)HAL_PIXEL_FORMAT_YCrCb_NV12;
+        case HAL_PIXEL_FORMAT_YCrCb_NV12:
+            return afbc ? (uint64_t)MALI_GRALLOC_FORMAT_INTERNAL_YV12 : req_format;
+        case HAL_PIXEL_FORMAT_YCrCb_NV12_10:
+            return afbc ? (uint64_t)MALI_GRALLOC_FORMAT_INTERNAL_Y0L2 : req_format;
+        case HAL_PIXEL_FORMAT_YCbCr_422_SP_10:
+            return afbc ? (uint64_t)MALI_GRALLOC_FORMAT_INTERNAL_Y210 : req_format;
+        default:
+            return req_format;
+    }
+}
+
+const uint64_t k_hw_usage_bits[] =
+{
+    GRALLOC_USAGE_HW_TEXTURE,
+    GRALLOC_USAGE_HW_RENDER,
+    GRALLOC_USAGE_HW_COMPOSER,
+    GRALLOC_USAGE_HW_FB,
+    GRALLOC_USAGE_HW_VIDEO_ENCODER,
+};
+
+const uint64_t k_extra_usages[] =
+{
+    0,
+    GRALLOC_USAGE_SW_READ_OFTEN,
+    GRALLOC_USAGE_SW_WRITE_RARELY,
+    GRALLOC_ARM_USAGE_NO_AFBC,
+    GRALLOC_USAGE_TO_USE_FBDC_FMT,
+    GRALLOC_USAGE_TO_USE_FBDC_FMT | GRALLOC_USAGE_SW_READ_OFTEN,
+};
+
+const uint64_t k_caps_masks[] =
+{
+    k_caps_none,
+    MALI_GRALLOC_FORMAT_CAPABILITY_OPTIONS_PRESENT,
+    k_caps_basic,
+    MALI_GRALLOC_FORMAT_CAPABILITY_OPTIONS_PRESENT | MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_SPLITBLK,
+    k_caps_all,
+    k_caps_all | MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_WIDEBLK_YUV_DISABLE,
+    k_caps_all | MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_YUV_NOREAD,
+    k_caps_all | MALI_GRALLOC_FORMAT_CAPABILITY_AFBC_YUV_NOWRITE,
+    /* AFBC 的 caps 存在, 但没有 OPTIONS_PRESENT : caps 无效. */
+    k_caps_all & ~MALI_GRALLOC_FORMAT_CAPABILITY_OPTIONS_PRESENT,
+};
+
+const int k_buffer_sizes[] = { 64 * 64, k_size_1080p, k_vop_afbc_max_size, k_size_4k };
+
+TEST(FormatSelectionTest, Exhaustive)
+{
+    const size_t n_hw = sizeof(k_hw_usage_bits) / sizeof(k_hw_usage_bits[0]);
+    int n_afbc = 0;
+    int n_total = 0;
+
+    for ( uint64_t req_format : k_req_formats )
+    for ( uint32_t hw_set = 0; hw_set < (1u << n_hw); hw_set++ )
+    for ( uint64_t extra : k_extra_usages )
+    for ( uint64_t gpu_caps : k_caps_masks )
+    for ( uint64_t dpu_caps : k_caps_masks )
+    for ( int buffer_size : k_buffer_sizes )
+    {
+        uint64_t hw_usage = 0;
+        uint64_t usage;
+        uint64_t result;
+        uint64_t result_repeated;
+        bool afbc;
+        bool gpu_reads, gpu_writes, vop_reads;
+
+        for ( size_t b = 0; b < n_hw; b++ )
+        {
+            if ( hw_set & (1u << b) )
+            {
+                hw_usage |= k_hw_usage_bits[b];
+            }
+        }
+        usage = hw_usage | extra;
+        gpu_reads = (usage & GRALLOC_USAGE_HW_TEXTURE) != 0;
+        gpu_writes = (usage & GRALLOC_USAGE_HW_RENDER) != 0;
+        vop_reads = (usage & (GRALLOC_USAGE_HW_COMPOSER | GRALLOC_USAGE_HW_FB) ) != 0;
+
+        result = select(req_format, usage, buffer_size, gpu_caps, dpu_caps);
+        result_repeated = select(req_format, usage, buffer_size, gpu_caps, dpu_caps);
+        afbc = (result & k_afbc_mask) != 0;
+        n_total++;
+        n_afbc += afbc;
+
+        SCOPED_TRACE(::testing::Message() << std::hex << "req 0x" << req_format << ", usage 0x" << usage
+                     << ", gpu caps 0x" << gpu_caps << ", dpu caps 0x" << dpu_caps
+                     << std::dec << ", size " << buffer_size << std::hex << " -> 0x" << result);
+
+        ASSERT_EQ(result, result_repeated);
+        ASSERT_EQ(expected_base_format(req_format, afbc), result & MALI_GRALLOC_INTFMT_FMT_MASK);
+
+        if ( !afbc )
+        {
+            continue;
+        }
+
+        /* 以下都是 AFBC 的结果. */
+        ASSERT_EQ(0u, usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK) );
+        ASSERT_NE(GRALLOC_ARM_USAGE_NO_AFBC, usage & GRALLOC_ARM_USAGE_NO_AFBC);
+        ASSERT_EQ(0u, usage & GRALLOC_USAGE_HW_VIDEO_ENCODER);
+        ASSERT_NE(0u, hw_usage);
+        if ( is_yuv_base(result & MALI_GRALLOC_INTFMT_FMT_MASK) )
+        {
+            ASSERT_EQ( (uint64_t)GRALLOC_USAGE_TO_USE_FBDC_FMT, usage & GRALLOC_USAGE_ROT_MASK);
+        }
+        if ( gpu_reads || gpu_writes )
+        {
+            ASSERT_TRUE(caps_allow(result, gpu_caps, gpu_reads, gpu_writes) );
+        }
+        if ( vop_reads )
+        {
+            ASSERT_TRUE(caps_allow(result, dpu_caps, true, false) );
+            ASSERT_LE(buffer_size, k_vop_afbc_max_size);
+            /* AFBDC of VOP 只支持 16x16 的 basic block. */
+            ASSERT_EQ( (uint64_t)MALI_GRALLOC_INTFMT_AFBC_BASIC, result & k_afbc_mask);
+        }
+
+        /* 若 split block 被选中, AFBC basic 必然不可用 (其 weight 更高). */
+        if ( (result & k_afbc_mask) == MALI_GRALLOC_INTFMT_AFBC_SPLITBLK )
+        {
+            uint64_t basic = (result & MALI_GRALLOC_INTFMT_FMT_MASK) | MALI_GRALLOC_INTFMT_AFBC_BASIC;
+
+            ASSERT_FALSE( (gpu_reads || gpu_writes) && caps_allow(basic, gpu_caps, gpu_reads, gpu_writes)
+                          && (!vop_reads || caps_allow(basic, dpu_caps, true, false) ) );
+        }
+    }
+
+    /* 确认遍历确实覆盖了 AFBC 和非 AFBC 两种结果. */
+    EXPECT_GT(n_afbc, 0);
+    EXPECT_GT(n_total - n_afbc, 0);
+}
+
+} // namespace
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_import_benchmark.cpp
+ *      import + 首次 lock 的延迟, 分别对 gem import 和 cpu_only_import 两条路径.
+ *
+ * 每次迭代 clone 一个已分配 buffer 的 handle, 并清除其中的 data_owner, 模拟从另一个进程收到的 handle,
+ * 然后 register, 以 SW_READ lock, 读取每个 page 的首个 byte, unlock, unregister.
+ * gem import 的 buffer 的 CPU 映射路径由 'vendor.gralloc.dmabuf_mmap' 决定 (在进程启动时读取),
+ * 分别以 true 和 false 运行, 可以比较 rockchip_bo_map 和直接 mmap dma_buf 的开销.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <cutils/native_handle.h>
+#include <cutils/properties.h>
+#include <hardware/gralloc.h>
+#include <log/log.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "gralloc_drm.h"
+#include "gralloc_drm_handle.h"
+
+static const gralloc_module_t* get_gralloc_module()
+{
+    static const gralloc_module_t* s_module = NULL;
+
+    if ( NULL == s_module )
+    {
+        const hw_module_t* module = NULL;
+
+        if ( 0 == hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &module) )
+        {
+            s_module = (const gralloc_module_t*)module;
+        }
+    }
+
+    return s_module;
+}
+
+/*
+ * args : cpu_only_import, width, height.
+ */
+static void BM_ImportFirstLock(benchmark::State& state)
+{
+    const gralloc_module_t* module = get_gralloc_module();
+    const int cpu_only = (int)state.range(0);
+    const int width = (int)state.range(1);
+    const int height = (int)state.range(2);
+    const int usage = GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_HW_TEXTURE;
+    const long page_size = sysconf(_SC_PAGESIZE);
+    alloc_device_t* alloc_dev = NULL;
+    buffer_handle_t buffer = NULL;
+    int stride = 0;
+
+    if ( NULL == module || 0 != gralloc_open(&module->common, &alloc_dev) )
+    {
+        state.SkipWithError("failed to open gralloc");
+        return;
+    }
+
+    if ( 0 != alloc_dev->alloc(alloc_dev, width, height, HAL_PIXEL_FORMAT_RGBA_8888, usage, &buffer, &stride) )
+    {
+        gralloc_close(alloc_dev);
+        state.SkipWithError("failed to alloc buffer");
+        return;
+    }
+
+    module->perform(module, GRALLOC_MODULE_PERFORM_SET_CPU_ONLY_IMPORT, cpu_only);
+
+    for ( auto _ : state )
+    {
+        native_handle_t* copy = native_handle_clone(buffer);
+        struct gralloc_drm_handle_t* handle = (struct gralloc_drm_handle_t*)copy;
+        volatile uint8_t sum = 0;
+        void* vaddr = NULL;
+
+        /* 模拟从另一个进程收到的 handle : 当前进程中的状态 (包括 attr 区的映射) 都无效. */
+        handle->data_owner = 0;
+        handle->data = NULL;
+#if MALI_AFBC_GRALLOC == 1
+        handle->attr_base = MAP_FAILED;
+#endif
+#ifdef USE_HWC2
+        handle->ashmem_base = MAP_FAILED;
+#endif
+
+        if ( 0 != module->registerBuffer(module, copy) )
+        {
+            state.SkipWithError("failed to register buffer");
+            native_handle_close(copy);
+            native_handle_delete(copy);
+            break;
+        }
+
+        if ( 0 == module->lock(module, copy, GRALLOC_USAGE_SW_READ_OFTEN, 0, 0, width, height, &vaddr) )
+        {
+            for ( int offset = 0; offset < handle->size; offset += page_size )
+            {
+                sum += ((const uint8_t*)vaddr)[offset];
+            }
+            module->unlock(module, copy);
+        }
+        else
+        {
+            state.SkipWithError("failed to lock buffer");
+        }
+
+        /* unregister 时 gralloc 关闭了 handle 中的 fd, 这里只释放 handle 本身. */
+        module->unregisterBuffer(module, copy);
+        native_handle_delete(copy);
+    }
+
+    module->perform(module, GRALLOC_MODULE_PERFORM_SET_CPU_ONLY_IMPORT, 0);
+    alloc_dev->free(alloc_dev, buffer);
+    gralloc_close(alloc_dev);
+
+    state.SetLabel(cpu_only ? "cpu_only_import"
+                            : (property_get_bool("vendor.gralloc.dmabuf_mmap", false) ? "gem_import+dmabuf_mmap"
+                                                                                     : "gem_import+gem_mmap") );
+}
+
+BENCHMARK(BM_ImportFirstLock)
+    ->ArgNames({"cpu_only", "width", "height"})
+    ->Args({0, 640, 480})
+    ->Args({1, 640, 480})
+    ->Args({0, 1920, 1080})
+    ->Args({1, 1920, 1080})
+    ->Args({0, 3840, 2160})
+    ->Args({1, 3840, 2160})
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,361 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_lazy_commit_test.cpp
+ *      lazy commit 的 buffer 在 commit 之前被交给其他进程, 通过 gralloc.$(TARGET_BOARD_PLATFORM), 在 target 上运行.
+ *
+ * 当前进程 alloc 之后, 在 commit 之前通过 unix socket 把 handle 发送给 fork + exec 的 consumer 进程 (以 --consumer 运行的本程序),
+ * 与 BufferQueue 经 binder 传递 handle 的方式相同. consumer register (请求 alloc 的进程 commit) 并以 CPU 写入.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cutils/native_handle.h>
+#include <fcntl.h>
+#include <hardware/gralloc.h>
+#include <log/log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "gralloc_drm.h"
+#include "gralloc_drm_handle.h"
+
+namespace {
+
+const char k_consumer_arg[] = "--consumer";
+const int k_width = 256;
+const int k_height = 64;
+const uint8_t k_pattern = 0x5a;
+
+/* consumer 进程的退出码. */
+enum
+{
+    CONSUMER_OK = 0,
+    CONSUMER_NO_HANDLE = 1,
+    CONSUMER_REGISTER_FAILED = 2,
+    CONSUMER_LOCK_FAILED = 3,
+    CONSUMER_NO_MODULE = 4,
+};
+
+/* native_handle 的 fd 和 int 的最大个数. */
+const int k_max_fds = 4;
+const int k_max_ints = 128;
+
+const gralloc_module_t* get_gralloc_module()
+{
+    static const gralloc_module_t* s_module = NULL;
+
+    if ( NULL == s_module )
+    {
+        const hw_module_t* module = NULL;
+
+        if ( 0 == hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &module) )
+        {
+            s_module = (const gralloc_module_t*)module;
+        }
+    }
+
+    return s_module;
+}
+
+/*
+ * 通过 'socket_fd' 发送 'handle' : 数据是 numFds, numInts 和各 int, fd 通过 SCM_RIGHTS 发送.
+ */
+bool send_handle(int socket_fd, const native_handle_t* handle)
+{
+    int payload[2 + k_max_ints];
+    char control[CMSG_SPACE(sizeof(int) * k_max_fds)];
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+
+    if ( handle->numFds > k_max_fds || handle->numInts > k_max_ints )
+    {
+        return false;
+    }
+
+    payload[0] = handle->numFds;
+    payload[1] = handle->numInts;
+    memcpy(&payload[2], &handle->data[handle->numFds], sizeof(int) * handle->numInts);
+
+    memset(&msg, 0, sizeof(msg) );
+    memset(control, 0, sizeof(control) );
+    iov.iov_base = payload;
+    iov.iov_len = sizeof(int) * (2 + handle->numInts);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * handle->numFds);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * handle->numFds);
+    memcpy(CMSG_DATA(cmsg), &handle->data[0], sizeof(int) * handle->numFds);
+
+    return sendmsg(socket_fd, &msg, 0) == (ssize_t)iov.iov_len;
+}
+
+/*
+ * 从 'socket_fd' 接收 send_handle() 发送的 handle, 失败返回 NULL.
+ */
+native_handle_t* recv_handle(int socket_fd)
+{
+    int payload[2 + k_max_ints];
+    char control[CMSG_SPACE(sizeof(int) * k_max_fds)];
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    native_handle_t* handle;
+    ssize_t n;
+
+    memset(&msg, 0, sizeof(msg) );
+    iov.iov_base = payload;
+    iov.iov_len = sizeof(payload);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    n = recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if ( n < (ssize_t)(sizeof(int) * 2) || NULL == cmsg || cmsg->cmsg_type != SCM_RIGHTS
+        || payload[0] > k_max_fds || payload[1] > k_max_ints
+        || n != (ssize_t)(sizeof(int) * (2 + payload[1]) )
+        || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * payload[0]) )
+    {
+        return NULL;
+    }
+
+    handle = native_handle_create(payload[0], payload[1]);
+    if ( NULL == handle )
+    {
+        return NULL;
+    }
+    memcpy(&handle->data[0], CMSG_DATA(cmsg), sizeof(int) * payload[0]);
+    memcpy(&handle->data[payload[0]], &payload[2], sizeof(int) * payload[1]);
+
+    return handle;
+}
+
+/*
+ * consumer 进程 : 从 'socket_fd' 接收 handle, register, 以 CPU 写入 k_pattern, 然后 unregister 并关闭 handle.
+ */
+int run_consumer(int socket_fd)
+{
+    const gralloc_module_t* module = get_gralloc_module();
+    native_handle_t* copy;
+    struct gralloc_drm_handle_t* handle;
+    void* vaddr = NULL;
+
+    if ( NULL == module )
+    {
+        return CONSUMER_NO_MODULE;
+    }
+
+    copy = recv_handle(socket_fd);
+    if ( NULL == copy )
+    {
+        return CONSUMER_NO_HANDLE;
+    }
+    handle = (struct gralloc_drm_handle_t*)copy;
+
+    /* handle 中 alloc 的进程中的地址在当前进程中无效. */
+    handle->data = NULL;
+#if MALI_AFBC_GRALLOC == 1
+    handle->attr_base = MAP_FAILED;
+#endif
+#ifdef USE_HWC2
+    handle->ashmem_base = MAP_FAILED;
+#endif
+
+    if ( module->registerBuffer(module, copy) != 0 )
+    {
+        native_handle_close(copy);
+        native_handle_delete(copy);
+        return CONSUMER_REGISTER_FAILED;
+    }
+
+    if ( module->lock(module, copy, GRALLOC_USAGE_SW_WRITE_OFTEN, 0, 0, k_width, k_height, &vaddr) != 0 )
+    {
+        module->unregisterBuffer(module, copy);
+        native_handle_close(copy);
+        native_handle_delete(copy);
+        return CONSUMER_LOCK_FAILED;
+    }
+    memset(vaddr, k_pattern, handle->size);
+    module->unlock(module, copy);
+
+    module->unregisterBuffer(module, copy);
+    native_handle_close(copy);
+    native_handle_delete(copy);
+    return CONSUMER_OK;
+}
+
+class LazyCommitTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        m_module = get_gralloc_module();
+        ASSERT_NE(nullptr, m_module);
+        ASSERT_EQ(0, gralloc_open(&m_module->common, &m_alloc_dev) );
+        ASSERT_EQ(0, m_module->perform(m_module, GRALLOC_MODULE_PERFORM_SET_LAZY_COMMIT, 1) );
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, m_channel) );
+        /* 只有 consumer 一端被 exec 继承. */
+        ASSERT_EQ(0, fcntl(m_channel[0], F_SETFD, FD_CLOEXEC) );
+    }
+
+    void TearDown() override
+    {
+        if ( m_buffer != NULL )
+        {
+            m_alloc_dev->free(m_alloc_dev, m_buffer);
+        }
+        if ( m_module != NULL )
+        {
+            m_module->perform(m_module, GRALLOC_MODULE_PERFORM_SET_LAZY_COMMIT, 0);
+        }
+        if ( m_alloc_dev != NULL )
+        {
+            gralloc_close(m_alloc_dev);
+        }
+        close(m_channel[0]);
+        if ( m_channel[1] >= 0 )
+        {
+            close(m_channel[1]);
+        }
+    }
+
+    /*
+     * alloc 一个 lazy commit 的 buffer. 当前平台上该 buffer 不能推迟分配 (比如要求物理连续) 时返回 false.
+     */
+    bool alloc_deferred()
+    {
+        const int usage = GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN | GRALLOC_USAGE_HW_TEXTURE;
+        int stride = 0;
+        struct stat st;
+
+        if ( m_alloc_dev->alloc(m_alloc_dev, k_width, k_height, HAL_PIXEL_FORMAT_RGBA_8888, usage, &m_buffer, &stride) != 0 )
+        {
+            m_buffer = NULL;
+            return false;
+        }
+
+        /* 尚未 commit 的 buffer 的 prime_fd 是 placeholder (unix socket), 不是 dma_buf. */
+        return 0 == fstat(((const struct gralloc_drm_handle_t*)m_buffer)->prime_fd, &st) && S_ISSOCK(st.st_mode);
+    }
+
+    /*
+     * fork + exec 以 --consumer 运行的本程序, 返回其 pid.
+     */
+    pid_t start_consumer()
+    {
+        pid_t pid = fork();
+
+        if ( 0 == pid )
+        {
+            char fd_arg[16];
+
+            snprintf(fd_arg, sizeof(fd_arg), "%d", m_channel[1]);
+            execl("/proc/self/exe", "/proc/self/exe", k_consumer_arg, fd_arg, (char*)NULL);
+            _exit(127);
+        }
+
+        close(m_channel[1]);
+        m_channel[1] = -1;
+        return pid;
+    }
+
+    int wait_consumer(pid_t pid)
+    {
+        int status = 0;
+
+        if ( waitpid(pid, &status, 0) != pid || !WIFEXITED(status) )
+        {
+            return -1;
+        }
+        return WEXITSTATUS(status);
+    }
+
+    const gralloc_module_t* m_module = nullptr;
+    alloc_device_t* m_alloc_dev = nullptr;
+    buffer_handle_t m_buffer = nullptr;
+    /* [0] : 当前进程, [1] : consumer. */
+    int m_channel[2] = { -1, -1 };
+};
+
+} // namespace
+
+TEST_F(LazyCommitTest, ConsumerRegistersBeforeCommit)
+{
+    void* vaddr = NULL;
+
+    if ( !alloc_deferred() )
+    {
+        GTEST_SKIP() << "buffer is not deferred on this platform";
+    }
+
+    pid_t pid = start_consumer();
+    ASSERT_GT(pid, 0);
+    ASSERT_TRUE(send_handle(m_channel[0], m_buffer) );
+    ASSERT_EQ(CONSUMER_OK, wait_consumer(pid) );
+
+    /* consumer 已经退出, 当前进程之后 commit, 得到的是 consumer 写入过的同一块 memory. */
+    ASSERT_EQ(0, m_module->registerBuffer(m_module, m_buffer) );
+    ASSERT_EQ(0, m_module->lock(m_module, m_buffer, GRALLOC_USAGE_SW_READ_OFTEN, 0, 0, k_width, k_height, &vaddr) );
+    const struct gralloc_drm_handle_t* handle = (const struct gralloc_drm_handle_t*)m_buffer;
+    for ( int offset = 0; offset < handle->size; offset += 4096 )
+    {
+        ASSERT_EQ(k_pattern, ((const uint8_t*)vaddr)[offset]) << "offset " << offset;
+    }
+    m_module->unlock(m_module, m_buffer);
+    m_module->unregisterBuffer(m_module, m_buffer);
+}
+
+TEST_F(LazyCommitTest, OwnerFreesBeforeImport)
+{
+    if ( !alloc_deferred() )
+    {
+        GTEST_SKIP() << "buffer is not deferred on this platform";
+    }
+
+    /* handle 在 consumer register 之前发送, 之后 alloc 的进程立即 free, 与 allocator service 相同. */
+    ASSERT_TRUE(send_handle(m_channel[0], m_buffer) );
+    m_alloc_dev->free(m_alloc_dev, m_buffer);
+    m_buffer = NULL;
+
+    pid_t pid = start_consumer();
+    ASSERT_GT(pid, 0);
+    EXPECT_EQ(CONSUMER_OK, wait_consumer(pid) );
+}
+
+int main(int argc, char** argv)
+{
+    if ( 3 == argc && 0 == strcmp(argv[1], k_consumer_arg) )
+    {
+        return run_consumer(atoi(argv[2]) );
+    }
+
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
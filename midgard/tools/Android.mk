@@ -0,0 +1,34 @@
+# Command line tools of drm_gralloc, run on the target.
+
+LOCAL_PATH := $(call my-dir)
+
+# ------------ #
+
+# Offline evaluation of buffer layout overhead, through libgralloc_drm. See gralloc_layout_eval.cpp.
+include $(CLEAR_VARS)
+LOCAL_MODULE := gralloc_drm_layout_eval
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := gralloc_layout_eval.cpp
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/.. \
+	external/libdrm \
+	external/libdrm/include/drm
+LOCAL_HEADER_LIBRARIES := \
+	libhardware_headers \
+	liblog_headers \
+	libutils_headers \
+	libcutils_headers
+LOCAL_SHARED_LIBRARIES := \
+	libgralloc_drm \
+	liblog
+# same handle layout as gralloc.$(TARGET_BOARD_PLATFORM)
+LOCAL_CFLAGS := \
+	-DRK_DRM_GRALLOC=1 \
+	-DRK_DRM_GRALLOC_DEBUG=0 \
+	-DMALI_AFBC_GRALLOC=1 \
+	-DPLATFORM_SDK_VERSION=$(PLATFORM_SDK_VERSION)
+ifeq ($(TARGET_USES_HWC2),true)
+LOCAL_CFLAGS += -DUSE_HWC2
+endif
+include $(BUILD_EXECUTABLE)
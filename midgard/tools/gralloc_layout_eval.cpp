@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2018 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file gralloc_layout_eval.cpp
+ *      离线评估 buffer layout 的开销.
+ *
+ * 用法 : gralloc_drm_layout_eval <file>, <file> 为 "-" 时从 stdin 读取.
+ * 文件中每行是 4 个 (十进制或 0x 开头的十六进制) 整数 : format width height usage, 空行和 '#' 开头的行被忽略.
+ * 按 alloc 的逻辑计算每行的 buffer 的 layout, 不分配任何内存,
+ * 输出各 buffer 的 layout size, 紧密排列 (无任何对齐和 padding) 的 size, 以及按 base format 和 AllocType 汇总的开销.
+ * 当前进程 alloc 的 buffer 的同样的汇总通过 alloc_device_t::dump 输出.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <utility>
+
+#include "gralloc_drm.h"
+#include "mali_gralloc_formats.h"
+
+namespace {
+
+/* 输入中一行的最大长度. */
+const size_t k_line_max = 256;
+
+struct overhead_entry_t
+{
+    uint64_t count;
+    uint64_t layout_bytes;
+    uint64_t packed_bytes;
+};
+
+/* 按 (base_format, AllocType) 汇总的开销. */
+typedef std::map<std::pair<uint64_t, std::string>, overhead_entry_t> overhead_map_t;
+
+/*
+ * 返回 'layout_bytes' 相对 'packed_bytes' 的开销, 单位 1/1000.
+ */
+int64_t get_overhead_permille(uint64_t layout_bytes, uint64_t packed_bytes)
+{
+    if ( 0 == packed_bytes )
+    {
+        return 0;
+    }
+
+    return ( (int64_t)layout_bytes - (int64_t)packed_bytes) * 1000 / (int64_t)packed_bytes;
+}
+
+void print_overhead(const overhead_map_t& overhead, uint64_t unclassified_count, uint64_t unclassified_bytes)
+{
+    uint64_t layout_bytes = 0;
+    uint64_t packed_bytes = 0;
+    int64_t permille;
+
+    for ( const auto& it : overhead )
+    {
+        layout_bytes += it.second.layout_bytes;
+        packed_bytes += it.second.packed_bytes;
+    }
+    permille = get_overhead_permille(layout_bytes, packed_bytes);
+
+    printf("total : layout %" PRIu64 " KB, packed %" PRIu64 " KB, overhead %" PRId64 ".%" PRId64 "%%, unclassified %" PRIu64 " (%" PRIu64 " KB)\n",
+           layout_bytes / 1024,
+           packed_bytes / 1024,
+           permille / 10,
+           (permille < 0 ? -permille : permille) % 10,
+           unclassified_count,
+           unclassified_bytes / 1024);
+
+    for ( const auto& it : overhead )
+    {
+        const overhead_entry_t& entry = it.second;
+
+        permille = get_overhead_permille(entry.layout_bytes, entry.packed_bytes);
+        printf("  format 0x%" PRIx64 " %s : count %" PRIu64 ", layout %" PRIu64 " KB, packed %" PRIu64 " KB, overhead %" PRId64 ".%" PRId64 "%%\n",
+               it.first.first,
+               it.first.second.c_str(),
+               entry.count,
+               entry.layout_bytes / 1024,
+               entry.packed_bytes / 1024,
+               permille / 10,
+               (permille < 0 ? -permille : permille) % 10);
+    }
+}
+
+/*
+ * 解析 'line' 中的 4 个整数, 失败返回 false.
+ */
+bool parse_line(const char* line, unsigned long values[4])
+{
+    const char* cursor = line;
+    char* end;
+
+    for ( int i = 0; i < 4; i++ )
+    {
+        errno = 0;
+        values[i] = strtoul(cursor, &end, 0);
+        if ( end == cursor || errno != 0 )
+        {
+            return false;
+        }
+        cursor = end;
+    }
+
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    struct gralloc_drm_t* drm;
+    overhead_map_t overhead;
+    uint64_t unclassified_count = 0;
+    uint64_t unclassified_bytes = 0;
+    char line[k_line_max];
+    int line_no = 0;
+    FILE* file;
+
+    if ( argc != 2 )
+    {
+        fprintf(stderr, "usage : %s <file>|-\n", argv[0]);
+        return 1;
+    }
+
+    file = (0 == strcmp(argv[1], "-") ) ? stdin : fopen(argv[1], "r");
+    if ( NULL == file )
+    {
+        fprintf(stderr, "failed to open '%s' : %s\n", argv[1], strerror(errno) );
+        return 1;
+    }
+
+    drm = gralloc_drm_create();
+    if ( NULL == drm )
+    {
+        fprintf(stderr, "failed to create gralloc drm device.\n");
+        return 1;
+    }
+
+    while ( fgets(line, sizeof(line), file) != NULL )
+    {
+        struct gralloc_drm_layout_t layout;
+        unsigned long values[4];
+        const char* cursor = line;
+        int format, width, height, usage;
+
+        line_no++;
+        while ( ' ' == *cursor || '\t' == *cursor )
+        {
+            cursor++;
+        }
+        if ( '#' == *cursor || '\n' == *cursor || '\r' == *cursor || '\0' == *cursor )
+        {
+            continue;
+        }
+
+        if ( !parse_line(cursor, values) )
+        {
+            printf("line %d : malformed\n", line_no);
+            continue;
+        }
+
+        format = (int)values[0];
+        width = (int)values[1];
+        height = (int)values[2];
+        usage = (int)values[3];
+
+        if ( gralloc_drm_compute_layout(drm, width, height, format, usage, &layout) != 0 )
+        {
+            printf("line %d : format 0x%x %dx%d usage 0x%x : unsupported\n", line_no, format, width, height, usage);
+            continue;
+        }
+
+        printf("line %d : format 0x%x %dx%d usage 0x%x : internal_format 0x%" PRIx64 " %s, byte_stride %d, size %zu, packed %" PRIu64 "\n",
+               line_no, format, width, height, usage,
+               layout.internal_format, layout.alloc_type, layout.byte_stride,
+               layout.size, layout.packed_size);
+
+        if ( 0 == layout.packed_size )
+        {
+            unclassified_count++;
+            unclassified_bytes += layout.size;
+            continue;
+        }
+
+        overhead_entry_t& entry = overhead[std::make_pair(layout.internal_format & MALI_GRALLOC_INTFMT_FMT_MASK,
+                                                          std::string(layout.alloc_type) )];
+        entry.count++;
+        entry.layout_bytes += layout.size;
+        entry.packed_bytes += layout.packed_size;
+    }
+
+    if ( file != stdin )
+    {
+        fclose(file);
+    }
+
+    print_overhead(overhead, unclassified_count, unclassified_bytes);
+
+    gralloc_drm_destroy(drm);
+    return 0;
+}